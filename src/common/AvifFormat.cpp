@@ -85,10 +85,18 @@ namespace
         globals->loadOptions.hlg.displayGamma = 1.2f;
         globals->loadOptions.hlg.nominalPeakBrightness = 1000;
         globals->loadOptions.pq.nominalPeakBrightness = pqDefaultBrightness;
+        globals->loadOptions.workingSpace = LoadOptionsWorkingSpace::Embedded;
         globals->saveOptions.quality = 85;
         globals->saveOptions.chromaSubsampling = ChromaSubsampling::Yuv422;
         globals->saveOptions.compressionSpeed = CompressionSpeed::Default;
         globals->saveOptions.hdrTransferFunction = ColorTransferFunction::PQ;
+        globals->saveOptions.encoderBackend = EncoderBackend::Aom;
+        globals->saveOptions.tune = EncoderTune::Default;
+        globals->saveOptions.encoderSpeed = encoderSpeedUsePreset;
+        globals->saveOptions.aqMode = aqModeUseDefault;
+        globals->saveOptions.targetFileSize = 0;
+        globals->saveOptions.targetSsim = 0.0f;
+        globals->saveOptions.encodeTimeBudget = 0;
         globals->saveOptions.pq.nominalPeakBrightness = pqDefaultBrightness;
         globals->saveOptions.lossless = false;
         globals->saveOptions.losslessAlpha = true;
@@ -97,6 +105,16 @@ namespace
         globals->saveOptions.keepExif = false;
         globals->saveOptions.keepXmp = false;
         globals->saveOptions.premultipliedAlpha = false;
+        globals->saveOptions.enableChromaDeltaQ = false;
+        globals->saveOptions.enableCdef = true;
+        globals->saveOptions.enableRestoration = true;
+        globals->saveOptions.neutralAsMonochrome = false;
+        globals->saveOptions.screenContentTools = ScreenContentTools::Auto;
+        globals->saveOptions.detectEightBitContent = false;
+        globals->saveOptions.remuxUnmodifiedImages = false;
+        globals->saveOptions.thumbnailSize = 0;
+        globals->saveOptions.exportVariantCount = 0;
+        globals->saveResults = SaveResults{};
         globals->libheifInitialized = false;
     }
 }
@@ -177,13 +195,13 @@ void PluginMain(const short selector, FormatRecordPtr formatRecord, intptr_t* da
             *result = DoWritePrepare(formatRecord);
             break;
         case formatSelectorWriteStart:
-            *result = DoWriteStart(formatRecord, globals->saveOptions);
+            *result = DoWriteStart(formatRecord, globals->saveOptions, globals->saveResults);
             break;
         case formatSelectorWriteContinue:
             *result = DoWriteContinue();
             break;
         case formatSelectorWriteFinish:
-            *result = DoWriteFinish(formatRecord, globals->saveOptions);
+            *result = DoWriteFinish(formatRecord, globals->saveOptions, globals->saveResults);
             break;
 
         case formatSelectorFilterFile:
@@ -46,6 +46,38 @@ enum class ImageBitDepth
     Twelve
 };
 
+enum class EncoderBackend
+{
+    Aom,
+    Svt,
+    Rav1e
+};
+
+enum class EncoderTune
+{
+    Default,
+    Psnr,
+    Ssim
+};
+
+enum class ScreenContentTools
+{
+    Auto,
+    Enabled,
+    Disabled
+};
+
+// An encoder speed of -1 uses the value from the compression speed preset,
+// other values are clamped to the range supported by the selected encoder.
+constexpr int encoderSpeedUsePreset = -1;
+constexpr int encoderSpeedMin = 0;
+constexpr int encoderSpeedMax = 13;
+
+// An AQ mode of -1 uses the encoder default.
+constexpr int aqModeUseDefault = -1;
+constexpr int aqModeMin = 0;
+constexpr int aqModeMax = 3;
+
 constexpr float displayGammaMin = 1.0f;
 constexpr float displayGammaMax = 3.0f;
 
@@ -58,6 +90,21 @@ constexpr int nominalPeakBrightnessMax = 10000;
 // https://en.wikipedia.org/wiki/SRGB#Viewing_environment
 constexpr int pqDefaultBrightness = 80;
 
+// The export variants are reduced size copies of the image that are written to files
+// next to the saved file, the image is scaled to fit within the maximum dimension.
+constexpr int maxExportVariants = 8;
+constexpr int exportVariantDimensionMin = 1;
+constexpr int exportVariantDimensionMax = 65536;
+
+// A thumbnail size of 0 disables the embedded thumbnail image.
+constexpr int thumbnailSizeMax = 1024;
+
+struct ExportVariant
+{
+    int maxDimension;
+    int quality;
+};
+
 struct HLGOptions
 {
     bool applyOOTF;
@@ -77,11 +124,22 @@ enum class LoadOptionsHDRFormat : int
     PQ
 };
 
+// The color space that RGB images are converted to when they are read.
+// Embedded keeps the image color space and attaches a color profile that describes it.
+enum class LoadOptionsWorkingSpace : int
+{
+    Embedded = 0,
+    SRGB,
+    DisplayP3,
+    AdobeRGB
+};
+
 struct LoadUIOptions
 {
     LoadOptionsHDRFormat format;
     HLGOptions hlg;
     PQOptions pq;
+    LoadOptionsWorkingSpace workingSpace;
 };
 
 struct SaveUIOptions
@@ -91,6 +149,13 @@ struct SaveUIOptions
     CompressionSpeed compressionSpeed;
     ImageBitDepth imageBitDepth;
     ColorTransferFunction hdrTransferFunction;
+    EncoderBackend encoderBackend;
+    EncoderTune tune;
+    int encoderSpeed;
+    int aqMode;
+    int targetFileSize;
+    float targetSsim;
+    int encodeTimeBudget;
     PQOptions pq;
     bool lossless;
     bool losslessAlpha;
@@ -98,6 +163,32 @@ struct SaveUIOptions
     bool keepExif;
     bool keepXmp;
     bool premultipliedAlpha;
+    bool enableChromaDeltaQ;
+    bool enableCdef;
+    bool enableRestoration;
+    bool neutralAsMonochrome;
+    ScreenContentTools screenContentTools;
+    bool detectEightBitContent;
+    bool remuxUnmodifiedImages;
+    int thumbnailSize;
+    int exportVariantCount;
+    ExportVariant exportVariants[maxExportVariants];
+};
+
+// The results of the last save, these are reported in the scripting parameters
+// after the save and are never read back as options.
+struct SaveResults
+{
+    // The encoded size and quality that were selected by the target file size or target SSIM search.
+    int outputFileSize;
+    int outputQuality;
+    int searchIterations;
+    // The quality metrics of the output image, only set by the target SSIM search.
+    // The PSNR is not set when the target SSIM could not be reached.
+    double outputSsim;
+    double outputPsnr;
+    // The 16-bit image only contained 8-bit values and was saved as 8-bit.
+    bool eightBitContentDetected;
 };
 
 struct RevertInfo
@@ -112,6 +203,10 @@ struct RevertInfo
 
     PQOptions pq;
     LoadOptionsHDRFormat format;
+
+    // Version 2 fields:
+
+    LoadOptionsWorkingSpace workingSpace;
 };
 
 struct Globals
@@ -124,6 +219,7 @@ struct Globals
 
     LoadUIOptions loadOptions;
     SaveUIOptions saveOptions;
+    SaveResults saveResults;
     bool libheifInitialized;
 };
 
@@ -167,9 +263,9 @@ OSErr DoEstimateContinue();
 OSErr DoEstimateFinish();
 
 OSErr DoWritePrepare(FormatRecordPtr formatRecord);
-OSErr DoWriteStart(FormatRecordPtr formatRecord, SaveUIOptions& options);
+OSErr DoWriteStart(FormatRecordPtr formatRecord, SaveUIOptions& options, SaveResults& results);
 OSErr DoWriteContinue();
-OSErr DoWriteFinish(FormatRecordPtr formatRecord, const SaveUIOptions& options);
+OSErr DoWriteFinish(FormatRecordPtr formatRecord, const SaveUIOptions& options, const SaveResults& results);
 
 // Scripting
 
@@ -177,6 +273,7 @@ OSErr ReadScriptParamsOnRead(FormatRecordPtr formatRecord, LoadUIOptions& option
 OSErr WriteScriptParamsOnRead(FormatRecordPtr formatRecord, const LoadUIOptions& options);
 
 OSErr ReadScriptParamsOnWrite(FormatRecordPtr formatRecord, SaveUIOptions& options, Boolean* showDialog);
-OSErr WriteScriptParamsOnWrite(FormatRecordPtr formatRecord, const SaveUIOptions& options);
+// The results are not written when they are null, this is used before the image has been saved.
+OSErr WriteScriptParamsOnWrite(FormatRecordPtr formatRecord, const SaveUIOptions& options, const SaveResults* results);
 
 #endif // !AVIFFORMAT_H
@@ -168,6 +168,12 @@ resource 'aete' (ResourceID, plugInName " dictionary", purgeable)
                 "The display brightness in nits (candela per square metre), range 1 to 10000 inclusive",
                 flagsSingleProperty,
 
+                "working space",
+                keyWorkingSpace,
+                typeWorkingSpace,
+                "The color space that RGB images are converted to when they are opened",
+                flagsEnumeratedParameter,
+
                 /* Save dialog parameters */
 
                 "quality",
@@ -235,6 +241,140 @@ resource 'aete' (ResourceID, plugInName " dictionary", purgeable)
                 typeHDRTransferFunction,
                 "",
                 flagsEnumeratedParameter,
+
+                "encoder",
+                keyEncoderBackend,
+                typeEncoderBackend,
+                "The AV1 encoder, AOM is used if the selected encoder is not available",
+                flagsEnumeratedParameter,
+
+                "encoder speed",
+                keyEncoderSpeed,
+                typeInteger,
+                "Overrides the compression speed preset, range 0 to 13 inclusive, clamped to the range supported by the encoder",
+                flagsSingleProperty,
+
+                "tune",
+                keyEncoderTune,
+                typeEncoderTune,
+                "",
+                flagsEnumeratedParameter,
+
+                "AQ mode",
+                keyAQMode,
+                typeInteger,
+                "The AOM adaptive quantization mode, range 0 to 3 inclusive",
+                flagsSingleProperty,
+
+                "chroma delta q",
+                keyEnableChromaDeltaQ,
+                typeBoolean,
+                "",
+                flagsSingleProperty,
+
+                "CDEF",
+                keyEnableCDEF,
+                typeBoolean,
+                "",
+                flagsSingleProperty,
+
+                "loop restoration",
+                keyEnableRestoration,
+                typeBoolean,
+                "",
+                flagsSingleProperty,
+
+                "target file size",
+                keyTargetFileSize,
+                typeInteger,
+                "The maximum file size in bytes, overrides the quality setting. Ignored for lossless compression",
+                flagsSingleProperty,
+
+                "target SSIM",
+                keyTargetSSIM,
+                typeFloat,
+                "The minimum luma SSIM, range 0.0 to 1.0 inclusive, overrides the quality setting. Ignored for lossless compression",
+                flagsSingleProperty,
+
+                "encode time budget",
+                keyEncodeTimeBudget,
+                typeInteger,
+                "The AV1 encode time budget in milliseconds, overrides the AOM speed. Only used with the AOM encoder",
+                flagsSingleProperty,
+
+                "neutral as monochrome",
+                keyNeutralAsMonochrome,
+                typeBoolean,
+                "Save RGB images where every pixel is neutral gray as monochrome",
+                flagsSingleProperty,
+
+                "screen content tools",
+                keyScreenContentTools,
+                typeScreenContentTools,
+                "The AOM screen content tools, auto enables them for images that are detected as screen content",
+                flagsEnumeratedParameter,
+
+                "detect 8-bit content",
+                keyDetectEightBitContent,
+                typeBoolean,
+                "Save 16-bit images as 8-bit when every value was converted from 8-bit, the bit depth setting is not changed",
+                flagsSingleProperty,
+
+                "remux unmodified images",
+                keyRemuxUnmodifiedImages,
+                typeBoolean,
+                "Copy the compressed image data from the original AVIF file when the image has not been modified, the quality and encoder settings are not applied",
+                flagsSingleProperty,
+
+                "thumbnail size",
+                keyThumbnailSize,
+                typeInteger,
+                "The maximum width or height of the embedded thumbnail image, 0 does not embed a thumbnail",
+                flagsSingleProperty,
+
+                "export variants",
+                keyExportVariants,
+                typeChar,
+                "Reduced size copies written next to the file, replacing existing files with the same names, a list of maximum dimension:quality pairs separated by semicolons",
+                flagsSingleProperty,
+
+                /* Save results, these are ignored when the parameters are played back */
+
+                "output file size",
+                keyOutputFileSize,
+                typeInteger,
+                "Read-only, the encoded image size in bytes that was selected by the target search",
+                flagsSingleProperty,
+
+                "output quality",
+                keyOutputQuality,
+                typeInteger,
+                "Read-only, the quality that was selected by the target search",
+                flagsSingleProperty,
+
+                "search iterations",
+                keySearchIterations,
+                typeInteger,
+                "Read-only, the number of full resolution encodes used by the target search",
+                flagsSingleProperty,
+
+                "output SSIM",
+                keyOutputSSIM,
+                typeFloat,
+                "Read-only, the luma SSIM of the image that was selected by the target SSIM search, an upper bound if the target was not reached",
+                flagsSingleProperty,
+
+                "output PSNR",
+                keyOutputPSNR,
+                typeFloat,
+                "Read-only, the luma PSNR in dB of the image that was selected by the target SSIM search",
+                flagsSingleProperty,
+
+                "8-bit content detected",
+                keyEightBitContentDetected,
+                typeBoolean,
+                "Read-only, the 16-bit image only contained 8-bit values and was saved as 8-bit",
+                flagsSingleProperty,
             },
             {}, /* elements (not supported) */
             /* class descriptions */
@@ -300,6 +440,66 @@ resource 'aete' (ResourceID, plugInName " dictionary", purgeable)
                 "Clip",
                 hdrTransferFunctionClip,
                 "None, clip",
+            },
+            typeEncoderBackend,
+            {
+                "AOM",
+                encoderBackendAOM,
+                "libaom",
+
+                "SVT-AV1",
+                encoderBackendSVT,
+                "SVT-AV1",
+
+                "rav1e",
+                encoderBackendRav1e,
+                "rav1e"
+            },
+            typeEncoderTune,
+            {
+                "default",
+                encoderTuneDefault,
+                "",
+
+                "PSNR",
+                encoderTunePSNR,
+                "",
+
+                "SSIM",
+                encoderTuneSSIM,
+                ""
+            },
+            typeScreenContentTools,
+            {
+                "auto",
+                screenContentToolsAuto,
+                "",
+
+                "enabled",
+                screenContentToolsEnabled,
+                "",
+
+                "disabled",
+                screenContentToolsDisabled,
+                ""
+            },
+            typeWorkingSpace,
+            {
+                "embedded",
+                workingSpaceEmbedded,
+                "Keep the image color space",
+
+                "sRGB",
+                workingSpaceSRGB,
+                "sRGB IEC 61966-2-1",
+
+                "Display P3",
+                workingSpaceDisplayP3,
+                "",
+
+                "Adobe RGB",
+                workingSpaceAdobeRGB,
+                "Adobe RGB (1998)"
             }
         }
     }
@@ -41,6 +41,7 @@
 #define keyHLGDisplayGamma keyGamma
 #define keyHLGNominalPeakBrightness keyBrightness
 #define keyPQNominalPeakBrightness 'pqBr'
+#define keyWorkingSpace 'wkSp'
 
 // keyQuality is defined in PITerminology.h
 #define keyCompressionSpeed 'av1S'
@@ -53,6 +54,28 @@
 #define keyPremultipliedAlpha 'pmAl'
 #define keyImageBitDepth 'av1B'
 #define keyHDRTransferFunction 'hTrf'
+#define keyEncoderBackend 'av1E'
+#define keyEncoderSpeed 'encS'
+#define keyEncoderTune 'encT'
+#define keyAQMode 'aqMd'
+#define keyEnableChromaDeltaQ 'cDlq'
+#define keyEnableCDEF 'cdeF'
+#define keyEnableRestoration 'lrsT'
+#define keyTargetFileSize 'tgFs'
+#define keyTargetSSIM 'tgSs'
+#define keyEncodeTimeBudget 'tmBg'
+#define keyNeutralAsMonochrome 'ntMn'
+#define keyScreenContentTools 'scrC'
+#define keyDetectEightBitContent 'ebDt'
+#define keyRemuxUnmodifiedImages 'rmUn'
+#define keyExportVariants 'exVr'
+#define keyThumbnailSize 'thmS'
+#define keyOutputFileSize 'otFs'
+#define keyOutputQuality 'otQl'
+#define keySearchIterations 'srIt'
+#define keyOutputSSIM 'otSs'
+#define keyOutputPSNR 'otPs'
+#define keyEightBitContentDetected 'ebFd'
 
 #define typeCompressionSpeed 'coSp'
 
@@ -78,4 +101,25 @@
 #define hdrTransferFunctionSMPTE428 'trF2'
 #define hdrTransferFunctionClip 'trF3'
 
+#define typeEncoderBackend 'enBk'
+#define encoderBackendAOM 'enB0'
+#define encoderBackendSVT 'enB1'
+#define encoderBackendRav1e 'enB2'
+
+#define typeEncoderTune 'enTn'
+#define encoderTuneDefault 'tun0'
+#define encoderTunePSNR 'tun1'
+#define encoderTuneSSIM 'tun2'
+
+#define typeScreenContentTools 'scrT'
+#define screenContentToolsAuto 'scr0'
+#define screenContentToolsEnabled 'scr1'
+#define screenContentToolsDisabled 'scr2'
+
+#define typeWorkingSpace 'wkSt'
+#define workingSpaceEmbedded 'wkS0'
+#define workingSpaceSRGB 'wkS1'
+#define workingSpaceDisplayP3 'wkS2'
+#define workingSpaceAdobeRGB 'wkS3'
+
 #endif
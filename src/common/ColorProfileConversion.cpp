@@ -20,10 +20,12 @@
 
 #include "ColorProfileConversion.h"
 #include "ColorProfileDetection.h"
-#include "ColorProfileGeneration.h"
+#include "ColorTransformCache.h"
 #include "HostMetadata.h"
 #include "ScopedHandleSuite.h"
 #include "ScopedLcms.h"
+#include <algorithm>
+#include <thread>
 
 namespace
 {
@@ -33,66 +35,6 @@ namespace
 
         return ScopedLcmsProfile(cmsOpenProfileFromMemTHR(context, lock.data(), formatRecord->iCCprofileSize));
     }
-
-    std::vector<uint16_t> BuildHostToLcmsLookup()
-    {
-        std::vector<uint16_t> lookupTable;
-        lookupTable.reserve(32769);
-
-        // Map the image data from Photoshop's 16-bit range [0, 32768] to [0, 65535].
-        // Little CMS has a formatter plug-in that adds support for Photoshop's 16-bit range, but we
-        // cannot use it because of the GPL license.
-
-        constexpr int maxValue = 65535;
-        constexpr float maxValueFloat = static_cast<float>(maxValue);
-
-        for (size_t i = 0; i < lookupTable.capacity(); i++)
-        {
-            int value = static_cast<int>(((static_cast<float>(i) / 32768.0f) * maxValueFloat) + 0.5f);
-
-            if (value < 0)
-            {
-                value = 0;
-            }
-            else if (value > maxValue)
-            {
-                value = maxValue;
-            }
-
-            lookupTable.push_back(static_cast<uint16_t>(value));
-        }
-
-        return lookupTable;
-    }
-
-    std::vector<uint16_t> BuildLcmsToHostLookup()
-    {
-        std::vector<uint16_t> lookupTable;
-        lookupTable.reserve(65536);
-
-        // Map the image data from [0, 65535] to Photoshop's 16-bit range [0, 32768].
-
-        constexpr int maxValue = 32768;
-        constexpr float maxValueFloat = static_cast<float>(maxValue);
-
-        for (size_t i = 0; i < lookupTable.capacity(); i++)
-        {
-            int value = static_cast<int>(((static_cast<float>(i) / 65535.0f) * maxValueFloat) + 0.5f);
-
-            if (value < 0)
-            {
-                value = 0;
-            }
-            else if (value > maxValue)
-            {
-                value = maxValue;
-            }
-
-            lookupTable.push_back(static_cast<uint16_t>(value));
-        }
-
-        return lookupTable;
-    }
 }
 
 ColorProfileConversion::ColorProfileConversion(
@@ -100,9 +42,8 @@ ColorProfileConversion::ColorProfileConversion(
     bool hasAlpha,
     ColorTransferFunction transferFunction,
     bool keepEmbeddedColorProfile)
-    : context(cmsCreateContext(nullptr, nullptr)), documentProfile(), outputImageProfile(), transform(),
-      numberOfChannels(hasAlpha ? 4 : 3), isSixteenBitMode(false), hostToLcmsLookupTable(),
-      lcmsToHostLookupTable()
+    : context(cmsCreateContext(nullptr, nullptr)), documentProfile(), matrixShaperTransform(), transform(),
+      threadCount(std::max(std::thread::hardware_concurrency(), 1U)), workerPool()
 {
     bool mayRequireConversion = transferFunction != ColorTransferFunction::Clip || !keepEmbeddedColorProfile;
 
@@ -136,9 +77,8 @@ ColorProfileConversion::ColorProfileConversion(
     bool hasAlpha,
     int hostBitsPerChannel,
     bool keepEmbeddedColorProfile)
-    : context(cmsCreateContext(nullptr, nullptr)), documentProfile(), outputImageProfile(), transform(),
-      numberOfChannels(hasAlpha ? 4 : 3), isSixteenBitMode(hostBitsPerChannel == 16), hostToLcmsLookupTable(),
-      lcmsToHostLookupTable()
+    : context(cmsCreateContext(nullptr, nullptr)), documentProfile(), matrixShaperTransform(), transform(),
+      threadCount(std::max(std::thread::hardware_concurrency(), 1U)), workerPool()
 {
     if (HasColorProfileMetadata(formatRecord) && !keepEmbeddedColorProfile)
     {
@@ -156,20 +96,20 @@ ColorProfileConversion::ColorProfileConversion(
     }
 }
 
-void ColorProfileConversion::ConvertRow(void* row, cmsUInt32Number pixelsPerLine, cmsUInt32Number bytesPerLine)
+void ColorProfileConversion::ConvertRow(void* row, cmsUInt32Number pixelsPerLine, cmsUInt32Number bytesPerLine) const
 {
-    if (transform)
+    if (matrixShaperTransform)
+    {
+        // The matrix/TRC transform uses Photoshop's 16-bit range directly.
+        matrixShaperTransform->ConvertRow(row, pixelsPerLine);
+    }
+    else if (transform)
     {
         constexpr cmsUInt32Number lineCount = 1;
         constexpr cmsUInt32Number bytesPerPlane = 0; // Unused for interleaved data
 
-        if (isSixteenBitMode)
-        {
-            ConvertSixteenBitRowToLcms(static_cast<uint16_t*>(row), pixelsPerLine);
-        }
-
         cmsDoTransformLineStride(
-            transform.get(),
+            transform->get(),
             row,
             row,
             pixelsPerLine,
@@ -178,67 +118,88 @@ void ColorProfileConversion::ConvertRow(void* row, cmsUInt32Number pixelsPerLine
             bytesPerLine,
             bytesPerPlane,
             bytesPerPlane);
-
-        if (isSixteenBitMode)
-        {
-            ConvertSixteenBitRowToHost(static_cast<uint16_t*>(row), pixelsPerLine);
-        }
     }
 }
 
-void ColorProfileConversion::ConvertSixteenBitRowToLcms(uint16_t* row, cmsUInt32Number pixelsPerLine)
+void ColorProfileConversion::ConvertRows(
+    void* rows,
+    cmsUInt32Number rowCount,
+    cmsUInt32Number pixelsPerLine,
+    cmsUInt32Number bytesPerLine)
 {
-    for (size_t i = 0; i < pixelsPerLine; i++)
+    if (!matrixShaperTransform && !transform)
     {
-        const size_t index = i * numberOfChannels;
+        return;
+    }
 
-        uint16_t r = row[index];
-        row[index] = hostToLcmsLookupTable[r];
+    const cmsUInt32Number rowsPerTask = GetRowsPerTask(bytesPerLine);
+    const size_t taskCount = (static_cast<size_t>(rowCount) + rowsPerTask - 1) / rowsPerTask;
 
-        uint16_t g = row[index + 1];
-        row[index + 1] = hostToLcmsLookupTable[g];
+    if (taskCount > 1 && !workerPool)
+    {
+        workerPool = std::make_unique<WorkerPool>(threadCount - 1);
+    }
 
-        uint16_t b = row[index + 2];
-        row[index + 2] = hostToLcmsLookupTable[b];
+    const auto convertTaskRows = [&](size_t taskIndex)
+    {
+        const size_t firstRow = taskIndex * rowsPerTask;
+        const size_t lastRow = std::min(firstRow + rowsPerTask, static_cast<size_t>(rowCount));
+
+        for (size_t i = firstRow; i < lastRow; i++)
+        {
+            ConvertRow(static_cast<uint8_t*>(rows) + (i * bytesPerLine), pixelsPerLine, bytesPerLine);
+        }
+    };
 
-        if (numberOfChannels == 4)
+    if (workerPool)
+    {
+        workerPool->Run(taskCount, convertTaskRows);
+    }
+    else
+    {
+        for (size_t i = 0; i < taskCount; i++)
         {
-            uint16_t a = row[index + 3];
-            row[index + 3] = hostToLcmsLookupTable[a];
+            convertTaskRows(i);
         }
     }
 }
 
-void ColorProfileConversion::ConvertSixteenBitRowToHost(uint16_t* row, cmsUInt32Number pixelsPerLine)
+cmsUInt32Number ColorProfileConversion::GetBandRowCount(cmsUInt32Number bytesPerLine) const noexcept
 {
-    for (size_t i = 0; i < pixelsPerLine; i++)
+    if (threadCount == 1 || (!matrixShaperTransform && !transform))
     {
-        const size_t index = i * numberOfChannels;
-
-        uint16_t r = row[index];
-        row[index] = lcmsToHostLookupTable[r];
+        return 1;
+    }
 
-        uint16_t g = row[index + 1];
-        row[index + 1] = lcmsToHostLookupTable[g];
+    return GetRowsPerTask(bytesPerLine) * threadCount;
+}
 
-        uint16_t b = row[index + 2];
-        row[index + 2] = lcmsToHostLookupTable[b];
+cmsUInt32Number ColorProfileConversion::GetRowsPerTask(cmsUInt32Number bytesPerLine) const noexcept
+{
+    // Each task converts about 256 KB of rows, this keeps the rows in the per-core L2 cache
+    // while limiting the task dispatch overhead.
+    constexpr cmsUInt32Number taskCacheBytes = 256 * 1024;
 
-        if (numberOfChannels == 4)
-        {
-            uint16_t a = row[index + 3];
-            row[index + 3] = lcmsToHostLookupTable[a];
-        }
-    }
+    return std::max(taskCacheBytes / std::max(bytesPerLine, 1U), 1U);
 }
 
 void ColorProfileConversion::InitializeForRec2020Conversion(bool hasAlpha)
 {
-    outputImageProfile = CreateRec2020LinearRGBProfile(context.get());
+    if (IsEquivalentToColorTransformOutputProfile(documentProfile.get(), ColorTransformOutputProfile::Rec2020Linear))
+    {
+        return;
+    }
 
-    if (!outputImageProfile)
+    matrixShaperTransform = TryCreateMatrixShaperTransform(
+        context.get(),
+        documentProfile.get(),
+        ColorTransformOutputProfile::Rec2020Linear,
+        hasAlpha,
+        32);
+
+    if (matrixShaperTransform)
     {
-        throw ::std::runtime_error("Unable to create a Rec. 2020 color profile for HDR conversion.");
+        return;
     }
 
     cmsUInt32Number transformFormat = TYPE_RGB_FLT;
@@ -250,28 +211,32 @@ void ColorProfileConversion::InitializeForRec2020Conversion(bool hasAlpha)
         transformFlags |= cmsFLAGS_COPY_ALPHA;
     }
 
-    transform.reset(cmsCreateTransformTHR(
-        context.get(),
+    transform = GetCachedColorTransform(
         documentProfile.get(),
+        ColorTransformOutputProfile::Rec2020Linear,
         transformFormat,
-        outputImageProfile.get(),
-        transformFormat,
-        INTENT_PERCEPTUAL,
-        transformFlags));
-
-    if (!transform)
-    {
-        throw ::std::runtime_error("Unable to create a color profile transform for HDR conversion.");
-    }
+        transformFlags,
+        false);
 }
 
 void ColorProfileConversion::InitializeForSRGBConversion(bool hasAlpha, int hostBitsPerChannel)
 {
-    outputImageProfile.reset(cmsCreate_sRGBProfileTHR(context.get()));
+    // Profiles that were re-serialized by other applications often contain the same sRGB definition.
+    if (IsEquivalentToColorTransformOutputProfile(documentProfile.get(), ColorTransformOutputProfile::SRGB))
+    {
+        return;
+    }
 
-    if (!outputImageProfile)
+    matrixShaperTransform = TryCreateMatrixShaperTransform(
+        context.get(),
+        documentProfile.get(),
+        ColorTransformOutputProfile::SRGB,
+        hasAlpha,
+        hostBitsPerChannel);
+
+    if (matrixShaperTransform)
     {
-        throw ::std::runtime_error("Unable to create a sRGB color profile for the output image.");
+        return;
     }
 
     cmsUInt32Number transformFormat;
@@ -296,9 +261,6 @@ void ColorProfileConversion::InitializeForSRGBConversion(bool hasAlpha, int host
             transformFormat = TYPE_RGBA_16;
             transformFlags |= cmsFLAGS_COPY_ALPHA;
         }
-
-        hostToLcmsLookupTable = BuildHostToLcmsLookup();
-        lcmsToHostLookupTable = BuildLcmsToHostLookup();
     }
     else if (hostBitsPerChannel == 32)
     {
@@ -315,17 +277,11 @@ void ColorProfileConversion::InitializeForSRGBConversion(bool hasAlpha, int host
         throw ::std::runtime_error("Unsupported host bit depth, must be 8, 16 or 32.");
     }
 
-    transform.reset(cmsCreateTransformTHR(
-        context.get(),
+    // The 16-bit transform uses Photoshop's 16-bit range directly.
+    transform = GetCachedColorTransform(
         documentProfile.get(),
+        ColorTransformOutputProfile::SRGB,
         transformFormat,
-        outputImageProfile.get(),
-        transformFormat,
-        INTENT_PERCEPTUAL,
-        transformFlags));
-
-    if (!transform)
-    {
-        throw ::std::runtime_error("Unable to create a color profile transform for the output image conversion.");
-    }
+        transformFlags,
+        hostBitsPerChannel == 16);
 }
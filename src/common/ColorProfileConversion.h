@@ -24,8 +24,10 @@
 #include "Common.h"
 #include "AlphaState.h"
 #include "ColorTransfer.h"
+#include "MatrixShaperTransform.h"
 #include "ScopedLcms.h"
-#include <vector>
+#include "WorkerPool.h"
+#include <memory>
 
 class ColorProfileConversion
 {
@@ -43,13 +45,18 @@ public:
         int hostBitsPerChannel,
         bool keepEmbeddedColorProfile);
 
-    void ConvertRow(void* row, cmsUInt32Number pixelsPerLine, cmsUInt32Number bytesPerLine);
+    void ConvertRow(void* row, cmsUInt32Number pixelsPerLine, cmsUInt32Number bytesPerLine) const;
 
-private:
+    // Converts a band of rows, the rows are split between multiple threads.
+    void ConvertRows(void* rows, cmsUInt32Number rowCount, cmsUInt32Number pixelsPerLine, cmsUInt32Number bytesPerLine);
+
+    // Gets the number of rows that the caller should pass to ConvertRows.
+    // Returns 1 if the image does not require a conversion.
+    cmsUInt32Number GetBandRowCount(cmsUInt32Number bytesPerLine) const noexcept;
 
-    void ConvertSixteenBitRowToLcms(uint16_t* row, cmsUInt32Number pixelCount);
+private:
 
-    void ConvertSixteenBitRowToHost(uint16_t* row, cmsUInt32Number pixelCount);
+    cmsUInt32Number GetRowsPerTask(cmsUInt32Number bytesPerLine) const noexcept;
 
     void InitializeForRec2020Conversion(bool hasAlpha);
 
@@ -57,12 +64,13 @@ private:
 
     ScopedLcmsContext context;
     ScopedLcmsProfile documentProfile;
-    ScopedLcmsProfile outputImageProfile;
-    ScopedLcmsTransform transform;
-    const size_t numberOfChannels;
-    const bool isSixteenBitMode;
-    std::vector<uint16_t> hostToLcmsLookupTable;
-    std::vector<uint16_t> lcmsToHostLookupTable;
+    // Used instead of the lcms transform when both color profiles are matrix/TRC profiles.
+    std::unique_ptr<MatrixShaperTransform> matrixShaperTransform;
+    // The transform is shared with the other conversions that use the same document profile.
+    std::shared_ptr<const ScopedLcmsTransform> transform;
+    const unsigned int threadCount;
+    // The worker threads are started by the first ConvertRows call that uses them.
+    std::unique_ptr<WorkerPool> workerPool;
 };
 
 #endif // !COLORPROFILECONVERSION_H
@@ -149,6 +149,36 @@ namespace
         return fabs(a.x - b.x) < tolerance && fabs(a.y - b.y) < tolerance;
     }
 
+    bool CompareXYZValues(const cmsCIEXYZ& a, const cmsCIEXYZ& b, cmsFloat64Number tolerance) noexcept
+    {
+        return fabs(a.X - b.X) < tolerance && fabs(a.Y - b.Y) < tolerance && fabs(a.Z - b.Z) < tolerance;
+    }
+
+    bool ToneCurvesAreEquivalent(const cmsToneCurve* a, const cmsToneCurve* b)
+    {
+        if (a == b)
+        {
+            return true;
+        }
+
+        // The curves are sampled because the same curve may be stored as a parametric
+        // curve in one profile and as a table in the other.
+        constexpr int sampleCount = 1024;
+        constexpr cmsFloat32Number tolerance = 1.0f / 4096.0f;
+
+        for (int i = 0; i < sampleCount; i++)
+        {
+            const cmsFloat32Number value = static_cast<cmsFloat32Number>(i) / static_cast<cmsFloat32Number>(sampleCount - 1);
+
+            if (fabs(cmsEvalToneCurveFloat(a, value) - cmsEvalToneCurveFloat(b, value)) > tolerance)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
     bool ProfileHasColorantsAndWhitepoint(
         cmsHPROFILE profile,
         const cmsCIExyY& requiredWhitepoint,
@@ -326,6 +356,15 @@ namespace
 
         return false;
     }
+
+    bool ProfileHasLutBasedTransform(cmsHPROFILE profile)
+    {
+        // lcms uses the LUT based tags instead of the matrix/TRC tags when the profile has both.
+        return cmsIsCLUT(profile, INTENT_PERCEPTUAL, LCMS_USED_AS_INPUT)
+            || cmsIsCLUT(profile, INTENT_PERCEPTUAL, LCMS_USED_AS_OUTPUT)
+            || cmsIsTag(profile, cmsSigDToB0Tag)
+            || cmsIsTag(profile, cmsSigBToD0Tag);
+    }
 }
 
 bool IsRec2020ColorProfile(cmsHPROFILE profile)
@@ -372,3 +411,58 @@ bool IsSRGBColorProfile(cmsHPROFILE profile)
 
     return result;
 }
+
+bool TryReadMatrixShaperProfile(cmsHPROFILE profile, cmsCIEXYZTRIPLE& colorants, cmsToneCurve* (&toneCurves)[3])
+{
+    if (profile == nullptr ||
+        cmsGetColorSpace(profile) != cmsSigRgbData ||
+        cmsGetPCS(profile) != cmsSigXYZData ||
+        !cmsIsMatrixShaper(profile) ||
+        ProfileHasLutBasedTransform(profile))
+    {
+        return false;
+    }
+
+    if (!ReadColorantTag(profile, cmsSigRedColorantTag, colorants.Red) ||
+        !ReadColorantTag(profile, cmsSigGreenColorantTag, colorants.Green) ||
+        !ReadColorantTag(profile, cmsSigBlueColorantTag, colorants.Blue))
+    {
+        return false;
+    }
+
+    toneCurves[0] = static_cast<cmsToneCurve*>(cmsReadTag(profile, cmsSigRedTRCTag));
+    toneCurves[1] = static_cast<cmsToneCurve*>(cmsReadTag(profile, cmsSigGreenTRCTag));
+    toneCurves[2] = static_cast<cmsToneCurve*>(cmsReadTag(profile, cmsSigBlueTRCTag));
+
+    return toneCurves[0] != nullptr && toneCurves[1] != nullptr && toneCurves[2] != nullptr;
+}
+
+bool ColorProfilesAreEquivalent(cmsHPROFILE first, cmsHPROFILE second)
+{
+    cmsCIEXYZTRIPLE firstColorants{};
+    cmsCIEXYZTRIPLE secondColorants{};
+    cmsToneCurve* firstToneCurves[3]{};
+    cmsToneCurve* secondToneCurves[3]{};
+    cmsCIEXYZ firstWhitepoint{};
+    cmsCIEXYZ secondWhitepoint{};
+
+    if (!TryReadMatrixShaperProfile(first, firstColorants, firstToneCurves) ||
+        !TryReadMatrixShaperProfile(second, secondColorants, secondToneCurves) ||
+        !ReadMediaWhitePoint(first, firstWhitepoint) ||
+        !ReadMediaWhitePoint(second, secondWhitepoint))
+    {
+        return false;
+    }
+
+    // The XYZ values are stored as s15Fixed16Number values, and the applications that
+    // generate the profiles round the chromatic adaptation slightly differently.
+    constexpr cmsFloat64Number tolerance = 0.001;
+
+    return CompareXYZValues(firstWhitepoint, secondWhitepoint, tolerance)
+        && CompareXYZValues(firstColorants.Red, secondColorants.Red, tolerance)
+        && CompareXYZValues(firstColorants.Green, secondColorants.Green, tolerance)
+        && CompareXYZValues(firstColorants.Blue, secondColorants.Blue, tolerance)
+        && ToneCurvesAreEquivalent(firstToneCurves[0], secondToneCurves[0])
+        && ToneCurvesAreEquivalent(firstToneCurves[1], secondToneCurves[1])
+        && ToneCurvesAreEquivalent(firstToneCurves[2], secondToneCurves[2]);
+}
@@ -27,4 +27,13 @@ bool IsRec2020ColorProfile(cmsHPROFILE profile);
 
 bool IsSRGBColorProfile(cmsHPROFILE profile);
 
+// Reads the colorants and tone curves of a RGB matrix/TRC profile.
+// Returns false if lcms would use a LUT based transform for the profile.
+// The colorants are in the D50 PCS, the tone curves are owned by the profile.
+bool TryReadMatrixShaperProfile(cmsHPROFILE profile, cmsCIEXYZTRIPLE& colorants, cmsToneCurve* (&toneCurves)[3]);
+
+// Returns true if both profiles are matrix/TRC profiles with the same colorants, white point
+// and tone curves, within the rounding used when the profiles are serialized.
+bool ColorProfilesAreEquivalent(cmsHPROFILE first, cmsHPROFILE second);
+
 #endif // !COLORPROFILEDETECTION_H
@@ -29,6 +29,10 @@
 #include "ScopedHandleSuite.h"
 #include "ScopedHeif.h"
 #include "Utilities.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
 
 namespace
 {
@@ -98,27 +102,70 @@ namespace
         return profile;
     }
 
-    void SaveColorProfileToHandle(cmsHPROFILE profile, FormatRecord* formatRecord)
+    struct IccProfileKey
     {
+        bool monochrome;
+        heif_color_primaries primaries;
+        heif_transfer_characteristics transferCharacteristics;
+        heif_matrix_coefficients matrixCoefficients;
+        bool fullRange;
+        cmsFloat64Number whitepointX;
+        cmsFloat64Number whitepointY;
+
+        bool operator==(const IccProfileKey& other) const noexcept
+        {
+            return monochrome == other.monochrome
+                && primaries == other.primaries
+                && transferCharacteristics == other.transferCharacteristics
+                && matrixCoefficients == other.matrixCoefficients
+                && fullRange == other.fullRange
+                && whitepointX == other.whitepointX
+                && whitepointY == other.whitepointY;
+        }
+    };
+
+    struct CachedIccProfile
+    {
+        IccProfileKey key;
+        // Empty if the color settings are not supported.
+        std::vector<uint8_t> data;
+    };
+
+    std::vector<uint8_t> SaveColorProfileToMemory(cmsHPROFILE profile)
+    {
+        std::vector<uint8_t> profileData;
         cmsUInt32Number profileSize = 0;
 
         cmsSaveProfileToMem(profile, nullptr, &profileSize);
 
         if (profileSize > 0 && profileSize <= static_cast<cmsUInt32Number>(std::numeric_limits<int32>::max()))
         {
-            ScopedHandleSuiteHandle handle(formatRecord->handleProcs, static_cast<int32>(profileSize));
-
-            ScopedHandleSuiteLock lock = handle.lock();
+            profileData.resize(profileSize);
 
-            if (cmsSaveProfileToMem(profile, lock.data(), &profileSize))
+            if (!cmsSaveProfileToMem(profile, profileData.data(), &profileSize))
             {
-                lock.unlock();
-
-                // Ownership of the handle is transfered to the host through the iCCprofileData field.
-                formatRecord->iCCprofileData = handle.release();
-                formatRecord->iCCprofileSize = static_cast<int32>(profileSize);
+                profileData.clear();
             }
         }
+
+        return profileData;
+    }
+
+    void SaveColorProfileToHandle(const std::vector<uint8_t>& profileData, FormatRecord* formatRecord)
+    {
+        const int32 profileSize = static_cast<int32>(profileData.size());
+
+        ScopedHandleSuiteHandle handle(formatRecord->handleProcs, profileSize);
+
+        ScopedHandleSuiteLock lock = handle.lock();
+
+        std::memcpy(lock.data(), profileData.data(), profileData.size());
+
+        lock.unlock();
+
+        // Ownership of the handle is transfered to the host through the iCCprofileData field.
+        formatRecord->iCCprofileData = handle.release();
+        formatRecord->iCCprofileSize = profileSize;
     }
 
     void SetCICPTag(
@@ -136,201 +183,40 @@ namespace
 
         cmsWriteTag(profile, cmsSigcicpTag, &cicp);
     }
-}
 
-ScopedLcmsProfile CreateRec2020LinearRGBProfile(cmsContext context)
-{
-    ScopedLcmsProfile profile;
-
-    const cmsCIExyY whitepoint = { 0.3127, 0.3290, 1.0f }; // D65
-    const cmsCIExyYTRIPLE rgbPrimaries =
+    ScopedLcmsToneCurve BuildSRGBToneCurve(cmsContext context)
     {
-        { 0.708, 0.292, 1.0 },
-        { 0.170, 0.797, 1.0 },
-        { 0.131, 0.046, 1.0 }
-    };
-
-    ScopedLcmsToneCurve toneCurve(cmsBuildGamma(context, 1.0));
-    const wchar_t* description = L"Rec. 2020 (Linear RGB Profile)";
-
-    if (toneCurve)
-    {
-        profile = BuildRGBProfile(
-            context,
-            &whitepoint,
-            &rgbPrimaries,
-            toneCurve.get(),
-            description);
-
-        if (profile)
+        cmsFloat64Number Parameters[5]
         {
-            SetCICPTag(
-                profile.get(),
-                heif_color_primaries_ITU_R_BT_2020_2_and_2100_0,
-                heif_transfer_characteristic_linear,
-                heif_matrix_coefficients_ITU_R_BT_2020_2_non_constant_luminance,
-                true);
-        }
+            2.4,
+            1 / 1.055,
+            1 - 1 / 1.055,
+            1 / 12.92,
+            12.92 * 0.0031308,
+        };
+
+        return ScopedLcmsToneCurve(cmsBuildParametricToneCurve(context, 4, Parameters));
     }
 
-    return profile;
-}
-
-void SetIccProfileFromNclx(FormatRecord* formatRecord, const heif_color_profile_nclx* nclx)
-{
-    // (As of ISO/IEC 23000-22:2019 Amendment 2)
-    // MIAF Section 7.3.6.4 "Colour information property":
-    //
-    // If a coded image has no associated colour property, the default property is defined as having
-    // colour_type equal to 'nclx' with properties as follows:
-    //    colour_primaries equal to 1,
-    //    transfer_characteristics equal to 13,
-    //    matrix_coefficients equal to 5 or 6 (which are functionally identical), and
-    //    full_range_flag equal to 1.
-    // Only if the colour information property of the image matches these default values, the colour
-    // property may be omitted; all other images shall have an explicitly declared colour space via
-    // association with a property of this type.
-    //
-    // See here for the discussion: https://github.com/AOMediaCodec/av1-avif/issues/77#issuecomment-676526097
-
-    heif_color_primaries primaries = heif_color_primaries_ITU_R_BT_709_5;
-    heif_transfer_characteristics transferCharacteristics = heif_transfer_characteristic_IEC_61966_2_1;
-    heif_matrix_coefficients matrixCoefficients = heif_matrix_coefficients_ITU_R_BT_601_6;
-    bool fullRange = true;
-    // Default to the Rec. 709 white point values, D65.
-    cmsFloat64Number whitepointX = 0.3127;
-    cmsFloat64Number whitepointY = 0.3290;
-
-    if (nclx != nullptr)
+    std::vector<uint8_t> CreateIccProfileData(const IccProfileKey& key)
     {
-        if (nclx->color_primaries != heif_color_primaries_unspecified)
-        {
-            primaries = nclx->color_primaries;
-            whitepointX = nclx->color_primary_white_x;
-            whitepointY = nclx->color_primary_white_y;
-        }
+        std::vector<uint8_t> profileData;
 
-        if (nclx->transfer_characteristics != heif_transfer_characteristic_unspecified)
-        {
-            transferCharacteristics = nclx->transfer_characteristics;
-        }
+        ScopedLcmsContext context(cmsCreateContext(nullptr, nullptr));
 
-        if (nclx->matrix_coefficients != heif_matrix_coefficients_unspecified)
+        if (context)
         {
-            matrixCoefficients = nclx->matrix_coefficients;
-        }
-        fullRange = nclx->full_range_flag != 0;
-    }
-
-    // The 32-bits-per-channel image modes always operate in linear color.
-    if (formatRecord->depth == 32)
-    {
-        transferCharacteristics = heif_transfer_characteristic_linear;
-    }
-
-    ScopedLcmsContext context(cmsCreateContext(nullptr, nullptr));
-
-    if (context)
-    {
-        if (IsMonochromeImage(formatRecord))
-        {
-            ScopedLcmsToneCurve toneCurve;
-            const wchar_t* description = nullptr;
-
-            if (transferCharacteristics == heif_transfer_characteristic_linear)
-            {
-                toneCurve.reset(cmsBuildGamma(context.get(), 1.0));
-                description = L"Linear Grayscale Profile";
-            }
-            else if (transferCharacteristics == heif_transfer_characteristic_IEC_61966_2_1)
-            {
-                cmsFloat64Number Parameters[5]
-                {
-                    2.4,
-                    1 / 1.055,
-                    1 - 1 / 1.055,
-                    1 / 12.92,
-                    12.92 * 0.0031308,
-                };
-
-                toneCurve.reset(cmsBuildParametricToneCurve(context.get(), 4, Parameters));
-                description = L"Grayscale (sRGB TRC)";
-            }
-            else if (transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_709_5 ||
-                     transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_601_6 ||
-                     transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_10bit ||
-                     transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_12bit)
-            {
-                cmsFloat64Number Parameters[5]
-                {
-                    1.0 / 0.45,
-                    1.0 / 1.099296826809442,
-                    1.0 - 1 / 1.099296826809442,
-                    1.0 / 4.5,
-                    4.5 * 0.018053968510807,
-                };
-
-                toneCurve.reset(cmsBuildParametricToneCurve(context.get(), 4, Parameters));
-
-                switch (primaries)
-                {
-                case heif_color_primaries_ITU_R_BT_2020_2_and_2100_0:
-                    description = L"Grayscale (Rec. 2020)";
-                    break;
-                case heif_color_primaries_ITU_R_BT_709_5:
-                case heif_color_primaries_ITU_R_BT_470_6_System_M:
-                case heif_color_primaries_ITU_R_BT_470_6_System_B_G:
-                case heif_color_primaries_ITU_R_BT_601_6:
-                case heif_color_primaries_SMPTE_240M:
-                case heif_color_primaries_generic_film:
-                case heif_color_primaries_SMPTE_ST_428_1:
-                case heif_color_primaries_SMPTE_RP_431_2:
-                case heif_color_primaries_SMPTE_EG_432_1:
-                case heif_color_primaries_EBU_Tech_3213_E:
-                default:
-                    description = L"Grayscale (Rec. 709 TRC)";
-                    break;
-                }
-            }
-
-            if (toneCurve && description != nullptr)
-            {
-                ScopedLcmsProfile profile = BuildGrayProfile(
-                    context.get(),
-                    whitepointX,
-                    whitepointY,
-                    toneCurve.get(),
-                    description);
-
-                if (profile)
-                {
-                    SaveColorProfileToHandle(profile.get(), formatRecord);
-                }
-            }
-        }
-        else
-        {
-            ScopedLcmsProfile profile;
-
-            if (primaries == heif_color_primaries_ITU_R_BT_709_5)
+            if (key.monochrome)
             {
-                const cmsCIExyY whitepoint = { 0.3127, 0.3290, 1.0f }; // D65
-                const cmsCIExyYTRIPLE rgbPrimaries =
-                {
-                    { 0.6400, 0.3300, 1.0 },
-                    { 0.3000, 0.6000, 1.0 },
-                    { 0.1500, 0.0600, 1.0 }
-                };
-
                 ScopedLcmsToneCurve toneCurve;
                 const wchar_t* description = nullptr;
 
-                if (transferCharacteristics == heif_transfer_characteristic_linear)
+                if (key.transferCharacteristics == heif_transfer_characteristic_linear)
                 {
                     toneCurve.reset(cmsBuildGamma(context.get(), 1.0));
-                    description = L"sRGB IEC 61966-2-1 (Linear RGB Profile)";
+                    description = L"Linear Grayscale Profile";
                 }
-                else if (transferCharacteristics == heif_transfer_characteristic_IEC_61966_2_1)
+                else if (key.transferCharacteristics == heif_transfer_characteristic_IEC_61966_2_1)
                 {
                     cmsFloat64Number Parameters[5]
                     {
@@ -342,12 +228,12 @@ void SetIccProfileFromNclx(FormatRecord* formatRecord, const heif_color_profile_
                     };
 
                     toneCurve.reset(cmsBuildParametricToneCurve(context.get(), 4, Parameters));
-                    description = L"sRGB IEC 61966-2-1";
+                    description = L"Grayscale (sRGB TRC)";
                 }
-                else if (transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_709_5 ||
-                         transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_601_6 ||
-                         transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_10bit ||
-                         transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_12bit)
+                else if (key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_709_5 ||
+                         key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_601_6 ||
+                         key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_10bit ||
+                         key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_12bit)
                 {
                     cmsFloat64Number Parameters[5]
                     {
@@ -359,71 +245,466 @@ void SetIccProfileFromNclx(FormatRecord* formatRecord, const heif_color_profile_
                     };
 
                     toneCurve.reset(cmsBuildParametricToneCurve(context.get(), 4, Parameters));
-                    description = L"Rec. 709";
+
+                    switch (key.primaries)
+                    {
+                    case heif_color_primaries_ITU_R_BT_2020_2_and_2100_0:
+                        description = L"Grayscale (Rec. 2020)";
+                        break;
+                    case heif_color_primaries_ITU_R_BT_709_5:
+                    case heif_color_primaries_ITU_R_BT_470_6_System_M:
+                    case heif_color_primaries_ITU_R_BT_470_6_System_B_G:
+                    case heif_color_primaries_ITU_R_BT_601_6:
+                    case heif_color_primaries_SMPTE_240M:
+                    case heif_color_primaries_generic_film:
+                    case heif_color_primaries_SMPTE_ST_428_1:
+                    case heif_color_primaries_SMPTE_RP_431_2:
+                    case heif_color_primaries_SMPTE_EG_432_1:
+                    case heif_color_primaries_EBU_Tech_3213_E:
+                    default:
+                        description = L"Grayscale (Rec. 709 TRC)";
+                        break;
+                    }
                 }
 
                 if (toneCurve && description != nullptr)
                 {
-                    profile = BuildRGBProfile(
+                    ScopedLcmsProfile profile = BuildGrayProfile(
                         context.get(),
-                        &whitepoint,
-                        &rgbPrimaries,
+                        key.whitepointX,
+                        key.whitepointY,
                         toneCurve.get(),
                         description);
+
+                    if (profile)
+                    {
+                        profileData = SaveColorProfileToMemory(profile.get());
+                    }
                 }
             }
-            else if (primaries == heif_color_primaries_ITU_R_BT_2020_2_and_2100_0)
+            else
             {
-                const cmsCIExyY whitepoint = { 0.3127, 0.3290, 1.0f }; // D65
-                const cmsCIExyYTRIPLE rgbPrimaries =
+                ScopedLcmsProfile profile;
+
+                if (key.primaries == heif_color_primaries_ITU_R_BT_709_5)
                 {
-                    { 0.708, 0.292, 1.0 },
-                    { 0.170, 0.797, 1.0 },
-                    { 0.131, 0.046, 1.0 }
-                };
+                    const cmsCIExyY whitepoint = { 0.3127, 0.3290, 1.0f }; // D65
+                    const cmsCIExyYTRIPLE rgbPrimaries =
+                    {
+                        { 0.6400, 0.3300, 1.0 },
+                        { 0.3000, 0.6000, 1.0 },
+                        { 0.1500, 0.0600, 1.0 }
+                    };
 
-                ScopedLcmsToneCurve toneCurve;
-                const wchar_t* description = nullptr;
+                    ScopedLcmsToneCurve toneCurve;
+                    const wchar_t* description = nullptr;
 
-                if (transferCharacteristics == heif_transfer_characteristic_linear)
+                    if (key.transferCharacteristics == heif_transfer_characteristic_linear)
+                    {
+                        toneCurve.reset(cmsBuildGamma(context.get(), 1.0));
+                        description = L"sRGB IEC 61966-2-1 (Linear RGB Profile)";
+                    }
+                    else if (key.transferCharacteristics == heif_transfer_characteristic_IEC_61966_2_1)
+                    {
+                        cmsFloat64Number Parameters[5]
+                        {
+                            2.4,
+                            1 / 1.055,
+                            1 - 1 / 1.055,
+                            1 / 12.92,
+                            12.92 * 0.0031308,
+                        };
+
+                        toneCurve.reset(cmsBuildParametricToneCurve(context.get(), 4, Parameters));
+                        description = L"sRGB IEC 61966-2-1";
+                    }
+                    else if (key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_709_5 ||
+                             key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_601_6 ||
+                             key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_10bit ||
+                             key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_12bit)
+                    {
+                        cmsFloat64Number Parameters[5]
+                        {
+                            1.0 / 0.45,
+                            1.0 / 1.099296826809442,
+                            1.0 - 1 / 1.099296826809442,
+                            1.0 / 4.5,
+                            4.5 * 0.018053968510807,
+                        };
+
+                        toneCurve.reset(cmsBuildParametricToneCurve(context.get(), 4, Parameters));
+                        description = L"Rec. 709";
+                    }
+
+                    if (toneCurve && description != nullptr)
+                    {
+                        profile = BuildRGBProfile(
+                            context.get(),
+                            &whitepoint,
+                            &rgbPrimaries,
+                            toneCurve.get(),
+                            description);
+                    }
+                }
+                else if (key.primaries == heif_color_primaries_ITU_R_BT_2020_2_and_2100_0)
                 {
-                    toneCurve.reset(cmsBuildGamma(context.get(), 1.0));
-                    description = L"Rec. 2020 (Linear RGB Profile)";
+                    const cmsCIExyY whitepoint = { 0.3127, 0.3290, 1.0f }; // D65
+                    const cmsCIExyYTRIPLE rgbPrimaries =
+                    {
+                        { 0.708, 0.292, 1.0 },
+                        { 0.170, 0.797, 1.0 },
+                        { 0.131, 0.046, 1.0 }
+                    };
+
+                    ScopedLcmsToneCurve toneCurve;
+                    const wchar_t* description = nullptr;
+
+                    if (key.transferCharacteristics == heif_transfer_characteristic_linear)
+                    {
+                        toneCurve.reset(cmsBuildGamma(context.get(), 1.0));
+                        description = L"Rec. 2020 (Linear RGB Profile)";
+                    }
+                    else if (key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_709_5 ||
+                             key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_601_6 ||
+                             key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_10bit ||
+                             key.transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_12bit)
+                    {
+                        // BT. 2020 uses the same transfer curve as Rec. 709.
+                        cmsFloat64Number Parameters[5]
+                        {
+                            1.0 / 0.45,
+                            1.0 / 1.099296826809442,
+                            1.0 - 1 / 1.099296826809442,
+                            1.0 / 4.5,
+                            4.5 * 0.018053968510807,
+                        };
+
+                        toneCurve.reset(cmsBuildParametricToneCurve(context.get(), 4, Parameters));
+                        description = L"Rec. 2020";
+                    }
+
+                    if (toneCurve && description != nullptr)
+                    {
+                        profile = BuildRGBProfile(
+                            context.get(),
+                            &whitepoint,
+                            &rgbPrimaries,
+                            toneCurve.get(),
+                            description);
+                    }
                 }
-                else if (transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_709_5 ||
-                         transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_601_6 ||
-                         transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_10bit ||
-                         transferCharacteristics == heif_transfer_characteristic_ITU_R_BT_2020_2_12bit)
+                else if (key.primaries == heif_color_primaries_SMPTE_EG_432_1)
                 {
-                    // BT. 2020 uses the same transfer curve as Rec. 709.
-                    cmsFloat64Number Parameters[5]
+                    const cmsCIExyY whitepoint = { 0.3127, 0.3290, 1.0f }; // D65
+                    const cmsCIExyYTRIPLE rgbPrimaries =
                     {
-                        1.0 / 0.45,
-                        1.0 / 1.099296826809442,
-                        1.0 - 1 / 1.099296826809442,
-                        1.0 / 4.5,
-                        4.5 * 0.018053968510807,
+                        { 0.680, 0.320, 1.0 },
+                        { 0.265, 0.690, 1.0 },
+                        { 0.150, 0.060, 1.0 }
                     };
 
-                    toneCurve.reset(cmsBuildParametricToneCurve(context.get(), 4, Parameters));
-                    description = L"Rec. 2020";
+                    ScopedLcmsToneCurve toneCurve;
+                    const wchar_t* description = nullptr;
+
+                    if (key.transferCharacteristics == heif_transfer_characteristic_linear)
+                    {
+                        toneCurve.reset(cmsBuildGamma(context.get(), 1.0));
+                        description = L"Display P3 (Linear RGB Profile)";
+                    }
+                    else if (key.transferCharacteristics == heif_transfer_characteristic_IEC_61966_2_1)
+                    {
+                        // Display P3 uses the sRGB transfer curve.
+                        toneCurve = BuildSRGBToneCurve(context.get());
+                        description = L"Display P3";
+                    }
+
+                    if (toneCurve && description != nullptr)
+                    {
+                        profile = BuildRGBProfile(
+                            context.get(),
+                            &whitepoint,
+                            &rgbPrimaries,
+                            toneCurve.get(),
+                            description);
+                    }
                 }
 
-                if (toneCurve && description != nullptr)
+                if (profile)
                 {
-                    profile = BuildRGBProfile(
-                        context.get(),
-                        &whitepoint,
-                        &rgbPrimaries,
-                        toneCurve.get(),
-                        description);
+                    SetCICPTag(profile.get(), key.primaries, key.transferCharacteristics, key.matrixCoefficients, key.fullRange);
+                    profileData = SaveColorProfileToMemory(profile.get());
                 }
             }
+        }
+
+        return profileData;
+    }
+
+    IccProfileKey GetIccProfileKey(const FormatRecordPtr formatRecord, const heif_color_profile_nclx* nclx)
+    {
+        // (As of ISO/IEC 23000-22:2019 Amendment 2)
+        // MIAF Section 7.3.6.4 "Colour information property":
+        //
+        // If a coded image has no associated colour property, the default property is defined as having
+        // colour_type equal to 'nclx' with properties as follows:
+        //    colour_primaries equal to 1,
+        //    transfer_characteristics equal to 13,
+        //    matrix_coefficients equal to 5 or 6 (which are functionally identical), and
+        //    full_range_flag equal to 1.
+        // Only if the colour information property of the image matches these default values, the colour
+        // property may be omitted; all other images shall have an explicitly declared colour space via
+        // association with a property of this type.
+        //
+        // See here for the discussion: https://github.com/AOMediaCodec/av1-avif/issues/77#issuecomment-676526097
+
+        heif_color_primaries primaries = heif_color_primaries_ITU_R_BT_709_5;
+        heif_transfer_characteristics transferCharacteristics = heif_transfer_characteristic_IEC_61966_2_1;
+        heif_matrix_coefficients matrixCoefficients = heif_matrix_coefficients_ITU_R_BT_601_6;
+        bool fullRange = true;
+        // Default to the Rec. 709 white point values, D65.
+        cmsFloat64Number whitepointX = 0.3127;
+        cmsFloat64Number whitepointY = 0.3290;
+
+        if (nclx != nullptr)
+        {
+            if (nclx->color_primaries != heif_color_primaries_unspecified)
+            {
+                primaries = nclx->color_primaries;
+                whitepointX = nclx->color_primary_white_x;
+                whitepointY = nclx->color_primary_white_y;
+            }
+
+            if (nclx->transfer_characteristics != heif_transfer_characteristic_unspecified)
+            {
+                transferCharacteristics = nclx->transfer_characteristics;
+            }
+
+            if (nclx->matrix_coefficients != heif_matrix_coefficients_unspecified)
+            {
+                matrixCoefficients = nclx->matrix_coefficients;
+            }
+            fullRange = nclx->full_range_flag != 0;
+        }
+
+        // The 32-bits-per-channel image modes always operate in linear color.
+        if (formatRecord->depth == 32)
+        {
+            transferCharacteristics = heif_transfer_characteristic_linear;
+        }
+
+        return IccProfileKey
+        {
+            IsMonochromeImage(formatRecord),
+            primaries,
+            transferCharacteristics,
+            matrixCoefficients,
+            fullRange,
+            whitepointX,
+            whitepointY
+        };
+    }
+
+    std::vector<uint8_t> GetIccProfileData(const IccProfileKey& key)
+    {
+        // The images in a batch usually share a few color settings, so the serialized profiles are
+        // kept for the lifetime of the plug-in.
+        static std::mutex cacheMutex;
+        static std::vector<CachedIccProfile> cache;
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        auto it = std::find_if(
+            cache.begin(),
+            cache.end(),
+            [&](const CachedIccProfile& item) { return item.key == key; });
+
+        if (it == cache.end())
+        {
+            cache.push_back({ key, CreateIccProfileData(key) });
+            it = cache.end() - 1;
+        }
+
+        return it->data;
+    }
+}
+
+ScopedLcmsProfile CreateRec2020LinearRGBProfile(cmsContext context)
+{
+    ScopedLcmsProfile profile;
+
+    const cmsCIExyY whitepoint = { 0.3127, 0.3290, 1.0f }; // D65
+    const cmsCIExyYTRIPLE rgbPrimaries =
+    {
+        { 0.708, 0.292, 1.0 },
+        { 0.170, 0.797, 1.0 },
+        { 0.131, 0.046, 1.0 }
+    };
+
+    ScopedLcmsToneCurve toneCurve(cmsBuildGamma(context, 1.0));
+    const wchar_t* description = L"Rec. 2020 (Linear RGB Profile)";
+
+    if (toneCurve)
+    {
+        profile = BuildRGBProfile(
+            context,
+            &whitepoint,
+            &rgbPrimaries,
+            toneCurve.get(),
+            description);
+
+        if (profile)
+        {
+            SetCICPTag(
+                profile.get(),
+                heif_color_primaries_ITU_R_BT_2020_2_and_2100_0,
+                heif_transfer_characteristic_linear,
+                heif_matrix_coefficients_ITU_R_BT_2020_2_non_constant_luminance,
+                true);
+        }
+    }
+
+    return profile;
+}
+
+ScopedLcmsProfile CreateNclxColorProfile(
+    cmsContext context,
+    const FormatRecordPtr formatRecord,
+    const heif_color_profile_nclx* nclx)
+{
+    ScopedLcmsProfile profile;
+
+    const std::vector<uint8_t> profileData = GetIccProfileData(GetIccProfileKey(formatRecord, nclx));
+
+    if (!profileData.empty())
+    {
+        profile.reset(cmsOpenProfileFromMemTHR(
+            context,
+            profileData.data(),
+            static_cast<cmsUInt32Number>(profileData.size())));
+    }
+
+    return profile;
+}
+
+ScopedLcmsProfile CreateWorkingSpaceColorProfile(
+    cmsContext context,
+    LoadOptionsWorkingSpace workingSpace,
+    bool linear)
+{
+    ScopedLcmsProfile profile;
+
+    const cmsCIExyY whitepoint = { 0.3127, 0.3290, 1.0f }; // D65
+    cmsCIExyYTRIPLE rgbPrimaries{};
+    ScopedLcmsToneCurve toneCurve;
+    const wchar_t* description = nullptr;
+
+    switch (workingSpace)
+    {
+    case LoadOptionsWorkingSpace::SRGB:
+        rgbPrimaries =
+        {
+            { 0.6400, 0.3300, 1.0 },
+            { 0.3000, 0.6000, 1.0 },
+            { 0.1500, 0.0600, 1.0 }
+        };
+
+        if (linear)
+        {
+            toneCurve.reset(cmsBuildGamma(context, 1.0));
+            description = L"sRGB IEC 61966-2-1 (Linear RGB Profile)";
+        }
+        else
+        {
+            toneCurve = BuildSRGBToneCurve(context);
+            description = L"sRGB IEC 61966-2-1";
+        }
+        break;
+    case LoadOptionsWorkingSpace::DisplayP3:
+        rgbPrimaries =
+        {
+            { 0.680, 0.320, 1.0 },
+            { 0.265, 0.690, 1.0 },
+            { 0.150, 0.060, 1.0 }
+        };
+
+        if (linear)
+        {
+            toneCurve.reset(cmsBuildGamma(context, 1.0));
+            description = L"Display P3 (Linear RGB Profile)";
+        }
+        else
+        {
+            toneCurve = BuildSRGBToneCurve(context);
+            description = L"Display P3";
+        }
+        break;
+    case LoadOptionsWorkingSpace::AdobeRGB:
+        rgbPrimaries =
+        {
+            { 0.6400, 0.3300, 1.0 },
+            { 0.2100, 0.7100, 1.0 },
+            { 0.1500, 0.0600, 1.0 }
+        };
+
+        if (linear)
+        {
+            toneCurve.reset(cmsBuildGamma(context, 1.0));
+            description = L"Adobe RGB (1998) (Linear RGB Profile)";
+        }
+        else
+        {
+            // Adobe RGB (1998) uses a pure gamma curve of 563/256.
+            toneCurve.reset(cmsBuildGamma(context, 563.0 / 256.0));
+            description = L"Adobe RGB (1998)";
+        }
+        break;
+    case LoadOptionsWorkingSpace::Embedded:
+    default:
+        break;
+    }
+
+    if (toneCurve && description != nullptr)
+    {
+        profile = BuildRGBProfile(
+            context,
+            &whitepoint,
+            &rgbPrimaries,
+            toneCurve.get(),
+            description);
+    }
+
+    return profile;
+}
+
+void SetIccProfileFromNclx(FormatRecord* formatRecord, const heif_color_profile_nclx* nclx)
+{
+    const std::vector<uint8_t> profileData = GetIccProfileData(GetIccProfileKey(formatRecord, nclx));
+
+    if (!profileData.empty())
+    {
+        SaveColorProfileToHandle(profileData, formatRecord);
+    }
+}
+
+void SetIccProfileFromWorkingSpace(FormatRecord* formatRecord, LoadOptionsWorkingSpace workingSpace)
+{
+    ScopedLcmsContext context(cmsCreateContext(nullptr, nullptr));
+
+    if (context)
+    {
+        // The 32-bits-per-channel image modes always operate in linear color.
+        ScopedLcmsProfile profile = CreateWorkingSpaceColorProfile(
+            context.get(),
+            workingSpace,
+            formatRecord->depth == 32);
+
+        if (profile)
+        {
+            const std::vector<uint8_t> profileData = SaveColorProfileToMemory(profile.get());
 
-            if (profile)
+            if (!profileData.empty())
             {
-                SetCICPTag(profile.get(), primaries, transferCharacteristics, matrixCoefficients, fullRange);
-                SaveColorProfileToHandle(profile.get(), formatRecord);
+                SaveColorProfileToHandle(profileData, formatRecord);
             }
         }
     }
@@ -21,11 +21,25 @@
 #ifndef COLORPROFILEGENERATION_H
 #define COLORPROFILEGENERATION_H
 
-#include "Common.h"
+#include "AvifFormat.h"
 #include "ScopedLcms.h"
 
 ScopedLcmsProfile CreateRec2020LinearRGBProfile(cmsContext context);
 
+// Creates the profile that SetIccProfileFromNclx attaches to the document.
+// Returns an empty profile if the color settings are not supported.
+ScopedLcmsProfile CreateNclxColorProfile(
+    cmsContext context,
+    const FormatRecordPtr formatRecord,
+    const heif_color_profile_nclx* nclx);
+
+ScopedLcmsProfile CreateWorkingSpaceColorProfile(
+    cmsContext context,
+    LoadOptionsWorkingSpace workingSpace,
+    bool linear);
+
 void SetIccProfileFromNclx(FormatRecord* formatRecord, const heif_color_profile_nclx* nclx);
 
+void SetIccProfileFromWorkingSpace(FormatRecord* formatRecord, LoadOptionsWorkingSpace workingSpace);
+
 #endif // !COLORPROFILEGENERATION_H
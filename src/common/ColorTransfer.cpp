@@ -19,13 +19,392 @@
  */
 
 #include "ColorTransfer.h"
+#include "Common.h"
+#include <bit>
+#include <cfloat>
+#include <cstdint>
 #include <stdexcept>
 
+#if SIMD_SSE2
+#include <emmintrin.h>
+#elif SIMD_NEON
+#include <arm_neon.h>
+#endif
+
 namespace
 {
     // PQ (SMPTE ST 2084) has a maximum luminance level of 10000 nits
     // https://en.wikipedia.org/wiki/Perceptual_quantizer
     constexpr float pqMaxLuminanceLevel = 10000.0f;
+
+    constexpr float ln2 = 0.693147180559945f;
+    constexpr float sqrt2 = 1.41421356237310f;
+
+    // The row functions replace powf and logf with log2 and exp2 approximations, these are written
+    // once as templates that are used for both the SIMD vectors and the scalar values at the end of a row.
+
+    template <typename T>
+    T Splat(float value) noexcept;
+
+    template <>
+    float Splat<float>(float value) noexcept
+    {
+        return value;
+    }
+
+    float Add(float a, float b) noexcept
+    {
+        return a + b;
+    }
+
+    float Subtract(float a, float b) noexcept
+    {
+        return a - b;
+    }
+
+    float Multiply(float a, float b) noexcept
+    {
+        return a * b;
+    }
+
+    float Divide(float a, float b) noexcept
+    {
+        return a / b;
+    }
+
+    float Max(float a, float b) noexcept
+    {
+        return a > b ? a : b;
+    }
+
+    bool Less(float a, float b) noexcept
+    {
+        return a < b;
+    }
+
+    float Select(bool mask, float a, float b) noexcept
+    {
+        return mask ? a : b;
+    }
+
+#if SIMD_SSE2
+    template <>
+    __m128 Splat<__m128>(float value) noexcept
+    {
+        return _mm_set1_ps(value);
+    }
+
+    __m128 Add(__m128 a, __m128 b) noexcept
+    {
+        return _mm_add_ps(a, b);
+    }
+
+    __m128 Subtract(__m128 a, __m128 b) noexcept
+    {
+        return _mm_sub_ps(a, b);
+    }
+
+    __m128 Multiply(__m128 a, __m128 b) noexcept
+    {
+        return _mm_mul_ps(a, b);
+    }
+
+    __m128 Divide(__m128 a, __m128 b) noexcept
+    {
+        return _mm_div_ps(a, b);
+    }
+
+    __m128 Max(__m128 a, __m128 b) noexcept
+    {
+        // _mm_max_ps returns the second operand for NaN values.
+        return _mm_max_ps(a, b);
+    }
+
+    __m128 Less(__m128 a, __m128 b) noexcept
+    {
+        return _mm_cmplt_ps(a, b);
+    }
+
+    __m128 Select(__m128 mask, __m128 a, __m128 b) noexcept
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+#elif SIMD_NEON
+    template <>
+    float32x4_t Splat<float32x4_t>(float value) noexcept
+    {
+        return vdupq_n_f32(value);
+    }
+
+    float32x4_t Add(float32x4_t a, float32x4_t b) noexcept
+    {
+        return vaddq_f32(a, b);
+    }
+
+    float32x4_t Subtract(float32x4_t a, float32x4_t b) noexcept
+    {
+        return vsubq_f32(a, b);
+    }
+
+    float32x4_t Multiply(float32x4_t a, float32x4_t b) noexcept
+    {
+        return vmulq_f32(a, b);
+    }
+
+    float32x4_t Divide(float32x4_t a, float32x4_t b) noexcept
+    {
+        return vdivq_f32(a, b);
+    }
+
+    float32x4_t Max(float32x4_t a, float32x4_t b) noexcept
+    {
+        return vmaxq_f32(a, b);
+    }
+
+    uint32x4_t Less(float32x4_t a, float32x4_t b) noexcept
+    {
+        return vcltq_f32(a, b);
+    }
+
+    float32x4_t Select(uint32x4_t mask, float32x4_t a, float32x4_t b) noexcept
+    {
+        return vbslq_f32(mask, a, b);
+    }
+#endif
+
+    // Returns log2(mantissa) for a mantissa in the [sqrt(0.5), sqrt(2)] range.
+    // The polynomial is a Chebyshev fit of log2(1 + x) / x, the maximum error is below 8e-8.
+    template <typename T>
+    T Log2Mantissa(T mantissa) noexcept
+    {
+        const T x = Subtract(mantissa, Splat<T>(1.0f));
+
+        T result = Splat<T>(0.126148626f);
+        result = Add(Multiply(result, x), Splat<T>(-0.207421288f));
+        result = Add(Multiply(result, x), Splat<T>(0.215669915f));
+        result = Add(Multiply(result, x), Splat<T>(-0.238920316f));
+        result = Add(Multiply(result, x), Splat<T>(0.287918329f));
+        result = Add(Multiply(result, x), Splat<T>(-0.360704839f));
+        result = Add(Multiply(result, x), Splat<T>(0.480910599f));
+        result = Add(Multiply(result, x), Splat<T>(-0.721347332f));
+        result = Add(Multiply(result, x), Splat<T>(1.44269502f));
+
+        return Multiply(result, x);
+    }
+
+    // Returns 2^fraction for a fraction in the [-0.5, 0.5] range.
+    // The degree 6 Taylor polynomial has a relative error below 2e-7 in this range.
+    template <typename T>
+    T Exp2Fraction(T fraction) noexcept
+    {
+        constexpr float c1 = ln2;
+        constexpr float c2 = c1 * ln2 / 2.0f;
+        constexpr float c3 = c2 * ln2 / 3.0f;
+        constexpr float c4 = c3 * ln2 / 4.0f;
+        constexpr float c5 = c4 * ln2 / 5.0f;
+        constexpr float c6 = c5 * ln2 / 6.0f;
+
+        T result = Splat<T>(c6);
+        result = Add(Multiply(result, fraction), Splat<T>(c5));
+        result = Add(Multiply(result, fraction), Splat<T>(c4));
+        result = Add(Multiply(result, fraction), Splat<T>(c3));
+        result = Add(Multiply(result, fraction), Splat<T>(c2));
+        result = Add(Multiply(result, fraction), Splat<T>(c1));
+
+        return Add(Multiply(result, fraction), Splat<T>(1.0f));
+    }
+
+    // The value must be a positive normal number.
+    float FastLog2(float value) noexcept
+    {
+        const uint32_t bits = std::bit_cast<uint32_t>(value);
+
+        int32_t exponent = static_cast<int32_t>(bits >> 23) - 127;
+        float mantissa = std::bit_cast<float>((bits & 0x007fffff) | 0x3f800000);
+
+        if (mantissa > sqrt2)
+        {
+            mantissa *= 0.5f;
+            exponent++;
+        }
+
+        return static_cast<float>(exponent) + Log2Mantissa(mantissa);
+    }
+
+    float FastExp2(float value) noexcept
+    {
+        value = std::clamp(value, -126.0f, 127.0f);
+
+        const float integer = floorf(value + 0.5f);
+        const float scale = std::bit_cast<float>(static_cast<uint32_t>(static_cast<int32_t>(integer) + 127) << 23);
+
+        return Exp2Fraction(value - integer) * scale;
+    }
+
+#if SIMD_SSE2
+    __m128 FastLog2(__m128 value) noexcept
+    {
+        const __m128i bits = _mm_castps_si128(value);
+
+        __m128i exponent = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+        __m128 mantissa = _mm_castsi128_ps(_mm_or_si128(
+            _mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+            _mm_set1_epi32(0x3f800000)));
+
+        const __m128 adjust = _mm_cmpgt_ps(mantissa, _mm_set1_ps(sqrt2));
+
+        mantissa = Select(adjust, _mm_mul_ps(mantissa, _mm_set1_ps(0.5f)), mantissa);
+        // The comparison mask is -1 for the adjusted values.
+        exponent = _mm_sub_epi32(exponent, _mm_castps_si128(adjust));
+
+        return _mm_add_ps(_mm_cvtepi32_ps(exponent), Log2Mantissa(mantissa));
+    }
+
+    __m128 FastExp2(__m128 value) noexcept
+    {
+        value = _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(-126.0f)), _mm_set1_ps(127.0f));
+
+        // _mm_cvtps_epi32 uses the default round to nearest mode.
+        const __m128i integer = _mm_cvtps_epi32(value);
+        const __m128 fraction = _mm_sub_ps(value, _mm_cvtepi32_ps(integer));
+        const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(integer, _mm_set1_epi32(127)), 23));
+
+        return _mm_mul_ps(Exp2Fraction(fraction), scale);
+    }
+#elif SIMD_NEON
+    float32x4_t FastLog2(float32x4_t value) noexcept
+    {
+        const uint32x4_t bits = vreinterpretq_u32_f32(value);
+
+        int32x4_t exponent = vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127));
+        float32x4_t mantissa = vreinterpretq_f32_u32(vorrq_u32(
+            vandq_u32(bits, vdupq_n_u32(0x007fffff)),
+            vdupq_n_u32(0x3f800000)));
+
+        const uint32x4_t adjust = vcgtq_f32(mantissa, vdupq_n_f32(sqrt2));
+
+        mantissa = vbslq_f32(adjust, vmulq_n_f32(mantissa, 0.5f), mantissa);
+        // The comparison mask is -1 for the adjusted values.
+        exponent = vsubq_s32(exponent, vreinterpretq_s32_u32(adjust));
+
+        return vaddq_f32(vcvtq_f32_s32(exponent), Log2Mantissa(mantissa));
+    }
+
+    float32x4_t FastExp2(float32x4_t value) noexcept
+    {
+        value = vminq_f32(vmaxq_f32(value, vdupq_n_f32(-126.0f)), vdupq_n_f32(127.0f));
+
+        const int32x4_t integer = vcvtnq_s32_f32(value);
+        const float32x4_t fraction = vsubq_f32(value, vcvtq_f32_s32(integer));
+        const float32x4_t scale = vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(integer, vdupq_n_s32(127)), 23));
+
+        return vmulq_f32(Exp2Fraction(fraction), scale);
+    }
+#endif
+
+    template <typename T>
+    T FastPow(T value, float exponent) noexcept
+    {
+        // The smallest normal number keeps zero and the denormals in the FastLog2 range.
+        return FastExp2(Multiply(Splat<T>(exponent), FastLog2(Max(value, Splat<T>(FLT_MIN)))));
+    }
+
+    template <typename T>
+    T FastLinearToPQ(T value, float luminanceMultiplier) noexcept
+    {
+        constexpr float m1 = 2610.0f / 16384.0f;
+        constexpr float m2 = 2523.0f / 4096.0f * 128.0f;
+        constexpr float c1 = 3424.0f / 4096.0f; // c3 - c2 + 1
+        constexpr float c2 = 2413.0f / 4096.0f * 32.0f;
+        constexpr float c3 = 2392.0f / 4096.0f * 32.0f;
+
+        const T x = FastPow(Multiply(value, Splat<T>(luminanceMultiplier)), m1);
+        const T ratio = Divide(
+            Add(Splat<T>(c1), Multiply(Splat<T>(c2), x)),
+            Add(Splat<T>(1.0f), Multiply(Splat<T>(c3), x)));
+
+        return Select(Less(value, Splat<T>(0.0f)), Splat<T>(0.0f), FastPow(ratio, m2));
+    }
+
+    template <typename T>
+    T FastLinearToSMPTE428(T value) noexcept
+    {
+        const T result = FastPow(Multiply(value, Splat<T>(48.0f / 52.37f)), 1.0f / 2.6f);
+
+        return Select(Less(value, Splat<T>(0.0f)), Splat<T>(0.0f), result);
+    }
+
+    template <typename Function>
+    void TransformRow(float* values, size_t count, Function&& function) noexcept
+    {
+        size_t i = 0;
+
+#if SIMD_SSE2
+        for (; i + 4 <= count; i += 4)
+        {
+            _mm_storeu_ps(values + i, function(_mm_loadu_ps(values + i)));
+        }
+#elif SIMD_NEON
+        for (; i + 4 <= count; i += 4)
+        {
+            vst1q_f32(values + i, function(vld1q_f32(values + i)));
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            values[i] = function(values[i]);
+        }
+    }
+
+    // Multiplies the color channels of each pixel by scale * luma^exponent.
+    // The luma values are gathered into a block so that the power function can be evaluated with SIMD.
+    void ScaleRowByLumaPower(
+        float* pixels,
+        size_t pixelCount,
+        size_t channelCount,
+        const HLGLumaCoefficiants& lumaCoefficiants,
+        float exponent,
+        float scale) noexcept
+    {
+        constexpr size_t blockSize = 64;
+
+        float factors[blockSize];
+
+        for (size_t blockStart = 0; blockStart < pixelCount; blockStart += blockSize)
+        {
+            const size_t blockCount = std::min(blockSize, pixelCount - blockStart);
+            float* const blockPixels = pixels + (blockStart * channelCount);
+
+            const float* src = blockPixels;
+
+            for (size_t i = 0; i < blockCount; i++)
+            {
+                factors[i] = (src[0] * lumaCoefficiants.red) + (src[1] * lumaCoefficiants.green) + (src[2] * lumaCoefficiants.blue);
+                src += channelCount;
+            }
+
+            TransformRow(
+                factors,
+                blockCount,
+                [=](auto luma)
+                {
+                    using T = decltype(luma);
+
+                    return Multiply(Splat<T>(scale), FastPow(luma, exponent));
+                });
+
+            float* dst = blockPixels;
+
+            for (size_t i = 0; i < blockCount; i++)
+            {
+                dst[0] *= factors[i];
+                dst[1] *= factors[i];
+                dst[2] *= factors[i];
+                dst += channelCount;
+            }
+        }
+    }
 }
 
 HLGLumaCoefficiants GetHLGLumaCoefficients(heif_color_primaries primaries)
@@ -218,3 +597,68 @@ void ApplyInverseHLGOOTF(
     rgb[1] *= factor;
     rgb[2] *= factor;
 }
+
+void LinearToTransferFunctionRow(
+    float* values,
+    size_t count,
+    ColorTransferFunction transferFunction,
+    float imageMaxLuminanceLevel)
+{
+    switch (transferFunction)
+    {
+    case ColorTransferFunction::PQ:
+    {
+        // For the image to be displayed correctly, we have to adjust for the difference in the
+        // maximum luminance level between the image and PQ.
+        const float luminanceMultiplier = imageMaxLuminanceLevel / pqMaxLuminanceLevel;
+
+        TransformRow(values, count, [=](auto value) { return FastLinearToPQ(value, luminanceMultiplier); });
+        break;
+    }
+    case ColorTransferFunction::SMPTE428:
+        TransformRow(values, count, [](auto value) { return FastLinearToSMPTE428(value); });
+        break;
+    case ColorTransferFunction::Clip:
+        break;
+    default:
+        throw std::runtime_error("Unsupported color transfer function.");
+    }
+}
+
+void ApplyHLGOOTFRow(
+    float* pixels,
+    size_t pixelCount,
+    size_t channelCount,
+    const HLGLumaCoefficiants& lumaCoefficiants,
+    float displayGamma,
+    float nominalPeakBrightness)
+{
+    ScaleRowByLumaPower(
+        pixels,
+        pixelCount,
+        channelCount,
+        lumaCoefficiants,
+        displayGamma - 1.0f,
+        nominalPeakBrightness);
+}
+
+void ApplyInverseHLGOOTFRow(
+    float* pixels,
+    size_t pixelCount,
+    size_t channelCount,
+    const HLGLumaCoefficiants& lumaCoefficiants,
+    float displayGamma,
+    float nominalPeakBrightness)
+{
+    const float exponent = (displayGamma - 1.0f) / displayGamma;
+
+    // powf(luma / peak, exponent) / peak is equal to powf(luma, exponent) * (powf(peak, -exponent) / peak),
+    // this moves the division by the peak brightness out of the pixel loop.
+    ScaleRowByLumaPower(
+        pixels,
+        pixelCount,
+        channelCount,
+        lumaCoefficiants,
+        exponent,
+        powf(nominalPeakBrightness, -exponent) / nominalPeakBrightness);
+}
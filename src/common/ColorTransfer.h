@@ -22,6 +22,7 @@
 #define COLORTRANSFER_H
 
 #include <algorithm>
+#include <cstddef>
 #include <math.h>
 #include <libheif/heif.h>
 
@@ -56,6 +57,17 @@ float LinearToHLG(float value);
 
 float HLGToLinear(float value);
 
+// Converts a row of linear values to the transfer function in place.
+// This uses SIMD polynomial approximations of the LinearToPQ and LinearToSMPTE428 functions,
+// the maximum error in the [0, 1] output range is below 2e-5, about the same as the powf versions and
+// less than a tenth of a 12-bit code value.
+// The Clip transfer function does not change the values.
+void LinearToTransferFunctionRow(
+    float* values,
+    size_t count,
+    ColorTransferFunction transferFunction,
+    float imageMaxLuminanceLevel);
+
 void ApplyHLGOOTF(
     float* rgb,
     const HLGLumaCoefficiants& lumaCoefficiants,
@@ -68,4 +80,22 @@ void ApplyInverseHLGOOTF(
     float displayGamma,
     float nominalPeakBrightness);
 
+// Applies the HLG OOTF to a row of interleaved RGB or RGBA pixels, channelCount is the number of values per pixel.
+// The row functions use a SIMD approximation of powf with a relative error below 1e-6.
+void ApplyHLGOOTFRow(
+    float* pixels,
+    size_t pixelCount,
+    size_t channelCount,
+    const HLGLumaCoefficiants& lumaCoefficiants,
+    float displayGamma,
+    float nominalPeakBrightness);
+
+void ApplyInverseHLGOOTFRow(
+    float* pixels,
+    size_t pixelCount,
+    size_t channelCount,
+    const HLGLumaCoefficiants& lumaCoefficiants,
+    float displayGamma,
+    float nominalPeakBrightness);
+
 #endif // !COLORTRANSFER_H
@@ -0,0 +1,299 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ColorTransformCache.h"
+#include "ColorProfileDetection.h"
+#include "ColorProfileGeneration.h"
+#include "Common.h"
+#include <array>
+#include <list>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+namespace
+{
+    // The float transforms use large lookup tables, this limits the memory used by the cache.
+    constexpr size_t maxCachedTransforms = 16;
+
+    using ProfileId = std::array<cmsUInt8Number, 16>;
+
+    struct ColorTransformKey
+    {
+        ProfileId documentProfileId;
+        ColorTransformOutputProfile outputProfile;
+        cmsUInt32Number format;
+        cmsUInt32Number flags;
+        bool photoshopSixteenBitRange;
+
+        bool operator==(const ColorTransformKey& other) const noexcept
+        {
+            return documentProfileId == other.documentProfileId
+                && outputProfile == other.outputProfile
+                && format == other.format
+                && flags == other.flags
+                && photoshopSixteenBitRange == other.photoshopSixteenBitRange;
+        }
+    };
+
+    struct CachedColorTransform
+    {
+        ColorTransformKey key;
+        std::shared_ptr<const ScopedLcmsTransform> transform;
+    };
+
+    using ProfileEquivalenceKey = std::pair<ProfileId, ColorTransformOutputProfile>;
+
+    struct ColorTransformCache
+    {
+        ColorTransformCache()
+            : context(cmsCreateContext(nullptr, nullptr)), transforms(), profileEquivalence(), hits(0), misses(0)
+        {
+        }
+
+        std::mutex mutex;
+        // The transforms must be released before the context they were created in.
+        ScopedLcmsContext context;
+        // The most recently used transform is at the front of the list.
+        std::list<CachedColorTransform> transforms;
+        // The entries are small, so the results for every profile that was used are kept.
+        std::map<ProfileEquivalenceKey, bool> profileEquivalence;
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    ColorTransformCache& GetCache()
+    {
+        static ColorTransformCache cache;
+
+        return cache;
+    }
+
+    ProfileId GetProfileId(cmsHPROFILE profile)
+    {
+        static const ProfileId emptyProfileId{};
+
+        ProfileId profileId;
+        cmsGetHeaderProfileID(profile, profileId.data());
+
+        // The profile ID is optional, it is computed if the profile does not include it.
+        if (profileId == emptyProfileId)
+        {
+            if (!cmsMD5computeID(profile))
+            {
+                throw std::runtime_error("Unable to compute the color profile ID.");
+            }
+
+            cmsGetHeaderProfileID(profile, profileId.data());
+        }
+
+        return profileId;
+    }
+
+    ScopedLcmsProfile CreatePhotoshopSixteenBitRangeLink(cmsContext context, bool toPhotoshopRange)
+    {
+        // Little CMS has a formatter plug-in that adds support for Photoshop's 16-bit range, but we
+        // cannot use it because of the GPL license.
+        // A device link that scales the values between [0, 32768] and [0, 65535] is placed at each
+        // end of the transform instead, lcms merges it with the other curves when it optimizes the transform.
+        const cmsFloat64Number scale = toPhotoshopRange ? 32768.0 / 65535.0 : 65535.0 / 32768.0;
+        // Y = (aX + b)^g, the lcms 16-bit formatters clamp the values that are outside of the range.
+        const cmsFloat64Number parameters[3] = { 1.0, scale, 0.0 };
+
+        ScopedLcmsToneCurve toneCurve(cmsBuildParametricToneCurve(context, 1, parameters));
+
+        if (!toneCurve)
+        {
+            throw std::bad_alloc();
+        }
+
+        cmsToneCurve* const toneCurves[3] = { toneCurve.get(), toneCurve.get(), toneCurve.get() };
+
+        ScopedLcmsProfile profile(cmsCreateLinearizationDeviceLinkTHR(context, cmsSigRgbData, toneCurves));
+
+        if (!profile)
+        {
+            throw std::runtime_error("Unable to create the 16-bit range device link profile.");
+        }
+
+        return profile;
+    }
+
+    ScopedLcmsTransform CreateTransform(
+        cmsContext context,
+        cmsHPROFILE documentProfile,
+        cmsHPROFILE outputProfile,
+        cmsUInt32Number format,
+        cmsUInt32Number flags,
+        bool photoshopSixteenBitRange)
+    {
+        if (photoshopSixteenBitRange)
+        {
+            ScopedLcmsProfile fromPhotoshopRange = CreatePhotoshopSixteenBitRangeLink(context, false);
+            ScopedLcmsProfile toPhotoshopRange = CreatePhotoshopSixteenBitRangeLink(context, true);
+
+            cmsHPROFILE profiles[4] = { fromPhotoshopRange.get(), documentProfile, outputProfile, toPhotoshopRange.get() };
+
+            return ScopedLcmsTransform(cmsCreateMultiprofileTransformTHR(
+                context,
+                profiles,
+                4,
+                format,
+                format,
+                INTENT_PERCEPTUAL,
+                flags));
+        }
+
+        return ScopedLcmsTransform(cmsCreateTransformTHR(
+            context,
+            documentProfile,
+            format,
+            outputProfile,
+            format,
+            INTENT_PERCEPTUAL,
+            flags));
+    }
+}
+
+std::shared_ptr<const ScopedLcmsTransform> GetCachedColorTransform(
+    cmsHPROFILE documentProfile,
+    ColorTransformOutputProfile outputProfile,
+    cmsUInt32Number format,
+    cmsUInt32Number flags,
+    bool photoshopSixteenBitRange)
+{
+    const ColorTransformKey key{ GetProfileId(documentProfile), outputProfile, format, flags, photoshopSixteenBitRange };
+
+    ColorTransformCache& cache = GetCache();
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    if (!cache.context)
+    {
+        throw std::bad_alloc();
+    }
+
+    for (auto it = cache.transforms.begin(); it != cache.transforms.end(); ++it)
+    {
+        if (it->key == key)
+        {
+            cache.hits++;
+            cache.transforms.splice(cache.transforms.begin(), cache.transforms, it);
+
+            DebugOut("Color transform cache hit, %llu hits and %llu misses.", cache.hits, cache.misses);
+
+            return cache.transforms.front().transform;
+        }
+    }
+
+    cache.misses++;
+
+    // The transform only uses the profiles while it is being created.
+    ScopedLcmsProfile outputImageProfile = CreateColorTransformOutputProfile(cache.context.get(), outputProfile);
+
+    auto transform = std::make_shared<ScopedLcmsTransform>(CreateTransform(
+        cache.context.get(),
+        documentProfile,
+        outputImageProfile.get(),
+        format,
+        flags,
+        photoshopSixteenBitRange));
+
+    if (!*transform)
+    {
+        throw std::runtime_error("Unable to create a color profile transform.");
+    }
+
+    cache.transforms.push_front({ key, transform });
+
+    // The transforms that are still in use by another conversion are released when it finishes.
+    if (cache.transforms.size() > maxCachedTransforms)
+    {
+        cache.transforms.pop_back();
+    }
+
+    DebugOut("Color transform cache miss, %llu hits and %llu misses.", cache.hits, cache.misses);
+
+    return transform;
+}
+
+bool IsEquivalentToColorTransformOutputProfile(cmsHPROFILE documentProfile, ColorTransformOutputProfile outputProfile)
+{
+    const ProfileEquivalenceKey key(GetProfileId(documentProfile), outputProfile);
+
+    ColorTransformCache& cache = GetCache();
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    if (!cache.context)
+    {
+        throw std::bad_alloc();
+    }
+
+    const auto it = cache.profileEquivalence.find(key);
+
+    if (it != cache.profileEquivalence.end())
+    {
+        return it->second;
+    }
+
+    ScopedLcmsProfile outputImageProfile = CreateColorTransformOutputProfile(cache.context.get(), outputProfile);
+
+    const bool equivalent = ColorProfilesAreEquivalent(documentProfile, outputImageProfile.get());
+
+    cache.profileEquivalence.emplace(key, equivalent);
+
+    DebugOut("The document color profile %s equivalent to the output profile.", equivalent ? "is" : "is not");
+
+    return equivalent;
+}
+
+ScopedLcmsProfile CreateColorTransformOutputProfile(cmsContext context, ColorTransformOutputProfile outputProfile)
+{
+    ScopedLcmsProfile profile;
+
+    switch (outputProfile)
+    {
+    case ColorTransformOutputProfile::SRGB:
+        profile.reset(cmsCreate_sRGBProfileTHR(context));
+        break;
+    case ColorTransformOutputProfile::Rec2020Linear:
+        profile = CreateRec2020LinearRGBProfile(context);
+        break;
+    default:
+        throw std::runtime_error("Unknown color transform output profile.");
+    }
+
+    if (!profile)
+    {
+        throw std::runtime_error("Unable to create the output color profile.");
+    }
+
+    return profile;
+}
+
+ColorTransformCacheStatistics GetColorTransformCacheStatistics() noexcept
+{
+    ColorTransformCache& cache = GetCache();
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    return { cache.hits, cache.misses, cache.transforms.size() };
+}
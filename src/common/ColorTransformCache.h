@@ -0,0 +1,62 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COLORTRANSFORMCACHE_H
+#define COLORTRANSFORMCACHE_H
+
+#include "ScopedLcms.h"
+#include <cstdint>
+#include <memory>
+
+enum class ColorTransformOutputProfile
+{
+    SRGB,
+    Rec2020Linear
+};
+
+struct ColorTransformCacheStatistics
+{
+    uint64_t hits;
+    uint64_t misses;
+    size_t size;
+};
+
+// Gets a perceptual intent transform from the document profile to the output profile.
+// The transforms are shared between the documents that use the same color profile, they are
+// identified by the profile ID, so the document profile may be modified to compute the ID.
+// The returned transform can be used from multiple threads.
+// When photoshopSixteenBitRange is true the 16-bit transform reads and writes Photoshop's 16-bit
+// range [0, 32768] instead of [0, 65535], the alpha channel is copied unchanged.
+std::shared_ptr<const ScopedLcmsTransform> GetCachedColorTransform(
+    cmsHPROFILE documentProfile,
+    ColorTransformOutputProfile outputProfile,
+    cmsUInt32Number format,
+    cmsUInt32Number flags,
+    bool photoshopSixteenBitRange);
+
+// Returns true if the document profile is equivalent to the output profile, so the conversion
+// can be skipped. The result is cached by the profile ID.
+bool IsEquivalentToColorTransformOutputProfile(cmsHPROFILE documentProfile, ColorTransformOutputProfile outputProfile);
+
+ScopedLcmsProfile CreateColorTransformOutputProfile(cmsContext context, ColorTransformOutputProfile outputProfile);
+
+ColorTransformCacheStatistics GetColorTransformCacheStatistics() noexcept;
+
+#endif // !COLORTRANSFORMCACHE_H
@@ -22,6 +22,10 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+#if DEBUG_BUILD && __PIWin__
+#include <Psapi.h>
+#endif // DEBUG_BUILD && __PIWin__
+
 #if DEBUG_BUILD
 void DebugOut(const char* fmt, ...) noexcept
 {
@@ -39,4 +43,28 @@ void DebugOut(const char* fmt, ...) noexcept
 #error "Debug output has not been configured for this platform."
 #endif // __PIWin__
 }
+
+void DebugOutMemoryUsage(const char* label) noexcept
+{
+#if __PIWin__
+    PROCESS_MEMORY_COUNTERS_EX counters = {};
+
+    if (GetProcessMemoryInfo(
+        GetCurrentProcess(),
+        reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters),
+        sizeof(counters)))
+    {
+        constexpr SIZE_T bytesPerMegabyte = 1024 * 1024;
+
+        // The peak value covers the lifetime of the host process, not just the current operation.
+        DebugOut(
+            "%s: private bytes %zu MB, peak private bytes %zu MB",
+            label,
+            counters.PrivateUsage / bytesPerMegabyte,
+            counters.PeakPagefileUsage / bytesPerMegabyte);
+    }
+#else
+#error "Memory usage output has not been configured for this platform."
+#endif // __PIWin__
+}
 #endif // DEBUG_BUILD
@@ -57,10 +57,26 @@
 
 #if DEBUG_BUILD
 void DebugOut(const char* fmt, ...) noexcept;
+// Writes the current and peak memory usage of the host process to the debug output.
+void DebugOutMemoryUsage(const char* label) noexcept;
 #else
 #define DebugOut(fmt, ...)
+#define DebugOutMemoryUsage(label)
 #endif // DEBUG_BUILD
 
 #define PrintFunctionName() DebugOut(__FUNCTION__)
 
+// The SIMD row functions use SSE2 on x86 and x64, and NEON on ARM64.
+// Both are part of the baseline instruction set of the targets, so no runtime detection is needed.
+#if defined(_M_IX86) || defined(_M_AMD64) || defined(__i386__) || defined(__x86_64__)
+#define SIMD_SSE2 1
+#define SIMD_NEON 0
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define SIMD_SSE2 0
+#define SIMD_NEON 1
+#else
+#define SIMD_SSE2 0
+#define SIMD_NEON 0
+#endif
+
 #endif // !COMMON_H
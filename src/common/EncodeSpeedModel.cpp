@@ -0,0 +1,487 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EncodeSpeedModel.h"
+#include "Common.h"
+#include "FileIO.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+    constexpr int aomSpeedMin = 0;
+    constexpr int aomSpeedMax = 9;
+
+    // The encode time for images with the same dimensions varies with the content,
+    // the prediction is scaled by this value when it is compared to the budget.
+    constexpr double predictionSafetyMargin = 1.2;
+
+    // AOM only encodes tiles in parallel, tiles smaller than this reduce the compression
+    // efficiency without a meaningful speed improvement.
+    constexpr int minimumTileSize = 256;
+    constexpr int maximumTileLog2 = 6;
+
+    constexpr int modelFileVersion = 1;
+    constexpr const char* modelFileName = "encode-speed-model.txt";
+    constexpr const char* logFileName = "encode-times.csv";
+
+    struct ModelKey
+    {
+        int speed;
+        int threadCount;
+        bool highBitDepth;
+        bool lossless;
+
+        bool operator<(const ModelKey& other) const
+        {
+            return std::tie(speed, threadCount, highBitDepth, lossless)
+                 < std::tie(other.speed, other.threadCount, other.highBitDepth, other.lossless);
+        }
+    };
+
+    struct ModelEntry
+    {
+        double pixelsPerSecond;
+        int sampleCount;
+    };
+
+    using SpeedModel = std::map<ModelKey, ModelEntry>;
+
+    struct SpeedModelCache
+    {
+        SpeedModelCache() : mutex(), model(), loaded(false)
+        {
+        }
+
+        std::mutex mutex;
+        SpeedModel model;
+        bool loaded;
+    };
+
+    SpeedModelCache& GetModelCache()
+    {
+        static SpeedModelCache cache;
+
+        return cache;
+    }
+
+    bool TryGetDataFilePath(const char* fileName, std::filesystem::path& path)
+    {
+        std::filesystem::path directory;
+
+        if (GetPluginDataDirectory(directory) != noErr)
+        {
+            return false;
+        }
+
+        path = directory / fileName;
+        return true;
+    }
+
+    double GetPriorPixelsPerSecond(const ModelKey& key)
+    {
+        // The approximate single-threaded libaom throughput in megapixels per second
+        // for an 8-bit 4:2:0 still image, indexed by the speed.
+        static const double megapixelsPerSecond[aomSpeedMax + 1] =
+        {
+            0.02, 0.04, 0.08, 0.15, 0.3, 0.5, 0.9, 1.3, 1.8, 2.5
+        };
+
+        double value = megapixelsPerSecond[key.speed] * 1000000.0;
+
+        // The multi-threading in libaom does not scale linearly.
+        value *= std::pow(static_cast<double>(key.threadCount), 0.7);
+
+        if (key.highBitDepth)
+        {
+            value *= 0.7;
+        }
+
+        if (key.lossless)
+        {
+            value *= 0.5;
+        }
+
+        return value;
+    }
+
+    SpeedModel LoadModel()
+    {
+        SpeedModel model;
+        std::filesystem::path path;
+
+        if (!TryGetDataFilePath(modelFileName, path))
+        {
+            return model;
+        }
+
+        std::ifstream stream(path);
+        int version = 0;
+
+        if (!(stream >> version) || version != modelFileVersion)
+        {
+            return model;
+        }
+
+        ModelKey key;
+        int highBitDepth;
+        int lossless;
+        ModelEntry entry;
+
+        while (stream >> key.speed >> key.threadCount >> highBitDepth >> lossless >> entry.pixelsPerSecond >> entry.sampleCount)
+        {
+            if (key.speed < aomSpeedMin || key.speed > aomSpeedMax ||
+                key.threadCount < 1 ||
+                !std::isfinite(entry.pixelsPerSecond) || entry.pixelsPerSecond <= 0.0 ||
+                entry.sampleCount < 1)
+            {
+                // Ignore invalid entries.
+                continue;
+            }
+
+            key.highBitDepth = highBitDepth != 0;
+            key.lossless = lossless != 0;
+
+            model[key] = entry;
+        }
+
+        return model;
+    }
+
+    // The model file is only read by the first save, RecordEncodeTime keeps the cached model up to date.
+    // The caller must hold the cache mutex.
+    SpeedModel& GetCachedModel(SpeedModelCache& cache)
+    {
+        if (!cache.loaded)
+        {
+            cache.model = LoadModel();
+            cache.loaded = true;
+        }
+
+        return cache.model;
+    }
+
+    SpeedModel GetModel()
+    {
+        SpeedModelCache& cache = GetModelCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+
+        return GetCachedModel(cache);
+    }
+
+    void SaveModel(const SpeedModel& model)
+    {
+        std::filesystem::path path;
+
+        if (!TryGetDataFilePath(modelFileName, path))
+        {
+            return;
+        }
+
+        // The model is written to a temporary file that replaces the existing file,
+        // this prevents a partially written file if the write fails.
+        std::filesystem::path tempPath = path;
+        tempPath += ".tmp";
+
+        {
+            std::ofstream stream(tempPath, std::ios::trunc);
+
+            stream << modelFileVersion << '\n';
+
+            for (const auto& item : model)
+            {
+                const ModelKey& key = item.first;
+                const ModelEntry& entry = item.second;
+
+                stream << key.speed << ' '
+                       << key.threadCount << ' '
+                       << (key.highBitDepth ? 1 : 0) << ' '
+                       << (key.lossless ? 1 : 0) << ' '
+                       << entry.pixelsPerSecond << ' '
+                       << entry.sampleCount << '\n';
+            }
+
+            stream.close();
+
+            if (stream.fail())
+            {
+                return;
+            }
+        }
+
+        std::error_code errorCode;
+        std::filesystem::rename(tempPath, path, errorCode);
+    }
+
+    // Speeds that have not been measured use the prior scaled by the average
+    // ratio between the measured speeds and their priors.
+    double GetPriorCorrectionFactor(const SpeedModel& model)
+    {
+        if (model.empty())
+        {
+            return 1.0;
+        }
+
+        double logRatioSum = 0.0;
+
+        for (const auto& item : model)
+        {
+            logRatioSum += std::log(item.second.pixelsPerSecond / GetPriorPixelsPerSecond(item.first));
+        }
+
+        return std::exp(logRatioSum / static_cast<double>(model.size()));
+    }
+
+    double PredictPixelsPerSecond(const SpeedModel& model, const ModelKey& key, double priorCorrectionFactor)
+    {
+        const auto item = model.find(key);
+
+        if (item != model.end())
+        {
+            return item->second.pixelsPerSecond;
+        }
+
+        return GetPriorPixelsPerSecond(key) * priorCorrectionFactor;
+    }
+
+    double GetEffectivePixelCount(const EncodeWorkload& workload)
+    {
+        double pixelCount = static_cast<double>(workload.width) * static_cast<double>(workload.height);
+
+        if (workload.hasAlpha)
+        {
+            // The alpha channel is encoded as a separate monochrome image.
+            pixelCount *= 1.5;
+        }
+
+        return pixelCount;
+    }
+
+    ModelKey GetModelKey(const EncodeWorkload& workload, int speed, int threadCount)
+    {
+        return { speed, threadCount, workload.highBitDepth, workload.lossless };
+    }
+
+    // The thread counts are powers of two that match the tile counts, followed by the number of available threads.
+    std::vector<int> GetCandidateThreadCounts(unsigned int maxThreadCount)
+    {
+        const int availableThreadCount = static_cast<int>(std::clamp(std::thread::hardware_concurrency(), 1U, std::max(maxThreadCount, 1U)));
+
+        std::vector<int> threadCounts;
+
+        for (int threadCount = 1; threadCount < availableThreadCount; threadCount *= 2)
+        {
+            threadCounts.push_back(threadCount);
+        }
+
+        threadCounts.push_back(availableThreadCount);
+
+        return threadCounts;
+    }
+
+    void ChooseTileLayout(const EncodeWorkload& workload, int threadCount, int& tileColumnsLog2, int& tileRowsLog2)
+    {
+        tileColumnsLog2 = 0;
+        tileRowsLog2 = 0;
+
+        // Use enough tiles to keep the encoder threads busy, splitting columns before rows.
+        while ((1 << (tileColumnsLog2 + tileRowsLog2)) < threadCount)
+        {
+            const bool canSplitColumns = tileColumnsLog2 < maximumTileLog2
+                && (workload.width >> (tileColumnsLog2 + 1)) >= minimumTileSize;
+            const bool canSplitRows = tileRowsLog2 < maximumTileLog2
+                && (workload.height >> (tileRowsLog2 + 1)) >= minimumTileSize;
+
+            if (canSplitColumns && (tileColumnsLog2 <= tileRowsLog2 || !canSplitRows))
+            {
+                tileColumnsLog2++;
+            }
+            else if (canSplitRows)
+            {
+                tileRowsLog2++;
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    void AppendToEncodeTimeLog(
+        const EncodeWorkload& workload,
+        const EncodeSettingsPrediction& prediction,
+        int timeBudgetMilliseconds,
+        double elapsedSeconds)
+    {
+        std::filesystem::path path;
+
+        if (!TryGetDataFilePath(logFileName, path))
+        {
+            return;
+        }
+
+        std::error_code errorCode;
+        const bool writeHeader = !std::filesystem::exists(path, errorCode);
+
+        std::ofstream stream(path, std::ios::app);
+
+        if (writeHeader)
+        {
+            stream << "width,height,high bit depth,alpha,lossless,speed,threads,tile columns log2,tile rows log2,"
+                      "budget ms,predicted ms,actual ms\n";
+        }
+
+        stream << workload.width << ','
+               << workload.height << ','
+               << (workload.highBitDepth ? 1 : 0) << ','
+               << (workload.hasAlpha ? 1 : 0) << ','
+               << (workload.lossless ? 1 : 0) << ','
+               << prediction.speed << ','
+               << prediction.threadCount << ','
+               << prediction.tileColumnsLog2 << ','
+               << prediction.tileRowsLog2 << ','
+               << timeBudgetMilliseconds << ','
+               << std::lround(prediction.predictedSeconds * 1000.0) << ','
+               << std::lround(elapsedSeconds * 1000.0) << '\n';
+    }
+}
+
+EncodeSettingsPrediction PredictEncodeSettings(
+    const EncodeWorkload& workload,
+    int timeBudgetMilliseconds,
+    unsigned int maxThreadCount)
+{
+    EncodeSettingsPrediction prediction{};
+
+    const SpeedModel model = GetModel();
+    const double priorCorrectionFactor = GetPriorCorrectionFactor(model);
+    const double pixelCount = GetEffectivePixelCount(workload);
+    const double budgetSeconds = static_cast<double>(timeBudgetMilliseconds) / 1000.0;
+    const std::vector<int> threadCounts = GetCandidateThreadCounts(maxThreadCount);
+    bool fitsBudget = false;
+
+    // The slowest speed has the largest effect on the compression, so it is chosen first.
+    // For that speed the smallest thread count that fits the budget is used, fewer threads
+    // use fewer tiles, which compress better, and leave the other processor cores for the host.
+    for (int speed = aomSpeedMin; speed <= aomSpeedMax && !fitsBudget; speed++)
+    {
+        for (const int threadCount : threadCounts)
+        {
+            const ModelKey key = GetModelKey(workload, speed, threadCount);
+
+            prediction.speed = speed;
+            prediction.threadCount = threadCount;
+            prediction.predictedSeconds = pixelCount / PredictPixelsPerSecond(model, key, priorCorrectionFactor);
+
+            if (prediction.predictedSeconds * predictionSafetyMargin <= budgetSeconds)
+            {
+                fitsBudget = true;
+                break;
+            }
+        }
+    }
+
+    ChooseTileLayout(workload, prediction.threadCount, prediction.tileColumnsLog2, prediction.tileRowsLog2);
+
+    DebugOut(
+        "Encode time budget %d ms: speed %d, %d threads, tiles %dx%d, predicted %.0f ms.",
+        timeBudgetMilliseconds,
+        prediction.speed,
+        prediction.threadCount,
+        1 << prediction.tileColumnsLog2,
+        1 << prediction.tileRowsLog2,
+        prediction.predictedSeconds * 1000.0);
+
+    return prediction;
+}
+
+double PredictEncodeSeconds(const EncodeWorkload& workload, int speed, int threadCount)
+{
+    const SpeedModel model = GetModel();
+    const ModelKey key = GetModelKey(
+        workload,
+        std::clamp(speed, aomSpeedMin, aomSpeedMax),
+        std::max(threadCount, 1));
+
+    return GetEffectivePixelCount(workload) / PredictPixelsPerSecond(model, key, GetPriorCorrectionFactor(model));
+}
+
+void RecordEncodeTime(
+    const EncodeWorkload& workload,
+    const EncodeSettingsPrediction& prediction,
+    int timeBudgetMilliseconds,
+    double elapsedSeconds) noexcept
+{
+    DebugOut(
+        "Encode time: predicted %.0f ms, actual %.0f ms, budget %d ms.",
+        prediction.predictedSeconds * 1000.0,
+        elapsedSeconds * 1000.0,
+        timeBudgetMilliseconds);
+
+    if (!(elapsedSeconds > 0.0))
+    {
+        return;
+    }
+
+    try
+    {
+        SpeedModelCache& cache = GetModelCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+
+        SpeedModel& model = GetCachedModel(cache);
+
+        const ModelKey key = GetModelKey(workload, prediction.speed, prediction.threadCount);
+        const double measuredPixelsPerSecond = GetEffectivePixelCount(workload) / elapsedSeconds;
+
+        auto item = model.find(key);
+
+        if (item == model.end())
+        {
+            model.emplace(key, ModelEntry{ measuredPixelsPerSecond, 1 });
+        }
+        else
+        {
+            ModelEntry& entry = item->second;
+
+            // The first few samples are averaged, after that an exponential moving
+            // average lets the model follow changes in the hardware or encoder version.
+            const double weight = entry.sampleCount < 4 ? 1.0 / (entry.sampleCount + 1) : 0.25;
+
+            entry.pixelsPerSecond += weight * (measuredPixelsPerSecond - entry.pixelsPerSecond);
+            entry.sampleCount = std::min(entry.sampleCount + 1, 1000000);
+        }
+
+        SaveModel(model);
+        AppendToEncodeTimeLog(workload, prediction, timeBudgetMilliseconds, elapsedSeconds);
+    }
+    catch (...)
+    {
+        // The calibration data is only used to choose the encoder settings, failing to
+        // update it should not cause the save to fail.
+    }
+}
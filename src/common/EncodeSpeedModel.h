@@ -0,0 +1,61 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODESPEEDMODEL_H
+#define ENCODESPEEDMODEL_H
+
+struct EncodeWorkload
+{
+    int width;
+    int height;
+    bool highBitDepth;
+    bool hasAlpha;
+    bool lossless;
+};
+
+struct EncodeSettingsPrediction
+{
+    int speed;
+    int threadCount;
+    int tileColumnsLog2;
+    int tileRowsLog2;
+    double predictedSeconds;
+};
+
+// Chooses the slowest AOM speed that the calibration model predicts will finish within the time budget,
+// and the smallest thread count that fits the budget at that speed.
+// The fastest speed and the maximum thread count are used if none of the settings are predicted to fit.
+EncodeSettingsPrediction PredictEncodeSettings(
+    const EncodeWorkload& workload,
+    int timeBudgetMilliseconds,
+    unsigned int maxThreadCount);
+
+// Predicts the AOM encode time in seconds using the calibration model.
+double PredictEncodeSeconds(const EncodeWorkload& workload, int speed, int threadCount);
+
+// Updates the calibration model with the measured encode time and appends the
+// prediction and the actual time to the encode time log.
+void RecordEncodeTime(
+    const EncodeWorkload& workload,
+    const EncodeSettingsPrediction& prediction,
+    int timeBudgetMilliseconds,
+    double elapsedSeconds) noexcept;
+
+#endif // !ENCODESPEEDMODEL_H
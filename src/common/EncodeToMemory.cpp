@@ -0,0 +1,155 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EncodeToMemory.h"
+#include "EncoderSettings.h"
+#include "LibHeifException.h"
+#include "ScopedHeif.h"
+#include "WriteMetadata.h"
+
+namespace
+{
+    heif_error heif_memory_writer_write(
+        heif_context* /*context*/,
+        const void* data,
+        size_t size,
+        void* userdata)
+    {
+        static heif_error Success = { heif_error_Ok, heif_suberror_Unspecified, "Success" };
+        static heif_error OutOfMemory = { heif_error_Memory_allocation_error, heif_suberror_Unspecified, "Out of memory" };
+
+        try
+        {
+            std::vector<uint8_t>* output = static_cast<std::vector<uint8_t>*>(userdata);
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+            output->insert(output->end(), bytes, bytes + size);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return OutOfMemory;
+        }
+
+        return Success;
+    }
+
+    ScopedHeifContext CreateContext()
+    {
+        ScopedHeifContext context(heif_context_alloc());
+
+        if (context == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        return context;
+    }
+
+    ScopedHeifImageHandle EncodeImage(
+        heif_context* context,
+        heif_image* image,
+        const SaveUIOptions& saveOptions,
+        bool hasAlpha,
+        unsigned int maxThreadCount)
+    {
+        ScopedHeifEncoder encoder = CreateEncoder(context, saveOptions, hasAlpha, maxThreadCount);
+        ScopedHeifEncodingOptions encodingOptions = CreateEncodingOptions();
+
+        heif_image_handle* encodedImageHandle;
+
+        LibHeifException::ThrowIfError(heif_context_encode_image(
+            context,
+            image,
+            encoder.get(),
+            encodingOptions.get(),
+            &encodedImageHandle));
+
+        return ScopedHeifImageHandle(encodedImageHandle);
+    }
+
+    struct FileEncodeJob
+    {
+        ScopedHeifContext context;
+        ScopedHeifImageHandle encodedImageHandle;
+    };
+}
+
+std::vector<uint8_t> WriteContextToMemory(heif_context* context)
+{
+    static heif_writer writer = { 1, heif_memory_writer_write };
+
+    std::vector<uint8_t> output;
+
+    LibHeifException::ThrowIfError(heif_context_write(context, &writer, &output));
+
+    return output;
+}
+
+std::vector<uint8_t> EncodeImageToMemory(
+    heif_image* image,
+    const SaveUIOptions& saveOptions,
+    bool hasAlpha,
+    unsigned int maxThreadCount)
+{
+    ScopedHeifContext context = CreateContext();
+
+    EncodeImage(context.get(), image, saveOptions, hasAlpha, maxThreadCount);
+
+    return WriteContextToMemory(context.get());
+}
+
+std::vector<uint8_t> EncodeFileToMemory(
+    const FormatRecordPtr formatRecord,
+    const std::shared_ptr<heif_image>& image,
+    const SaveUIOptions& saveOptions,
+    bool hasAlpha,
+    const EncodeProgressRange& progress)
+{
+    std::shared_ptr<FileEncodeJob> job = std::make_shared<FileEncodeJob>();
+    job->context = CreateContext();
+
+    RunEncodeOnWorkerThread(
+        formatRecord,
+        [job, image, saveOptions, hasAlpha]()
+        {
+            job->encodedImageHandle = EncodeImage(
+                job->context.get(),
+                image.get(),
+                saveOptions,
+                hasAlpha,
+                encoderMaxThreadCount);
+        },
+        progress);
+
+    // The metadata is read from the host, so it is added after the worker has finished.
+    if (saveOptions.keepExif)
+    {
+        AddExifMetadata(formatRecord, job->context.get(), job->encodedImageHandle.get());
+    }
+
+    if (saveOptions.keepXmp)
+    {
+        AddXmpMetadata(formatRecord, job->context.get(), job->encodedImageHandle.get());
+    }
+
+    job->encodedImageHandle.reset();
+
+    return WriteContextToMemory(job->context.get());
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODETOMEMORY_H
+#define ENCODETOMEMORY_H
+
+#include "AvifFormat.h"
+#include "WorkerEncode.h"
+#include <memory>
+#include <vector>
+
+// Encodes the image as an AVIF file in memory.
+// This does not call any of the host callbacks, so it can be used from a worker thread.
+std::vector<uint8_t> EncodeImageToMemory(
+    heif_image* image,
+    const SaveUIOptions& saveOptions,
+    bool hasAlpha,
+    unsigned int maxThreadCount);
+
+// Encodes the image and the document's EXIF and XMP metadata as an AVIF file in memory.
+// The image is encoded on a worker thread that shares ownership of it, so that a canceled encode
+// can finish in the background. This must be called from the host thread.
+std::vector<uint8_t> EncodeFileToMemory(
+    const FormatRecordPtr formatRecord,
+    const std::shared_ptr<heif_image>& image,
+    const SaveUIOptions& saveOptions,
+    bool hasAlpha,
+    const EncodeProgressRange& progress);
+
+// Writes the encoded images in the context as an AVIF file in memory.
+std::vector<uint8_t> WriteContextToMemory(heif_context* context);
+
+#endif // !ENCODETOMEMORY_H
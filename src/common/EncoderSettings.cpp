@@ -0,0 +1,406 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EncoderSettings.h"
+#include "LibHeifException.h"
+#include "OSErrException.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace
+{
+    const char* GetEncoderName(EncoderBackend backend)
+    {
+        switch (backend)
+        {
+        case EncoderBackend::Svt:
+            return "svt";
+        case EncoderBackend::Rav1e:
+            return "rav1e";
+        case EncoderBackend::Aom:
+        default:
+            return "aom";
+        }
+    }
+
+    const heif_encoder_descriptor* GetEncoderDescriptor(heif_context* context, EncoderBackend backend)
+    {
+        const heif_encoder_descriptor* descriptor;
+
+        if (heif_context_get_encoder_descriptors(context, heif_compression_AV1, GetEncoderName(backend), &descriptor, 1) != 1)
+        {
+            return nullptr;
+        }
+
+        return descriptor;
+    }
+
+    const heif_encoder_parameter* FindParameter(heif_encoder* encoder, const char* name)
+    {
+        for (const heif_encoder_parameter* const* parameters = heif_encoder_list_parameters(encoder);
+             *parameters != nullptr;
+             parameters++)
+        {
+            if (strcmp(heif_encoder_parameter_get_name(*parameters), name) == 0)
+            {
+                return *parameters;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // The encoder back-ends do not share the same parameter set, parameters that are
+    // not supported by the current back-end are skipped.
+
+    bool SetBooleanParameter(heif_encoder* encoder, const char* name, bool value)
+    {
+        if (FindParameter(encoder, name) == nullptr)
+        {
+            return false;
+        }
+
+        return heif_encoder_set_parameter_boolean(encoder, name, value).code == heif_error_Ok;
+    }
+
+    bool SetIntegerParameter(heif_encoder* encoder, const char* name, int value)
+    {
+        const heif_encoder_parameter* parameter = FindParameter(encoder, name);
+
+        if (parameter == nullptr)
+        {
+            return false;
+        }
+
+        int haveMinimumMaximum = 0;
+        int minimum = 0;
+        int maximum = 0;
+
+        if (heif_encoder_parameter_get_valid_integer_range(parameter, &haveMinimumMaximum, &minimum, &maximum).code == heif_error_Ok
+            && haveMinimumMaximum)
+        {
+            value = std::clamp(value, minimum, maximum);
+        }
+
+        return heif_encoder_set_parameter_integer(encoder, name, value).code == heif_error_Ok;
+    }
+
+    bool SetStringParameter(heif_encoder* encoder, const char* name, const char* value)
+    {
+        const heif_encoder_parameter* parameter = FindParameter(encoder, name);
+
+        if (parameter == nullptr)
+        {
+            return false;
+        }
+
+        const char* const* validValues = nullptr;
+
+        if (heif_encoder_parameter_get_valid_string_values(parameter, &validValues).code == heif_error_Ok
+            && validValues != nullptr)
+        {
+            bool isValidValue = false;
+
+            for (const char* const* item = validValues; *item != nullptr; item++)
+            {
+                if (strcmp(*item, value) == 0)
+                {
+                    isValidValue = true;
+                    break;
+                }
+            }
+
+            if (!isValidValue)
+            {
+                return false;
+            }
+        }
+
+        return heif_encoder_set_parameter_string(encoder, name, value).code == heif_error_Ok;
+    }
+
+    // Sets an AOM option that may not be in the libheif parameter list.
+    // libheif passes unknown parameters to aom_codec_set_option.
+    void SetAomCodecOption(heif_encoder* encoder, const char* name, int value)
+    {
+        const heif_encoder_parameter* parameter = FindParameter(encoder, name);
+
+        if (parameter != nullptr)
+        {
+            switch (heif_encoder_parameter_get_type(parameter))
+            {
+            case heif_encoder_parameter_type_boolean:
+                SetBooleanParameter(encoder, name, value != 0);
+                return;
+            case heif_encoder_parameter_type_integer:
+                SetIntegerParameter(encoder, name, value);
+                return;
+            default:
+                break;
+            }
+        }
+
+        heif_encoder_set_parameter_string(encoder, name, std::to_string(value).c_str());
+    }
+
+    void SetAomCodecOption(heif_encoder* encoder, const char* name, const char* value)
+    {
+        if (!SetStringParameter(encoder, name, value))
+        {
+            heif_encoder_set_parameter_string(encoder, name, value);
+        }
+    }
+
+    void SetEncoderTuning(heif_encoder* encoder, EncoderBackend backend, const SaveUIOptions& saveOptions)
+    {
+        switch (saveOptions.tune)
+        {
+        case EncoderTune::Psnr:
+            SetStringParameter(encoder, "tune", "psnr");
+            break;
+        case EncoderTune::Ssim:
+            SetStringParameter(encoder, "tune", "ssim");
+            break;
+        case EncoderTune::Default:
+            break;
+        default:
+            throw OSErrException(formatBadParameters);
+        }
+
+        if (backend == EncoderBackend::Aom)
+        {
+            if (saveOptions.aqMode != aqModeUseDefault)
+            {
+                SetAomCodecOption(encoder, "aq-mode", saveOptions.aqMode);
+            }
+
+            if (saveOptions.enableChromaDeltaQ)
+            {
+                SetAomCodecOption(encoder, "enable-chroma-deltaq", 1);
+            }
+
+            if (!saveOptions.enableCdef)
+            {
+                SetAomCodecOption(encoder, "enable-cdef", 0);
+            }
+
+            if (!saveOptions.enableRestoration)
+            {
+                SetAomCodecOption(encoder, "enable-restoration", 0);
+            }
+
+            if (saveOptions.screenContentTools == ScreenContentTools::Enabled)
+            {
+                // Enables the palette mode and intra block copy coding tools.
+                SetAomCodecOption(encoder, "tune-content", "screen");
+                SetAomCodecOption(encoder, "enable-palette", 1);
+            }
+        }
+    }
+
+    // Returns false if the encoder does not support the chroma sub-sampling, e.g. SVT-AV1 only supports 4:2:0.
+    bool TrySetChromaSubsampling(heif_encoder* encoder, ChromaSubsampling chromaSubsampling)
+    {
+        const char* value;
+
+        switch (chromaSubsampling)
+        {
+        case ChromaSubsampling::Yuv420:
+            value = "420";
+            break;
+        case ChromaSubsampling::Yuv422:
+            value = "422";
+            break;
+        case ChromaSubsampling::Yuv444:
+            value = "444";
+            break;
+        default:
+            throw OSErrException(formatBadParameters);
+        }
+
+        return SetStringParameter(encoder, "chroma", value);
+    }
+
+    ScopedHeifEncoder GetBackendEncoder(heif_context* context, EncoderBackend& backend)
+    {
+        const heif_encoder_descriptor* descriptor = GetEncoderDescriptor(context, backend);
+
+        if (descriptor == nullptr && backend != EncoderBackend::Aom)
+        {
+            DebugOut("The %s encoder is not available, using aom.", GetEncoderName(backend));
+
+            backend = EncoderBackend::Aom;
+            descriptor = GetEncoderDescriptor(context, backend);
+        }
+
+        if (descriptor == nullptr)
+        {
+            throw std::runtime_error("Unable to get the AOM encoder descriptor.");
+        }
+
+        heif_encoder* tempEncoder;
+
+        LibHeifException::ThrowIfError(heif_context_get_encoder(context, descriptor, &tempEncoder));
+
+        return ScopedHeifEncoder(tempEncoder);
+    }
+
+    int GetEncoderSpeed(EncoderBackend backend, CompressionSpeed compressionSpeed)
+    {
+        // Each back-end uses a different speed range, higher values are faster.
+        // AOM: 0 to 9, SVT-AV1: 0 to 13, rav1e: 0 to 10.
+        switch (backend)
+        {
+        case EncoderBackend::Svt:
+            switch (compressionSpeed)
+            {
+            case CompressionSpeed::Fastest:
+                return 12;
+            case CompressionSpeed::Slowest:
+                return 4;
+            case CompressionSpeed::Default:
+                return 8;
+            default:
+                throw OSErrException(formatBadParameters);
+            }
+        case EncoderBackend::Rav1e:
+            switch (compressionSpeed)
+            {
+            case CompressionSpeed::Fastest:
+                return 10;
+            case CompressionSpeed::Slowest:
+                return 2;
+            case CompressionSpeed::Default:
+                return 6;
+            default:
+                throw OSErrException(formatBadParameters);
+            }
+        case EncoderBackend::Aom:
+        default:
+            switch (compressionSpeed)
+            {
+            case CompressionSpeed::Fastest:
+                return 6;
+            case CompressionSpeed::Slowest:
+                return 1;
+            case CompressionSpeed::Default:
+                return 4;
+            default:
+                throw OSErrException(formatBadParameters);
+            }
+        }
+    }
+}
+
+ScopedHeifEncoder CreateEncoder(
+    heif_context* context,
+    const SaveUIOptions& saveOptions,
+    bool hasAlpha,
+    unsigned int maxThreadCount)
+{
+    EncoderBackend backend = saveOptions.encoderBackend;
+
+    if (saveOptions.lossless && backend != EncoderBackend::Aom)
+    {
+        // Lossless compression is only supported by AOM.
+        backend = EncoderBackend::Aom;
+    }
+
+    ScopedHeifEncoder encoder = GetBackendEncoder(context, backend);
+
+    if (!saveOptions.lossless
+        && !TrySetChromaSubsampling(encoder.get(), saveOptions.chromaSubsampling)
+        && backend != EncoderBackend::Aom)
+    {
+        // The requested chroma sub-sampling takes precedence over the back-end, as it does for lossless compression.
+        DebugOut("The %s encoder does not support the chroma sub-sampling, using aom.", GetEncoderName(backend));
+
+        backend = EncoderBackend::Aom;
+        encoder = GetBackendEncoder(context, backend);
+
+        if (!TrySetChromaSubsampling(encoder.get(), saveOptions.chromaSubsampling))
+        {
+            throw std::runtime_error("Unable to set the chroma sub-sampling.");
+        }
+    }
+
+    if (saveOptions.lossless)
+    {
+        heif_encoder_set_lossy_quality(encoder.get(), 100);
+        heif_encoder_set_lossless(encoder.get(), true);
+        SetStringParameter(encoder.get(), "chroma", "444");
+    }
+    else
+    {
+        heif_encoder_set_lossy_quality(encoder.get(), saveOptions.quality);
+        heif_encoder_set_lossless(encoder.get(), false);
+
+        if (hasAlpha && saveOptions.losslessAlpha)
+        {
+            SetIntegerParameter(encoder.get(), "alpha-quality", 100);
+            SetBooleanParameter(encoder.get(), "lossless-alpha", true);
+        }
+    }
+
+    if (saveOptions.encoderSpeed != encoderSpeedUsePreset)
+    {
+        SetIntegerParameter(encoder.get(), "speed", saveOptions.encoderSpeed);
+    }
+    else
+    {
+        SetIntegerParameter(encoder.get(), "speed", GetEncoderSpeed(backend, saveOptions.compressionSpeed));
+
+        if (saveOptions.compressionSpeed == CompressionSpeed::Fastest)
+        {
+            SetBooleanParameter(encoder.get(), "realtime", true);
+        }
+    }
+
+    SetEncoderTuning(encoder.get(), backend, saveOptions);
+
+    const unsigned int threadCount = std::clamp(std::thread::hardware_concurrency(), 1U, std::max(maxThreadCount, 1U));
+    SetIntegerParameter(encoder.get(), "threads", static_cast<int>(threadCount));
+
+    return encoder;
+}
+
+ScopedHeifEncodingOptions CreateEncodingOptions()
+{
+    ScopedHeifEncodingOptions encodingOptions(heif_encoding_options_alloc());
+
+    if (encodingOptions == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    encodingOptions->save_two_colr_boxes_when_ICC_and_nclx_available = true;
+    encodingOptions->macOS_compatibility_workaround_no_nclx_profile = false;
+
+    return encodingOptions;
+}
+
+void SetEncoderTiling(heif_encoder* encoder, int tileColumnsLog2, int tileRowsLog2)
+{
+    SetAomCodecOption(encoder, "tile-columns", tileColumnsLog2);
+    SetAomCodecOption(encoder, "tile-rows", tileRowsLog2);
+}
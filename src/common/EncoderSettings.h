@@ -0,0 +1,43 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODERSETTINGS_H
+#define ENCODERSETTINGS_H
+
+#include "AvifFormat.h"
+#include "ScopedHeif.h"
+
+constexpr unsigned int encoderMaxThreadCount = 16;
+
+// Creates an AV1 encoder using the back-end and compression settings from the save options.
+// The AOM encoder will be used if the requested back-end is not available, or if it does not
+// support lossless compression or the requested chroma sub-sampling.
+ScopedHeifEncoder CreateEncoder(
+    heif_context* context,
+    const SaveUIOptions& saveOptions,
+    bool hasAlpha,
+    unsigned int maxThreadCount);
+
+ScopedHeifEncodingOptions CreateEncodingOptions();
+
+// Sets the AOM tile layout, the values are the base 2 logarithm of the tile column and row counts.
+void SetEncoderTiling(heif_encoder* encoder, int tileColumnsLog2, int tileRowsLog2);
+
+#endif // !ENCODERSETTINGS_H
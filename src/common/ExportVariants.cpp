@@ -0,0 +1,196 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ExportVariants.h"
+#include "EncoderSettings.h"
+#include "FileIO.h"
+#include "ImageScaling.h"
+#include "LibHeifException.h"
+#include "OSErrException.h"
+#include "WriteHeifImage.h"
+#include "WorkerEncode.h"
+#include "WriteMetadata.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace
+{
+    // The variant files use the name of the saved file with the variant settings appended,
+    // e.g. image-1920-q70.avif.
+    std::filesystem::path GetVariantPath(const std::filesystem::path& filePath, const ExportVariant& variant)
+    {
+        std::filesystem::path fileName = filePath.stem();
+        fileName += "-" + std::to_string(variant.maxDimension) + "-q" + std::to_string(variant.quality);
+        fileName += filePath.extension();
+
+        return filePath.parent_path() / fileName;
+    }
+
+    EncodedExportVariant EncodeVariant(
+        heif_image* image,
+        const SaveUIOptions& saveOptions,
+        bool hasAlpha,
+        unsigned int maxThreadCount)
+    {
+        EncodedExportVariant encoded;
+
+        encoded.context.reset(heif_context_alloc());
+
+        if (encoded.context == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        ScopedHeifEncoder encoder = CreateEncoder(encoded.context.get(), saveOptions, hasAlpha, maxThreadCount);
+        ScopedHeifEncodingOptions encodingOptions = CreateEncodingOptions();
+
+        heif_image_handle* encodedImageHandle;
+
+        LibHeifException::ThrowIfError(heif_context_encode_image(
+            encoded.context.get(),
+            image,
+            encoder.get(),
+            encodingOptions.get(),
+            &encodedImageHandle));
+
+        encoded.imageHandle.reset(encodedImageHandle);
+
+        return encoded;
+    }
+
+    heif_error heif_file_writer_write(
+        heif_context* /*context*/,
+        const void* data,
+        size_t size,
+        void* userdata)
+    {
+        static heif_error Success = { heif_error_Ok, heif_suberror_Unspecified, "Success" };
+        static heif_error WriteError = { heif_error_Encoding_error, heif_suberror_Cannot_write_output_data, "Write error" };
+
+        std::ofstream* stream = static_cast<std::ofstream*>(userdata);
+
+        stream->write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+
+        return stream->good() ? Success : WriteError;
+    }
+
+    void WriteVariantFile(const std::filesystem::path& path, heif_context* context)
+    {
+        static heif_writer writer = { 1, heif_file_writer_write };
+
+        std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+
+        if (!stream)
+        {
+            throw OSErrException(writErr);
+        }
+
+        LibHeifException::ThrowIfError(heif_context_write(context, &writer, &stream));
+    }
+}
+
+ExportVariantEncoder::ExportVariantEncoder(
+    const FormatRecordPtr formatRecord,
+    heif_image* image,
+    const SaveUIOptions& saveOptions)
+    : variants()
+{
+    if (saveOptions.exportVariantCount <= 0)
+    {
+        return;
+    }
+
+    std::filesystem::path filePath;
+    OSErrException::ThrowIfError(GetFilePath(formatRecord->dataFork, filePath));
+
+    const int width = heif_image_get_primary_width(image);
+    const int height = heif_image_get_primary_height(image);
+    const bool hasAlpha = HeifImageHasAlphaChannel(image);
+
+    // The saved image is encoded at the same time, each encoder gets a share of the processor threads.
+    const unsigned int threadCount = std::max(
+        std::thread::hardware_concurrency() / static_cast<unsigned int>(saveOptions.exportVariantCount + 1),
+        1U);
+
+    variants.reserve(static_cast<size_t>(saveOptions.exportVariantCount));
+
+    for (int i = 0; i < saveOptions.exportVariantCount; i++)
+    {
+        const ExportVariant& variant = saveOptions.exportVariants[i];
+
+        int variantWidth;
+        int variantHeight;
+
+        GetScaledImageSize(width, height, variant.maxDimension, variantWidth, variantHeight);
+
+        ScopedHeifImage variantImage = ScaleHeifImage(image, variantWidth, variantHeight);
+
+        AddColorProfileToImage(formatRecord, variantImage.get(), saveOptions);
+
+        // The variant quality replaces the lossless, target file size and target SSIM settings.
+        SaveUIOptions variantOptions = saveOptions;
+        variantOptions.quality = variant.quality;
+        variantOptions.lossless = false;
+        variantOptions.targetFileSize = 0;
+        variantOptions.targetSsim = 0.0f;
+
+        variants.push_back(
+        {
+            GetVariantPath(filePath, variant),
+            StartEncodeOnWorkerThread<EncodedExportVariant>(
+                [variantImage = std::shared_ptr<heif_image>(std::move(variantImage)), variantOptions, hasAlpha, threadCount]()
+                {
+                    return EncodeVariant(variantImage.get(), variantOptions, hasAlpha, threadCount);
+                })
+        });
+    }
+}
+
+void ExportVariantEncoder::WriteFiles(const FormatRecordPtr formatRecord, const SaveUIOptions& saveOptions)
+{
+    for (PendingVariant& variant : variants)
+    {
+        // The encoders cannot be interrupted, the remaining variants are discarded when they finish.
+        WaitForWorkerEncode(formatRecord, variant.result, nullptr, std::chrono::steady_clock::now());
+
+        EncodedExportVariant encoded = variant.result.get();
+
+        // The metadata must be read from the host thread.
+        if (saveOptions.keepExif)
+        {
+            AddExifMetadata(formatRecord, encoded.context.get(), encoded.imageHandle.get());
+        }
+
+        if (saveOptions.keepXmp)
+        {
+            AddXmpMetadata(formatRecord, encoded.context.get(), encoded.imageHandle.get());
+        }
+
+        encoded.imageHandle.reset();
+
+        WriteVariantFile(variant.path, encoded.context.get());
+    }
+
+    variants.clear();
+}
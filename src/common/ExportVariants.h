@@ -0,0 +1,61 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPORTVARIANTS_H
+#define EXPORTVARIANTS_H
+
+#include "AvifFormat.h"
+#include "ScopedHeif.h"
+#include <filesystem>
+#include <future>
+#include <vector>
+
+struct EncodedExportVariant
+{
+    ScopedHeifContext context;
+    ScopedHeifImageHandle imageHandle;
+};
+
+// Encodes the export variants on worker threads while the host thread encodes the saved image.
+class ExportVariantEncoder
+{
+public:
+
+    // Creates the reduced size images and starts encoding them.
+    // The color profile is added to each variant, image must not contain the color profile metadata.
+    ExportVariantEncoder(const FormatRecordPtr formatRecord, heif_image* image, const SaveUIOptions& saveOptions);
+
+    // Waits for the variants to finish encoding and writes them to files next to the saved file.
+    // Existing files with the variant file names are replaced.
+    void WriteFiles(const FormatRecordPtr formatRecord, const SaveUIOptions& saveOptions);
+
+private:
+
+    // The variants are encoded on detached worker threads that own the scaled images.
+    struct PendingVariant
+    {
+        std::filesystem::path path;
+        std::future<EncodedExportVariant> result;
+    };
+
+    std::vector<PendingVariant> variants;
+};
+
+#endif // !EXPORTVARIANTS_H
@@ -26,6 +26,11 @@
 #error "Missing a native file I/O header for this platform."
 #endif
 
+OSErr GetFilePath(intptr_t refNum, std::filesystem::path& path)
+{
+    return GetFilePathNative(refNum, path);
+}
+
 OSErr GetFilePosition(intptr_t refNum, int64& position)
 {
     return GetFilePositionNative(refNum, position);
@@ -50,3 +55,8 @@ OSErr WriteData(intptr_t refNum, const void* buffer, size_t size)
 {
     return WriteDataNative(refNum, buffer, size);
 }
+
+OSErr GetPluginDataDirectory(std::filesystem::path& path)
+{
+    return GetPluginDataDirectoryNative(path);
+}
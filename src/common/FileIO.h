@@ -22,6 +22,10 @@
 #define FILEIO_H
 
 #include "Common.h"
+#include <filesystem>
+
+// Gets the full path of an open file.
+OSErr GetFilePath(intptr_t refNum, std::filesystem::path& path);
 
 OSErr GetFilePosition(intptr_t refNum, int64& position);
 
@@ -33,4 +37,7 @@ OSErr SetFilePosition(intptr_t refNum, int64 position);
 
 OSErr WriteData(intptr_t refNum, const void* buffer, size_t size);
 
+// Gets the directory used for the plug-in's local data files, the directory is created if it does not exist.
+OSErr GetPluginDataDirectory(std::filesystem::path& path);
+
 #endif // !FILEIO_H
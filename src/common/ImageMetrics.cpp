@@ -0,0 +1,386 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ImageMetrics.h"
+#include "Common.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if SIMD_SSE2
+#include <emmintrin.h>
+#elif SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+    // The SSIM is computed using non-overlapping 8x8 windows with uniform weights.
+    constexpr int ssimWindowSize = 8;
+    constexpr double ssimC1 = 0.01 * 0.01;
+    constexpr double ssimC2 = 0.03 * 0.03;
+
+    struct PlaneInfo
+    {
+        const uint8_t* scan0;
+        int stride;
+        int channelCount;
+        bool sixteenBit;
+        float scale;
+    };
+
+    PlaneInfo GetPlaneInfo(heif_image* image)
+    {
+        const heif_chroma chroma = heif_image_get_chroma_format(image);
+        const heif_channel channel = chroma == heif_chroma_monochrome ? heif_channel_Y : heif_channel_interleaved;
+
+        PlaneInfo info{};
+        info.scan0 = heif_image_get_plane_readonly(image, channel, &info.stride);
+
+        switch (chroma)
+        {
+        case heif_chroma_monochrome:
+            info.channelCount = 1;
+            break;
+        case heif_chroma_interleaved_RGB:
+        case heif_chroma_interleaved_RRGGBB_LE:
+            info.channelCount = 3;
+            break;
+        case heif_chroma_interleaved_RGBA:
+        case heif_chroma_interleaved_RRGGBBAA_LE:
+            info.channelCount = 4;
+            break;
+        default:
+            throw std::runtime_error("Unsupported image format for the quality metrics.");
+        }
+
+        const int bitDepth = heif_image_get_bits_per_pixel_range(image, channel);
+
+        info.sixteenBit = bitDepth > 8;
+        info.scale = 1.0f / static_cast<float>((1 << bitDepth) - 1);
+
+        return info;
+    }
+
+    template <typename T>
+    void ConvertRowToLuma(const T* src, int width, int channelCount, float scale, float* luma)
+    {
+        if (channelCount == 1)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                luma[x] = static_cast<float>(src[x]) * scale;
+            }
+        }
+        else
+        {
+            // Rec. 601 luma weights.
+            const float redScale = 0.299f * scale;
+            const float greenScale = 0.587f * scale;
+            const float blueScale = 0.114f * scale;
+
+            for (int x = 0; x < width; x++)
+            {
+                luma[x] = (static_cast<float>(src[0]) * redScale) +
+                          (static_cast<float>(src[1]) * greenScale) +
+                          (static_cast<float>(src[2]) * blueScale);
+
+                src += channelCount;
+            }
+        }
+    }
+
+    void ConvertRowToLuma(const PlaneInfo& plane, int y, int width, float* luma)
+    {
+        const uint8_t* row = plane.scan0 + (static_cast<int64_t>(y) * plane.stride);
+
+        if (plane.sixteenBit)
+        {
+            ConvertRowToLuma(reinterpret_cast<const uint16_t*>(row), width, plane.channelCount, plane.scale, luma);
+        }
+        else
+        {
+            ConvertRowToLuma(row, width, plane.channelCount, plane.scale, luma);
+        }
+    }
+
+    struct ColumnSums
+    {
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> xx;
+        std::vector<float> yy;
+        std::vector<float> xy;
+
+        explicit ColumnSums(size_t width) : x(width), y(width), xx(width), yy(width), xy(width)
+        {
+        }
+
+        void Clear()
+        {
+            std::fill(x.begin(), x.end(), 0.0f);
+            std::fill(y.begin(), y.end(), 0.0f);
+            std::fill(xx.begin(), xx.end(), 0.0f);
+            std::fill(yy.begin(), yy.end(), 0.0f);
+            std::fill(xy.begin(), xy.end(), 0.0f);
+        }
+    };
+
+    void AccumulateColumnSums(const float* reference, const float* distorted, int width, ColumnSums& sums)
+    {
+        float* sumX = sums.x.data();
+        float* sumY = sums.y.data();
+        float* sumXX = sums.xx.data();
+        float* sumYY = sums.yy.data();
+        float* sumXY = sums.xy.data();
+
+        int i = 0;
+
+#if SIMD_SSE2
+        for (; i + 4 <= width; i += 4)
+        {
+            const __m128 x = _mm_loadu_ps(reference + i);
+            const __m128 y = _mm_loadu_ps(distorted + i);
+
+            _mm_storeu_ps(sumX + i, _mm_add_ps(_mm_loadu_ps(sumX + i), x));
+            _mm_storeu_ps(sumY + i, _mm_add_ps(_mm_loadu_ps(sumY + i), y));
+            _mm_storeu_ps(sumXX + i, _mm_add_ps(_mm_loadu_ps(sumXX + i), _mm_mul_ps(x, x)));
+            _mm_storeu_ps(sumYY + i, _mm_add_ps(_mm_loadu_ps(sumYY + i), _mm_mul_ps(y, y)));
+            _mm_storeu_ps(sumXY + i, _mm_add_ps(_mm_loadu_ps(sumXY + i), _mm_mul_ps(x, y)));
+        }
+#elif SIMD_NEON
+        for (; i + 4 <= width; i += 4)
+        {
+            const float32x4_t x = vld1q_f32(reference + i);
+            const float32x4_t y = vld1q_f32(distorted + i);
+
+            vst1q_f32(sumX + i, vaddq_f32(vld1q_f32(sumX + i), x));
+            vst1q_f32(sumY + i, vaddq_f32(vld1q_f32(sumY + i), y));
+            vst1q_f32(sumXX + i, vmlaq_f32(vld1q_f32(sumXX + i), x, x));
+            vst1q_f32(sumYY + i, vmlaq_f32(vld1q_f32(sumYY + i), y, y));
+            vst1q_f32(sumXY + i, vmlaq_f32(vld1q_f32(sumXY + i), x, y));
+        }
+#endif
+
+        for (; i < width; i++)
+        {
+            const float x = reference[i];
+            const float y = distorted[i];
+
+            sumX[i] += x;
+            sumY[i] += y;
+            sumXX[i] += x * x;
+            sumYY[i] += y * y;
+            sumXY[i] += x * y;
+        }
+    }
+
+    struct BandResult
+    {
+        // The sum of (1 - SSIM) for each window in the band.
+        double ssimDeficit;
+        double squaredError;
+    };
+
+    BandResult ComputeBand(
+        const PlaneInfo& reference,
+        const PlaneInfo& distorted,
+        int band,
+        int windowWidth,
+        int windowHeight,
+        int windowsPerRow,
+        std::vector<float>& referenceLuma,
+        std::vector<float>& distortedLuma,
+        ColumnSums& sums)
+    {
+        const int width = windowsPerRow * windowWidth;
+        const int top = band * windowHeight;
+
+        sums.Clear();
+
+        for (int y = top; y < top + windowHeight; y++)
+        {
+            ConvertRowToLuma(reference, y, width, referenceLuma.data());
+            ConvertRowToLuma(distorted, y, width, distortedLuma.data());
+
+            AccumulateColumnSums(referenceLuma.data(), distortedLuma.data(), width, sums);
+        }
+
+        const double windowPixelCount = static_cast<double>(windowWidth) * static_cast<double>(windowHeight);
+
+        BandResult result{};
+
+        for (int window = 0; window < windowsPerRow; window++)
+        {
+            double sumX = 0;
+            double sumY = 0;
+            double sumXX = 0;
+            double sumYY = 0;
+            double sumXY = 0;
+
+            const int left = window * windowWidth;
+
+            for (int x = left; x < left + windowWidth; x++)
+            {
+                sumX += sums.x[x];
+                sumY += sums.y[x];
+                sumXX += sums.xx[x];
+                sumYY += sums.yy[x];
+                sumXY += sums.xy[x];
+            }
+
+            const double meanX = sumX / windowPixelCount;
+            const double meanY = sumY / windowPixelCount;
+            const double varianceX = std::max((sumXX / windowPixelCount) - (meanX * meanX), 0.0);
+            const double varianceY = std::max((sumYY / windowPixelCount) - (meanY * meanY), 0.0);
+            const double covariance = (sumXY / windowPixelCount) - (meanX * meanY);
+
+            const double ssim = (((2.0 * meanX * meanY) + ssimC1) * ((2.0 * covariance) + ssimC2)) /
+                                (((meanX * meanX) + (meanY * meanY) + ssimC1) * (varianceX + varianceY + ssimC2));
+
+            result.ssimDeficit += 1.0 - ssim;
+            result.squaredError += std::max(sumXX + sumYY - (2.0 * sumXY), 0.0);
+        }
+
+        return result;
+    }
+}
+
+ImageQualityMetrics ComputeImageQualityMetrics(heif_image* reference, heif_image* distorted, double minimumSsim)
+{
+    const int width = heif_image_get_primary_width(reference);
+    const int height = heif_image_get_primary_height(reference);
+
+    if (width != heif_image_get_primary_width(distorted) ||
+        height != heif_image_get_primary_height(distorted) ||
+        heif_image_get_chroma_format(reference) != heif_image_get_chroma_format(distorted))
+    {
+        throw std::runtime_error("The images must have the same size and format.");
+    }
+
+    const PlaneInfo referencePlane = GetPlaneInfo(reference);
+    const PlaneInfo distortedPlane = GetPlaneInfo(distorted);
+
+    const int windowWidth = std::min(ssimWindowSize, width);
+    const int windowHeight = std::min(ssimWindowSize, height);
+    const int windowsPerRow = width / windowWidth;
+    const int bandCount = height / windowHeight;
+
+    const double windowCount = static_cast<double>(windowsPerRow) * static_cast<double>(bandCount);
+    // The SSIM of each window is at most 1, so the computation can stop as soon as
+    // the accumulated deficit shows that the mean cannot reach the minimum value.
+    const double maximumDeficit = (1.0 - minimumSsim) * windowCount;
+
+    std::atomic<int> nextBand = 0;
+    std::atomic<bool> stop = false;
+    std::mutex resultMutex;
+    double totalDeficit = 0;
+    double totalSquaredError = 0;
+    std::exception_ptr workerException;
+
+    auto worker = [&]()
+    {
+        try
+        {
+            const size_t rowWidth = static_cast<size_t>(windowsPerRow) * static_cast<size_t>(windowWidth);
+
+            std::vector<float> referenceLuma(rowWidth);
+            std::vector<float> distortedLuma(rowWidth);
+            ColumnSums sums(rowWidth);
+
+            int band;
+
+            while (!stop.load(std::memory_order_relaxed) && (band = nextBand.fetch_add(1)) < bandCount)
+            {
+                const BandResult result = ComputeBand(
+                    referencePlane,
+                    distortedPlane,
+                    band,
+                    windowWidth,
+                    windowHeight,
+                    windowsPerRow,
+                    referenceLuma,
+                    distortedLuma,
+                    sums);
+
+                std::lock_guard<std::mutex> lock(resultMutex);
+
+                totalDeficit += result.ssimDeficit;
+                totalSquaredError += result.squaredError;
+
+                if (totalDeficit > maximumDeficit)
+                {
+                    stop.store(true, std::memory_order_relaxed);
+                }
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(resultMutex);
+
+            if (!workerException)
+            {
+                workerException = std::current_exception();
+            }
+
+            stop.store(true, std::memory_order_relaxed);
+        }
+    };
+
+    const unsigned int threadCount = std::clamp(std::thread::hardware_concurrency(), 1U, static_cast<unsigned int>(bandCount));
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+
+    for (unsigned int i = 1; i < threadCount; i++)
+    {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (workerException)
+    {
+        std::rethrow_exception(workerException);
+    }
+
+    ImageQualityMetrics metrics{};
+    metrics.ssim = 1.0 - (totalDeficit / windowCount);
+    metrics.stoppedEarly = stop.load();
+
+    if (!metrics.stoppedEarly)
+    {
+        const double meanSquaredError = totalSquaredError / (windowCount * windowWidth * windowHeight);
+
+        metrics.psnr = meanSquaredError > 0.0 ? 10.0 * std::log10(1.0 / meanSquaredError) : 100.0;
+    }
+
+    return metrics;
+}
@@ -0,0 +1,39 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGEMETRICS_H
+#define IMAGEMETRICS_H
+
+#include "ScopedHeif.h"
+
+struct ImageQualityMetrics
+{
+    double ssim;
+    double psnr;
+    // Indicates that the computation stopped early because the SSIM could not reach the minimum value.
+    // In that case the SSIM is an upper bound that is below the minimum, and the PSNR is not set.
+    bool stoppedEarly;
+};
+
+// Computes the luma SSIM and PSNR of the distorted image relative to the reference image.
+// Both images must have the same dimensions and use the same heif_chroma format.
+ImageQualityMetrics ComputeImageQualityMetrics(heif_image* reference, heif_image* distorted, double minimumSsim);
+
+#endif // !IMAGEMETRICS_H
@@ -0,0 +1,255 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ImageScaling.h"
+#include "LibHeifException.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    struct SourceSpan
+    {
+        int start;
+        int end;
+    };
+
+    std::vector<SourceSpan> BuildSourceSpans(int sourceSize, int destinationSize)
+    {
+        std::vector<SourceSpan> spans;
+        spans.reserve(static_cast<size_t>(destinationSize));
+
+        for (int i = 0; i < destinationSize; i++)
+        {
+            const int start = static_cast<int>((static_cast<int64_t>(i) * sourceSize) / destinationSize);
+            int end = static_cast<int>((static_cast<int64_t>(i + 1) * sourceSize) / destinationSize);
+
+            if (end <= start)
+            {
+                end = start + 1;
+            }
+
+            spans.push_back({ start, end });
+        }
+
+        return spans;
+    }
+
+    template <typename T>
+    void BoxFilterPlane(
+        const uint8_t* sourceScan0,
+        int sourceStride,
+        int sourceWidth,
+        int sourceHeight,
+        uint8_t* destinationScan0,
+        int destinationStride,
+        int destinationWidth,
+        int destinationHeight,
+        int channelCount)
+    {
+        const std::vector<SourceSpan> columns = BuildSourceSpans(sourceWidth, destinationWidth);
+        const std::vector<SourceSpan> rows = BuildSourceSpans(sourceHeight, destinationHeight);
+
+        std::vector<uint64_t> rowSums(static_cast<size_t>(destinationWidth) * static_cast<size_t>(channelCount));
+
+        for (int y = 0; y < destinationHeight; y++)
+        {
+            const SourceSpan& rowSpan = rows[y];
+
+            std::fill(rowSums.begin(), rowSums.end(), 0);
+
+            for (int sourceY = rowSpan.start; sourceY < rowSpan.end; sourceY++)
+            {
+                const T* src = reinterpret_cast<const T*>(sourceScan0 + (static_cast<int64_t>(sourceY) * sourceStride));
+                uint64_t* sums = rowSums.data();
+
+                for (int x = 0; x < destinationWidth; x++)
+                {
+                    const SourceSpan& columnSpan = columns[x];
+
+                    for (int sourceX = columnSpan.start; sourceX < columnSpan.end; sourceX++)
+                    {
+                        const T* pixel = src + (static_cast<int64_t>(sourceX) * channelCount);
+
+                        for (int channel = 0; channel < channelCount; channel++)
+                        {
+                            sums[channel] += pixel[channel];
+                        }
+                    }
+
+                    sums += channelCount;
+                }
+            }
+
+            T* dst = reinterpret_cast<T*>(destinationScan0 + (static_cast<int64_t>(y) * destinationStride));
+            const uint64_t* sums = rowSums.data();
+
+            for (int x = 0; x < destinationWidth; x++)
+            {
+                const SourceSpan& columnSpan = columns[x];
+
+                const uint64_t area = static_cast<uint64_t>(columnSpan.end - columnSpan.start) *
+                                      static_cast<uint64_t>(rowSpan.end - rowSpan.start);
+                const uint64_t halfArea = area / 2;
+
+                for (int channel = 0; channel < channelCount; channel++)
+                {
+                    dst[channel] = static_cast<T>((sums[channel] + halfArea) / area);
+                }
+
+                dst += channelCount;
+                sums += channelCount;
+            }
+        }
+    }
+
+    void ScalePlane(
+        heif_image* source,
+        heif_image* destination,
+        heif_channel channel,
+        int channelCount,
+        int width,
+        int height)
+    {
+        const int bitDepth = heif_image_get_bits_per_pixel_range(source, channel);
+
+        LibHeifException::ThrowIfError(heif_image_add_plane(destination, channel, width, height, bitDepth));
+
+        int sourceStride;
+        const uint8_t* sourceScan0 = heif_image_get_plane_readonly(source, channel, &sourceStride);
+
+        int destinationStride;
+        uint8_t* destinationScan0 = heif_image_get_plane(destination, channel, &destinationStride);
+
+        const int sourceWidth = heif_image_get_width(source, channel);
+        const int sourceHeight = heif_image_get_height(source, channel);
+
+        if (bitDepth > 8)
+        {
+            BoxFilterPlane<uint16_t>(
+                sourceScan0,
+                sourceStride,
+                sourceWidth,
+                sourceHeight,
+                destinationScan0,
+                destinationStride,
+                width,
+                height,
+                channelCount);
+        }
+        else
+        {
+            BoxFilterPlane<uint8_t>(
+                sourceScan0,
+                sourceStride,
+                sourceWidth,
+                sourceHeight,
+                destinationScan0,
+                destinationStride,
+                width,
+                height,
+                channelCount);
+        }
+    }
+
+    void CopyColorProfiles(heif_image* source, heif_image* destination)
+    {
+        const size_t iccProfileSize = heif_image_get_raw_color_profile_size(source);
+
+        if (iccProfileSize > 0)
+        {
+            std::vector<uint8_t> iccProfile(iccProfileSize);
+
+            LibHeifException::ThrowIfError(heif_image_get_raw_color_profile(source, iccProfile.data()));
+            LibHeifException::ThrowIfError(heif_image_set_raw_color_profile(
+                destination,
+                "prof",
+                iccProfile.data(),
+                iccProfile.size()));
+        }
+
+        heif_color_profile_nclx* nclxProfile;
+
+        if (heif_image_get_nclx_color_profile(source, &nclxProfile).code == heif_error_Ok)
+        {
+            ScopedHeifNclxProfile profile(nclxProfile);
+
+            LibHeifException::ThrowIfError(heif_image_set_nclx_color_profile(destination, profile.get()));
+        }
+    }
+}
+
+void GetScaledImageSize(int width, int height, int maxDimension, int& scaledWidth, int& scaledHeight)
+{
+    const int longestSide = std::max(width, height);
+
+    if (longestSide <= maxDimension)
+    {
+        scaledWidth = width;
+        scaledHeight = height;
+    }
+    else
+    {
+        const int64_t halfLongestSide = longestSide / 2;
+
+        scaledWidth = std::max(static_cast<int>(((static_cast<int64_t>(width) * maxDimension) + halfLongestSide) / longestSide), 1);
+        scaledHeight = std::max(static_cast<int>(((static_cast<int64_t>(height) * maxDimension) + halfLongestSide) / longestSide), 1);
+    }
+}
+
+ScopedHeifImage ScaleHeifImage(heif_image* image, int width, int height)
+{
+    const heif_colorspace colorspace = heif_image_get_colorspace(image);
+    const heif_chroma chroma = heif_image_get_chroma_format(image);
+
+    heif_image* tempImage;
+
+    LibHeifException::ThrowIfError(heif_image_create(width, height, colorspace, chroma, &tempImage));
+
+    ScopedHeifImage scaledImage(tempImage);
+
+    switch (chroma)
+    {
+    case heif_chroma_monochrome:
+        ScalePlane(image, scaledImage.get(), heif_channel_Y, 1, width, height);
+
+        if (heif_image_has_channel(image, heif_channel_Alpha))
+        {
+            ScalePlane(image, scaledImage.get(), heif_channel_Alpha, 1, width, height);
+        }
+        break;
+    case heif_chroma_interleaved_RGB:
+    case heif_chroma_interleaved_RRGGBB_LE:
+        ScalePlane(image, scaledImage.get(), heif_channel_interleaved, 3, width, height);
+        break;
+    case heif_chroma_interleaved_RGBA:
+    case heif_chroma_interleaved_RRGGBBAA_LE:
+        ScalePlane(image, scaledImage.get(), heif_channel_interleaved, 4, width, height);
+        break;
+    default:
+        throw std::runtime_error("Unsupported image format for scaling.");
+    }
+
+    CopyColorProfiles(image, scaledImage.get());
+    heif_image_set_premultiplied_alpha(scaledImage.get(), heif_image_is_premultiplied_alpha(image) != 0);
+
+    return scaledImage;
+}
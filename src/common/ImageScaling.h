@@ -0,0 +1,34 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGESCALING_H
+#define IMAGESCALING_H
+
+#include "ScopedHeif.h"
+
+// Creates a reduced size copy of an image using a box filter.
+// The image must use one of the formats created by the CreateHeifImage functions,
+// the color profiles and premultiplied alpha state are copied to the new image.
+ScopedHeifImage ScaleHeifImage(heif_image* image, int width, int height);
+
+// Gets the size of an image scaled to fit within the maximum dimension, the image is never enlarged.
+void GetScaledImageSize(int width, int height, int maxDimension, int& scaledWidth, int& scaledHeight);
+
+#endif // !IMAGESCALING_H
@@ -0,0 +1,335 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MatrixShaperTransform.h"
+#include "ColorProfileDetection.h"
+#include "lcms2_plugin.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+    // The number of intervals in the interpolated 32-bit tone curve tables.
+    constexpr size_t interpolatedTableIntervals = 4096;
+
+    // The largest value in Photoshop's 16-bit range [0, 32768].
+    constexpr uint16_t hostSixteenBitMaxValue = 32768;
+
+    cmsMAT3 ColorantsToMatrix(const cmsCIEXYZTRIPLE& colorants) noexcept
+    {
+        cmsMAT3 matrix{};
+
+        _cmsVEC3init(&matrix.v[0], colorants.Red.X, colorants.Green.X, colorants.Blue.X);
+        _cmsVEC3init(&matrix.v[1], colorants.Red.Y, colorants.Green.Y, colorants.Blue.Y);
+        _cmsVEC3init(&matrix.v[2], colorants.Red.Z, colorants.Green.Z, colorants.Blue.Z);
+
+        return matrix;
+    }
+
+    float InterpolateLookupTable(const std::vector<float>& table, float position) noexcept
+    {
+        const size_t index = std::min(static_cast<size_t>(position), interpolatedTableIntervals - 1);
+        const float fraction = position - static_cast<float>(index);
+
+        return table[index] + ((table[index + 1] - table[index]) * fraction);
+    }
+
+    std::vector<float> BuildDocumentLookupTable(const cmsToneCurve* toneCurve, int hostBitsPerChannel)
+    {
+        std::vector<float> lookupTable;
+
+        if (hostBitsPerChannel == 8)
+        {
+            lookupTable.reserve(256);
+
+            for (size_t i = 0; i < lookupTable.capacity(); i++)
+            {
+                lookupTable.push_back(cmsEvalToneCurveFloat(toneCurve, static_cast<float>(i) / 255.0f));
+            }
+        }
+        else if (hostBitsPerChannel == 16)
+        {
+            lookupTable.reserve(static_cast<size_t>(hostSixteenBitMaxValue) + 1);
+
+            for (size_t i = 0; i < lookupTable.capacity(); i++)
+            {
+                lookupTable.push_back(cmsEvalToneCurveFloat(toneCurve, static_cast<float>(i) / 32768.0f));
+            }
+        }
+        else if (!cmsIsToneCurveLinear(toneCurve))
+        {
+            lookupTable.reserve(interpolatedTableIntervals + 1);
+
+            for (size_t i = 0; i < lookupTable.capacity(); i++)
+            {
+                const float value = static_cast<float>(i) / static_cast<float>(interpolatedTableIntervals);
+
+                lookupTable.push_back(cmsEvalToneCurveFloat(toneCurve, value));
+            }
+        }
+
+        return lookupTable;
+    }
+
+    std::vector<float> BuildOutputLookupTable(const cmsToneCurve* inverseToneCurve)
+    {
+        std::vector<float> lookupTable;
+
+        if (!cmsIsToneCurveLinear(inverseToneCurve))
+        {
+            lookupTable.reserve(interpolatedTableIntervals + 1);
+
+            // The table is indexed by the square root of the linear value, this places more
+            // of the table entries in the dark tones where the inverse tone curves are steepest.
+            for (size_t i = 0; i < lookupTable.capacity(); i++)
+            {
+                const float position = static_cast<float>(i) / static_cast<float>(interpolatedTableIntervals);
+
+                lookupTable.push_back(cmsEvalToneCurveFloat(inverseToneCurve, position * position));
+            }
+        }
+
+        return lookupTable;
+    }
+
+    bool HasZeroBlackPoint(cmsToneCurve* const (&toneCurves)[3])
+    {
+        // lcms black point compensation changes the conversion when the profile black point is not zero.
+        constexpr float maxBlackValue = 1.0f / 65535.0f;
+
+        for (const cmsToneCurve* toneCurve : toneCurves)
+        {
+            if (std::fabs(cmsEvalToneCurveFloat(toneCurve, 0.0f)) > maxBlackValue)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+MatrixShaperTransform::MatrixShaperTransform(
+    const cmsCIEXYZTRIPLE& documentColorants,
+    cmsToneCurve* const (&documentToneCurves)[3],
+    const cmsCIEXYZTRIPLE& outputColorants,
+    cmsToneCurve* const (&outputToneCurves)[3],
+    bool hasAlpha,
+    int hostBitsPerChannel)
+    : numberOfChannels(hasAlpha ? 4 : 3), hostBitsPerChannel(hostBitsPerChannel), matrix(),
+      documentLookupTables(), outputLookupTables(), documentToneCurves(), inverseOutputToneCurves()
+{
+    if (hostBitsPerChannel != 8 && hostBitsPerChannel != 16 && hostBitsPerChannel != 32)
+    {
+        throw ::std::runtime_error("Unsupported host bit depth, must be 8, 16 or 32.");
+    }
+
+    // Both profiles use the D50 PCS, so the document colorants can be converted to the
+    // output primaries with the inverse of the output colorant matrix.
+    const cmsMAT3 documentMatrix = ColorantsToMatrix(documentColorants);
+    cmsMAT3 outputMatrix = ColorantsToMatrix(outputColorants);
+    cmsMAT3 inverseOutputMatrix{};
+
+    if (!_cmsMAT3inverse(&outputMatrix, &inverseOutputMatrix))
+    {
+        throw ::std::runtime_error("The output color profile colorants cannot be inverted.");
+    }
+
+    cmsMAT3 conversionMatrix{};
+    _cmsMAT3per(&conversionMatrix, &inverseOutputMatrix, &documentMatrix);
+
+    for (size_t row = 0; row < 3; row++)
+    {
+        for (size_t column = 0; column < 3; column++)
+        {
+            matrix[row][column] = static_cast<float>(conversionMatrix.v[row].n[column]);
+        }
+    }
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        ScopedLcmsToneCurve inverseOutputToneCurve(cmsReverseToneCurve(outputToneCurves[i]));
+
+        if (!inverseOutputToneCurve)
+        {
+            throw ::std::bad_alloc();
+        }
+
+        documentLookupTables[i] = BuildDocumentLookupTable(documentToneCurves[i], hostBitsPerChannel);
+        outputLookupTables[i] = BuildOutputLookupTable(inverseOutputToneCurve.get());
+
+        if (hostBitsPerChannel == 32)
+        {
+            this->documentToneCurves[i].reset(cmsDupToneCurve(documentToneCurves[i]));
+
+            if (!this->documentToneCurves[i])
+            {
+                throw ::std::bad_alloc();
+            }
+
+            inverseOutputToneCurves[i] = std::move(inverseOutputToneCurve);
+        }
+    }
+}
+
+void MatrixShaperTransform::ConvertRow(void* row, cmsUInt32Number pixelsPerLine) const noexcept
+{
+    switch (hostBitsPerChannel)
+    {
+    case 8:
+        ConvertPixels(static_cast<uint8_t*>(row), pixelsPerLine);
+        break;
+    case 16:
+        ConvertPixels(static_cast<uint16_t*>(row), pixelsPerLine);
+        break;
+    case 32:
+        ConvertPixels(static_cast<float*>(row), pixelsPerLine);
+        break;
+    }
+}
+
+template <typename T>
+void MatrixShaperTransform::ConvertPixels(T* row, cmsUInt32Number pixelsPerLine) const noexcept
+{
+    // The alpha channel is not modified.
+    for (size_t i = 0; i < pixelsPerLine; i++)
+    {
+        T* pixel = row + (i * numberOfChannels);
+
+        const float r = Linearize(0, pixel[0]);
+        const float g = Linearize(1, pixel[1]);
+        const float b = Linearize(2, pixel[2]);
+
+        for (size_t channel = 0; channel < 3; channel++)
+        {
+            const float value = (matrix[channel][0] * r) + (matrix[channel][1] * g) + (matrix[channel][2] * b);
+
+            Encode(channel, value, pixel[channel]);
+        }
+    }
+}
+
+float MatrixShaperTransform::Linearize(size_t channel, uint8_t value) const noexcept
+{
+    return documentLookupTables[channel][value];
+}
+
+float MatrixShaperTransform::Linearize(size_t channel, uint16_t value) const noexcept
+{
+    return documentLookupTables[channel][std::min(value, hostSixteenBitMaxValue)];
+}
+
+float MatrixShaperTransform::Linearize(size_t channel, float value) const noexcept
+{
+    const std::vector<float>& lookupTable = documentLookupTables[channel];
+
+    if (lookupTable.empty())
+    {
+        return value;
+    }
+    else if (value >= 0.0f && value <= 1.0f)
+    {
+        return InterpolateLookupTable(lookupTable, value * static_cast<float>(interpolatedTableIntervals));
+    }
+
+    return cmsEvalToneCurveFloat(documentToneCurves[channel].get(), value);
+}
+
+float MatrixShaperTransform::Delinearize(size_t channel, float value) const noexcept
+{
+    const std::vector<float>& lookupTable = outputLookupTables[channel];
+
+    if (lookupTable.empty())
+    {
+        return value;
+    }
+    else if (value >= 0.0f && value <= 1.0f)
+    {
+        return InterpolateLookupTable(lookupTable, std::sqrt(value) * static_cast<float>(interpolatedTableIntervals));
+    }
+
+    return cmsEvalToneCurveFloat(inverseOutputToneCurves[channel].get(), value);
+}
+
+void MatrixShaperTransform::Encode(size_t channel, float value, uint8_t& result) const noexcept
+{
+    const float encoded = Delinearize(channel, std::clamp(value, 0.0f, 1.0f));
+
+    result = static_cast<uint8_t>(std::clamp((encoded * 255.0f) + 0.5f, 0.0f, 255.0f));
+}
+
+void MatrixShaperTransform::Encode(size_t channel, float value, uint16_t& result) const noexcept
+{
+    const float encoded = Delinearize(channel, std::clamp(value, 0.0f, 1.0f));
+
+    result = static_cast<uint16_t>(std::clamp((encoded * 32768.0f) + 0.5f, 0.0f, 32768.0f));
+}
+
+void MatrixShaperTransform::Encode(size_t channel, float value, float& result) const noexcept
+{
+    // The 32-bit lcms transforms are unbounded, the values outside of the [0, 1] range are preserved.
+    result = Delinearize(channel, value);
+}
+
+std::unique_ptr<MatrixShaperTransform> TryCreateMatrixShaperTransform(
+    cmsContext context,
+    cmsHPROFILE documentProfile,
+    ColorTransformOutputProfile outputProfile,
+    bool hasAlpha,
+    int hostBitsPerChannel)
+{
+    ScopedLcmsProfile outputImageProfile = CreateColorTransformOutputProfile(context, outputProfile);
+
+    return TryCreateMatrixShaperTransform(documentProfile, outputImageProfile.get(), hasAlpha, hostBitsPerChannel);
+}
+
+std::unique_ptr<MatrixShaperTransform> TryCreateMatrixShaperTransform(
+    cmsHPROFILE documentProfile,
+    cmsHPROFILE outputProfile,
+    bool hasAlpha,
+    int hostBitsPerChannel)
+{
+    cmsCIEXYZTRIPLE documentColorants{};
+    cmsToneCurve* documentToneCurves[3]{};
+
+    if (!TryReadMatrixShaperProfile(documentProfile, documentColorants, documentToneCurves) ||
+        !HasZeroBlackPoint(documentToneCurves))
+    {
+        return nullptr;
+    }
+
+    cmsCIEXYZTRIPLE outputColorants{};
+    cmsToneCurve* outputToneCurves[3]{};
+
+    if (!TryReadMatrixShaperProfile(outputProfile, outputColorants, outputToneCurves) ||
+        !HasZeroBlackPoint(outputToneCurves))
+    {
+        return nullptr;
+    }
+
+    return std::make_unique<MatrixShaperTransform>(
+        documentColorants,
+        documentToneCurves,
+        outputColorants,
+        outputToneCurves,
+        hasAlpha,
+        hostBitsPerChannel);
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MATRIXSHAPERTRANSFORM_H
+#define MATRIXSHAPERTRANSFORM_H
+
+#include "ColorTransformCache.h"
+#include "ScopedLcms.h"
+#include <array>
+#include <memory>
+#include <vector>
+
+// Converts the document image data between two RGB matrix/TRC profiles without using lcms.
+// The document tone curves are applied with lookup tables, the combined colorant matrix converts
+// the linear values to the output primaries and the inverse output tone curves are applied with a
+// second lookup table.
+// The results match the perceptual intent lcms transform with black point compensation, to within rounding.
+class MatrixShaperTransform
+{
+public:
+
+    MatrixShaperTransform(
+        const cmsCIEXYZTRIPLE& documentColorants,
+        cmsToneCurve* const (&documentToneCurves)[3],
+        const cmsCIEXYZTRIPLE& outputColorants,
+        cmsToneCurve* const (&outputToneCurves)[3],
+        bool hasAlpha,
+        int hostBitsPerChannel);
+
+    void ConvertRow(void* row, cmsUInt32Number pixelsPerLine) const noexcept;
+
+private:
+
+    template <typename T>
+    void ConvertPixels(T* row, cmsUInt32Number pixelsPerLine) const noexcept;
+
+    float Linearize(size_t channel, uint8_t value) const noexcept;
+
+    float Linearize(size_t channel, uint16_t value) const noexcept;
+
+    float Linearize(size_t channel, float value) const noexcept;
+
+    float Delinearize(size_t channel, float value) const noexcept;
+
+    void Encode(size_t channel, float value, uint8_t& result) const noexcept;
+
+    void Encode(size_t channel, float value, uint16_t& result) const noexcept;
+
+    void Encode(size_t channel, float value, float& result) const noexcept;
+
+    const size_t numberOfChannels;
+    const int hostBitsPerChannel;
+    float matrix[3][3];
+    // An empty table is used for linear tone curves.
+    std::array<std::vector<float>, 3> documentLookupTables;
+    std::array<std::vector<float>, 3> outputLookupTables;
+    // The 32-bit mode uses the tone curves directly for the values that are outside of the [0, 1] range.
+    std::array<ScopedLcmsToneCurve, 3> documentToneCurves;
+    std::array<ScopedLcmsToneCurve, 3> inverseOutputToneCurves;
+};
+
+// Creates a transform if both the document profile and the output profile are matrix/TRC profiles,
+// returns nullptr if the conversion requires lcms.
+std::unique_ptr<MatrixShaperTransform> TryCreateMatrixShaperTransform(
+    cmsContext context,
+    cmsHPROFILE documentProfile,
+    ColorTransformOutputProfile outputProfile,
+    bool hasAlpha,
+    int hostBitsPerChannel);
+
+// Creates a transform between two profiles that the caller supplies, the profiles are
+// only used while the transform is created.
+std::unique_ptr<MatrixShaperTransform> TryCreateMatrixShaperTransform(
+    cmsHPROFILE documentProfile,
+    cmsHPROFILE outputProfile,
+    bool hasAlpha,
+    int hostBitsPerChannel);
+
+#endif // !MATRIXSHAPERTRANSFORM_H
@@ -59,7 +59,7 @@ OSErr DoOptionsStart(FormatRecordPtr formatRecord, Globals* globals)
     {
         if (DoSaveUI(formatRecord, globals->saveOptions))
         {
-            WriteScriptParamsOnWrite(formatRecord, globals->saveOptions);
+            WriteScriptParamsOnWrite(formatRecord, globals->saveOptions, nullptr);
         }
         else
         {
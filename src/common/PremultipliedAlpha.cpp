@@ -45,28 +45,167 @@
 
 #include "PremultipliedAlpha.h"
 #include <algorithm>
+#include <bit>
 
-float PremultiplyColor(float color, float alpha, float maxValue)
+#if SIMD_SSE2
+#include <emmintrin.h>
+#elif SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
 {
-    return color * alpha / maxValue;
+    const PremultipliedAlphaTable& GetEightBitTable()
+    {
+        static const PremultipliedAlphaTable table(255);
+
+        return table;
+    }
+
+    template <typename T>
+    void PremultiplyRowScalar(T* pixels, size_t pixelCount, size_t channelCount, const PremultipliedAlphaTable& table) noexcept
+    {
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            const T alpha = pixels[channelCount - 1];
+
+            for (size_t j = 0; j < channelCount - 1; j++)
+            {
+                pixels[j] = static_cast<T>(table.Premultiply(pixels[j], alpha));
+            }
+
+            pixels += channelCount;
+        }
+    }
+
+    template <typename T>
+    void UnpremultiplyRowScalar(T* pixels, size_t pixelCount, size_t channelCount, const PremultipliedAlphaTable& table) noexcept
+    {
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            const T alpha = pixels[channelCount - 1];
+
+            for (size_t j = 0; j < channelCount - 1; j++)
+            {
+                pixels[j] = static_cast<T>(table.Unpremultiply(pixels[j], alpha));
+            }
+
+            pixels += channelCount;
+        }
+    }
+
+    // Premultiplies blocks of 8-bit pixels with SIMD and returns the number of pixels that were processed,
+    // the pixels that do not fill a complete block are left for the caller.
+    // This computes round(color * alpha / 255) as (t + (t >> 8)) >> 8 with t = color * alpha + 128,
+    // which is exact for all 8-bit values.
+    template <size_t channelCount>
+    size_t PremultiplyEightBitBlocks(uint8_t* pixels, size_t pixelCount) noexcept
+    {
+        size_t i = 0;
+
+#if SIMD_SSE2
+        constexpr size_t pixelsPerBlock = 16 / channelCount;
+        // Selects the alpha value of each pixel in a vector of 16-bit channels.
+        constexpr int alphaShuffle = channelCount == 4 ? _MM_SHUFFLE(3, 3, 3, 3) : _MM_SHUFFLE(3, 3, 1, 1);
+
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alphaChannelMask = channelCount == 4
+            ? _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0)
+            : _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0);
+        // The alpha channel is multiplied by 255, this leaves it unchanged.
+        const __m128i alphaChannelMultiplier = _mm_and_si128(alphaChannelMask, _mm_set1_epi16(255));
+        const __m128i rounding = _mm_set1_epi16(128);
+
+        const auto premultiply = [&](__m128i channels)
+        {
+            __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(channels, alphaShuffle), alphaShuffle);
+            alpha = _mm_or_si128(_mm_andnot_si128(alphaChannelMask, alpha), alphaChannelMultiplier);
+
+            const __m128i t = _mm_add_epi16(_mm_mullo_epi16(channels, alpha), rounding);
+
+            return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+        };
+
+        for (; i + pixelsPerBlock <= pixelCount; i += pixelsPerBlock)
+        {
+            __m128i* block = reinterpret_cast<__m128i*>(pixels + (i * channelCount));
+
+            const __m128i value = _mm_loadu_si128(block);
+
+            const __m128i low = premultiply(_mm_unpacklo_epi8(value, zero));
+            const __m128i high = premultiply(_mm_unpackhi_epi8(value, zero));
+
+            _mm_storeu_si128(block, _mm_packus_epi16(low, high));
+        }
+#elif SIMD_NEON
+        constexpr size_t pixelsPerBlock = 8;
+
+        const auto premultiply = [](uint8x8_t color, uint8x8_t alpha)
+        {
+            const uint16x8_t product = vmull_u8(color, alpha);
+
+            return vrshrn_n_u16(vrsraq_n_u16(product, product, 8), 8);
+        };
+
+        for (; i + pixelsPerBlock <= pixelCount; i += pixelsPerBlock)
+        {
+            uint8_t* block = pixels + (i * channelCount);
+
+            if constexpr (channelCount == 4)
+            {
+                uint8x8x4_t value = vld4_u8(block);
+
+                value.val[0] = premultiply(value.val[0], value.val[3]);
+                value.val[1] = premultiply(value.val[1], value.val[3]);
+                value.val[2] = premultiply(value.val[2], value.val[3]);
+
+                vst4_u8(block, value);
+            }
+            else
+            {
+                uint8x8x2_t value = vld2_u8(block);
+
+                value.val[0] = premultiply(value.val[0], value.val[1]);
+
+                vst2_u8(block, value);
+            }
+        }
+#else
+        static_cast<void>(pixels);
+        static_cast<void>(pixelCount);
+#endif
+
+        return i;
+    }
 }
 
-uint8_t PremultiplyColor(uint8_t color, uint8_t alpha)
+PremultipliedAlphaTable::PremultipliedAlphaTable(uint16_t maxValue)
+    : premultiplyFactors(static_cast<size_t>(maxValue) + 1),
+      unpremultiplyFactors(static_cast<size_t>(maxValue) + 1),
+      rounding(),
+      shift()
 {
-    constexpr float maxValueFloat = 255.0f;
-
-    const float value = PremultiplyColor(static_cast<float>(color), static_cast<float>(alpha), maxValueFloat);
-
-    return static_cast<uint8_t>(std::min(roundf(value), maxValueFloat));
+    // The factors are rounded up, a shift of 2n + 1 bits for n-bit values keeps the error below the
+    // smallest distance between an exact quotient and a rounding boundary, 1 / (2 * divisor).
+    shift = (2 * std::bit_width(maxValue)) + 1;
+    rounding = uint64_t(1) << (shift - 1);
+
+    const uint64_t one = uint64_t(1) << shift;
+
+    for (uint64_t alpha = 0; alpha <= maxValue; alpha++)
+    {
+        premultiplyFactors[alpha] = ((alpha * one) + maxValue - 1) / maxValue;
+
+        if (alpha > 0)
+        {
+            unpremultiplyFactors[alpha] = ((maxValue * one) + alpha - 1) / alpha;
+        }
+    }
 }
 
-uint16_t PremultiplyColor(uint16_t color, uint16_t alpha, uint16_t maxValue)
+float PremultiplyColor(float color, float alpha, float maxValue)
 {
-    const float maxValueFloat = static_cast<float>(maxValue);
-
-    const float value = PremultiplyColor(static_cast<float>(color), static_cast<float>(alpha), maxValueFloat);
-
-    return static_cast<uint16_t>(std::min(roundf(value), maxValueFloat));
+    return color * alpha / maxValue;
 }
 
 float UnpremultiplyColor(float color, float alpha, float maxValue)
@@ -74,20 +213,26 @@ float UnpremultiplyColor(float color, float alpha, float maxValue)
     return std::min(color * maxValue / alpha, maxValue);
 }
 
-uint8_t UnpremultiplyColor(uint8_t color, uint8_t alpha)
+void PremultiplyRow(uint8_t* pixels, size_t pixelCount, size_t channelCount) noexcept
 {
-    constexpr float maxValueFloat = 255.0f;
+    const size_t processed = channelCount == 4
+        ? PremultiplyEightBitBlocks<4>(pixels, pixelCount)
+        : PremultiplyEightBitBlocks<2>(pixels, pixelCount);
 
-    const float value = UnpremultiplyColor(static_cast<float>(color), static_cast<float>(alpha), maxValueFloat);
-
-    return static_cast<uint8_t>(std::min(roundf(value), maxValueFloat));
+    PremultiplyRowScalar(pixels + (processed * channelCount), pixelCount - processed, channelCount, GetEightBitTable());
 }
 
-uint16_t UnpremultiplyColor(uint16_t color, uint16_t alpha, uint16_t maxValue)
+void PremultiplyRow(uint16_t* pixels, size_t pixelCount, size_t channelCount, const PremultipliedAlphaTable& table) noexcept
 {
-    const float maxValueFloat = static_cast<float>(maxValue);
+    PremultiplyRowScalar(pixels, pixelCount, channelCount, table);
+}
 
-    const float value = UnpremultiplyColor(static_cast<float>(color), static_cast<float>(alpha), maxValueFloat);
+void UnpremultiplyRow(uint8_t* pixels, size_t pixelCount, size_t channelCount) noexcept
+{
+    UnpremultiplyRowScalar(pixels, pixelCount, channelCount, GetEightBitTable());
+}
 
-    return static_cast<uint16_t>(std::min(roundf(value), maxValueFloat));
+void UnpremultiplyRow(uint16_t* pixels, size_t pixelCount, size_t channelCount, const PremultipliedAlphaTable& table) noexcept
+{
+    UnpremultiplyRowScalar(pixels, pixelCount, channelCount, table);
 }
@@ -22,17 +22,54 @@
 #define PREMULTIPLIEDALPHA_H
 
 #include "Common.h"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
 
 float PremultiplyColor(float color, float alpha, float maxValue);
 
-uint8_t PremultiplyColor(uint8_t color, uint8_t alpha);
+float UnpremultiplyColor(float color, float alpha, float maxValue);
 
-uint16_t PremultiplyColor(uint16_t color, uint16_t alpha, uint16_t maxValue);
+// Premultiplies and unpremultiplies integer color values without a division, using a multiply-shift
+// factor for each alpha value.
+// The values are rounded to nearest with ties rounded up, which gives the same result as dividing
+// in single precision and calling roundf for image data of up to 12 bits per channel.
+class PremultipliedAlphaTable
+{
+public:
 
-float UnpremultiplyColor(float color, float alpha, float maxValue);
+    explicit PremultipliedAlphaTable(uint16_t maxValue);
+
+    // The color and alpha values must not be greater than maxValue.
+    uint16_t Premultiply(uint16_t color, uint16_t alpha) const noexcept
+    {
+        return static_cast<uint16_t>(((color * premultiplyFactors[alpha]) + rounding) >> shift);
+    }
+
+    // The color and alpha values must not be greater than maxValue.
+    // The color is set to zero when alpha is zero.
+    uint16_t Unpremultiply(uint16_t color, uint16_t alpha) const noexcept
+    {
+        return static_cast<uint16_t>(((std::min(color, alpha) * unpremultiplyFactors[alpha]) + rounding) >> shift);
+    }
+
+private:
+
+    std::vector<uint64_t> premultiplyFactors;
+    std::vector<uint64_t> unpremultiplyFactors;
+    uint64_t rounding;
+    int shift;
+};
+
+// The row functions process interleaved pixels where alpha is the last channel,
+// channelCount must be 2 for gray with alpha or 4 for RGBA.
+
+void PremultiplyRow(uint8_t* pixels, size_t pixelCount, size_t channelCount) noexcept;
+
+void PremultiplyRow(uint16_t* pixels, size_t pixelCount, size_t channelCount, const PremultipliedAlphaTable& table) noexcept;
 
-uint8_t UnpremultiplyColor(uint8_t color, uint8_t alpha);
+void UnpremultiplyRow(uint8_t* pixels, size_t pixelCount, size_t channelCount) noexcept;
 
-uint16_t UnpremultiplyColor(uint16_t color, uint16_t alpha, uint16_t maxValue);
+void UnpremultiplyRow(uint16_t* pixels, size_t pixelCount, size_t channelCount, const PremultipliedAlphaTable& table) noexcept;
 
 #endif // PREMULTIPLIEDALPHA_H
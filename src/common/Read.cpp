@@ -19,15 +19,19 @@
  */
 
 #include "AvifFormat.h"
+#include "ColorProfileDetection.h"
 #include "ColorProfileGeneration.h"
 #include "FileIO.h"
 #include "LibHeifException.h"
+#include "MatrixShaperTransform.h"
 #include "OSErrException.h"
 #include "ReadHeifImage.h"
 #include "ReadMetadata.h"
+#include "RemuxPassthrough.h"
 #include "ScopedHandleSuite.h"
 #include "ScopedHeif.h"
 #include <memory>
+#include <vector>
 
 namespace
 {
@@ -209,8 +213,9 @@ namespace
 
             RevertInfo* revertInfo = reinterpret_cast<RevertInfo*>(lock.data());
 
-            revertInfo->version = 1;
+            revertInfo->version = 2;
             revertInfo->format = options.format;
+            revertInfo->workingSpace = options.workingSpace;
 
             switch (options.format)
             {
@@ -220,6 +225,9 @@ namespace
             case LoadOptionsHDRFormat::PQ:
                 revertInfo->pq = options.pq;
                 break;
+            case LoadOptionsHDRFormat::Unknown:
+                // The image is not HDR, only the working space is used.
+                break;
             default:
                 throw std::runtime_error("Unsupported LoadOptionsHDRFormat value.");
             }
@@ -229,6 +237,89 @@ namespace
             formatRecord->revertInfo = handle.release();
         }
     }
+
+    ScopedLcmsProfile ReadEmbeddedColorProfile(cmsContext context, const heif_image_handle* handle)
+    {
+        ScopedLcmsProfile profile;
+
+        const size_t iccProfileLength = heif_image_handle_get_raw_color_profile_size(handle);
+
+        if (iccProfileLength > 0 && iccProfileLength <= static_cast<size_t>(std::numeric_limits<int32>::max()))
+        {
+            std::vector<uint8_t> iccProfile(iccProfileLength);
+
+            LibHeifException::ThrowIfError(heif_image_handle_get_raw_color_profile(handle, iccProfile.data()));
+
+            profile.reset(cmsOpenProfileFromMemTHR(
+                context,
+                iccProfile.data(),
+                static_cast<cmsUInt32Number>(iccProfile.size())));
+        }
+
+        return profile;
+    }
+
+    // Returns nullptr if the image is read in its own color space, either because the working space
+    // option is not used or because the image color space cannot be converted during the read.
+    std::unique_ptr<MatrixShaperTransform> TryCreateWorkingSpaceTransform(
+        const FormatRecordPtr formatRecord,
+        const Globals* globals,
+        const heif_color_profile_nclx* nclxProfile,
+        AlphaState alphaState)
+    {
+        // The conversion is performed after the YCbCr to RGB conversion in the YUV decode functions.
+        if (globals->loadOptions.workingSpace == LoadOptionsWorkingSpace::Embedded ||
+            IsMonochromeImage(formatRecord) ||
+            heif_image_get_colorspace(globals->image) != heif_colorspace_YCbCr)
+        {
+            return nullptr;
+        }
+
+        ScopedLcmsContext context(cmsCreateContext(nullptr, nullptr));
+
+        if (!context)
+        {
+            throw std::bad_alloc();
+        }
+
+        const bool linear = formatRecord->depth == 32;
+
+        ScopedLcmsProfile documentProfile;
+
+        if (globals->imageHandleProfileType == heif_color_profile_type_prof ||
+            globals->imageHandleProfileType == heif_color_profile_type_rICC)
+        {
+            // The 32-bits-per-channel image modes always operate in linear color, so an embedded
+            // profile does not describe the image data that is passed to the host.
+            if (!linear)
+            {
+                documentProfile = ReadEmbeddedColorProfile(context.get(), globals->imageHandle);
+            }
+        }
+        else
+        {
+            documentProfile = CreateNclxColorProfile(context.get(), formatRecord, nclxProfile);
+        }
+
+        ScopedLcmsProfile workingSpaceProfile = CreateWorkingSpaceColorProfile(
+            context.get(),
+            globals->loadOptions.workingSpace,
+            linear);
+
+        if (!documentProfile ||
+            !workingSpaceProfile ||
+            ColorProfilesAreEquivalent(documentProfile.get(), workingSpaceProfile.get()))
+        {
+            return nullptr;
+        }
+
+        // Profiles that are not matrix/TRC profiles are kept, the host can convert them.
+        return TryCreateMatrixShaperTransform(
+            documentProfile.get(),
+            workingSpaceProfile.get(),
+            alphaState != AlphaState::None,
+            formatRecord->depth);
+    }
 }
 
 OSErr DoReadPrepare(FormatRecordPtr formatRecord)
@@ -275,7 +366,7 @@ OSErr DoReadStart(FormatRecordPtr formatRecord, Globals* globals)
 
                 RevertInfo* revertInfo = reinterpret_cast<RevertInfo*>(lock.data());
 
-                if (revertInfo->version == 1)
+                if (revertInfo->version == 1 || revertInfo->version == 2)
                 {
                     switch (revertInfo->format)
                     {
@@ -287,9 +378,20 @@ OSErr DoReadStart(FormatRecordPtr formatRecord, Globals* globals)
                         globals->loadOptions.pq = revertInfo->pq;
                         showPQImportDialog = false;
                         break;
+                    case LoadOptionsHDRFormat::Unknown:
+                        if (revertInfo->version == 1)
+                        {
+                            throw std::runtime_error("Unsupported LoadOptionsHDRFormat value.");
+                        }
+                        break;
                     default:
                         throw std::runtime_error("Unsupported LoadOptionsHDRFormat value.");
                     }
+
+                    if (revertInfo->version == 2)
+                    {
+                        globals->loadOptions.workingSpace = revertInfo->workingSpace;
+                    }
                 }
                 else if (revertInfo->version == 0)
                 {
@@ -520,6 +622,12 @@ OSErr DoReadStart(FormatRecordPtr formatRecord, Globals* globals)
                 formatRecord->transparencyPlane = formatRecord->planes - 1;
             }
 
+            if (globals->loadOptions.workingSpace != LoadOptionsWorkingSpace::Embedded &&
+                formatRecord->revertInfo == nullptr)
+            {
+                SetRevertInfo(formatRecord, globals->loadOptions);
+            }
+
             // The context, image handle and image must remain valid until DoReadFinish is called.
             // The image data and meta-data will be set in DoReadContinue.
             globals->context = context.release();
@@ -584,15 +692,27 @@ OSErr DoReadContinue(FormatRecordPtr formatRecord, Globals* globals)
 
         const AlphaState alphaState = GetAlphaState(globals->imageHandle);
 
+        const std::unique_ptr<MatrixShaperTransform> workingSpaceTransform = TryCreateWorkingSpaceTransform(
+            formatRecord,
+            globals,
+            nclxProfile,
+            alphaState);
+
+        // HDR images are not remuxed, the conversion to 32-bit floating point cannot be reversed exactly.
+        // Images that are converted to the working space are not remuxed, the compressed image data
+        // is in the original color space.
+        RemuxSourceRecorder remuxSource(formatRecord, formatRecord->depth != 32 && workingSpaceTransform == nullptr);
+        HostImageHash& hostImageHash = remuxSource.GetHostImageHash();
+
         if (IsMonochromeImage(formatRecord))
         {
             switch (formatRecord->depth)
             {
             case 8:
-                ReadHeifImageGrayEightBit(globals->image, alphaState, nclxProfile, formatRecord);
+                ReadHeifImageGrayEightBit(globals->image, alphaState, nclxProfile, hostImageHash, formatRecord);
                 break;
             case 16:
-                ReadHeifImageGraySixteenBit(globals->image, alphaState, nclxProfile, formatRecord);
+                ReadHeifImageGraySixteenBit(globals->image, alphaState, nclxProfile, hostImageHash, formatRecord);
                 break;
             case 32:
                 ReadHeifImageGrayThirtyTwoBit(
@@ -611,16 +731,29 @@ OSErr DoReadContinue(FormatRecordPtr formatRecord, Globals* globals)
             switch (formatRecord->depth)
             {
             case 8:
-                ReadHeifImageRGBEightBit(globals->image, alphaState, nclxProfile, formatRecord);
+                ReadHeifImageRGBEightBit(
+                    globals->image,
+                    alphaState,
+                    nclxProfile,
+                    workingSpaceTransform.get(),
+                    hostImageHash,
+                    formatRecord);
                 break;
             case 16:
-                ReadHeifImageRGBSixteenBit(globals->image, alphaState, nclxProfile, formatRecord);
+                ReadHeifImageRGBSixteenBit(
+                    globals->image,
+                    alphaState,
+                    nclxProfile,
+                    workingSpaceTransform.get(),
+                    hostImageHash,
+                    formatRecord);
                 break;
             case 32:
                 ReadHeifImageRGBThirtyTwoBit(
                     globals->image,
                     alphaState,
                     nclxProfile,
+                    workingSpaceTransform.get(),
                     globals->loadOptions,
                     formatRecord);
                 break;
@@ -644,8 +777,12 @@ OSErr DoReadContinue(FormatRecordPtr formatRecord, Globals* globals)
             {
                 const heif_color_profile_type imageHandleProfileType = globals->imageHandleProfileType;
 
-                if (imageHandleProfileType == heif_color_profile_type_prof ||
-                    imageHandleProfileType == heif_color_profile_type_rICC)
+                if (workingSpaceTransform != nullptr)
+                {
+                    SetIccProfileFromWorkingSpace(formatRecord, globals->loadOptions.workingSpace);
+                }
+                else if (imageHandleProfileType == heif_color_profile_type_prof ||
+                         imageHandleProfileType == heif_color_profile_type_rICC)
                 {
                     ReadIccProfileMetadata(formatRecord, globals->imageHandle);
                 }
@@ -655,6 +792,11 @@ OSErr DoReadContinue(FormatRecordPtr formatRecord, Globals* globals)
                 }
             }
         }
+
+        remuxSource.Register(
+            formatRecord,
+            heif_image_handle_get_luma_bits_per_pixel(globals->imageHandle),
+            alphaState);
     }
     catch (const std::bad_alloc&)
     {
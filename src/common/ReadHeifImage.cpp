@@ -20,6 +20,7 @@
 
 #include "ReadHeifImage.h"
 #include "ColorTransfer.h"
+#include "MatrixShaperTransform.h"
 #include "PremultipliedAlpha.h"
 #include "ScopedBufferSuite.h"
 #include "Utilities.h"
@@ -80,10 +81,21 @@ namespace
         }
     }
 
+    void ConvertToWorkingSpace(const MatrixShaperTransform* workingSpaceTransform, void* row, int32 rowWidth)
+    {
+        // The row is converted while it is still in the cache from the YUV decode.
+        if (workingSpaceTransform != nullptr)
+        {
+            workingSpaceTransform->ConvertRow(row, static_cast<cmsUInt32Number>(rowWidth));
+        }
+    }
+
     void ReadHeifImageYUVEightBit(
         const heif_image* image,
         AlphaState alphaState,
         const heif_color_profile_nclx* nclxProfile,
+        const MatrixShaperTransform* workingSpaceTransform,
+        HostImageHash& hostImageHash,
         FormatRecordPtr formatRecord)
     {
         const heif_chroma chroma = heif_image_get_chroma_format(image);
@@ -151,11 +163,15 @@ namespace
                 DecodeYUV8RowToRGBA8(srcY, srcCb, srcCr, srcAlpha, alphaPremultiplied,
                     dst, imageSize.h, xChromaShift, yuvCoefficiants, tables);
 
+                ConvertToWorkingSpace(workingSpaceTransform, dst, imageSize.h);
+
                 const int32 top = y;
                 const int32 bottom = y + 1;
 
                 SetRect(formatRecord, top, left, bottom, right);
 
+                hostImageHash.AddRow(formatRecord);
+
                 OSErrException::ThrowIfError(formatRecord->advanceState());
             }
         }
@@ -173,11 +189,15 @@ namespace
                 DecodeYUV8RowToRGB8(srcY, srcCb, srcCr, dst, imageSize.h, xChromaShift,
                     yuvCoefficiants, tables);
 
+                ConvertToWorkingSpace(workingSpaceTransform, dst, imageSize.h);
+
                 const int32 top = y;
                 const int32 bottom = y + 1;
 
                 SetRect(formatRecord, top, left, bottom, right);
 
+                hostImageHash.AddRow(formatRecord);
+
                 OSErrException::ThrowIfError(formatRecord->advanceState());
             }
         }
@@ -187,6 +207,8 @@ namespace
         const heif_image* image,
         AlphaState alphaState,
         const heif_color_profile_nclx* nclxProfile,
+        const MatrixShaperTransform* workingSpaceTransform,
+        HostImageHash& hostImageHash,
         FormatRecordPtr formatRecord)
     {
         const heif_chroma chroma = heif_image_get_chroma_format(image);
@@ -255,11 +277,15 @@ namespace
                 DecodeYUV16RowToRGBA16(srcY, srcCb, srcCr, srcAlpha, alphaPremultiplied,
                     dst, imageSize.h, xChromaShift, yuvCoefficiants, tables);
 
+                ConvertToWorkingSpace(workingSpaceTransform, dst, imageSize.h);
+
                 const int32 top = y;
                 const int32 bottom = y + 1;
 
                 SetRect(formatRecord, top, left, bottom, right);
 
+                hostImageHash.AddRow(formatRecord);
+
                 OSErrException::ThrowIfError(formatRecord->advanceState());
             }
         }
@@ -277,11 +303,15 @@ namespace
                 DecodeYUV16RowToRGB16(srcY, srcCb, srcCr, dst, imageSize.h, xChromaShift,
                     yuvCoefficiants, tables);
 
+                ConvertToWorkingSpace(workingSpaceTransform, dst, imageSize.h);
+
                 const int32 top = y;
                 const int32 bottom = y + 1;
 
                 SetRect(formatRecord, top, left, bottom, right);
 
+                hostImageHash.AddRow(formatRecord);
+
                 OSErrException::ThrowIfError(formatRecord->advanceState());
             }
         }
@@ -291,6 +321,7 @@ namespace
         const heif_image* image,
         AlphaState alphaState,
         const heif_color_profile_nclx* nclxProfile,
+        const MatrixShaperTransform* workingSpaceTransform,
         FormatRecordPtr formatRecord,
         ColorTransferFunction transferFunction,
         const LoadUIOptions& loadOptions)
@@ -367,6 +398,8 @@ namespace
                 DecodeYUV16RowToRGBA32(srcY, srcCb, srcCr, srcAlpha, alphaPremultiplied,
                     dst, imageSize.h, xChromaShift, yuvCoefficiants, tables, transferFunction, loadOptions, hlgLumaCoefficiants);
 
+                ConvertToWorkingSpace(workingSpaceTransform, dst, imageSize.h);
+
                 const int32 top = y;
                 const int32 bottom = y + 1;
 
@@ -389,6 +422,8 @@ namespace
                 DecodeYUV16RowToRGB32(srcY, srcCb, srcCr, dst, imageSize.h, xChromaShift,
                     yuvCoefficiants, tables, transferFunction, loadOptions, hlgLumaCoefficiants);
 
+                ConvertToWorkingSpace(workingSpaceTransform, dst, imageSize.h);
+
                 const int32 top = y;
                 const int32 bottom = y + 1;
 
@@ -419,6 +454,7 @@ void ReadHeifImageGrayEightBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    HostImageHash& hostImageHash,
     FormatRecordPtr formatRecord)
 {
     const VPoint imageSize = GetImageSize(formatRecord);
@@ -464,6 +500,8 @@ void ReadHeifImageGrayEightBit(
 
             SetRect(formatRecord, top, left, bottom, right);
 
+            hostImageHash.AddRow(formatRecord);
+
             OSErrException::ThrowIfError(formatRecord->advanceState());
         }
     }
@@ -481,6 +519,8 @@ void ReadHeifImageGrayEightBit(
 
             SetRect(formatRecord, top, left, bottom, right);
 
+            hostImageHash.AddRow(formatRecord);
+
             OSErrException::ThrowIfError(formatRecord->advanceState());
         }
     }
@@ -490,6 +530,7 @@ void ReadHeifImageGraySixteenBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    HostImageHash& hostImageHash,
     FormatRecordPtr formatRecord)
 {
     const VPoint imageSize = GetImageSize(formatRecord);
@@ -536,6 +577,8 @@ void ReadHeifImageGraySixteenBit(
 
             SetRect(formatRecord, top, left, bottom, right);
 
+            hostImageHash.AddRow(formatRecord);
+
             OSErrException::ThrowIfError(formatRecord->advanceState());
         }
     }
@@ -553,6 +596,8 @@ void ReadHeifImageGraySixteenBit(
 
             SetRect(formatRecord, top, left, bottom, right);
 
+            hostImageHash.AddRow(formatRecord);
+
             OSErrException::ThrowIfError(formatRecord->advanceState());
         }
     }
@@ -562,6 +607,8 @@ void ReadHeifImageRGBEightBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    const MatrixShaperTransform* workingSpaceTransform,
+    HostImageHash& hostImageHash,
     FormatRecordPtr formatRecord)
 {
     const heif_colorspace colorspace = heif_image_get_colorspace(image);
@@ -569,7 +616,7 @@ void ReadHeifImageRGBEightBit(
     // The image color space can be either YCbCr or RGB.
     if (colorspace == heif_colorspace_YCbCr)
     {
-        ReadHeifImageYUVEightBit(image, alphaState, nclxProfile, formatRecord);
+        ReadHeifImageYUVEightBit(image, alphaState, nclxProfile, workingSpaceTransform, hostImageHash, formatRecord);
         return;
     }
     else if (colorspace != heif_colorspace_RGB)
@@ -595,8 +642,6 @@ void ReadHeifImageRGBEightBit(
 
     SetupFormatRecord(formatRecord, imageSize);
 
-    constexpr uint8_t rgbMaxValue = 255;
-
     int rPlaneStride;
     const uint8_t* rPlaneScan0 = heif_image_get_plane_readonly(image, heif_channel_R, &rPlaneStride);
 
@@ -635,34 +680,10 @@ void ReadHeifImageRGBEightBit(
 
             for (int32 x = 0; x < imageSize.h; x++)
             {
-                uint8_t r = *srcR;
-                uint8_t g = *srcG;
-                uint8_t b = *srcB;
-                uint8_t a = *srcAlpha;
-
-                if (alphaPremultiplied)
-                {
-                    if (a < rgbMaxValue)
-                    {
-                        if (a == 0)
-                        {
-                            r = 0;
-                            g = 0;
-                            b = 0;
-                        }
-                        else
-                        {
-                            r = UnpremultiplyColor(r, a);
-                            g = UnpremultiplyColor(g, a);
-                            b = UnpremultiplyColor(b, a);
-                        }
-                    }
-                }
-
-                dst[0] = r;
-                dst[1] = g;
-                dst[2] = b;
-                dst[3] = a;
+                dst[0] = *srcR;
+                dst[1] = *srcG;
+                dst[2] = *srcB;
+                dst[3] = *srcAlpha;
 
                 srcR++;
                 srcG++;
@@ -671,11 +692,18 @@ void ReadHeifImageRGBEightBit(
                 dst += 4;
             }
 
+            if (alphaPremultiplied)
+            {
+                UnpremultiplyRow(static_cast<uint8_t*>(formatRecord->data), static_cast<size_t>(imageSize.h), 4);
+            }
+
             const int32 top = y;
             const int32 bottom = y + 1;
 
             SetRect(formatRecord, top, left, bottom, right);
 
+            hostImageHash.AddRow(formatRecord);
+
             OSErrException::ThrowIfError(formatRecord->advanceState());
         }
     }
@@ -706,6 +734,8 @@ void ReadHeifImageRGBEightBit(
 
             SetRect(formatRecord, top, left, bottom, right);
 
+            hostImageHash.AddRow(formatRecord);
+
             OSErrException::ThrowIfError(formatRecord->advanceState());
         }
     }
@@ -715,6 +745,8 @@ void ReadHeifImageRGBSixteenBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    const MatrixShaperTransform* workingSpaceTransform,
+    HostImageHash& hostImageHash,
     FormatRecordPtr formatRecord)
 {
     const heif_colorspace colorspace = heif_image_get_colorspace(image);
@@ -722,7 +754,7 @@ void ReadHeifImageRGBSixteenBit(
     // The image color space can be either YCbCr or RGB.
     if (colorspace == heif_colorspace_YCbCr)
     {
-        ReadHeifImageYUVSixteenBit(image, alphaState, nclxProfile, formatRecord);
+        ReadHeifImageYUVSixteenBit(image, alphaState, nclxProfile, workingSpaceTransform, hostImageHash, formatRecord);
         return;
     }
     else if (colorspace != heif_colorspace_RGB)
@@ -772,6 +804,7 @@ void ReadHeifImageRGBSixteenBit(
         int alphaStride;
         const uint8_t* alphaScan0 = heif_image_get_plane_readonly(image, heif_channel_Alpha, &alphaStride);
         const bool alphaPremultiplied = alphaState == AlphaState::Premultiplied;
+        const PremultipliedAlphaTable premultipliedAlphaTable(maxValue);
 
         for (int32 y = 0; y < imageSize.v; y++)
         {
@@ -784,34 +817,10 @@ void ReadHeifImageRGBSixteenBit(
 
             for (int32 x = 0; x < imageSize.h; x++)
             {
-                uint16_t r = *srcR & maxValue;
-                uint16_t g = *srcG & maxValue;
-                uint16_t b = *srcB & maxValue;
-                uint16_t a = *srcAlpha & maxValue;
-
-                if (alphaPremultiplied)
-                {
-                    if (a < maxValue)
-                    {
-                        if (a == 0)
-                        {
-                            r = 0;
-                            g = 0;
-                            b = 0;
-                        }
-                        else
-                        {
-                            r = UnpremultiplyColor(r, a, maxValue);
-                            g = UnpremultiplyColor(g, a, maxValue);
-                            b = UnpremultiplyColor(b, a, maxValue);
-                        }
-                    }
-                }
-
-                dst[0] = r;
-                dst[1] = g;
-                dst[2] = b;
-                dst[3] = a;
+                dst[0] = *srcR & maxValue;
+                dst[1] = *srcG & maxValue;
+                dst[2] = *srcB & maxValue;
+                dst[3] = *srcAlpha & maxValue;
 
                 srcR++;
                 srcG++;
@@ -820,11 +829,22 @@ void ReadHeifImageRGBSixteenBit(
                 dst += 4;
             }
 
+            if (alphaPremultiplied)
+            {
+                UnpremultiplyRow(
+                    static_cast<uint16_t*>(formatRecord->data),
+                    static_cast<size_t>(imageSize.h),
+                    4,
+                    premultipliedAlphaTable);
+            }
+
             const int32 top = y;
             const int32 bottom = y + 1;
 
             SetRect(formatRecord, top, left, bottom, right);
 
+            hostImageHash.AddRow(formatRecord);
+
             OSErrException::ThrowIfError(formatRecord->advanceState());
         }
     }
@@ -855,6 +875,8 @@ void ReadHeifImageRGBSixteenBit(
 
             SetRect(formatRecord, top, left, bottom, right);
 
+            hostImageHash.AddRow(formatRecord);
+
             OSErrException::ThrowIfError(formatRecord->advanceState());
         }
     }
@@ -950,6 +972,7 @@ void ReadHeifImageRGBThirtyTwoBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    const MatrixShaperTransform* workingSpaceTransform,
     const LoadUIOptions& loadOptions,
     FormatRecordPtr formatRecord)
 {
@@ -965,7 +988,14 @@ void ReadHeifImageRGBThirtyTwoBit(
     // The image color space can be either YCbCr or RGB.
     if (colorspace == heif_colorspace_YCbCr)
     {
-        ReadHeifImageYUVThirtyTwoBit(image, alphaState, nclxProfile, formatRecord, transferFunction, loadOptions);
+        ReadHeifImageYUVThirtyTwoBit(
+            image,
+            alphaState,
+            nclxProfile,
+            workingSpaceTransform,
+            formatRecord,
+            transferFunction,
+            loadOptions);
         return;
     }
     else if (colorspace != heif_colorspace_RGB)
@@ -1022,7 +1052,7 @@ void ReadHeifImageRGBThirtyTwoBit(
         const uint8_t* alphaScan0 = heif_image_get_plane_readonly(image, heif_channel_Alpha, &alphaStride);
         const bool alphaPremultiplied = alphaState == AlphaState::Premultiplied;
 
-        const uint16_t rgbMaxValue = (1 << redBitsPerPixel) - 1;
+        const PremultipliedAlphaTable premultipliedAlphaTable(static_cast<uint16_t>((1 << redBitsPerPixel) - 1));
 
         for (int32 y = 0; y < imageSize.v; y++)
         {
@@ -1042,21 +1072,9 @@ void ReadHeifImageRGBThirtyTwoBit(
 
                 if (alphaPremultiplied)
                 {
-                    if (unormA < rgbMaxValue)
-                    {
-                        if (unormA == 0)
-                        {
-                            unormR = 0;
-                            unormG = 0;
-                            unormB = 0;
-                        }
-                        else
-                        {
-                            unormR = UnpremultiplyColor(unormR, unormA, rgbMaxValue);
-                            unormG = UnpremultiplyColor(unormG, unormA, rgbMaxValue);
-                            unormB = UnpremultiplyColor(unormB, unormA, rgbMaxValue);
-                        }
-                    }
+                    unormR = premultipliedAlphaTable.Unpremultiply(unormR, unormA);
+                    unormG = premultipliedAlphaTable.Unpremultiply(unormG, unormA);
+                    unormB = premultipliedAlphaTable.Unpremultiply(unormB, unormA);
                 }
 
                 const float r = unormToFloatTable[unormR];
@@ -1075,15 +1093,6 @@ void ReadHeifImageRGBThirtyTwoBit(
                     dst[0] = HLGToLinear(r);
                     dst[1] = HLGToLinear(g);
                     dst[2] = HLGToLinear(b);
-
-                    if (loadOptions.hlg.applyOOTF)
-                    {
-                        ApplyHLGOOTF(
-                            dst,
-                            hlgLumaCoefficiants,
-                            loadOptions.hlg.displayGamma,
-                            static_cast<float>(loadOptions.hlg.nominalPeakBrightness));
-                    }
                     break;
                 case ColorTransferFunction::SMPTE428:
                     dst[0] = SMPTE428ToLinear(r);
@@ -1103,6 +1112,17 @@ void ReadHeifImageRGBThirtyTwoBit(
                 dst += 4;
             }
 
+            if (transferFunction == ColorTransferFunction::HLG && loadOptions.hlg.applyOOTF)
+            {
+                ApplyHLGOOTFRow(
+                    static_cast<float*>(formatRecord->data),
+                    static_cast<size_t>(imageSize.h),
+                    4,
+                    hlgLumaCoefficiants,
+                    loadOptions.hlg.displayGamma,
+                    static_cast<float>(loadOptions.hlg.nominalPeakBrightness));
+            }
+
             const int32 top = y;
             const int32 bottom = y + 1;
 
@@ -1142,15 +1162,6 @@ void ReadHeifImageRGBThirtyTwoBit(
                     dst[0] = HLGToLinear(r);
                     dst[1] = HLGToLinear(g);
                     dst[2] = HLGToLinear(b);
-
-                    if (loadOptions.hlg.applyOOTF)
-                    {
-                        ApplyHLGOOTF(
-                            dst,
-                            hlgLumaCoefficiants,
-                            loadOptions.hlg.displayGamma,
-                            static_cast<float>(loadOptions.hlg.nominalPeakBrightness));
-                    }
                     break;
                 case ColorTransferFunction::SMPTE428:
                     dst[0] = SMPTE428ToLinear(r);
@@ -1167,6 +1178,17 @@ void ReadHeifImageRGBThirtyTwoBit(
                 dst += 3;
             }
 
+            if (transferFunction == ColorTransferFunction::HLG && loadOptions.hlg.applyOOTF)
+            {
+                ApplyHLGOOTFRow(
+                    static_cast<float*>(formatRecord->data),
+                    static_cast<size_t>(imageSize.h),
+                    3,
+                    hlgLumaCoefficiants,
+                    loadOptions.hlg.displayGamma,
+                    static_cast<float>(loadOptions.hlg.nominalPeakBrightness));
+            }
+
             const int32 top = y;
             const int32 bottom = y + 1;
 
@@ -23,29 +23,41 @@
 
 #include "AvifFormat.h"
 #include "AlphaState.h"
+#include "RemuxPassthrough.h"
+
+class MatrixShaperTransform;
+
+// The RGB functions convert YCbCr images to the working space with workingSpaceTransform
+// when it is not null, RGB coded images are not converted.
 
 void ReadHeifImageGrayEightBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    HostImageHash& hostImageHash,
     FormatRecordPtr formatRecord);
 
 void ReadHeifImageRGBEightBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    const MatrixShaperTransform* workingSpaceTransform,
+    HostImageHash& hostImageHash,
     FormatRecordPtr formatRecord);
 
 void ReadHeifImageGraySixteenBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    HostImageHash& hostImageHash,
     FormatRecordPtr formatRecord);
 
 void ReadHeifImageRGBSixteenBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    const MatrixShaperTransform* workingSpaceTransform,
+    HostImageHash& hostImageHash,
     FormatRecordPtr formatRecord);
 
 void ReadHeifImageGrayThirtyTwoBit(
@@ -59,6 +71,7 @@ void ReadHeifImageRGBThirtyTwoBit(
     const heif_image* image,
     AlphaState alphaState,
     const heif_color_profile_nclx* nclxProfile,
+    const MatrixShaperTransform* workingSpaceTransform,
     const LoadUIOptions& loadOptions,
     FormatRecordPtr formatRecord);
 
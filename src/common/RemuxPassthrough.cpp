@@ -0,0 +1,2732 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "RemuxPassthrough.h"
+#include "EncodeToMemory.h"
+#include "FileIO.h"
+#include "HostMetadata.h"
+#include "LibHeifException.h"
+#include "OSErrException.h"
+#include "ScopedHandleSuite.h"
+#include "ScopedHeif.h"
+#include "Utilities.h"
+#include "WorkerEncode.h"
+#include "WriteHeifImage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    // Only the file layout is kept in memory, the compressed image data is read from the
+    // original file when it is remuxed. The least recently used files are discarded.
+    constexpr size_t maximumRemuxSourceCount = 16;
+
+    // The 'meta' box of a recorded file is read into memory, larger boxes are not supported.
+    constexpr uint64_t maximumMetaBoxSize = 16 * 1024 * 1024;
+
+    // The changed grid tiles are encoded in batches on worker threads, the progress uses the
+    // same range as the encode of a whole image.
+    constexpr size_t maximumConcurrentTileEncodes = 8;
+    constexpr int32 tileEncodeProgressStart = 50;
+    constexpr int32 tileEncodeProgressEnd = 75;
+    // The expected duration of the first batch, the later batches use the previous batch duration.
+    constexpr double firstTileBatchExpectedSeconds = 1.0;
+
+    constexpr uint32_t FourCC(const char (&value)[5]) noexcept
+    {
+        return (static_cast<uint32_t>(static_cast<uint8_t>(value[0])) << 24)
+             | (static_cast<uint32_t>(static_cast<uint8_t>(value[1])) << 16)
+             | (static_cast<uint32_t>(static_cast<uint8_t>(value[2])) << 8)
+             | static_cast<uint32_t>(static_cast<uint8_t>(value[3]));
+    }
+
+    constexpr uint64_t RotateLeft(uint64_t value, int count) noexcept
+    {
+        return (value << count) | (value >> (64 - count));
+    }
+
+    // The SplitMix64 finalizer.
+    constexpr uint64_t MixBits(uint64_t value) noexcept
+    {
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+        return value ^ (value >> 31);
+    }
+
+    constexpr uint64_t HashWord(uint64_t lane, uint64_t word) noexcept
+    {
+        return RotateLeft((lane ^ word) * 0x9E3779B97F4A7C15ULL, 31);
+    }
+
+    uint64_t HashBytes(uint64_t seed, const uint8_t* data, size_t size) noexcept
+    {
+        // Four independent lanes allow the multiplications to overlap.
+        uint64_t lanes[4] =
+        {
+            seed ^ 0x243F6A8885A308D3ULL,
+            seed ^ 0x13198A2E03707344ULL,
+            seed ^ 0xA4093822299F31D0ULL,
+            seed ^ 0x082EFA98EC4E6C89ULL
+        };
+
+        size_t offset = 0;
+
+        for (; offset + 32 <= size; offset += 32)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                uint64_t word;
+                memcpy(&word, data + offset + (i * 8), sizeof(word));
+
+                lanes[i] = HashWord(lanes[i], word);
+            }
+        }
+
+        for (; offset < size; offset += 8)
+        {
+            uint64_t word = 0;
+            memcpy(&word, data + offset, std::min<size_t>(8, size - offset));
+
+            lanes[0] = HashWord(lanes[0], word);
+        }
+
+        return MixBits(lanes[0] ^ RotateLeft(lanes[1], 16) ^ RotateLeft(lanes[2], 32) ^ RotateLeft(lanes[3], 48) ^ size);
+    }
+
+    class BoxReader
+    {
+    public:
+
+        BoxReader(const uint8_t* data, size_t size) noexcept
+            : data(data), size(size), offset(0)
+        {
+        }
+
+        bool IsAtEnd() const noexcept
+        {
+            return offset == size;
+        }
+
+        size_t GetRemaining() const noexcept
+        {
+            return size - offset;
+        }
+
+        const uint8_t* GetCurrent() const noexcept
+        {
+            return data + offset;
+        }
+
+        const uint8_t* ReadBytes(size_t count)
+        {
+            if (count > GetRemaining())
+            {
+                throw std::runtime_error("Unexpected end of box.");
+            }
+
+            const uint8_t* bytes = data + offset;
+            offset += count;
+
+            return bytes;
+        }
+
+        uint8_t ReadUInt8()
+        {
+            return *ReadBytes(1);
+        }
+
+        uint16_t ReadUInt16()
+        {
+            return static_cast<uint16_t>(ReadUInt(2));
+        }
+
+        uint32_t ReadUInt32()
+        {
+            return static_cast<uint32_t>(ReadUInt(4));
+        }
+
+        // Reads a big-endian unsigned integer, a byte count of zero returns zero.
+        uint64_t ReadUInt(int byteCount)
+        {
+            if (byteCount > 8)
+            {
+                throw std::runtime_error("Unsupported integer size.");
+            }
+
+            const uint8_t* bytes = ReadBytes(static_cast<size_t>(byteCount));
+
+            uint64_t value = 0;
+
+            for (int i = 0; i < byteCount; i++)
+            {
+                value = (value << 8) | bytes[i];
+            }
+
+            return value;
+        }
+
+        std::string ReadString()
+        {
+            const uint8_t* start = GetCurrent();
+            const uint8_t* end = static_cast<const uint8_t*>(memchr(start, 0, GetRemaining()));
+
+            if (end == nullptr)
+            {
+                throw std::runtime_error("Unterminated string in box.");
+            }
+
+            const size_t length = static_cast<size_t>(end - start);
+            ReadBytes(length + 1);
+
+            return std::string(reinterpret_cast<const char*>(start), length);
+        }
+
+        void ReadFullBoxHeader(uint8_t& version, uint32_t& flags)
+        {
+            version = ReadUInt8();
+            flags = static_cast<uint32_t>(ReadUInt(3));
+        }
+
+    private:
+
+        const uint8_t* data;
+        size_t size;
+        size_t offset;
+    };
+
+    class BoxWriter
+    {
+    public:
+
+        void WriteUInt8(uint8_t value)
+        {
+            data.push_back(value);
+        }
+
+        void WriteUInt16(uint16_t value)
+        {
+            WriteUInt(value, 2);
+        }
+
+        void WriteUInt32(uint32_t value)
+        {
+            WriteUInt(value, 4);
+        }
+
+        // Writes a big-endian unsigned integer, a byte count of zero writes nothing.
+        void WriteUInt(uint64_t value, int byteCount)
+        {
+            for (int i = byteCount - 1; i >= 0; i--)
+            {
+                data.push_back(static_cast<uint8_t>(value >> (i * 8)));
+            }
+        }
+
+        void WriteBytes(const std::vector<uint8_t>& bytes)
+        {
+            data.insert(data.end(), bytes.begin(), bytes.end());
+        }
+
+        void WriteString(const char* value)
+        {
+            data.insert(data.end(), value, value + strlen(value) + 1);
+        }
+
+        size_t BeginBox(uint32_t type)
+        {
+            const size_t start = data.size();
+
+            WriteUInt32(0);
+            WriteUInt32(type);
+
+            return start;
+        }
+
+        size_t BeginFullBox(uint32_t type, uint8_t version, uint32_t flags)
+        {
+            const size_t start = BeginBox(type);
+
+            WriteUInt8(version);
+            WriteUInt(flags, 3);
+
+            return start;
+        }
+
+        void EndBox(size_t start)
+        {
+            const size_t boxSize = data.size() - start;
+
+            if (boxSize > std::numeric_limits<uint32_t>::max())
+            {
+                throw std::runtime_error("The box is too large.");
+            }
+
+            for (size_t i = 0; i < 4; i++)
+            {
+                data[start + i] = static_cast<uint8_t>(boxSize >> ((3 - i) * 8));
+            }
+        }
+
+        const std::vector<uint8_t>& GetData() const noexcept
+        {
+            return data;
+        }
+
+    private:
+
+        std::vector<uint8_t> data;
+    };
+
+    // A view of a box in a memory buffer.
+    struct Box
+    {
+        uint32_t type;
+        const uint8_t* start;
+        size_t size;
+        const uint8_t* payload;
+        size_t payloadSize;
+
+        std::vector<uint8_t> GetBytes() const
+        {
+            return std::vector<uint8_t>(start, start + size);
+        }
+    };
+
+    std::vector<Box> ReadBoxes(const uint8_t* data, size_t size)
+    {
+        std::vector<Box> boxes;
+        BoxReader reader(data, size);
+
+        while (!reader.IsAtEnd())
+        {
+            const uint8_t* start = reader.GetCurrent();
+            const size_t remaining = reader.GetRemaining();
+
+            uint64_t boxSize = reader.ReadUInt32();
+            const uint32_t type = reader.ReadUInt32();
+
+            if (boxSize == 1)
+            {
+                boxSize = reader.ReadUInt(8);
+            }
+            else if (boxSize == 0)
+            {
+                // The box extends to the end of the data.
+                boxSize = remaining;
+            }
+
+            if (type == FourCC("uuid"))
+            {
+                reader.ReadBytes(16);
+            }
+
+            const size_t headerSize = remaining - reader.GetRemaining();
+
+            if (boxSize < headerSize || boxSize > remaining)
+            {
+                throw std::runtime_error("Invalid box size.");
+            }
+
+            const size_t payloadSize = static_cast<size_t>(boxSize) - headerSize;
+
+            boxes.push_back({ type, start, static_cast<size_t>(boxSize), reader.ReadBytes(payloadSize), payloadSize });
+        }
+
+        return boxes;
+    }
+
+    std::vector<Box> ReadChildBoxes(const Box& box, bool fullBox)
+    {
+        BoxReader reader(box.payload, box.payloadSize);
+
+        if (fullBox)
+        {
+            reader.ReadBytes(4);
+        }
+
+        return ReadBoxes(reader.GetCurrent(), reader.GetRemaining());
+    }
+
+    struct ItemInfo
+    {
+        uint32_t id;
+        uint32_t type;
+        std::string contentType;
+        std::vector<uint8_t> infeBox;
+    };
+
+    struct ItemLocation
+    {
+        uint32_t itemId;
+        uint8_t constructionMethod;
+        uint64_t baseOffset;
+        std::vector<std::pair<uint64_t, uint64_t>> extents;
+    };
+
+    struct ItemReference
+    {
+        uint32_t type;
+        uint32_t fromItemId;
+        std::vector<uint32_t> toItemIds;
+    };
+
+    struct PropertyAssociation
+    {
+        // The one-based index of the property in the 'ipco' box.
+        uint32_t propertyIndex;
+        bool essential;
+    };
+
+    using PropertyAssociationMap = std::map<uint32_t, std::vector<PropertyAssociation>>;
+
+    struct RemuxItem
+    {
+        ItemInfo info;
+        bool hasData;
+        std::vector<uint8_t> data;
+        // The absolute file offset and length of the item data that has not been read yet.
+        std::vector<std::pair<uint64_t, uint64_t>> fileExtents;
+    };
+
+    struct GridTileLayout
+    {
+        uint32_t columns;
+        uint32_t rows;
+        uint32_t tileWidth;
+        uint32_t tileHeight;
+        std::vector<uint32_t> tileItemIds;
+        // The NCLX color information that is used to convert the tiles to YUV.
+        heif_color_primaries colorPrimaries;
+        heif_transfer_characteristics transferCharacteristics;
+        heif_matrix_coefficients matrixCoefficients;
+        bool fullRange;
+    };
+}
+
+struct RemuxSource
+{
+    uint64_t hostImageHash;
+    VPoint imageSize;
+    int16 imageMode;
+    int16 planes;
+    int16 depth;
+    int lumaBitsPerPixel;
+    AlphaState alphaState;
+
+    // The color tagging and coding format of the primary image, the save options must not change them.
+    bool hasIccProfile;
+    bool monochrome;
+    bool lossless;
+    ChromaSubsampling chromaSubsampling;
+
+    // The file that the image data is read from, the file is not used if it has been modified.
+    std::filesystem::path filePath;
+    uint64_t fileSize;
+    std::filesystem::file_time_type fileWriteTime;
+
+    std::vector<uint8_t> ftypBox;
+    std::vector<uint8_t> hdlrBox;
+    uint32_t primaryItemId;
+    std::vector<RemuxItem> items;
+    std::vector<ItemReference> references;
+    std::vector<std::vector<uint8_t>> properties;
+    PropertyAssociationMap propertyAssociations;
+    // The 'meta' child boxes that do not need to be rewritten, e.g. 'dinf'.
+    std::vector<std::vector<uint8_t>> otherMetaBoxes;
+
+    // The tile layout is only set for grid images that support re-encoding individual tiles.
+    bool hasGridTileLayout;
+    GridTileLayout gridTileLayout;
+    std::vector<uint64_t> tileHostImageHashes;
+};
+
+namespace
+{
+    // The files are ordered from the most to the least recently used.
+    // The list is shared by the documents that are read and saved on different threads,
+    // the sources are copied out of the list while the mutex is held.
+    std::mutex remuxSourcesMutex;
+    std::list<RemuxSource> remuxSources;
+
+    bool IsSameRemuxSource(const RemuxSource& first, const RemuxSource& second)
+    {
+        return first.hostImageHash == second.hostImageHash
+            && first.filePath == second.filePath
+            && first.fileWriteTime == second.fileWriteTime;
+    }
+
+    // Moves the recorded file to the front of the list, or removes it if it can no longer be used.
+    void UpdateRemuxSourceUsage(const RemuxSource& source, bool remove)
+    {
+        std::lock_guard<std::mutex> lock(remuxSourcesMutex);
+
+        const auto existing = std::find_if(
+            remuxSources.begin(),
+            remuxSources.end(),
+            [&](const RemuxSource& item) { return IsSameRemuxSource(item, source); });
+
+        if (existing != remuxSources.end())
+        {
+            if (remove)
+            {
+                remuxSources.erase(existing);
+            }
+            else
+            {
+                remuxSources.splice(remuxSources.begin(), remuxSources, existing);
+            }
+        }
+    }
+
+    uint32_t ReadItemId(BoxReader& reader, bool largeItemId)
+    {
+        return largeItemId ? reader.ReadUInt32() : reader.ReadUInt16();
+    }
+
+    uint32_t GetHandlerType(const Box& hdlr)
+    {
+        BoxReader reader(hdlr.payload, hdlr.payloadSize);
+
+        // Skip the FullBox header and the pre_defined field.
+        reader.ReadBytes(8);
+
+        return reader.ReadUInt32();
+    }
+
+    uint32_t ParsePrimaryItem(const Box& pitm)
+    {
+        BoxReader reader(pitm.payload, pitm.payloadSize);
+
+        uint8_t version;
+        uint32_t flags;
+        reader.ReadFullBoxHeader(version, flags);
+
+        return ReadItemId(reader, version != 0);
+    }
+
+    std::vector<ItemLocation> ParseItemLocations(const Box& iloc)
+    {
+        BoxReader reader(iloc.payload, iloc.payloadSize);
+
+        uint8_t version;
+        uint32_t flags;
+        reader.ReadFullBoxHeader(version, flags);
+
+        if (version > 2)
+        {
+            throw std::runtime_error("Unsupported 'iloc' box version.");
+        }
+
+        const uint8_t offsetAndLengthSize = reader.ReadUInt8();
+        const uint8_t baseOffsetAndIndexSize = reader.ReadUInt8();
+
+        const int offsetSize = offsetAndLengthSize >> 4;
+        const int lengthSize = offsetAndLengthSize & 15;
+        const int baseOffsetSize = baseOffsetAndIndexSize >> 4;
+        const int indexSize = version != 0 ? baseOffsetAndIndexSize & 15 : 0;
+
+        const uint32_t itemCount = version < 2 ? reader.ReadUInt16() : reader.ReadUInt32();
+
+        std::vector<ItemLocation> locations;
+        locations.reserve(itemCount);
+
+        for (uint32_t i = 0; i < itemCount; i++)
+        {
+            ItemLocation location{};
+            location.itemId = ReadItemId(reader, version == 2);
+
+            if (version != 0)
+            {
+                location.constructionMethod = static_cast<uint8_t>(reader.ReadUInt16() & 15);
+            }
+
+            const uint16_t dataReferenceIndex = reader.ReadUInt16();
+
+            // Only data in the same file, or in the 'idat' box is supported.
+            if (dataReferenceIndex != 0 || location.constructionMethod > 1)
+            {
+                throw std::runtime_error("Unsupported item location.");
+            }
+
+            location.baseOffset = reader.ReadUInt(baseOffsetSize);
+
+            const uint16_t extentCount = reader.ReadUInt16();
+
+            for (uint16_t j = 0; j < extentCount; j++)
+            {
+                reader.ReadUInt(indexSize);
+                const uint64_t extentOffset = reader.ReadUInt(offsetSize);
+                const uint64_t extentLength = reader.ReadUInt(lengthSize);
+
+                // An extent length of zero refers to the rest of the file.
+                if (extentLength == 0)
+                {
+                    throw std::runtime_error("Unsupported item extent length.");
+                }
+
+                location.extents.emplace_back(extentOffset, extentLength);
+            }
+
+            locations.push_back(std::move(location));
+        }
+
+        return locations;
+    }
+
+    std::vector<ItemInfo> ParseItemInfo(const Box& iinf)
+    {
+        BoxReader reader(iinf.payload, iinf.payloadSize);
+
+        uint8_t version;
+        uint32_t flags;
+        reader.ReadFullBoxHeader(version, flags);
+
+        // Skip the entry count, the entries are read from the child boxes.
+        reader.ReadBytes(version == 0 ? 2 : 4);
+
+        std::vector<ItemInfo> items;
+
+        for (const Box& infe : ReadBoxes(reader.GetCurrent(), reader.GetRemaining()))
+        {
+            if (infe.type != FourCC("infe"))
+            {
+                continue;
+            }
+
+            BoxReader infeReader(infe.payload, infe.payloadSize);
+
+            uint8_t infeVersion;
+            uint32_t infeFlags;
+            infeReader.ReadFullBoxHeader(infeVersion, infeFlags);
+
+            if (infeVersion < 2)
+            {
+                throw std::runtime_error("Unsupported 'infe' box version.");
+            }
+
+            ItemInfo item{};
+            item.id = ReadItemId(infeReader, infeVersion != 2);
+
+            if (infeReader.ReadUInt16() != 0)
+            {
+                throw std::runtime_error("Protected items are not supported.");
+            }
+
+            item.type = infeReader.ReadUInt32();
+            infeReader.ReadString(); // item_name
+
+            if (item.type == FourCC("mime"))
+            {
+                item.contentType = infeReader.ReadString();
+            }
+
+            item.infeBox = infe.GetBytes();
+
+            items.push_back(std::move(item));
+        }
+
+        return items;
+    }
+
+    std::vector<ItemReference> ParseItemReferences(const Box& iref)
+    {
+        BoxReader reader(iref.payload, iref.payloadSize);
+
+        uint8_t version;
+        uint32_t flags;
+        reader.ReadFullBoxHeader(version, flags);
+
+        std::vector<ItemReference> references;
+
+        for (const Box& box : ReadBoxes(reader.GetCurrent(), reader.GetRemaining()))
+        {
+            BoxReader referenceReader(box.payload, box.payloadSize);
+
+            ItemReference reference{};
+            reference.type = box.type;
+            reference.fromItemId = ReadItemId(referenceReader, version != 0);
+
+            const uint16_t referenceCount = referenceReader.ReadUInt16();
+
+            for (uint16_t i = 0; i < referenceCount; i++)
+            {
+                reference.toItemIds.push_back(ReadItemId(referenceReader, version != 0));
+            }
+
+            references.push_back(std::move(reference));
+        }
+
+        return references;
+    }
+
+    void ParseItemPropertyAssociations(const Box& ipma, PropertyAssociationMap& associations, size_t propertyCount)
+    {
+        BoxReader reader(ipma.payload, ipma.payloadSize);
+
+        uint8_t version;
+        uint32_t flags;
+        reader.ReadFullBoxHeader(version, flags);
+
+        const uint32_t entryCount = reader.ReadUInt32();
+
+        for (uint32_t i = 0; i < entryCount; i++)
+        {
+            std::vector<PropertyAssociation>& itemAssociations = associations[ReadItemId(reader, version != 0)];
+
+            const uint8_t associationCount = reader.ReadUInt8();
+
+            for (uint8_t j = 0; j < associationCount; j++)
+            {
+                PropertyAssociation association{};
+
+                if ((flags & 1) != 0)
+                {
+                    const uint16_t value = reader.ReadUInt16();
+
+                    association.essential = (value & 0x8000) != 0;
+                    association.propertyIndex = value & 0x7fff;
+                }
+                else
+                {
+                    const uint8_t value = reader.ReadUInt8();
+
+                    association.essential = (value & 0x80) != 0;
+                    association.propertyIndex = value & 0x7f;
+                }
+
+                if (association.propertyIndex > propertyCount)
+                {
+                    throw std::runtime_error("Invalid item property index.");
+                }
+
+                // A property index of zero indicates that no property is associated.
+                if (association.propertyIndex != 0)
+                {
+                    itemAssociations.push_back(association);
+                }
+            }
+        }
+    }
+
+    // Gets the offset and length of each extent in the file or the 'idat' box, the item data is the
+    // concatenation of the extents.
+    std::vector<std::pair<uint64_t, uint64_t>> GetItemExtents(const ItemLocation& location, uint64_t sourceSize)
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> extents;
+
+        for (const auto& extent : location.extents)
+        {
+            const uint64_t offset = location.baseOffset + extent.first;
+            const uint64_t length = extent.second;
+
+            if (offset < extent.first || offset > sourceSize || length > sourceSize - offset)
+            {
+                throw std::runtime_error("The item data is outside of the file.");
+            }
+
+            extents.emplace_back(offset, length);
+        }
+
+        return extents;
+    }
+
+    std::vector<uint8_t> CopyExtents(const uint8_t* source, const std::vector<std::pair<uint64_t, uint64_t>>& extents)
+    {
+        std::vector<uint8_t> data;
+
+        for (const auto& extent : extents)
+        {
+            data.insert(data.end(), source + extent.first, source + extent.first + extent.second);
+        }
+
+        return data;
+    }
+
+    void ReadExtents(intptr_t refNum, RemuxItem& item)
+    {
+        for (const auto& extent : item.fileExtents)
+        {
+            const size_t offset = item.data.size();
+            item.data.resize(offset + static_cast<size_t>(extent.second));
+
+            OSErrException::ThrowIfError(SetFilePosition(refNum, static_cast<int64>(extent.first)));
+            OSErrException::ThrowIfError(ReadData(refNum, item.data.data() + offset, static_cast<size_t>(extent.second)));
+        }
+
+        item.fileExtents.clear();
+    }
+
+    Box GetPropertyBox(const std::vector<uint8_t>& property)
+    {
+        const std::vector<Box> boxes = ReadBoxes(property.data(), property.size());
+
+        if (boxes.size() != 1)
+        {
+            throw std::runtime_error("Invalid item property.");
+        }
+
+        return boxes[0];
+    }
+
+    uint32_t GetColorType(const Box& colr)
+    {
+        BoxReader reader(colr.payload, colr.payloadSize);
+
+        return reader.ReadUInt32();
+    }
+
+    // Returns the one-based index of the first property of the specified type that is associated
+    // with the item, or zero if there is no such property.
+    // The 'colr' properties can be filtered by their color type.
+    uint32_t FindItemProperty(
+        const std::vector<std::vector<uint8_t>>& properties,
+        const PropertyAssociationMap& propertyAssociations,
+        uint32_t itemId,
+        uint32_t propertyType,
+        uint32_t colorType = 0)
+    {
+        const auto itemAssociations = propertyAssociations.find(itemId);
+
+        if (itemAssociations != propertyAssociations.end())
+        {
+            for (const PropertyAssociation& association : itemAssociations->second)
+            {
+                const Box property = GetPropertyBox(properties[association.propertyIndex - 1]);
+
+                if (property.type == propertyType && (colorType == 0 || GetColorType(property) == colorType))
+                {
+                    return association.propertyIndex;
+                }
+            }
+        }
+
+        return 0;
+    }
+
+    const RemuxItem* FindItem(const std::vector<RemuxItem>& items, uint32_t itemId)
+    {
+        for (const RemuxItem& item : items)
+        {
+            if (item.info.id == itemId)
+            {
+                return &item;
+            }
+        }
+
+        return nullptr;
+    }
+
+    bool IsReplacedMetadataItem(const ItemInfo& item, const std::vector<ItemReference>& references, uint32_t primaryItemId)
+    {
+        const bool isExifOrXmp = item.type == FourCC("Exif")
+            || (item.type == FourCC("mime") && item.contentType == "application/rdf+xml");
+
+        if (isExifOrXmp)
+        {
+            for (const ItemReference& reference : references)
+            {
+                if (reference.type == FourCC("cdsc")
+                    && reference.fromItemId == item.id
+                    && std::find(reference.toItemIds.begin(), reference.toItemIds.end(), primaryItemId) != reference.toItemIds.end())
+                {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    // Gets the layout of a grid image whose tiles can be encoded individually.
+    bool TryGetGridTileLayout(const RemuxSource& source, GridTileLayout& layout)
+    {
+        const RemuxItem* grid = FindItem(source.items, source.primaryItemId);
+
+        if (grid->info.type != FourCC("grid") || !grid->hasData)
+        {
+            return false;
+        }
+
+        for (const ItemReference& reference : source.references)
+        {
+            // An alpha channel would have to be split into tiles as well.
+            if (reference.type == FourCC("auxl")
+                && std::find(reference.toItemIds.begin(), reference.toItemIds.end(), source.primaryItemId) != reference.toItemIds.end())
+            {
+                return false;
+            }
+        }
+
+        // The transformations change the mapping between the document and the tiles.
+        for (const uint32_t transformation : { FourCC("clap"), FourCC("irot"), FourCC("imir") })
+        {
+            if (FindItemProperty(source.properties, source.propertyAssociations, source.primaryItemId, transformation) != 0)
+            {
+                return false;
+            }
+        }
+
+        BoxReader reader(grid->data.data(), grid->data.size());
+
+        const uint8_t version = reader.ReadUInt8();
+        const uint8_t flags = reader.ReadUInt8();
+
+        if (version != 0)
+        {
+            return false;
+        }
+
+        layout.rows = reader.ReadUInt8() + 1U;
+        layout.columns = reader.ReadUInt8() + 1U;
+
+        const int outputSizeFieldLength = (flags & 1) != 0 ? 4 : 2;
+        const uint64_t outputWidth = reader.ReadUInt(outputSizeFieldLength);
+        const uint64_t outputHeight = reader.ReadUInt(outputSizeFieldLength);
+
+        const auto tiles = std::find_if(
+            source.references.begin(),
+            source.references.end(),
+            [&](const ItemReference& reference)
+            {
+                return reference.type == FourCC("dimg") && reference.fromItemId == source.primaryItemId;
+            });
+
+        if (tiles == source.references.end()
+            || tiles->toItemIds.size() != static_cast<size_t>(layout.rows) * layout.columns
+            || std::set<uint32_t>(tiles->toItemIds.begin(), tiles->toItemIds.end()).size() != tiles->toItemIds.size())
+        {
+            // Tiles that are used more than once cannot be replaced individually.
+            return false;
+        }
+
+        layout.tileItemIds = tiles->toItemIds;
+
+        for (size_t i = 0; i < layout.tileItemIds.size(); i++)
+        {
+            const uint32_t tileItemId = layout.tileItemIds[i];
+            const RemuxItem* tile = FindItem(source.items, tileItemId);
+
+            if (tile == nullptr || tile->info.type != FourCC("av01") || !tile->hasData)
+            {
+                return false;
+            }
+
+            const uint32_t ispe = FindItemProperty(source.properties, source.propertyAssociations, tileItemId, FourCC("ispe"));
+            const uint32_t av1C = FindItemProperty(source.properties, source.propertyAssociations, tileItemId, FourCC("av1C"));
+
+            if (ispe == 0 || av1C == 0)
+            {
+                return false;
+            }
+
+            const Box imageSpatialExtents = GetPropertyBox(source.properties[ispe - 1]);
+            BoxReader ispeReader(imageSpatialExtents.payload, imageSpatialExtents.payloadSize);
+            ispeReader.ReadBytes(4);
+
+            const uint32_t tileWidth = ispeReader.ReadUInt32();
+            const uint32_t tileHeight = ispeReader.ReadUInt32();
+
+            if (i == 0)
+            {
+                layout.tileWidth = tileWidth;
+                layout.tileHeight = tileHeight;
+            }
+            else if (tileWidth != layout.tileWidth || tileHeight != layout.tileHeight)
+            {
+                return false;
+            }
+        }
+
+        // The tiles in the last row and column may extend past the edge of the image.
+        if (layout.tileWidth == 0
+            || layout.tileHeight == 0
+            || static_cast<uint64_t>(layout.tileWidth) * layout.columns < outputWidth
+            || static_cast<uint64_t>(layout.tileWidth) * (layout.columns - 1) >= outputWidth
+            || static_cast<uint64_t>(layout.tileHeight) * layout.rows < outputHeight
+            || static_cast<uint64_t>(layout.tileHeight) * (layout.rows - 1) >= outputHeight)
+        {
+            return false;
+        }
+
+        // The replacement tiles must be converted to YUV with the same color information as the original tiles.
+        uint32_t nclx = FindItemProperty(
+            source.properties,
+            source.propertyAssociations,
+            source.primaryItemId,
+            FourCC("colr"),
+            FourCC("nclx"));
+
+        if (nclx == 0)
+        {
+            nclx = FindItemProperty(
+                source.properties,
+                source.propertyAssociations,
+                layout.tileItemIds[0],
+                FourCC("colr"),
+                FourCC("nclx"));
+
+            if (nclx == 0)
+            {
+                return false;
+            }
+        }
+
+        const Box colr = GetPropertyBox(source.properties[nclx - 1]);
+        BoxReader colrReader(colr.payload, colr.payloadSize);
+        colrReader.ReadBytes(4);
+
+        layout.colorPrimaries = static_cast<heif_color_primaries>(colrReader.ReadUInt16());
+        layout.transferCharacteristics = static_cast<heif_transfer_characteristics>(colrReader.ReadUInt16());
+        layout.matrixCoefficients = static_cast<heif_matrix_coefficients>(colrReader.ReadUInt16());
+        layout.fullRange = (colrReader.ReadUInt8() & 0x80) != 0;
+
+        return true;
+    }
+
+    // The EXIF and XMP items of the primary image are removed unless keepMetadataItems is true,
+    // they are replaced with the document meta-data when the file is remuxed.
+    // The data of the items that are stored in the file is not read, only their file extents are set.
+    RemuxSource ParseRemuxSourceBoxes(const Box& ftyp, const Box& meta, uint64_t fileSize, bool keepMetadataItems)
+    {
+        RemuxSource source{};
+        source.ftypBox = ftyp.GetBytes();
+
+        const std::vector<Box> metaBoxes = ReadChildBoxes(meta, true);
+
+        const Box* hdlr = nullptr;
+        const Box* pitm = nullptr;
+        const Box* iloc = nullptr;
+        const Box* iinf = nullptr;
+        const Box* iref = nullptr;
+        const Box* iprp = nullptr;
+        const Box* idat = nullptr;
+
+        for (const Box& box : metaBoxes)
+        {
+            switch (box.type)
+            {
+            case FourCC("hdlr"):
+                hdlr = &box;
+                break;
+            case FourCC("pitm"):
+                pitm = &box;
+                break;
+            case FourCC("iloc"):
+                iloc = &box;
+                break;
+            case FourCC("iinf"):
+                iinf = &box;
+                break;
+            case FourCC("iref"):
+                iref = &box;
+                break;
+            case FourCC("iprp"):
+                iprp = &box;
+                break;
+            case FourCC("idat"):
+                // The item data is moved to the 'mdat' box.
+                idat = &box;
+                break;
+            default:
+                source.otherMetaBoxes.push_back(box.GetBytes());
+                break;
+            }
+        }
+
+        if (hdlr == nullptr || pitm == nullptr || iloc == nullptr || iinf == nullptr || iprp == nullptr)
+        {
+            throw std::runtime_error("The file is missing a required 'meta' child box.");
+        }
+
+        if (GetHandlerType(*hdlr) != FourCC("pict"))
+        {
+            throw std::runtime_error("The 'meta' box does not use the 'pict' handler.");
+        }
+
+        source.hdlrBox = hdlr->GetBytes();
+        source.primaryItemId = ParsePrimaryItem(*pitm);
+
+        const std::vector<ItemLocation> locations = ParseItemLocations(*iloc);
+        const std::vector<ItemInfo> itemInfo = ParseItemInfo(*iinf);
+        const std::vector<ItemReference> references = iref != nullptr ? ParseItemReferences(*iref) : std::vector<ItemReference>();
+
+        PropertyAssociationMap propertyAssociations;
+
+        for (const Box& box : ReadChildBoxes(*iprp, false))
+        {
+            if (box.type == FourCC("ipco"))
+            {
+                for (const Box& property : ReadChildBoxes(box, false))
+                {
+                    source.properties.push_back(property.GetBytes());
+                }
+            }
+        }
+
+        for (const Box& box : ReadChildBoxes(*iprp, false))
+        {
+            if (box.type == FourCC("ipma"))
+            {
+                ParseItemPropertyAssociations(box, propertyAssociations, source.properties.size());
+            }
+        }
+
+        std::set<uint32_t> replacedItemIds;
+        bool hasPrimaryItem = false;
+
+        for (const ItemInfo& info : itemInfo)
+        {
+            if (info.id == source.primaryItemId)
+            {
+                // Grid images are supported because their tiles are copied unchanged.
+                if (info.type != FourCC("av01") && info.type != FourCC("grid"))
+                {
+                    throw std::runtime_error("The primary image is not an AV1 image.");
+                }
+
+                hasPrimaryItem = true;
+            }
+
+            if (!keepMetadataItems && IsReplacedMetadataItem(info, references, source.primaryItemId))
+            {
+                replacedItemIds.insert(info.id);
+                continue;
+            }
+
+            RemuxItem item{};
+            item.info = info;
+
+            for (const ItemLocation& location : locations)
+            {
+                if (location.itemId == info.id)
+                {
+                    item.hasData = true;
+
+                    if (location.constructionMethod == 1)
+                    {
+                        if (idat == nullptr)
+                        {
+                            throw std::runtime_error("The item data box is missing.");
+                        }
+
+                        item.data = CopyExtents(idat->payload, GetItemExtents(location, idat->payloadSize));
+                    }
+                    else
+                    {
+                        item.fileExtents = GetItemExtents(location, fileSize);
+                    }
+                    break;
+                }
+            }
+
+            source.items.push_back(std::move(item));
+        }
+
+        if (!hasPrimaryItem)
+        {
+            throw std::runtime_error("The primary item does not exist.");
+        }
+
+        for (const ItemReference& reference : references)
+        {
+            if (replacedItemIds.count(reference.fromItemId) != 0)
+            {
+                continue;
+            }
+
+            ItemReference keptReference = reference;
+
+            keptReference.toItemIds.erase(
+                std::remove_if(
+                    keptReference.toItemIds.begin(),
+                    keptReference.toItemIds.end(),
+                    [&](uint32_t id) { return replacedItemIds.count(id) != 0; }),
+                keptReference.toItemIds.end());
+
+            if (!keptReference.toItemIds.empty())
+            {
+                source.references.push_back(std::move(keptReference));
+            }
+        }
+
+        for (auto& entry : propertyAssociations)
+        {
+            if (replacedItemIds.count(entry.first) == 0)
+            {
+                source.propertyAssociations.insert(std::move(entry));
+            }
+        }
+
+        return source;
+    }
+
+    RemuxSource ParseRemuxSource(const std::vector<uint8_t>& file, bool keepMetadataItems)
+    {
+        const Box* ftyp = nullptr;
+        const Box* meta = nullptr;
+
+        const std::vector<Box> fileBoxes = ReadBoxes(file.data(), file.size());
+
+        for (const Box& box : fileBoxes)
+        {
+            if (box.type == FourCC("ftyp"))
+            {
+                ftyp = &box;
+            }
+            else if (box.type == FourCC("meta"))
+            {
+                if (meta != nullptr)
+                {
+                    throw std::runtime_error("The file has more than one 'meta' box.");
+                }
+
+                meta = &box;
+            }
+            else if (box.type == FourCC("moov"))
+            {
+                // The track data of image sequences refers to absolute file offsets.
+                throw std::runtime_error("Image sequences are not supported.");
+            }
+        }
+
+        if (ftyp == nullptr || meta == nullptr)
+        {
+            throw std::runtime_error("The file does not have the required 'ftyp' and 'meta' boxes.");
+        }
+
+        RemuxSource source = ParseRemuxSourceBoxes(*ftyp, *meta, file.size(), keepMetadataItems);
+
+        for (RemuxItem& item : source.items)
+        {
+            if (!item.fileExtents.empty())
+            {
+                item.data = CopyExtents(file.data(), item.fileExtents);
+                item.fileExtents.clear();
+            }
+        }
+
+        source.hasGridTileLayout = TryGetGridTileLayout(source, source.gridTileLayout);
+
+        return source;
+    }
+
+    // Reads the file layout without reading the compressed image data, the other item data
+    // is read because it may be needed to parse the layout.
+    RemuxSource ReadRemuxSourceLayout(intptr_t refNum, uint64_t fileSize)
+    {
+        std::vector<uint8_t> ftypBox;
+        std::vector<uint8_t> metaBox;
+        uint64_t position = 0;
+
+        while (position < fileSize)
+        {
+            const uint64_t remaining = fileSize - position;
+            uint8_t header[16] = {};
+
+            if (remaining < 8)
+            {
+                throw std::runtime_error("Invalid box size.");
+            }
+
+            OSErrException::ThrowIfError(SetFilePosition(refNum, static_cast<int64>(position)));
+            OSErrException::ThrowIfError(ReadData(refNum, header, 8));
+
+            BoxReader reader(header, sizeof(header));
+
+            uint64_t boxSize = reader.ReadUInt32();
+            const uint32_t type = reader.ReadUInt32();
+            uint64_t headerSize = 8;
+
+            if (boxSize == 1)
+            {
+                headerSize = 16;
+
+                if (remaining < headerSize)
+                {
+                    throw std::runtime_error("Invalid box size.");
+                }
+
+                OSErrException::ThrowIfError(ReadData(refNum, header + 8, 8));
+                boxSize = reader.ReadUInt(8);
+            }
+            else if (boxSize == 0)
+            {
+                // The box extends to the end of the file.
+                boxSize = remaining;
+            }
+
+            if (boxSize < headerSize || boxSize > remaining)
+            {
+                throw std::runtime_error("Invalid box size.");
+            }
+
+            if (type == FourCC("moov"))
+            {
+                // The track data of image sequences refers to absolute file offsets.
+                throw std::runtime_error("Image sequences are not supported.");
+            }
+
+            if (type == FourCC("ftyp") || type == FourCC("meta"))
+            {
+                std::vector<uint8_t>& box = type == FourCC("ftyp") ? ftypBox : metaBox;
+
+                if (!box.empty())
+                {
+                    throw std::runtime_error("The file has more than one 'ftyp' or 'meta' box.");
+                }
+
+                if (boxSize > maximumMetaBoxSize)
+                {
+                    throw std::runtime_error("The 'meta' box is too large.");
+                }
+
+                box.resize(static_cast<size_t>(boxSize));
+
+                OSErrException::ThrowIfError(SetFilePosition(refNum, static_cast<int64>(position)));
+                OSErrException::ThrowIfError(ReadData(refNum, box.data(), box.size()));
+            }
+
+            position += boxSize;
+        }
+
+        if (ftypBox.empty() || metaBox.empty())
+        {
+            throw std::runtime_error("The file does not have the required 'ftyp' and 'meta' boxes.");
+        }
+
+        const std::vector<Box> ftyp = ReadBoxes(ftypBox.data(), ftypBox.size());
+        const std::vector<Box> meta = ReadBoxes(metaBox.data(), metaBox.size());
+
+        RemuxSource source = ParseRemuxSourceBoxes(ftyp[0], meta[0], fileSize, false);
+
+        for (RemuxItem& item : source.items)
+        {
+            if (item.info.type != FourCC("av01"))
+            {
+                ReadExtents(refNum, item);
+            }
+        }
+
+        source.hasGridTileLayout = TryGetGridTileLayout(source, source.gridTileLayout);
+
+        return source;
+    }
+
+    // Reads the compressed image data of a recorded file.
+    // Returns false if the file has been modified or removed since it was read into the document.
+    bool TryReadRemuxSourceImageData(RemuxSource& source)
+    {
+        std::error_code errorCode;
+
+        const uintmax_t fileSize = std::filesystem::file_size(source.filePath, errorCode);
+
+        if (errorCode || fileSize != source.fileSize)
+        {
+            return false;
+        }
+
+        const std::filesystem::file_time_type fileWriteTime = std::filesystem::last_write_time(source.filePath, errorCode);
+
+        if (errorCode || fileWriteTime != source.fileWriteTime)
+        {
+            return false;
+        }
+
+        std::ifstream stream(source.filePath, std::ios::binary);
+
+        for (RemuxItem& item : source.items)
+        {
+            for (const auto& extent : item.fileExtents)
+            {
+                const size_t offset = item.data.size();
+                item.data.resize(offset + static_cast<size_t>(extent.second));
+
+                stream.seekg(static_cast<std::streamoff>(extent.first));
+                stream.read(reinterpret_cast<char*>(item.data.data() + offset), static_cast<std::streamsize>(extent.second));
+
+                if (!stream)
+                {
+                    return false;
+                }
+            }
+
+            item.fileExtents.clear();
+        }
+
+        return true;
+    }
+
+    ChromaSubsampling GetChromaSubsampling(const Box& av1C)
+    {
+        if (av1C.payloadSize < 4)
+        {
+            throw std::runtime_error("Invalid av1C property.");
+        }
+
+        const bool subsamplingX = (av1C.payload[2] & 0x08) != 0;
+        const bool subsamplingY = (av1C.payload[2] & 0x04) != 0;
+
+        if (subsamplingX && subsamplingY)
+        {
+            return ChromaSubsampling::Yuv420;
+        }
+        else if (subsamplingX)
+        {
+            return ChromaSubsampling::Yuv422;
+        }
+        else
+        {
+            return ChromaSubsampling::Yuv444;
+        }
+    }
+
+    // Sets the color tagging and coding format of the primary image, the tiles of a grid image
+    // must all use the same format.
+    void SetRemuxSourceCodingFormat(RemuxSource& source)
+    {
+        uint32_t codedItemId = source.primaryItemId;
+
+        if (FindItem(source.items, source.primaryItemId)->info.type == FourCC("grid"))
+        {
+            const auto tiles = std::find_if(
+                source.references.begin(),
+                source.references.end(),
+                [&](const ItemReference& reference)
+                {
+                    return reference.type == FourCC("dimg") && reference.fromItemId == source.primaryItemId;
+                });
+
+            if (tiles == source.references.end())
+            {
+                throw std::runtime_error("The grid image does not have any tiles.");
+            }
+
+            codedItemId = tiles->toItemIds[0];
+        }
+
+        const uint32_t av1C = FindItemProperty(source.properties, source.propertyAssociations, codedItemId, FourCC("av1C"));
+
+        if (av1C == 0)
+        {
+            throw std::runtime_error("The image does not have an av1C property.");
+        }
+
+        const Box codecConfiguration = GetPropertyBox(source.properties[av1C - 1]);
+
+        source.chromaSubsampling = GetChromaSubsampling(codecConfiguration);
+        source.monochrome = (codecConfiguration.payload[2] & 0x10) != 0;
+
+        source.hasIccProfile = FindItemProperty(
+            source.properties,
+            source.propertyAssociations,
+            source.primaryItemId,
+            FourCC("colr"),
+            FourCC("prof")) != 0
+            || FindItemProperty(
+                source.properties,
+                source.propertyAssociations,
+                source.primaryItemId,
+                FourCC("colr"),
+                FourCC("rICC")) != 0;
+
+        uint32_t nclx = FindItemProperty(
+            source.properties,
+            source.propertyAssociations,
+            source.primaryItemId,
+            FourCC("colr"),
+            FourCC("nclx"));
+
+        if (nclx == 0)
+        {
+            nclx = FindItemProperty(source.properties, source.propertyAssociations, codedItemId, FourCC("colr"), FourCC("nclx"));
+        }
+
+        // The lossless color images written by the plug-in use 4:4:4 chroma with the identity matrix,
+        // lossless monochrome images cannot be distinguished from lossy images.
+        source.lossless = false;
+
+        if (nclx != 0 && !source.monochrome && source.chromaSubsampling == ChromaSubsampling::Yuv444)
+        {
+            const Box colr = GetPropertyBox(source.properties[nclx - 1]);
+            BoxReader colrReader(colr.payload, colr.payloadSize);
+            colrReader.ReadBytes(8);
+
+            source.lossless = colrReader.ReadUInt16() == heif_matrix_coefficients_RGB_GBR;
+        }
+    }
+
+    bool IsIccColorProperty(const std::vector<uint8_t>& property)
+    {
+        const Box box = GetPropertyBox(property);
+
+        if (box.type != FourCC("colr"))
+        {
+            return false;
+        }
+
+        const uint32_t colorType = GetColorType(box);
+
+        return colorType == FourCC("prof") || colorType == FourCC("rICC");
+    }
+
+    std::vector<uint8_t> CreateIccColorProperty(const std::vector<uint8_t>& iccProfile)
+    {
+        BoxWriter writer;
+
+        const size_t colr = writer.BeginBox(FourCC("colr"));
+        writer.WriteUInt32(FourCC("prof"));
+        writer.WriteBytes(iccProfile);
+        writer.EndBox(colr);
+
+        return writer.GetData();
+    }
+
+    std::vector<uint8_t> CreateItemInfoEntry(uint32_t itemId, uint32_t itemType, const char* contentType)
+    {
+        BoxWriter writer;
+
+        const bool largeItemId = itemId > std::numeric_limits<uint16_t>::max();
+
+        const size_t infe = writer.BeginFullBox(FourCC("infe"), largeItemId ? 3 : 2, 0);
+        writer.WriteUInt(itemId, largeItemId ? 4 : 2);
+        writer.WriteUInt16(0); // item_protection_index
+        writer.WriteUInt32(itemType);
+        writer.WriteString(""); // item_name
+
+        if (contentType != nullptr)
+        {
+            writer.WriteString(contentType);
+        }
+
+        writer.EndBox(infe);
+
+        return writer.GetData();
+    }
+
+    struct RemuxOutputItem
+    {
+        uint32_t id;
+        std::vector<uint8_t> infeBox;
+        // The item data is owned by the RemuxSource or the caller, null if the item does not have any data.
+        const std::vector<uint8_t>* data;
+    };
+
+    struct RemuxOutput
+    {
+        std::vector<RemuxOutputItem> items;
+        std::vector<ItemReference> references;
+        std::vector<std::vector<uint8_t>> properties;
+        PropertyAssociationMap propertyAssociations;
+    };
+
+    RemuxOutput CopyRemuxSource(const RemuxSource& source, uint32_t& lastItemId)
+    {
+        RemuxOutput output;
+        lastItemId = 0;
+
+        for (const RemuxItem& item : source.items)
+        {
+            output.items.push_back({ item.info.id, item.info.infeBox, item.hasData ? &item.data : nullptr });
+            lastItemId = std::max(lastItemId, item.info.id);
+        }
+
+        output.references = source.references;
+        output.properties = source.properties;
+        output.propertyAssociations = source.propertyAssociations;
+
+        return output;
+    }
+
+    // A grid tile that was encoded again, the data is owned by the caller.
+    struct ReplacedItem
+    {
+        uint32_t itemId;
+        std::vector<uint8_t> data;
+        std::vector<uint8_t> codecConfiguration;
+    };
+
+    // Removes the properties that are not associated with any item and updates the property indices.
+    void RemoveUnusedProperties(RemuxOutput& output)
+    {
+        std::vector<uint32_t> newPropertyIndices(output.properties.size() + 1, 0);
+
+        for (const auto& entry : output.propertyAssociations)
+        {
+            for (const PropertyAssociation& association : entry.second)
+            {
+                newPropertyIndices[association.propertyIndex] = 1;
+            }
+        }
+
+        std::vector<std::vector<uint8_t>> usedProperties;
+
+        for (size_t i = 1; i < newPropertyIndices.size(); i++)
+        {
+            if (newPropertyIndices[i] != 0)
+            {
+                usedProperties.push_back(std::move(output.properties[i - 1]));
+                newPropertyIndices[i] = static_cast<uint32_t>(usedProperties.size());
+            }
+        }
+
+        for (auto& entry : output.propertyAssociations)
+        {
+            for (PropertyAssociation& association : entry.second)
+            {
+                association.propertyIndex = newPropertyIndices[association.propertyIndex];
+            }
+        }
+
+        output.properties = std::move(usedProperties);
+    }
+
+    // Makes the items share the first copy of identical properties, the other copies are removed.
+    void RemoveDuplicateProperties(RemuxOutput& output)
+    {
+        std::map<std::vector<uint8_t>, uint32_t> firstPropertyIndices;
+        std::vector<uint32_t> newPropertyIndices(output.properties.size() + 1, 0);
+
+        for (size_t i = 0; i < output.properties.size(); i++)
+        {
+            newPropertyIndices[i + 1] = firstPropertyIndices.emplace(output.properties[i], static_cast<uint32_t>(i + 1)).first->second;
+        }
+
+        for (auto& entry : output.propertyAssociations)
+        {
+            for (PropertyAssociation& association : entry.second)
+            {
+                association.propertyIndex = newPropertyIndices[association.propertyIndex];
+            }
+        }
+
+        RemoveUnusedProperties(output);
+    }
+
+    RemuxOutput CreateRemuxOutput(
+        const RemuxSource& source,
+        const std::vector<uint8_t>& iccProfile,
+        const std::vector<uint8_t>& exif,
+        const std::vector<uint8_t>& xmp,
+        const std::vector<ReplacedItem>& replacedItems)
+    {
+        uint32_t lastItemId;
+        RemuxOutput output = CopyRemuxSource(source, lastItemId);
+
+        for (const ReplacedItem& replacedItem : replacedItems)
+        {
+            for (RemuxOutputItem& item : output.items)
+            {
+                if (item.id == replacedItem.itemId)
+                {
+                    item.data = &replacedItem.data;
+                }
+            }
+
+            const uint32_t codecConfigurationIndex = FindItemProperty(
+                output.properties,
+                output.propertyAssociations,
+                replacedItem.itemId,
+                FourCC("av1C"));
+
+            if (output.properties[codecConfigurationIndex - 1] != replacedItem.codecConfiguration)
+            {
+                // The encoder may have written different sequence header OBUs, tiles with the same
+                // configuration share a property.
+                const auto existing = std::find(
+                    output.properties.begin(),
+                    output.properties.end(),
+                    replacedItem.codecConfiguration);
+
+                uint32_t newIndex;
+
+                if (existing != output.properties.end())
+                {
+                    newIndex = static_cast<uint32_t>(existing - output.properties.begin()) + 1;
+                }
+                else
+                {
+                    output.properties.push_back(replacedItem.codecConfiguration);
+                    newIndex = static_cast<uint32_t>(output.properties.size());
+                }
+
+                for (PropertyAssociation& association : output.propertyAssociations[replacedItem.itemId])
+                {
+                    if (association.propertyIndex == codecConfigurationIndex)
+                    {
+                        association.propertyIndex = newIndex;
+                    }
+                }
+            }
+        }
+
+        // The document color profile replaces the ICC profile of the original file, the NCLX
+        // color information describes the compressed image data and is always kept.
+        std::vector<PropertyAssociation>& primaryAssociations = output.propertyAssociations[source.primaryItemId];
+
+        primaryAssociations.erase(
+            std::remove_if(
+                primaryAssociations.begin(),
+                primaryAssociations.end(),
+                [&](const PropertyAssociation& association)
+                {
+                    return IsIccColorProperty(output.properties[association.propertyIndex - 1]);
+                }),
+            primaryAssociations.end());
+
+        if (!iccProfile.empty())
+        {
+            output.properties.push_back(CreateIccColorProperty(iccProfile));
+            primaryAssociations.push_back({ static_cast<uint32_t>(output.properties.size()), false });
+        }
+
+        const auto addMetadataItem = [&](const std::vector<uint8_t>& data, uint32_t itemType, const char* contentType)
+        {
+            if (lastItemId == std::numeric_limits<uint32_t>::max())
+            {
+                throw std::runtime_error("The file does not have any unused item ids.");
+            }
+
+            const uint32_t itemId = ++lastItemId;
+
+            output.items.push_back({ itemId, CreateItemInfoEntry(itemId, itemType, contentType), &data });
+            output.references.push_back({ FourCC("cdsc"), itemId, { source.primaryItemId } });
+        };
+
+        if (!exif.empty())
+        {
+            addMetadataItem(exif, FourCC("Exif"), nullptr);
+        }
+
+        if (!xmp.empty())
+        {
+            addMetadataItem(xmp, FourCC("mime"), "application/rdf+xml");
+        }
+
+        RemoveUnusedProperties(output);
+
+        return output;
+    }
+
+    // Adds the items of the thumbnail file with new item ids, the primary image of the thumbnail
+    // file becomes a thumbnail of the source primary image.
+    RemuxOutput CreateThumbnailOutput(const RemuxSource& source, const RemuxSource& thumbnail)
+    {
+        uint32_t lastItemId;
+        RemuxOutput output = CopyRemuxSource(source, lastItemId);
+
+        for (const RemuxItem& item : thumbnail.items)
+        {
+            if (item.info.id > std::numeric_limits<uint32_t>::max() - lastItemId)
+            {
+                throw std::runtime_error("The file does not have any unused item ids.");
+            }
+        }
+
+        const auto getItemId = [&](uint32_t thumbnailItemId)
+        {
+            return lastItemId + thumbnailItemId;
+        };
+
+        for (const RemuxItem& item : thumbnail.items)
+        {
+            const uint32_t itemId = getItemId(item.info.id);
+            const char* contentType = item.info.type == FourCC("mime") ? item.info.contentType.c_str() : nullptr;
+
+            output.items.push_back({
+                itemId,
+                CreateItemInfoEntry(itemId, item.info.type, contentType),
+                item.hasData ? &item.data : nullptr });
+
+            const auto itemAssociations = thumbnail.propertyAssociations.find(item.info.id);
+
+            if (itemAssociations != thumbnail.propertyAssociations.end())
+            {
+                std::vector<PropertyAssociation>& associations = output.propertyAssociations[itemId];
+
+                for (const PropertyAssociation& association : itemAssociations->second)
+                {
+                    output.properties.push_back(thumbnail.properties[association.propertyIndex - 1]);
+                    associations.push_back({ static_cast<uint32_t>(output.properties.size()), association.essential });
+                }
+            }
+        }
+
+        for (const ItemReference& reference : thumbnail.references)
+        {
+            ItemReference thumbnailReference{ reference.type, getItemId(reference.fromItemId), {} };
+
+            for (const uint32_t toItemId : reference.toItemIds)
+            {
+                thumbnailReference.toItemIds.push_back(getItemId(toItemId));
+            }
+
+            output.references.push_back(std::move(thumbnailReference));
+        }
+
+        output.references.push_back({ FourCC("thmb"), getItemId(thumbnail.primaryItemId), { source.primaryItemId } });
+
+        // The thumbnail file may contain the same properties as the source file.
+        RemoveDuplicateProperties(output);
+
+        return output;
+    }
+
+    std::vector<uint8_t> CreateMetaBox(
+        const RemuxSource& source,
+        const RemuxOutput& output,
+        uint64_t mediaDataOffset,
+        int offsetSize)
+    {
+        bool largeItemIds = false;
+
+        for (const RemuxOutputItem& item : output.items)
+        {
+            if (item.id > std::numeric_limits<uint16_t>::max())
+            {
+                largeItemIds = true;
+                break;
+            }
+        }
+
+        const int itemIdSize = largeItemIds ? 4 : 2;
+
+        BoxWriter writer;
+
+        const size_t meta = writer.BeginFullBox(FourCC("meta"), 0, 0);
+
+        writer.WriteBytes(source.hdlrBox);
+
+        const size_t pitm = writer.BeginFullBox(FourCC("pitm"), largeItemIds ? 1 : 0, 0);
+        writer.WriteUInt(source.primaryItemId, itemIdSize);
+        writer.EndBox(pitm);
+
+        // All of the item data is stored as a single extent in the 'mdat' box.
+        uint32_t locationCount = 0;
+
+        for (const RemuxOutputItem& item : output.items)
+        {
+            if (item.data != nullptr)
+            {
+                locationCount++;
+            }
+        }
+
+        const size_t iloc = writer.BeginFullBox(FourCC("iloc"), largeItemIds ? 2 : 0, 0);
+        writer.WriteUInt8(static_cast<uint8_t>((offsetSize << 4) | offsetSize));
+        writer.WriteUInt8(0); // The base offset and index are not used.
+        writer.WriteUInt(locationCount, itemIdSize);
+
+        uint64_t itemDataOffset = mediaDataOffset;
+
+        for (const RemuxOutputItem& item : output.items)
+        {
+            if (item.data != nullptr)
+            {
+                writer.WriteUInt(item.id, itemIdSize);
+                writer.WriteUInt16(0); // data_reference_index
+                writer.WriteUInt16(1); // extent_count
+                writer.WriteUInt(itemDataOffset, offsetSize);
+                writer.WriteUInt(item.data->size(), offsetSize);
+
+                itemDataOffset += item.data->size();
+            }
+        }
+
+        writer.EndBox(iloc);
+
+        const bool largeItemCount = output.items.size() > std::numeric_limits<uint16_t>::max();
+
+        const size_t iinf = writer.BeginFullBox(FourCC("iinf"), largeItemCount ? 1 : 0, 0);
+        writer.WriteUInt(output.items.size(), largeItemCount ? 4 : 2);
+
+        for (const RemuxOutputItem& item : output.items)
+        {
+            writer.WriteBytes(item.infeBox);
+        }
+
+        writer.EndBox(iinf);
+
+        if (!output.references.empty())
+        {
+            const size_t iref = writer.BeginFullBox(FourCC("iref"), largeItemIds ? 1 : 0, 0);
+
+            for (const ItemReference& reference : output.references)
+            {
+                if (reference.toItemIds.size() > std::numeric_limits<uint16_t>::max())
+                {
+                    throw std::runtime_error("The item has too many references.");
+                }
+
+                const size_t referenceBox = writer.BeginBox(reference.type);
+                writer.WriteUInt(reference.fromItemId, itemIdSize);
+                writer.WriteUInt16(static_cast<uint16_t>(reference.toItemIds.size()));
+
+                for (const uint32_t toItemId : reference.toItemIds)
+                {
+                    writer.WriteUInt(toItemId, itemIdSize);
+                }
+
+                writer.EndBox(referenceBox);
+            }
+
+            writer.EndBox(iref);
+        }
+
+        const size_t iprp = writer.BeginBox(FourCC("iprp"));
+        const size_t ipco = writer.BeginBox(FourCC("ipco"));
+
+        for (const std::vector<uint8_t>& property : output.properties)
+        {
+            writer.WriteBytes(property);
+        }
+
+        writer.EndBox(ipco);
+
+        if (output.properties.size() > 0x7fff)
+        {
+            throw std::runtime_error("The file has too many item properties.");
+        }
+
+        const bool largePropertyIndex = output.properties.size() > 0x7f;
+
+        uint32_t associationEntryCount = 0;
+
+        for (const auto& entry : output.propertyAssociations)
+        {
+            if (!entry.second.empty())
+            {
+                associationEntryCount++;
+            }
+        }
+
+        const size_t ipma = writer.BeginFullBox(FourCC("ipma"), largeItemIds ? 1 : 0, largePropertyIndex ? 1 : 0);
+        writer.WriteUInt32(associationEntryCount);
+
+        // The map keeps the entries in increasing item id order, as required by the specification.
+        for (const auto& entry : output.propertyAssociations)
+        {
+            if (entry.second.empty())
+            {
+                continue;
+            }
+
+            if (entry.second.size() > std::numeric_limits<uint8_t>::max())
+            {
+                throw std::runtime_error("The item has too many properties.");
+            }
+
+            writer.WriteUInt(entry.first, itemIdSize);
+            writer.WriteUInt8(static_cast<uint8_t>(entry.second.size()));
+
+            for (const PropertyAssociation& association : entry.second)
+            {
+                if (largePropertyIndex)
+                {
+                    writer.WriteUInt16(static_cast<uint16_t>((association.essential ? 0x8000 : 0) | association.propertyIndex));
+                }
+                else
+                {
+                    writer.WriteUInt8(static_cast<uint8_t>((association.essential ? 0x80 : 0) | association.propertyIndex));
+                }
+            }
+        }
+
+        writer.EndBox(ipma);
+        writer.EndBox(iprp);
+
+        for (const std::vector<uint8_t>& box : source.otherMetaBoxes)
+        {
+            writer.WriteBytes(box);
+        }
+
+        writer.EndBox(meta);
+
+        return writer.GetData();
+    }
+
+    void WriteRemuxedFile(intptr_t refNum, const RemuxSource& source, const RemuxOutput& output)
+    {
+        uint64_t mediaDataSize = 0;
+
+        for (const RemuxOutputItem& item : output.items)
+        {
+            if (item.data != nullptr)
+            {
+                mediaDataSize += item.data->size();
+            }
+        }
+
+        const bool largeMediaData = mediaDataSize + 8 > std::numeric_limits<uint32_t>::max();
+        const uint64_t mediaDataHeaderSize = largeMediaData ? 16 : 8;
+
+        // The size of the 'meta' box only depends on the size of the offset fields, so it is
+        // created once to find the start of the item data and again with the final offsets.
+        int offsetSize = 4;
+        std::vector<uint8_t> metaBox = CreateMetaBox(source, output, 0, offsetSize);
+        uint64_t mediaDataOffset = source.ftypBox.size() + metaBox.size() + mediaDataHeaderSize;
+
+        if (mediaDataOffset + mediaDataSize > std::numeric_limits<uint32_t>::max())
+        {
+            offsetSize = 8;
+            metaBox = CreateMetaBox(source, output, 0, offsetSize);
+            mediaDataOffset = source.ftypBox.size() + metaBox.size() + mediaDataHeaderSize;
+        }
+
+        metaBox = CreateMetaBox(source, output, mediaDataOffset, offsetSize);
+
+        BoxWriter mediaDataHeader;
+
+        if (largeMediaData)
+        {
+            mediaDataHeader.WriteUInt32(1);
+            mediaDataHeader.WriteUInt32(FourCC("mdat"));
+            mediaDataHeader.WriteUInt(mediaDataSize + mediaDataHeaderSize, 8);
+        }
+        else
+        {
+            mediaDataHeader.WriteUInt32(static_cast<uint32_t>(mediaDataSize + mediaDataHeaderSize));
+            mediaDataHeader.WriteUInt32(FourCC("mdat"));
+        }
+
+        OSErrException::ThrowIfError(WriteData(refNum, source.ftypBox.data(), source.ftypBox.size()));
+        OSErrException::ThrowIfError(WriteData(refNum, metaBox.data(), metaBox.size()));
+        OSErrException::ThrowIfError(WriteData(refNum, mediaDataHeader.GetData().data(), mediaDataHeader.GetData().size()));
+
+        for (const RemuxOutputItem& item : output.items)
+        {
+            if (item.data != nullptr && !item.data->empty())
+            {
+                OSErrException::ThrowIfError(WriteData(refNum, item.data->data(), item.data->size()));
+            }
+        }
+    }
+
+    std::vector<uint8_t> GetHandleData(const FormatRecordPtr formatRecord, Handle handle)
+    {
+        std::vector<uint8_t> data;
+
+        const int32 size = formatRecord->handleProcs->getSizeProc(handle);
+
+        if (size > 0)
+        {
+            ScopedHandleSuiteLock lock(formatRecord->handleProcs, handle);
+            const uint8_t* ptr = reinterpret_cast<const uint8_t*>(lock.data());
+
+            data.assign(ptr, ptr + size);
+        }
+
+        return data;
+    }
+
+    std::vector<uint8_t> GetExifItemData(const FormatRecordPtr formatRecord)
+    {
+        std::vector<uint8_t> data;
+
+        ScopedHandleSuiteHandle exif = GetExifMetadata(formatRecord);
+
+        if (exif != nullptr)
+        {
+            const std::vector<uint8_t> exifData = GetHandleData(formatRecord, exif.get());
+
+            if (!exifData.empty())
+            {
+                // The EXIF item data starts with the offset to the TIFF header, the host
+                // EXIF data starts with the TIFF header.
+                // See ISO/IEC 23008-12:2017 section A.2.1.
+                data.assign(4, 0);
+                data.insert(data.end(), exifData.begin(), exifData.end());
+            }
+        }
+
+        return data;
+    }
+
+    std::vector<uint8_t> GetXmpItemData(const FormatRecordPtr formatRecord)
+    {
+        std::vector<uint8_t> data;
+
+        ScopedHandleSuiteHandle xmp = GetXmpMetadata(formatRecord);
+
+        if (xmp != nullptr)
+        {
+            data = GetHandleData(formatRecord, xmp.get());
+        }
+
+        return data;
+    }
+
+    int GetImageBitDepth(ImageBitDepth imageBitDepth)
+    {
+        switch (imageBitDepth)
+        {
+        case ImageBitDepth::Eight:
+            return 8;
+        case ImageBitDepth::Ten:
+            return 10;
+        case ImageBitDepth::Twelve:
+        default:
+            return 12;
+        }
+    }
+
+    bool IsSameDocumentLayout(const RemuxSource& source, const FormatRecordPtr formatRecord, const VPoint& imageSize)
+    {
+        return source.imageSize.h == imageSize.h
+            && source.imageSize.v == imageSize.v
+            && source.imageMode == formatRecord->imageMode
+            && source.planes == formatRecord->planes
+            && source.depth == formatRecord->depth;
+    }
+
+    // The original pixels are only valid if the normal save path would not have converted
+    // them to sRGB, i.e. the document profile replaces the ICC profile of the file.
+    // A file without an ICC profile keeps its nclx color information, which describes the pixels.
+    bool IsSameColorTagging(const RemuxSource& source, const FormatRecordPtr formatRecord, const SaveUIOptions& saveOptions)
+    {
+        return !source.hasIccProfile || (saveOptions.keepColorProfile && HasColorProfileMetadata(formatRecord));
+    }
+
+    // The original compressed image data is only used if the normal save path would
+    // have encoded the image with the same bit depth, alpha format, color tagging and
+    // coding format. The quality and encoder settings cannot be recovered from the file.
+    bool CanRemuxSource(
+        const RemuxSource& source,
+        const FormatRecordPtr formatRecord,
+        const VPoint& imageSize,
+        const SaveUIOptions& saveOptions,
+        AlphaState alphaState)
+    {
+        if (!IsSameDocumentLayout(source, formatRecord, imageSize)
+            || source.lumaBitsPerPixel != GetImageBitDepth(saveOptions.imageBitDepth)
+            || source.alphaState != alphaState
+            || !IsSameColorTagging(source, formatRecord, saveOptions))
+        {
+            return false;
+        }
+
+        if (source.monochrome)
+        {
+            return !saveOptions.lossless;
+        }
+
+        // Lossless compression always uses 4:4:4 chroma.
+        return source.lossless == saveOptions.lossless
+            && (saveOptions.lossless || source.chromaSubsampling == saveOptions.chromaSubsampling);
+    }
+
+    void HashHostImage(const FormatRecordPtr formatRecord, const VPoint& imageSize, HostImageHash& hostImageHash)
+    {
+        for (int32 y = 0; y < imageSize.v; y++)
+        {
+            if (formatRecord->abortProc())
+            {
+                throw OSErrException(userCanceledErr);
+            }
+
+            SetRect(formatRecord, y, 0, y + 1, imageSize.h);
+
+            OSErrException::ThrowIfError(formatRecord->advanceState());
+
+            hostImageHash.AddRow(formatRecord);
+        }
+    }
+
+    struct RemuxMetadata
+    {
+        std::vector<uint8_t> iccProfile;
+        std::vector<uint8_t> exif;
+        std::vector<uint8_t> xmp;
+    };
+
+    RemuxMetadata GetRemuxMetadata(const FormatRecordPtr formatRecord, const SaveUIOptions& saveOptions)
+    {
+        RemuxMetadata metadata;
+
+        if (saveOptions.keepColorProfile && HasColorProfileMetadata(formatRecord))
+        {
+            metadata.iccProfile = GetHandleData(formatRecord, formatRecord->iCCprofileData);
+        }
+
+        if (saveOptions.keepExif)
+        {
+            metadata.exif = GetExifItemData(formatRecord);
+        }
+
+        if (saveOptions.keepXmp)
+        {
+            metadata.xmp = GetXmpItemData(formatRecord);
+        }
+
+        return metadata;
+    }
+
+    // Copies the tile from the image, the parts of the tile that extend past the edge
+    // of the image are filled by repeating the last row and column.
+    ScopedHeifImage CreateGridTileImage(const heif_image* image, const GridTileLayout& layout, uint32_t tileIndex)
+    {
+        const heif_colorspace colorspace = heif_image_get_colorspace(image);
+        const heif_chroma chroma = heif_image_get_chroma_format(image);
+        const heif_channel channel = chroma == heif_chroma_monochrome ? heif_channel_Y : heif_channel_interleaved;
+
+        heif_image* tempImage;
+
+        LibHeifException::ThrowIfError(heif_image_create(
+            static_cast<int>(layout.tileWidth),
+            static_cast<int>(layout.tileHeight),
+            colorspace,
+            chroma,
+            &tempImage));
+
+        ScopedHeifImage tile(tempImage);
+
+        LibHeifException::ThrowIfError(heif_image_add_plane(
+            tile.get(),
+            channel,
+            static_cast<int>(layout.tileWidth),
+            static_cast<int>(layout.tileHeight),
+            heif_image_get_bits_per_pixel_range(image, channel)));
+
+        const size_t pixelSize = static_cast<size_t>((heif_image_get_bits_per_pixel(image, channel) + 7) / 8);
+
+        int sourceStride;
+        const uint8_t* sourceScan0 = heif_image_get_plane_readonly(image, channel, &sourceStride);
+
+        int destinationStride;
+        uint8_t* destinationScan0 = heif_image_get_plane(tile.get(), channel, &destinationStride);
+
+        const uint32_t imageWidth = static_cast<uint32_t>(heif_image_get_width(image, channel));
+        const uint32_t imageHeight = static_cast<uint32_t>(heif_image_get_height(image, channel));
+
+        const uint32_t left = (tileIndex % layout.columns) * layout.tileWidth;
+        const uint32_t top = (tileIndex / layout.columns) * layout.tileHeight;
+        const uint32_t copyWidth = std::min(layout.tileWidth, imageWidth - left);
+        const uint32_t copyHeight = std::min(layout.tileHeight, imageHeight - top);
+
+        for (uint32_t y = 0; y < layout.tileHeight; y++)
+        {
+            const uint8_t* src = sourceScan0
+                + (static_cast<int64_t>(top + std::min(y, copyHeight - 1)) * sourceStride)
+                + (static_cast<size_t>(left) * pixelSize);
+            uint8_t* dst = destinationScan0 + (static_cast<int64_t>(y) * destinationStride);
+
+            memcpy(dst, src, copyWidth * pixelSize);
+
+            const uint8_t* lastPixel = dst + ((copyWidth - 1) * pixelSize);
+
+            for (uint32_t x = copyWidth; x < layout.tileWidth; x++)
+            {
+                memcpy(dst + (x * pixelSize), lastPixel, pixelSize);
+            }
+        }
+
+        ScopedHeifNclxProfile nclxProfile(heif_nclx_color_profile_alloc());
+
+        if (nclxProfile == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        nclxProfile->color_primaries = layout.colorPrimaries;
+        nclxProfile->transfer_characteristics = layout.transferCharacteristics;
+        nclxProfile->matrix_coefficients = layout.matrixCoefficients;
+        nclxProfile->full_range_flag = layout.fullRange;
+
+        LibHeifException::ThrowIfError(heif_image_set_nclx_color_profile(tile.get(), nclxProfile.get()));
+
+        return tile;
+    }
+
+    // The av1C bit depth, monochrome and chroma sub-sampling fields must match the other tiles.
+    // See the AV1 Codec ISO Media File Format Binding section 2.3.3.
+    bool IsCompatibleCodecConfiguration(const std::vector<uint8_t>& first, const std::vector<uint8_t>& second)
+    {
+        const Box firstBox = GetPropertyBox(first);
+        const Box secondBox = GetPropertyBox(second);
+
+        if (firstBox.payloadSize < 4 || secondBox.payloadSize < 4)
+        {
+            return false;
+        }
+
+        return (firstBox.payload[1] >> 5) == (secondBox.payload[1] >> 5)
+            && (firstBox.payload[2] & 0x7C) == (secondBox.payload[2] & 0x7C);
+    }
+
+    SaveUIOptions GetGridTileSaveOptions(
+        const SaveUIOptions& saveOptions,
+        const GridTileLayout& layout,
+        const std::vector<uint8_t>& codecConfiguration)
+    {
+        SaveUIOptions tileOptions = saveOptions;
+        tileOptions.chromaSubsampling = GetChromaSubsampling(GetPropertyBox(codecConfiguration));
+
+        // Lossless compression requires the identity matrix and 4:4:4 chroma, the other tiles
+        // determine the matrix and sub-sampling.
+        tileOptions.lossless = saveOptions.lossless
+            && layout.matrixCoefficients == heif_matrix_coefficients_RGB_GBR
+            && tileOptions.chromaSubsampling == ChromaSubsampling::Yuv444;
+
+        return tileOptions;
+    }
+}
+
+HostImageHash::HostImageHash(bool enabled)
+    : enabled(enabled), value(0), tileWidth(0), tileHeight(0), tileColumns(0), row(0), tileValues()
+{
+}
+
+void HostImageHash::SetTileGrid(uint32_t tileWidth, uint32_t tileHeight, uint32_t columns, uint32_t rows)
+{
+    this->tileWidth = tileWidth;
+    this->tileHeight = tileHeight;
+    tileColumns = columns;
+    tileValues.assign(static_cast<size_t>(columns) * rows, 0);
+}
+
+void HostImageHash::AddRow(const FormatRecordPtr formatRecord) noexcept
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    const uint8_t* data = static_cast<const uint8_t*>(formatRecord->data);
+    const size_t size = static_cast<size_t>(formatRecord->rowBytes);
+
+    value = HashBytes(value, data, size);
+
+    if (!tileValues.empty())
+    {
+        const size_t pixelSize = static_cast<size_t>(formatRecord->colBytes);
+        const size_t imageWidth = size / pixelSize;
+        const size_t firstTile = static_cast<size_t>(row / tileHeight) * tileColumns;
+
+        if (firstTile < tileValues.size())
+        {
+            for (uint32_t column = 0; column < tileColumns; column++)
+            {
+                const size_t left = static_cast<size_t>(column) * tileWidth;
+
+                if (left >= imageWidth)
+                {
+                    break;
+                }
+
+                const size_t width = std::min<size_t>(tileWidth, imageWidth - left);
+                uint64_t& tileValue = tileValues[firstTile + column];
+
+                tileValue = HashBytes(tileValue, data + (left * pixelSize), width * pixelSize);
+            }
+        }
+    }
+
+    row++;
+}
+
+bool HostImageHash::IsEnabled() const noexcept
+{
+    return enabled;
+}
+
+uint64_t HostImageHash::GetValue() const noexcept
+{
+    return value;
+}
+
+const std::vector<uint64_t>& HostImageHash::GetTileValues() const noexcept
+{
+    return tileValues;
+}
+
+RemuxSourceRecorder::RemuxSourceRecorder(const FormatRecordPtr formatRecord, bool enabled) noexcept
+    : source(), hostImageHash(false)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    try
+    {
+        int64 fileSize;
+        OSErrException::ThrowIfError(GetFileSize(formatRecord->dataFork, fileSize));
+
+        if (fileSize <= 0)
+        {
+            return;
+        }
+
+        std::filesystem::path filePath;
+        OSErrException::ThrowIfError(GetFilePath(formatRecord->dataFork, filePath));
+
+        source = std::make_unique<RemuxSource>(ReadRemuxSourceLayout(formatRecord->dataFork, static_cast<uint64_t>(fileSize)));
+        SetRemuxSourceCodingFormat(*source);
+
+        source->filePath = filePath;
+        source->fileSize = static_cast<uint64_t>(fileSize);
+        source->fileWriteTime = std::filesystem::last_write_time(filePath);
+
+        hostImageHash = HostImageHash(true);
+
+        if (source->hasGridTileLayout)
+        {
+            const GridTileLayout& layout = source->gridTileLayout;
+
+            hostImageHash.SetTileGrid(layout.tileWidth, layout.tileHeight, layout.columns, layout.rows);
+        }
+    }
+    catch (...)
+    {
+        // The file layout is not supported or it could not be read, the image will be encoded when it is saved.
+        DebugOut("The file cannot be used for remuxing.");
+        source.reset();
+    }
+}
+
+RemuxSourceRecorder::~RemuxSourceRecorder() = default;
+
+HostImageHash& RemuxSourceRecorder::GetHostImageHash() noexcept
+{
+    return hostImageHash;
+}
+
+void RemuxSourceRecorder::Register(
+    const FormatRecordPtr formatRecord,
+    int lumaBitsPerPixel,
+    AlphaState alphaState) noexcept
+{
+    if (source == nullptr)
+    {
+        return;
+    }
+
+    try
+    {
+        source->hostImageHash = hostImageHash.GetValue();
+        source->tileHostImageHashes = hostImageHash.GetTileValues();
+        source->imageSize = GetImageSize(formatRecord);
+        source->imageMode = formatRecord->imageMode;
+        source->planes = formatRecord->planes;
+        source->depth = formatRecord->depth;
+        source->lumaBitsPerPixel = lumaBitsPerPixel;
+        source->alphaState = alphaState;
+
+        std::lock_guard<std::mutex> lock(remuxSourcesMutex);
+
+        // Reverting a document reads the same file again.
+        remuxSources.remove_if([&](const RemuxSource& existing)
+        {
+            return existing.hostImageHash == source->hostImageHash
+                && IsSameDocumentLayout(existing, formatRecord, source->imageSize);
+        });
+
+        remuxSources.push_front(std::move(*source));
+        source.reset();
+
+        if (remuxSources.size() > maximumRemuxSourceCount)
+        {
+            remuxSources.pop_back();
+        }
+    }
+    catch (...)
+    {
+        DebugOut("The file could not be recorded for remuxing.");
+    }
+}
+
+bool TryRemuxUnmodifiedImage(
+    const FormatRecordPtr formatRecord,
+    const SaveUIOptions& saveOptions,
+    AlphaState alphaState,
+    ChangedGridTiles& changedGridTiles)
+{
+    changedGridTiles.source.reset();
+    changedGridTiles.tileIndices.clear();
+
+    if (!saveOptions.remuxUnmodifiedImages || formatRecord->depth == 32)
+    {
+        return false;
+    }
+
+    // The export variants and the thumbnail are scaled from the document image data.
+    if (saveOptions.exportVariantCount > 0 || saveOptions.thumbnailSize > 0)
+    {
+        return false;
+    }
+
+    // A target file size or quality requires the image to be encoded.
+    if (!saveOptions.lossless && (saveOptions.targetFileSize > 0 || saveOptions.targetSsim > 0.0f))
+    {
+        return false;
+    }
+
+    const VPoint imageSize = GetImageSize(formatRecord);
+
+    // Reading the document image data is only worthwhile when there is a file it could match.
+    std::vector<RemuxSource> candidates;
+
+    {
+        std::lock_guard<std::mutex> lock(remuxSourcesMutex);
+
+        for (const RemuxSource& source : remuxSources)
+        {
+            if (CanRemuxSource(source, formatRecord, imageSize, saveOptions, alphaState))
+            {
+                candidates.push_back(source);
+            }
+        }
+    }
+
+    if (candidates.empty())
+    {
+        return false;
+    }
+
+    const auto gridCandidate = std::find_if(
+        candidates.begin(),
+        candidates.end(),
+        [](const RemuxSource& source) { return source.hasGridTileLayout; });
+    const RemuxSource* gridSource = gridCandidate != candidates.end() ? &*gridCandidate : nullptr;
+
+    HostImageHash hostImageHash(true);
+
+    if (gridSource != nullptr)
+    {
+        const GridTileLayout& layout = gridSource->gridTileLayout;
+
+        hostImageHash.SetTileGrid(layout.tileWidth, layout.tileHeight, layout.columns, layout.rows);
+    }
+
+    HashHostImage(formatRecord, imageSize, hostImageHash);
+
+    const auto source = std::find_if(
+        candidates.begin(),
+        candidates.end(),
+        [&](const RemuxSource& source) { return source.hostImageHash == hostImageHash.GetValue(); });
+
+    if (source == candidates.end())
+    {
+        if (gridSource != nullptr)
+        {
+            const std::vector<uint64_t>& tileValues = hostImageHash.GetTileValues();
+
+            for (size_t i = 0; i < tileValues.size(); i++)
+            {
+                if (tileValues[i] != gridSource->tileHostImageHashes[i])
+                {
+                    changedGridTiles.tileIndices.push_back(static_cast<uint32_t>(i));
+                }
+            }
+
+            if (changedGridTiles.tileIndices.size() < tileValues.size())
+            {
+                DebugOut(
+                    "%zu of %zu grid tiles have changed.",
+                    changedGridTiles.tileIndices.size(),
+                    tileValues.size());
+                changedGridTiles.source = std::make_shared<RemuxSource>(std::move(*gridCandidate));
+                return false;
+            }
+
+            changedGridTiles.tileIndices.clear();
+        }
+
+        DebugOut("The document image data has changed, the image will be encoded.");
+        return false;
+    }
+
+    // The image data is read before anything is written, the output may replace the original file.
+    RemuxSource sourceWithImageData = std::move(*source);
+
+    if (!TryReadRemuxSourceImageData(sourceWithImageData))
+    {
+        DebugOut("The original file has been modified, the image will be encoded.");
+        UpdateRemuxSourceUsage(sourceWithImageData, true);
+        return false;
+    }
+
+    UpdateRemuxSourceUsage(sourceWithImageData, false);
+
+    const RemuxMetadata metadata = GetRemuxMetadata(formatRecord, saveOptions);
+    const RemuxOutput output = CreateRemuxOutput(sourceWithImageData, metadata.iccProfile, metadata.exif, metadata.xmp, {});
+
+    WriteRemuxedFile(formatRecord->dataFork, sourceWithImageData, output);
+
+    DebugOut("Remuxed the unmodified image data from the original file.");
+
+    return true;
+}
+
+bool TryRemuxChangedGridTiles(
+    const FormatRecordPtr formatRecord,
+    const ChangedGridTiles& changedGridTiles,
+    const heif_image* image,
+    const SaveUIOptions& saveOptions)
+{
+    RemuxSource source = *changedGridTiles.source;
+    const GridTileLayout& layout = source.gridTileLayout;
+
+    const uint32_t firstTileCodecConfigurationIndex = FindItemProperty(
+        source.properties,
+        source.propertyAssociations,
+        layout.tileItemIds[0],
+        FourCC("av1C"));
+    const std::vector<uint8_t>& codecConfiguration = source.properties[firstTileCodecConfigurationIndex - 1];
+    const bool monochromeTiles = (GetPropertyBox(codecConfiguration).payload[2] & 0x10) != 0;
+
+    // The save options may have changed the image format, in that case the whole image must be encoded.
+    if (HeifImageHasAlphaChannel(image)
+        || GetHeifImageBitsPerChannel(image) != source.lumaBitsPerPixel
+        || (heif_image_get_chroma_format(image) == heif_chroma_monochrome) != monochromeTiles)
+    {
+        return false;
+    }
+
+    // The image is converted to sRGB when the document profile is not kept, the changed tiles
+    // would then use a different color space than the original tiles.
+    if (!IsSameColorTagging(source, formatRecord, saveOptions)
+        || (HasColorProfileMetadata(formatRecord) && !saveOptions.keepColorProfile))
+    {
+        DebugOut("The image has been converted to a different color space, the whole image will be encoded.");
+        return false;
+    }
+
+    if (!TryReadRemuxSourceImageData(source))
+    {
+        DebugOut("The original file has been modified, the image will be encoded.");
+        return false;
+    }
+
+    const SaveUIOptions tileOptions = GetGridTileSaveOptions(saveOptions, layout, codecConfiguration);
+
+    std::vector<ReplacedItem> replacedItems;
+    replacedItems.reserve(changedGridTiles.tileIndices.size());
+
+    const size_t tileCount = changedGridTiles.tileIndices.size();
+    const size_t batchSize = std::min(
+        tileCount,
+        std::clamp<size_t>(std::thread::hardware_concurrency(), 1, maximumConcurrentTileEncodes));
+    const unsigned int threadsPerTile = std::max(std::thread::hardware_concurrency() / static_cast<unsigned int>(batchSize), 1U);
+    double expectedBatchSeconds = firstTileBatchExpectedSeconds;
+
+    for (size_t batchStart = 0; batchStart < tileCount; batchStart += batchSize)
+    {
+        const size_t batchEnd = std::min(batchStart + batchSize, tileCount);
+        const auto batchStartTime = std::chrono::steady_clock::now();
+
+        std::vector<std::future<std::vector<uint8_t>>> encodedTiles;
+        encodedTiles.reserve(batchEnd - batchStart);
+
+        for (size_t i = batchStart; i < batchEnd; i++)
+        {
+            // The tile images are shared with the encode worker threads, a canceled encode finishes in the background.
+            std::shared_ptr<heif_image> tile(CreateGridTileImage(image, layout, changedGridTiles.tileIndices[i]));
+
+            encodedTiles.push_back(StartEncodeOnWorkerThread<std::vector<uint8_t>>(
+                [tile, tileOptions, threadsPerTile]()
+                {
+                    return EncodeImageToMemory(tile.get(), tileOptions, false, threadsPerTile);
+                }));
+        }
+
+        const EncodeProgressRange progress =
+        {
+            tileEncodeProgressStart + static_cast<int32>((batchStart * (tileEncodeProgressEnd - tileEncodeProgressStart)) / tileCount),
+            tileEncodeProgressStart + static_cast<int32>((batchEnd * (tileEncodeProgressEnd - tileEncodeProgressStart)) / tileCount),
+            expectedBatchSeconds
+        };
+
+        for (size_t i = batchStart; i < batchEnd; i++)
+        {
+            std::future<std::vector<uint8_t>>& encodedTileResult = encodedTiles[i - batchStart];
+
+            WaitForWorkerEncode(formatRecord, encodedTileResult, &progress, batchStartTime);
+
+            const RemuxSource encodedTile = ParseRemuxSource(encodedTileResult.get(), false);
+
+            const RemuxItem* encodedItem = FindItem(encodedTile.items, encodedTile.primaryItemId);
+            const uint32_t encodedCodecConfigurationIndex = FindItemProperty(
+                encodedTile.properties,
+                encodedTile.propertyAssociations,
+                encodedTile.primaryItemId,
+                FourCC("av1C"));
+
+            if (encodedItem == nullptr || encodedItem->info.type != FourCC("av01") || encodedCodecConfigurationIndex == 0)
+            {
+                return false;
+            }
+
+            const std::vector<uint8_t>& encodedCodecConfiguration = encodedTile.properties[encodedCodecConfigurationIndex - 1];
+
+            if (!IsCompatibleCodecConfiguration(codecConfiguration, encodedCodecConfiguration))
+            {
+                DebugOut("The encoded grid tile is not compatible with the original tiles.");
+                return false;
+            }
+
+            replacedItems.push_back(
+            {
+                layout.tileItemIds[changedGridTiles.tileIndices[i]],
+                encodedItem->data,
+                encodedCodecConfiguration
+            });
+        }
+
+        const std::chrono::duration<double> batchElapsed = std::chrono::steady_clock::now() - batchStartTime;
+        expectedBatchSeconds = batchElapsed.count();
+    }
+
+    const RemuxMetadata metadata = GetRemuxMetadata(formatRecord, saveOptions);
+    const RemuxOutput output = CreateRemuxOutput(source, metadata.iccProfile, metadata.exif, metadata.xmp, replacedItems);
+
+    WriteRemuxedFile(formatRecord->dataFork, source, output);
+
+    DebugOut("Encoded %zu changed grid tiles and remuxed the other tiles.", tileCount);
+
+    return true;
+}
+
+void WriteFileWithThumbnail(
+    intptr_t refNum,
+    const std::vector<uint8_t>& file,
+    const std::vector<uint8_t>& thumbnailFile)
+{
+    const RemuxSource source = ParseRemuxSource(file, true);
+    const RemuxSource thumbnail = ParseRemuxSource(thumbnailFile, true);
+
+    const RemuxOutput output = CreateThumbnailOutput(source, thumbnail);
+
+    WriteRemuxedFile(refNum, source, output);
+}
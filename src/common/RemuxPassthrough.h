@@ -0,0 +1,129 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REMUXPASSTHROUGH_H
+#define REMUXPASSTHROUGH_H
+
+#include "AvifFormat.h"
+#include "AlphaState.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Computes a hash of the image data that is exchanged with the host, one row at a time.
+// The read and write paths use the same row layout, so an unmodified document produces
+// the same hash when it is saved.
+class HostImageHash
+{
+public:
+
+    explicit HostImageHash(bool enabled);
+
+    // Also computes a hash for each tile of a grid image, the tiles are numbered in row-major order.
+    void SetTileGrid(uint32_t tileWidth, uint32_t tileHeight, uint32_t columns, uint32_t rows);
+
+    // Adds the row in formatRecord->data, the row must use all of the image planes.
+    // The rows must be added in order, starting from the top of the image.
+    void AddRow(const FormatRecordPtr formatRecord) noexcept;
+
+    bool IsEnabled() const noexcept;
+
+    uint64_t GetValue() const noexcept;
+
+    const std::vector<uint64_t>& GetTileValues() const noexcept;
+
+private:
+
+    bool enabled;
+    uint64_t value;
+    uint32_t tileWidth;
+    uint32_t tileHeight;
+    uint32_t tileColumns;
+    uint32_t row;
+    std::vector<uint64_t> tileValues;
+};
+
+struct RemuxSource;
+
+// Records the AVIF file that is read into the document so that it can be remuxed if the
+// document is saved without changing the image data.
+// Only the file layout is kept in memory, the compressed image data is read from the file when it is remuxed.
+// The file is not recorded if its layout is not supported by the remuxer, this never causes the read to fail.
+class RemuxSourceRecorder
+{
+public:
+
+    // Reads the file layout, the host image hash is disabled if the file cannot be remuxed.
+    RemuxSourceRecorder(const FormatRecordPtr formatRecord, bool enabled) noexcept;
+
+    ~RemuxSourceRecorder();
+
+    // The hash must be updated with each row that is handed to the host.
+    HostImageHash& GetHostImageHash() noexcept;
+
+    void Register(const FormatRecordPtr formatRecord, int lumaBitsPerPixel, AlphaState alphaState) noexcept;
+
+private:
+
+    std::unique_ptr<RemuxSource> source;
+    HostImageHash hostImageHash;
+};
+
+// The grid tiles of the original file that were modified in the document.
+struct ChangedGridTiles
+{
+    // A copy of the recorded file layout, null if the grid tiles cannot be remuxed.
+    std::shared_ptr<const RemuxSource> source;
+    std::vector<uint32_t> tileIndices;
+};
+
+// Writes the image by copying the compressed image data from the file the document was read from,
+// the EXIF, XMP and ICC profile meta-data are replaced with the current document meta-data.
+// Returns false without writing anything if the document image data has changed, if the original
+// file has been modified, or if the save options require the image to be encoded again.
+// The quality and encoder settings of the save options are not applied to the copied image data.
+// If the document was read from a grid image and only some of the tiles have changed, those
+// tiles are stored in changedGridTiles.
+// The caller must have set up formatRecord to read complete rows of all image planes.
+bool TryRemuxUnmodifiedImage(
+    const FormatRecordPtr formatRecord,
+    const SaveUIOptions& saveOptions,
+    AlphaState alphaState,
+    ChangedGridTiles& changedGridTiles);
+
+// Writes the image by encoding the changed grid tiles from image and copying the other tiles
+// from the file the document was read from.
+// Returns false without writing anything if the encoded tiles are not compatible with the
+// original tiles, or if the image was converted to a different color space than the original
+// tiles, the caller should encode the whole image.
+bool TryRemuxChangedGridTiles(
+    const FormatRecordPtr formatRecord,
+    const ChangedGridTiles& changedGridTiles,
+    const heif_image* image,
+    const SaveUIOptions& saveOptions);
+
+// Writes the file with the images of thumbnailFile added as a thumbnail of its primary image.
+// Both files must be single images, e.g. files written by libheif.
+void WriteFileWithThumbnail(
+    intptr_t refNum,
+    const std::vector<uint8_t>& file,
+    const std::vector<uint8_t>& thumbnailFile);
+
+#endif // !REMUXPASSTHROUGH_H
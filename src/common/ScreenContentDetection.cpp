@@ -0,0 +1,67 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScreenContentDetection.h"
+#include <bitset>
+
+namespace
+{
+    // Images with fewer sampled pixels than this are too small for the statistics to be reliable.
+    constexpr uint64_t minimumSampledPixelCount = 4096;
+
+    // The fraction of the sampled pixels that must be identical to their left neighbor.
+    constexpr double minimumFlatPixelRatio = 0.5;
+
+    // The maximum number of occupied color hash buckets, out of 65536.
+    // Photographs fill most of the buckets, screen content rarely uses more than a few thousand colors.
+    constexpr size_t maximumColorBucketCount = 4096;
+}
+
+ScreenContentDetector::ScreenContentDetector(bool enabled)
+    : enabled(enabled), sampledPixelCount(0), flatPixelCount(0), colorHashSet()
+{
+}
+
+bool ScreenContentDetector::IsScreenContent() const
+{
+    if (!enabled || sampledPixelCount < minimumSampledPixelCount)
+    {
+        return false;
+    }
+
+    const double flatPixelRatio = static_cast<double>(flatPixelCount) / static_cast<double>(sampledPixelCount);
+
+    size_t colorBucketCount = 0;
+
+    for (const uint64_t bits : colorHashSet)
+    {
+        colorBucketCount += std::bitset<64>(bits).count();
+    }
+
+    const bool isScreenContent = flatPixelRatio >= minimumFlatPixelRatio && colorBucketCount <= maximumColorBucketCount;
+
+    DebugOut(
+        "Screen content detection: flat pixel ratio %.3f, %zu color buckets, screen content: %s",
+        flatPixelRatio,
+        colorBucketCount,
+        isScreenContent ? "yes" : "no");
+
+    return isScreenContent;
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCREENCONTENTDETECTION_H
+#define SCREENCONTENTDETECTION_H
+
+#include "Common.h"
+#include <array>
+#include <cstdint>
+
+// Classifies images as screen content (user interface screenshots, diagrams and rendered text)
+// using the rows that are written to the heif_image.
+// Screen content has large areas of identical pixels and a small number of distinct colors.
+class ScreenContentDetector
+{
+public:
+
+    explicit ScreenContentDetector(bool enabled);
+
+    // Adds a row of image data with channelCount interleaved channels, only the first three channels are used.
+    template <typename T>
+    void AddRow(int32 y, const T* row, int32 width, int channelCount)
+    {
+        // Every fourth row is sampled to reduce the cost of the detection.
+        if (!enabled || (y & 3) != 0)
+        {
+            return;
+        }
+
+        const int colorChannelCount = channelCount < 3 ? channelCount : 3;
+        uint64_t previousColor = ~0ULL;
+
+        for (int32 x = 0; x < width; x++)
+        {
+            uint64_t color = 0;
+
+            for (int i = 0; i < colorChannelCount; i++)
+            {
+                color = (color << 16) | row[i];
+            }
+
+            if (color == previousColor)
+            {
+                flatPixelCount++;
+            }
+            else
+            {
+                AddColor(color);
+                previousColor = color;
+            }
+
+            row += channelCount;
+        }
+
+        sampledPixelCount += static_cast<uint64_t>(width);
+    }
+
+    bool IsScreenContent() const;
+
+private:
+
+    void AddColor(uint64_t color)
+    {
+        // The color is hashed into a fixed size bit set, the number of set bits
+        // is an approximation of the number of distinct colors.
+        const uint32_t hash = static_cast<uint32_t>((color * 0x9E3779B97F4A7C15ULL) >> (64 - colorHashBits));
+
+        colorHashSet[hash >> 6] |= 1ULL << (hash & 63);
+    }
+
+    static constexpr int colorHashBits = 16;
+
+    bool enabled;
+    uint64_t sampledPixelCount;
+    uint64_t flatPixelCount;
+    std::array<uint64_t, (1 << colorHashBits) / 64> colorHashSet;
+};
+
+#endif // !SCREENCONTENTDETECTION_H
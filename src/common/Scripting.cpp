@@ -20,6 +20,9 @@
 
 #include "AvifFormat.h"
 #include "AvifFormatTerminology.h"
+#include <cstring>
+#include <sstream>
+#include <string>
 
 namespace
 {
@@ -135,6 +138,192 @@ namespace
         }
     }
 
+    EncoderBackend EncoderBackendFromDescriptor(DescriptorEnumID value)
+    {
+        switch (value)
+        {
+        case encoderBackendSVT:
+            return EncoderBackend::Svt;
+        case encoderBackendRav1e:
+            return EncoderBackend::Rav1e;
+        case encoderBackendAOM:
+        default:
+            return EncoderBackend::Aom;
+        }
+    }
+
+    DescriptorEnumID EncoderBackendToDescriptor(EncoderBackend value)
+    {
+        switch (value)
+        {
+        case EncoderBackend::Svt:
+            return encoderBackendSVT;
+        case EncoderBackend::Rav1e:
+            return encoderBackendRav1e;
+        case EncoderBackend::Aom:
+        default:
+            return encoderBackendAOM;
+        }
+    }
+
+    EncoderTune EncoderTuneFromDescriptor(DescriptorEnumID value)
+    {
+        switch (value)
+        {
+        case encoderTunePSNR:
+            return EncoderTune::Psnr;
+        case encoderTuneSSIM:
+            return EncoderTune::Ssim;
+        case encoderTuneDefault:
+        default:
+            return EncoderTune::Default;
+        }
+    }
+
+    DescriptorEnumID EncoderTuneToDescriptor(EncoderTune value)
+    {
+        switch (value)
+        {
+        case EncoderTune::Psnr:
+            return encoderTunePSNR;
+        case EncoderTune::Ssim:
+            return encoderTuneSSIM;
+        case EncoderTune::Default:
+        default:
+            return encoderTuneDefault;
+        }
+    }
+
+    ScreenContentTools ScreenContentToolsFromDescriptor(DescriptorEnumID value)
+    {
+        switch (value)
+        {
+        case screenContentToolsEnabled:
+            return ScreenContentTools::Enabled;
+        case screenContentToolsDisabled:
+            return ScreenContentTools::Disabled;
+        case screenContentToolsAuto:
+        default:
+            return ScreenContentTools::Auto;
+        }
+    }
+
+    DescriptorEnumID ScreenContentToolsToDescriptor(ScreenContentTools value)
+    {
+        switch (value)
+        {
+        case ScreenContentTools::Enabled:
+            return screenContentToolsEnabled;
+        case ScreenContentTools::Disabled:
+            return screenContentToolsDisabled;
+        case ScreenContentTools::Auto:
+        default:
+            return screenContentToolsAuto;
+        }
+    }
+
+    LoadOptionsWorkingSpace WorkingSpaceFromDescriptor(DescriptorEnumID value)
+    {
+        switch (value)
+        {
+        case workingSpaceSRGB:
+            return LoadOptionsWorkingSpace::SRGB;
+        case workingSpaceDisplayP3:
+            return LoadOptionsWorkingSpace::DisplayP3;
+        case workingSpaceAdobeRGB:
+            return LoadOptionsWorkingSpace::AdobeRGB;
+        case workingSpaceEmbedded:
+        default:
+            return LoadOptionsWorkingSpace::Embedded;
+        }
+    }
+
+    DescriptorEnumID WorkingSpaceToDescriptor(LoadOptionsWorkingSpace value)
+    {
+        switch (value)
+        {
+        case LoadOptionsWorkingSpace::SRGB:
+            return workingSpaceSRGB;
+        case LoadOptionsWorkingSpace::DisplayP3:
+            return workingSpaceDisplayP3;
+        case LoadOptionsWorkingSpace::AdobeRGB:
+            return workingSpaceAdobeRGB;
+        case LoadOptionsWorkingSpace::Embedded:
+        default:
+            return workingSpaceEmbedded;
+        }
+    }
+
+    // The export variants are stored as text in the form "maximum dimension:quality", with
+    // the variants separated by semicolons, e.g. "1920:70;512:60".
+    void ExportVariantsFromDescriptor(FormatRecordPtr formatRecord, Handle text, SaveUIOptions& options)
+    {
+        std::string value;
+
+        const int32 size = formatRecord->handleProcs->getSizeProc(text);
+
+        if (size > 0)
+        {
+            const Ptr data = LockPIHandle(formatRecord, text, false);
+            value.assign(data, static_cast<size_t>(size));
+            UnlockPIHandle(formatRecord, text);
+        }
+
+        options.exportVariantCount = 0;
+
+        std::istringstream stream(value);
+        std::string entry;
+
+        while (options.exportVariantCount < maxExportVariants && std::getline(stream, entry, ';'))
+        {
+            std::istringstream entryStream(entry);
+            int maxDimension;
+            char separator;
+            int quality;
+
+            // Invalid entries are ignored.
+            // This should only happen if value was set through the scripting system by another plug-in.
+            if ((entryStream >> maxDimension >> separator >> quality)
+                && separator == ':'
+                && maxDimension >= exportVariantDimensionMin
+                && maxDimension <= exportVariantDimensionMax
+                && quality >= 0
+                && quality <= 100)
+            {
+                options.exportVariants[options.exportVariantCount] = { maxDimension, quality };
+                options.exportVariantCount++;
+            }
+        }
+    }
+
+    void ExportVariantsToDescriptor(FormatRecordPtr formatRecord, PIWriteDescriptor token, const SaveUIOptions& options)
+    {
+        std::string value;
+
+        for (int i = 0; i < options.exportVariantCount; i++)
+        {
+            if (i > 0)
+            {
+                value += ';';
+            }
+
+            value += std::to_string(options.exportVariants[i].maxDimension);
+            value += ':';
+            value += std::to_string(options.exportVariants[i].quality);
+        }
+
+        Handle text;
+
+        if (NewPIHandle(formatRecord, static_cast<int32>(value.size()), &text) == noErr)
+        {
+            memcpy(LockPIHandle(formatRecord, text, false), value.data(), value.size());
+            UnlockPIHandle(formatRecord, text);
+
+            formatRecord->descriptorParameters->writeDescriptorProcs->putTextProc(token, keyExportVariants, text);
+
+            DisposePIHandle(formatRecord, text);
+        }
+    }
 }
 
 OSErr ReadScriptParamsOnRead(FormatRecordPtr formatRecord, LoadUIOptions& options, Boolean* showDialog)
@@ -157,6 +346,7 @@ OSErr ReadScriptParamsOnRead(FormatRecordPtr formatRecord, LoadUIOptions& option
             keyHLGDisplayGamma,
             keyHLGNominalPeakBrightness,
             keyPQNominalPeakBrightness,
+            keyWorkingSpace,
             NULLID
         };
 
@@ -168,6 +358,7 @@ OSErr ReadScriptParamsOnRead(FormatRecordPtr formatRecord, LoadUIOptions& option
             Boolean boolValue;
             real64  float64Value;
             int32 integerValue;
+            DescriptorEnumID enumValue;
 
             while (readProcs->getKeyProc(token, &key, &type, &flags))
             {
@@ -220,6 +411,12 @@ OSErr ReadScriptParamsOnRead(FormatRecordPtr formatRecord, LoadUIOptions& option
                         options.format = LoadOptionsHDRFormat::PQ;
                     }
                     break;
+                case keyWorkingSpace:
+                    if (readProcs->getEnumeratedProc(token, &enumValue) == noErr)
+                    {
+                        options.workingSpace = WorkingSpaceFromDescriptor(enumValue);
+                    }
+                    break;
                 }
             }
 
@@ -274,6 +471,15 @@ OSErr WriteScriptParamsOnRead(FormatRecordPtr formatRecord, const LoadUIOptions&
                 writeProcs->putIntegerProc(token, keyPQNominalPeakBrightness, options.pq.nominalPeakBrightness);
             }
 
+            if (options.workingSpace != LoadOptionsWorkingSpace::Embedded)
+            {
+                writeProcs->putEnumeratedProc(
+                    token,
+                    keyWorkingSpace,
+                    typeWorkingSpace,
+                    WorkingSpaceToDescriptor(options.workingSpace));
+            }
+
             error = writeProcs->closeWriteDescriptorProc(token, &formatRecord->descriptorParameters->descriptor);
         }
     }
@@ -307,6 +513,22 @@ OSErr ReadScriptParamsOnWrite(FormatRecordPtr formatRecord, SaveUIOptions& optio
             keyImageBitDepth,
             keyHDRTransferFunction,
             keyPQNominalPeakBrightness,
+            keyEncoderBackend,
+            keyEncoderSpeed,
+            keyEncoderTune,
+            keyAQMode,
+            keyEnableChromaDeltaQ,
+            keyEnableCDEF,
+            keyEnableRestoration,
+            keyTargetFileSize,
+            keyTargetSSIM,
+            keyEncodeTimeBudget,
+            keyNeutralAsMonochrome,
+            keyScreenContentTools,
+            keyDetectEightBitContent,
+            keyRemuxUnmodifiedImages,
+            keyThumbnailSize,
+            keyExportVariants,
             NULLID
         };
 
@@ -318,6 +540,8 @@ OSErr ReadScriptParamsOnWrite(FormatRecordPtr formatRecord, SaveUIOptions& optio
             DescriptorEnumID enumValue;
             Boolean boolValue;
             int32 intValue;
+            real64 float64Value;
+            Handle textValue;
 
             while (readProcs->getKeyProc(token, &key, &type, &flags))
             {
@@ -402,6 +626,145 @@ OSErr ReadScriptParamsOnWrite(FormatRecordPtr formatRecord, SaveUIOptions& optio
                         options.pq.nominalPeakBrightness = intValue;
                     }
                     break;
+                case keyEncoderBackend:
+                    if (readProcs->getEnumeratedProc(token, &enumValue) == noErr)
+                    {
+                        options.encoderBackend = EncoderBackendFromDescriptor(enumValue);
+                    }
+                    break;
+                case keyEncoderSpeed:
+                    if (readProcs->getIntegerProc(token, &intValue) == noErr)
+                    {
+                        if (intValue < encoderSpeedMin || intValue > encoderSpeedMax)
+                        {
+                            // Use the default value if the scripting parameter value is out of range.
+                            // This should only happen if value was set through the scripting system by another plug-in.
+                            continue;
+                        }
+
+                        options.encoderSpeed = intValue;
+                    }
+                    break;
+                case keyEncoderTune:
+                    if (readProcs->getEnumeratedProc(token, &enumValue) == noErr)
+                    {
+                        options.tune = EncoderTuneFromDescriptor(enumValue);
+                    }
+                    break;
+                case keyAQMode:
+                    if (readProcs->getIntegerProc(token, &intValue) == noErr)
+                    {
+                        if (intValue < aqModeMin || intValue > aqModeMax)
+                        {
+                            // Use the default value if the scripting parameter value is out of range.
+                            // This should only happen if value was set through the scripting system by another plug-in.
+                            continue;
+                        }
+
+                        options.aqMode = intValue;
+                    }
+                    break;
+                case keyEnableChromaDeltaQ:
+                    if (readProcs->getBooleanProc(token, &boolValue) == noErr)
+                    {
+                        options.enableChromaDeltaQ = boolValue;
+                    }
+                    break;
+                case keyEnableCDEF:
+                    if (readProcs->getBooleanProc(token, &boolValue) == noErr)
+                    {
+                        options.enableCdef = boolValue;
+                    }
+                    break;
+                case keyEnableRestoration:
+                    if (readProcs->getBooleanProc(token, &boolValue) == noErr)
+                    {
+                        options.enableRestoration = boolValue;
+                    }
+                    break;
+                case keyTargetFileSize:
+                    if (readProcs->getIntegerProc(token, &intValue) == noErr)
+                    {
+                        if (intValue < 0)
+                        {
+                            // Use the default value if the scripting parameter value is out of range.
+                            // This should only happen if value was set through the scripting system by another plug-in.
+                            continue;
+                        }
+
+                        options.targetFileSize = intValue;
+                    }
+                    break;
+                case keyTargetSSIM:
+                    if (readProcs->getFloatProc(token, &float64Value) == noErr)
+                    {
+                        if (float64Value < 0.0 || float64Value > 1.0)
+                        {
+                            // Use the default value if the scripting parameter value is out of range.
+                            // This should only happen if value was set through the scripting system by another plug-in.
+                            continue;
+                        }
+
+                        options.targetSsim = static_cast<float>(float64Value);
+                    }
+                    break;
+                case keyEncodeTimeBudget:
+                    if (readProcs->getIntegerProc(token, &intValue) == noErr)
+                    {
+                        if (intValue < 0)
+                        {
+                            // Use the default value if the scripting parameter value is out of range.
+                            // This should only happen if value was set through the scripting system by another plug-in.
+                            continue;
+                        }
+
+                        options.encodeTimeBudget = intValue;
+                    }
+                    break;
+                case keyNeutralAsMonochrome:
+                    if (readProcs->getBooleanProc(token, &boolValue) == noErr)
+                    {
+                        options.neutralAsMonochrome = boolValue;
+                    }
+                    break;
+                case keyScreenContentTools:
+                    if (readProcs->getEnumeratedProc(token, &enumValue) == noErr)
+                    {
+                        options.screenContentTools = ScreenContentToolsFromDescriptor(enumValue);
+                    }
+                    break;
+                case keyDetectEightBitContent:
+                    if (readProcs->getBooleanProc(token, &boolValue) == noErr)
+                    {
+                        options.detectEightBitContent = boolValue;
+                    }
+                    break;
+                case keyRemuxUnmodifiedImages:
+                    if (readProcs->getBooleanProc(token, &boolValue) == noErr)
+                    {
+                        options.remuxUnmodifiedImages = boolValue;
+                    }
+                    break;
+                case keyThumbnailSize:
+                    if (readProcs->getIntegerProc(token, &intValue) == noErr)
+                    {
+                        if (intValue < 0 || intValue > thumbnailSizeMax)
+                        {
+                            // Use the default value if the scripting parameter value is out of range.
+                            // This should only happen if value was set through the scripting system by another plug-in.
+                            continue;
+                        }
+
+                        options.thumbnailSize = intValue;
+                    }
+                    break;
+                case keyExportVariants:
+                    if (readProcs->getTextProc(token, &textValue) == noErr)
+                    {
+                        ExportVariantsFromDescriptor(formatRecord, textValue, options);
+                        DisposePIHandle(formatRecord, textValue);
+                    }
+                    break;
                 }
             }
 
@@ -427,7 +790,7 @@ OSErr ReadScriptParamsOnWrite(FormatRecordPtr formatRecord, SaveUIOptions& optio
     return error;
 }
 
-OSErr WriteScriptParamsOnWrite(FormatRecordPtr formatRecord, const SaveUIOptions& options)
+OSErr WriteScriptParamsOnWrite(FormatRecordPtr formatRecord, const SaveUIOptions& options, const SaveResults* results)
 {
     OSErr error = noErr;
 
@@ -504,6 +867,117 @@ OSErr WriteScriptParamsOnWrite(FormatRecordPtr formatRecord, const SaveUIOptions
 
             writeProcs->putIntegerProc(token, keyPQNominalPeakBrightness, options.pq.nominalPeakBrightness);
 
+            if (options.encoderBackend != EncoderBackend::Aom)
+            {
+                enumValue = EncoderBackendToDescriptor(options.encoderBackend);
+                writeProcs->putEnumeratedProc(token, keyEncoderBackend, typeEncoderBackend, enumValue);
+            }
+
+            if (options.encoderSpeed != encoderSpeedUsePreset)
+            {
+                writeProcs->putIntegerProc(token, keyEncoderSpeed, options.encoderSpeed);
+            }
+
+            if (options.tune != EncoderTune::Default)
+            {
+                enumValue = EncoderTuneToDescriptor(options.tune);
+                writeProcs->putEnumeratedProc(token, keyEncoderTune, typeEncoderTune, enumValue);
+            }
+
+            if (options.aqMode != aqModeUseDefault)
+            {
+                writeProcs->putIntegerProc(token, keyAQMode, options.aqMode);
+            }
+
+            if (options.enableChromaDeltaQ)
+            {
+                writeProcs->putBooleanProc(token, keyEnableChromaDeltaQ, options.enableChromaDeltaQ);
+            }
+
+            if (!options.enableCdef)
+            {
+                writeProcs->putBooleanProc(token, keyEnableCDEF, options.enableCdef);
+            }
+
+            if (!options.enableRestoration)
+            {
+                writeProcs->putBooleanProc(token, keyEnableRestoration, options.enableRestoration);
+            }
+
+            if (options.targetFileSize > 0)
+            {
+                writeProcs->putIntegerProc(token, keyTargetFileSize, options.targetFileSize);
+            }
+
+            if (options.targetSsim > 0.0f)
+            {
+                real64 targetSsim64 = options.targetSsim;
+
+                writeProcs->putFloatProc(token, keyTargetSSIM, &targetSsim64);
+            }
+
+            if (options.encodeTimeBudget > 0)
+            {
+                writeProcs->putIntegerProc(token, keyEncodeTimeBudget, options.encodeTimeBudget);
+            }
+
+            if (options.neutralAsMonochrome)
+            {
+                writeProcs->putBooleanProc(token, keyNeutralAsMonochrome, options.neutralAsMonochrome);
+            }
+
+            if (options.screenContentTools != ScreenContentTools::Auto)
+            {
+                enumValue = ScreenContentToolsToDescriptor(options.screenContentTools);
+                writeProcs->putEnumeratedProc(token, keyScreenContentTools, typeScreenContentTools, enumValue);
+            }
+
+            if (options.detectEightBitContent)
+            {
+                writeProcs->putBooleanProc(token, keyDetectEightBitContent, options.detectEightBitContent);
+            }
+
+            if (options.remuxUnmodifiedImages)
+            {
+                writeProcs->putBooleanProc(token, keyRemuxUnmodifiedImages, options.remuxUnmodifiedImages);
+            }
+
+            if (options.thumbnailSize > 0)
+            {
+                writeProcs->putIntegerProc(token, keyThumbnailSize, options.thumbnailSize);
+            }
+
+            if (options.exportVariantCount > 0)
+            {
+                ExportVariantsToDescriptor(formatRecord, token, options);
+            }
+
+            if (results != nullptr && results->searchIterations > 0)
+            {
+                writeProcs->putIntegerProc(token, keyOutputFileSize, results->outputFileSize);
+                writeProcs->putIntegerProc(token, keyOutputQuality, results->outputQuality);
+                writeProcs->putIntegerProc(token, keySearchIterations, results->searchIterations);
+
+                if (results->outputSsim > 0.0)
+                {
+                    real64 outputSsim64 = results->outputSsim;
+
+                    writeProcs->putFloatProc(token, keyOutputSSIM, &outputSsim64);
+                }
+
+                if (results->outputPsnr > 0.0)
+                {
+                    real64 outputPsnr64 = results->outputPsnr;
+
+                    writeProcs->putFloatProc(token, keyOutputPSNR, &outputPsnr64);
+                }
+            }
+
+            if (results != nullptr && results->eightBitContentDetected)
+            {
+                writeProcs->putBooleanProc(token, keyEightBitContentDetected, results->eightBitContentDetected);
+            }
+
             error = writeProcs->closeWriteDescriptorProc(token, &formatRecord->descriptorParameters->descriptor);
         }
     }
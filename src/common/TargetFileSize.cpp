@@ -0,0 +1,267 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TargetFileSize.h"
+#include "EncodeToMemory.h"
+#include "ImageScaling.h"
+#include "OSErrException.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <thread>
+
+namespace
+{
+    // The proxy image is small enough that the trial encodes take a fraction of the time
+    // of a full resolution encode, but large enough to be representative of the image content.
+    constexpr int64_t proxyImageMaxPixels = 512 * 512;
+    constexpr int maxFullResolutionIterations = 8;
+    // The number of full resolution encodes that use the predicted quality before
+    // the search switches to bisection.
+    constexpr int maxPredictedIterations = 3;
+    constexpr int32 searchProgressStart = 50;
+    constexpr int32 searchProgressEnd = 75;
+
+    struct QualitySample
+    {
+        int quality;
+        double size;
+    };
+
+    std::vector<QualitySample> EncodeProxySamples(
+        const FormatRecordPtr formatRecord,
+        const std::shared_ptr<heif_image>& image,
+        const SaveUIOptions& saveOptions,
+        bool hasAlpha,
+        double& areaRatio)
+    {
+        const int width = heif_image_get_primary_width(image.get());
+        const int height = heif_image_get_primary_height(image.get());
+        const int64_t imagePixels = static_cast<int64_t>(width) * static_cast<int64_t>(height);
+
+        // The proxy image is shared with the trial encode worker threads.
+        std::shared_ptr<heif_image> proxyImage = image;
+        areaRatio = 1.0;
+
+        if (imagePixels > proxyImageMaxPixels * 2)
+        {
+            const double scale = std::sqrt(static_cast<double>(proxyImageMaxPixels) / static_cast<double>(imagePixels));
+
+            const int proxyWidth = std::max(static_cast<int>(width * scale), 1);
+            const int proxyHeight = std::max(static_cast<int>(height * scale), 1);
+
+            proxyImage = ScaleHeifImage(image.get(), proxyWidth, proxyHeight);
+            areaRatio = static_cast<double>(imagePixels) / (static_cast<double>(proxyWidth) * static_cast<double>(proxyHeight));
+        }
+
+        const unsigned int trialCount = std::clamp(std::thread::hardware_concurrency(), 4U, 8U);
+        const unsigned int threadsPerTrial = std::max(std::thread::hardware_concurrency() / trialCount, 1U);
+
+        std::vector<QualitySample> samples(trialCount);
+        std::vector<std::future<size_t>> trials;
+        trials.reserve(trialCount);
+
+        for (unsigned int i = 0; i < trialCount; i++)
+        {
+            samples[i].quality = static_cast<int>(((i + 1) * 100) / (trialCount + 1));
+
+            SaveUIOptions trialOptions = saveOptions;
+            trialOptions.quality = samples[i].quality;
+
+            trials.push_back(StartEncodeOnWorkerThread<size_t>([=]()
+            {
+                return EncodeImageToMemory(proxyImage.get(), trialOptions, hasAlpha, threadsPerTrial).size();
+            }));
+        }
+
+        const auto startTime = std::chrono::steady_clock::now();
+
+        for (unsigned int i = 0; i < trialCount; i++)
+        {
+            WaitForWorkerEncode(formatRecord, trials[i], nullptr, startTime);
+
+            samples[i].size = static_cast<double>(trials[i].get());
+        }
+
+        return samples;
+    }
+
+    // Interpolates the logarithm of the file size between the proxy samples.
+    double EstimateSize(const std::vector<QualitySample>& samples, int quality)
+    {
+        size_t index = 0;
+
+        while (index + 2 < samples.size() && quality > samples[index + 1].quality)
+        {
+            index++;
+        }
+
+        const QualitySample& a = samples[index];
+        const QualitySample& b = samples[index + 1];
+
+        const double logA = std::log(std::max(a.size, 1.0));
+        const double logB = std::log(std::max(b.size, 1.0));
+        const double t = static_cast<double>(quality - a.quality) / static_cast<double>(b.quality - a.quality);
+
+        return std::exp(logA + (t * (logB - logA)));
+    }
+
+    int PredictQuality(const std::vector<QualitySample>& samples, double targetSize)
+    {
+        const double logTarget = std::log(std::max(targetSize, 1.0));
+
+        size_t index = 0;
+
+        while (index + 2 < samples.size() && logTarget > std::log(std::max(samples[index + 1].size, 1.0)))
+        {
+            index++;
+        }
+
+        const QualitySample& a = samples[index];
+        const QualitySample& b = samples[index + 1];
+
+        const double logA = std::log(std::max(a.size, 1.0));
+        const double logB = std::log(std::max(b.size, 1.0));
+
+        if (logB <= logA)
+        {
+            return a.quality;
+        }
+
+        const double t = (logTarget - logA) / (logB - logA);
+        const double quality = a.quality + (t * static_cast<double>(b.quality - a.quality));
+
+        return std::clamp(static_cast<int>(std::floor(quality)), 0, 100);
+    }
+}
+
+TargetFileSizeResult EncodeForTargetFileSize(
+    const FormatRecordPtr formatRecord,
+    const std::shared_ptr<heif_image>& image,
+    const SaveUIOptions& saveOptions,
+    bool hasAlpha)
+{
+    const double targetSize = static_cast<double>(saveOptions.targetFileSize);
+    const auto proxyStartTime = std::chrono::steady_clock::now();
+
+    double areaRatio;
+    const std::vector<QualitySample> proxySamples = EncodeProxySamples(formatRecord, image, saveOptions, hasAlpha, areaRatio);
+
+    // The expected duration is only used for the progress, the first full resolution encode
+    // is estimated from the proxy encodes and the later ones use the previous encode time.
+    const std::chrono::duration<double> proxyElapsed = std::chrono::steady_clock::now() - proxyStartTime;
+    double expectedEncodeSeconds = (proxyElapsed.count() * areaRatio) / static_cast<double>(proxySamples.size());
+
+    // The ratio between the full resolution and proxy file sizes starts with the ratio of
+    // the image areas, and is refined after each full resolution encode.
+    double sizeRatio = areaRatio;
+
+    TargetFileSizeResult result{};
+    result.quality = -1;
+
+    TargetFileSizeResult smallest{};
+    smallest.quality = -1;
+
+    int low = 0;
+    int high = 100;
+    int quality = PredictQuality(proxySamples, targetSize / sizeRatio);
+    int iterations = 0;
+
+    while (low <= high && iterations < maxFullResolutionIterations)
+    {
+        SaveUIOptions trialOptions = saveOptions;
+        trialOptions.quality = quality;
+
+        const EncodeProgressRange progress =
+        {
+            searchProgressStart + ((iterations * (searchProgressEnd - searchProgressStart)) / maxFullResolutionIterations),
+            searchProgressStart + (((iterations + 1) * (searchProgressEnd - searchProgressStart)) / maxFullResolutionIterations),
+            expectedEncodeSeconds
+        };
+        const auto encodeStartTime = std::chrono::steady_clock::now();
+
+        std::vector<uint8_t> file = EncodeFileToMemory(formatRecord, image, trialOptions, hasAlpha, progress);
+        iterations++;
+
+        const std::chrono::duration<double> encodeElapsed = std::chrono::steady_clock::now() - encodeStartTime;
+        expectedEncodeSeconds = encodeElapsed.count();
+
+        formatRecord->progressProc(progress.end, 100);
+
+        if (formatRecord->abortProc())
+        {
+            throw OSErrException(userCanceledErr);
+        }
+
+        const double fileSize = static_cast<double>(file.size());
+
+        sizeRatio = fileSize / EstimateSize(proxySamples, quality);
+
+        if (fileSize <= targetSize)
+        {
+            result.file = std::move(file);
+            result.quality = quality;
+            low = quality + 1;
+        }
+        else
+        {
+            if (result.quality < 0 && (smallest.quality < 0 || file.size() < smallest.file.size()))
+            {
+                smallest.file = std::move(file);
+                smallest.quality = quality;
+            }
+
+            high = quality - 1;
+        }
+
+        if (low > high)
+        {
+            break;
+        }
+
+        if (iterations < maxPredictedIterations)
+        {
+            quality = std::clamp(PredictQuality(proxySamples, targetSize / sizeRatio), low, high);
+        }
+        else
+        {
+            quality = low + ((high - low) / 2);
+        }
+    }
+
+    if (result.quality < 0)
+    {
+        result.file = std::move(smallest.file);
+        result.quality = smallest.quality;
+    }
+
+    result.iterations = iterations;
+
+    DebugOut(
+        "Target file size: %d bytes, output size: %zu bytes at quality %d after %u proxy encodes and %d full resolution encodes.",
+        saveOptions.targetFileSize,
+        result.file.size(),
+        result.quality,
+        static_cast<unsigned int>(proxySamples.size()),
+        result.iterations);
+
+    return result;
+}
@@ -0,0 +1,183 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TargetQuality.h"
+#include "EncodeToMemory.h"
+#include "ImageMetrics.h"
+#include "LibHeifException.h"
+#include "OSErrException.h"
+#include "ScopedHeif.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    // A bisection of the 0 to 100 quality range takes at most 7 iterations.
+    constexpr int maxIterations = 7;
+    constexpr int32 searchProgressStart = 50;
+    constexpr int32 searchProgressEnd = 75;
+    // The first encode has no previous encode time to estimate the progress from.
+    constexpr double firstEncodeExpectedSeconds = 2.0;
+
+    ScopedHeifImage DecodeFile(const std::vector<uint8_t>& file, heif_image* reference)
+    {
+        ScopedHeifContext context(heif_context_alloc());
+
+        if (context == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        LibHeifException::ThrowIfError(heif_context_read_from_memory_without_copy(
+            context.get(),
+            file.data(),
+            file.size(),
+            nullptr));
+
+        heif_image_handle* tempImageHandle;
+
+        LibHeifException::ThrowIfError(heif_context_get_primary_image_handle(context.get(), &tempImageHandle));
+
+        ScopedHeifImageHandle imageHandle(tempImageHandle);
+
+        heif_image* tempImage;
+
+        // The decoded image uses the same format as the reference image, so that
+        // the quality metrics can compare the images directly.
+        LibHeifException::ThrowIfError(heif_decode_image(
+            imageHandle.get(),
+            &tempImage,
+            heif_image_get_colorspace(reference),
+            heif_image_get_chroma_format(reference),
+            nullptr));
+
+        return ScopedHeifImage(tempImage);
+    }
+}
+
+TargetQualityResult EncodeForTargetQuality(
+    const FormatRecordPtr formatRecord,
+    const std::shared_ptr<heif_image>& image,
+    const SaveUIOptions& saveOptions,
+    bool hasAlpha)
+{
+    const double targetSsim = static_cast<double>(saveOptions.targetSsim);
+
+    TargetQualityResult result{};
+    result.quality = -1;
+
+    TargetQualityResult highest{};
+    highest.quality = -1;
+
+    int low = 0;
+    int high = 100;
+    // The first candidate uses the quality setting from the save options.
+    int quality = std::clamp(saveOptions.quality, low, high);
+    int iterations = 0;
+    double expectedEncodeSeconds = firstEncodeExpectedSeconds;
+
+    while (low <= high && iterations < maxIterations)
+    {
+        SaveUIOptions trialOptions = saveOptions;
+        trialOptions.quality = quality;
+
+        const EncodeProgressRange progress =
+        {
+            searchProgressStart + ((iterations * (searchProgressEnd - searchProgressStart)) / maxIterations),
+            searchProgressStart + (((iterations + 1) * (searchProgressEnd - searchProgressStart)) / maxIterations),
+            expectedEncodeSeconds
+        };
+        const auto encodeStartTime = std::chrono::steady_clock::now();
+
+        std::vector<uint8_t> file = EncodeFileToMemory(formatRecord, image, trialOptions, hasAlpha, progress);
+        iterations++;
+
+        const std::chrono::duration<double> encodeElapsed = std::chrono::steady_clock::now() - encodeStartTime;
+        expectedEncodeSeconds = encodeElapsed.count();
+
+        if (formatRecord->abortProc())
+        {
+            throw OSErrException(userCanceledErr);
+        }
+
+        const ImageQualityMetrics metrics = ComputeImageQualityMetrics(
+            image.get(),
+            DecodeFile(file, image.get()).get(),
+            targetSsim);
+
+        DebugOut(
+            "Quality %d: SSIM %f, PSNR %f dB, %zu bytes%s.",
+            quality,
+            metrics.ssim,
+            metrics.psnr,
+            file.size(),
+            metrics.stoppedEarly ? " (stopped early)" : "");
+
+        formatRecord->progressProc(progress.end, 100);
+
+        if (formatRecord->abortProc())
+        {
+            throw OSErrException(userCanceledErr);
+        }
+
+        if (metrics.ssim >= targetSsim)
+        {
+            result.file = std::move(file);
+            result.quality = quality;
+            result.ssim = metrics.ssim;
+            result.psnr = metrics.psnr;
+            high = quality - 1;
+        }
+        else
+        {
+            if (result.quality < 0 && quality > highest.quality)
+            {
+                highest.file = std::move(file);
+                highest.quality = quality;
+                highest.ssim = metrics.ssim;
+                highest.psnr = metrics.psnr;
+            }
+
+            low = quality + 1;
+        }
+
+        quality = low + ((high - low) / 2);
+    }
+
+    if (result.quality < 0)
+    {
+        result.file = std::move(highest.file);
+        result.quality = highest.quality;
+        result.ssim = highest.ssim;
+        result.psnr = highest.psnr;
+    }
+
+    result.iterations = iterations;
+
+    DebugOut(
+        "Target SSIM: %f, output SSIM: %f at quality %d, %zu bytes after %d encodes.",
+        targetSsim,
+        result.ssim,
+        result.quality,
+        result.file.size(),
+        result.iterations);
+
+    return result;
+}
@@ -0,0 +1,46 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TARGETQUALITY_H
+#define TARGETQUALITY_H
+
+#include "AvifFormat.h"
+#include <memory>
+#include <vector>
+
+struct TargetQualityResult
+{
+    std::vector<uint8_t> file;
+    int quality;
+    double ssim;
+    double psnr;
+    int iterations;
+};
+
+// Searches for the lowest quality value that produces a file with a luma SSIM of at least the target value.
+// If the target SSIM cannot be reached, the highest quality file that was encoded is returned.
+// The encodes run on a worker thread while the host thread reports progress.
+TargetQualityResult EncodeForTargetQuality(
+    const FormatRecordPtr formatRecord,
+    const std::shared_ptr<heif_image>& image,
+    const SaveUIOptions& saveOptions,
+    bool hasAlpha);
+
+#endif // !TARGETQUALITY_H
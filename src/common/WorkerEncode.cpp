@@ -0,0 +1,63 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WorkerEncode.h"
+#include "OSErrException.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+void PollWorkerEncode(
+    const FormatRecordPtr formatRecord,
+    const EncodeProgressRange* progress,
+    std::chrono::steady_clock::time_point startTime)
+{
+    if (formatRecord->abortProc())
+    {
+        // The host is released immediately, the workers finish in the background.
+        throw OSErrException(userCanceledErr);
+    }
+
+    if (progress != nullptr)
+    {
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+        const double progressTimeConstant = std::max(progress->expectedSeconds, 0.1) / 2.0;
+
+        // The progress approaches the end of the range asymptotically, this keeps the
+        // progress bar moving when the encode takes longer than expected.
+        const double fraction = 1.0 - std::exp(-elapsed.count() / progressTimeConstant);
+
+        formatRecord->progressProc(progress->start + static_cast<int32>(fraction * (progress->end - progress->start)), 100);
+    }
+}
+
+void RunEncodeOnWorkerThread(
+    const FormatRecordPtr formatRecord,
+    std::function<void()> encode,
+    const EncodeProgressRange& progress)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    std::future<void> encodeResult = StartEncodeOnWorkerThread(std::move(encode));
+
+    WaitForWorkerEncode(formatRecord, encodeResult, &progress, startTime);
+
+    encodeResult.get();
+}
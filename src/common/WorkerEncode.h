@@ -0,0 +1,126 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKERENCODE_H
+#define WORKERENCODE_H
+
+#include "AvifFormat.h"
+#include "LibHeifException.h"
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+struct EncodeProgressRange
+{
+    int32 start;
+    int32 end;
+    // The estimated encode duration, this controls how fast the progress approaches the end of the range.
+    double expectedSeconds;
+};
+
+// The host is polled for cancellation at this interval while waiting for the workers.
+constexpr std::chrono::milliseconds encodePollInterval(50);
+
+// Starts the encode on a detached worker thread.
+// libheif does not provide progress or cancellation callbacks for encoding, so the worker cannot be
+// interrupted. Unlike a std::async future, the returned future does not block in its destructor, so a
+// canceled save does not wait for the worker. The encode must own or share ownership of everything it uses.
+template <typename T>
+std::future<T> StartEncodeOnWorkerThread(std::function<T()> encode)
+{
+    // The worker holds its own libheif reference, the host thread deinitializes libheif
+    // when the save is canceled, but the encoder plugins must stay loaded until the worker is finished.
+    LibHeifException::ThrowIfError(heif_init(nullptr));
+
+    auto encodeFinished = std::make_shared<std::promise<T>>();
+    std::future<T> encodeResult = encodeFinished->get_future();
+
+    try
+    {
+        std::thread(
+            [encodeFinished, encode = std::move(encode)]() mutable
+            {
+                try
+                {
+                    if constexpr (std::is_void_v<T>)
+                    {
+                        encode();
+                        encodeFinished->set_value();
+                    }
+                    else
+                    {
+                        encodeFinished->set_value(encode());
+                    }
+                }
+                catch (...)
+                {
+                    encodeFinished->set_exception(std::current_exception());
+                }
+
+                // The objects owned by the encode, and the result if the host has discarded the future,
+                // are released before the libheif reference.
+                encode = nullptr;
+                encodeFinished.reset();
+                heif_deinit();
+            }).detach();
+    }
+    catch (...)
+    {
+        heif_deinit();
+        throw;
+    }
+
+    return encodeResult;
+}
+
+// Polls the host for cancellation and reports the estimated progress of the encodes that were started at startTime,
+// progress may be null if the caller does not report progress.
+// Throws OSErrException(userCanceledErr) when the user cancels, the workers finish in the background.
+void PollWorkerEncode(
+    const FormatRecordPtr formatRecord,
+    const EncodeProgressRange* progress,
+    std::chrono::steady_clock::time_point startTime);
+
+// Waits for a worker on the host thread, see PollWorkerEncode.
+template <typename T>
+void WaitForWorkerEncode(
+    const FormatRecordPtr formatRecord,
+    const std::future<T>& encodeResult,
+    const EncodeProgressRange* progress,
+    std::chrono::steady_clock::time_point startTime)
+{
+    while (encodeResult.wait_for(encodePollInterval) != std::future_status::ready)
+    {
+        PollWorkerEncode(formatRecord, progress, startTime);
+    }
+}
+
+// Runs the encode on a worker thread while the host thread reports the estimated progress
+// and polls for cancellation.
+void RunEncodeOnWorkerThread(
+    const FormatRecordPtr formatRecord,
+    std::function<void()> encode,
+    const EncodeProgressRange& progress);
+
+#endif // !WORKERENCODE_H
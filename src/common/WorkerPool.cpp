@@ -0,0 +1,168 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned int workerThreadCount)
+    : mutex(), workAvailable(), workFinished(), threads(), currentTask(nullptr), currentTaskCount(0),
+      nextTaskIndex(0), activeWorkerCount(0), generation(0), shuttingDown(false), taskException()
+{
+    threads.reserve(workerThreadCount);
+
+    try
+    {
+        for (unsigned int i = 0; i < workerThreadCount; i++)
+        {
+            threads.emplace_back(&WorkerPool::WorkerThreadProc, this);
+        }
+    }
+    catch (...)
+    {
+        // The pool runs the tasks with the threads that were started.
+        if (threads.empty())
+        {
+            throw;
+        }
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        shuttingDown = true;
+    }
+
+    workAvailable.notify_all();
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void WorkerPool::Run(size_t taskCount, const std::function<void(size_t)>& task)
+{
+    if (threads.empty() || taskCount <= 1)
+    {
+        for (size_t i = 0; i < taskCount; i++)
+        {
+            task(i);
+        }
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        currentTask = &task;
+        currentTaskCount = taskCount;
+        nextTaskIndex.store(0);
+        activeWorkerCount = threads.size();
+        taskException = nullptr;
+        generation++;
+    }
+
+    workAvailable.notify_all();
+
+    RunTasks();
+
+    std::exception_ptr exception;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        workFinished.wait(lock, [this] { return activeWorkerCount == 0; });
+
+        currentTask = nullptr;
+        exception = taskException;
+        taskException = nullptr;
+    }
+
+    if (exception)
+    {
+        std::rethrow_exception(exception);
+    }
+}
+
+void WorkerPool::RunTasks()
+{
+    while (true)
+    {
+        const size_t index = nextTaskIndex.fetch_add(1);
+
+        if (index >= currentTaskCount)
+        {
+            break;
+        }
+
+        try
+        {
+            (*currentTask)(index);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (!taskException)
+            {
+                taskException = std::current_exception();
+            }
+
+            nextTaskIndex.store(currentTaskCount);
+        }
+    }
+}
+
+void WorkerPool::WorkerThreadProc()
+{
+    uint64_t completedGeneration = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            workAvailable.wait(lock, [&] { return shuttingDown || generation != completedGeneration; });
+
+            if (shuttingDown)
+            {
+                return;
+            }
+
+            completedGeneration = generation;
+        }
+
+        RunTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            activeWorkerCount--;
+
+            if (activeWorkerCount == 0)
+            {
+                workFinished.notify_one();
+            }
+        }
+    }
+}
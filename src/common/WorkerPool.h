@@ -0,0 +1,70 @@
+/*
+ * This file is part of avif-format, an AV1 Image (AVIF) file format
+ * plug-in for Adobe Photoshop(R).
+ *
+ * Copyright (c) 2021, 2022, 2023 Nicholas Hayes
+ *
+ * avif-format is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * avif-format is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with avif-format.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A set of threads that are reused for the parallel loops of a single operation.
+// The calling thread also runs tasks, a pool without worker threads runs the tasks serially.
+class WorkerPool
+{
+public:
+
+    explicit WorkerPool(unsigned int workerThreadCount);
+
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Calls task for each index in [0, taskCount) and waits for all of the tasks to finish.
+    // If a task throws an exception the remaining tasks are skipped, and the first exception
+    // is rethrown on the calling thread.
+    void Run(size_t taskCount, const std::function<void(size_t)>& task);
+
+private:
+
+    void RunTasks();
+
+    void WorkerThreadProc();
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workFinished;
+    std::vector<std::thread> threads;
+    const std::function<void(size_t)>* currentTask;
+    size_t currentTaskCount;
+    std::atomic<size_t> nextTaskIndex;
+    size_t activeWorkerCount;
+    uint64_t generation;
+    bool shuttingDown;
+    std::exception_ptr taskException;
+};
+
+#endif // !WORKERPOOL_H
@@ -19,47 +19,90 @@
  */
 
 #include "AvifFormat.h"
+#include "EncodeSpeedModel.h"
+#include "EncodeToMemory.h"
+#include "EncoderSettings.h"
+#include "ExportVariants.h"
 #include "FileIO.h"
+#include "ImageScaling.h"
 #include "LibHeifException.h"
 #include "OSErrException.h"
 #include "PremultipliedAlpha.h"
+#include "RemuxPassthrough.h"
 #include "ScopedBufferSuite.h"
 #include "ScopedHeif.h"
+#include "TargetFileSize.h"
+#include "TargetQuality.h"
+#include "WorkerEncode.h"
 #include "WriteHeifImage.h"
 #include "WriteMetadata.h"
 #include <algorithm>
-#include <thread>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <utility>
 #include <vector>
 
 namespace
 {
-    ScopedHeifImageHandle EncodeImage(
-        heif_context* context,
-        heif_image* image,
-        heif_encoder* encoder,
-        const heif_encoding_options* options)
-    {
-        heif_image_handle* encodedImageHandle;
+    constexpr int encodeProgressStart = 50;
+    constexpr int encodeProgressEnd = 75;
 
-        LibHeifException::ThrowIfError(heif_context_encode_image(context, image, encoder, options, &encodedImageHandle));
+    // The encode job is shared with the worker thread, so that a canceled encode can finish in the background
+    // after the host has been released.
+    struct ImageEncodeJob
+    {
+        ScopedHeifContext context;
+        ScopedHeifImage image;
+        ScopedHeifEncoder encoder;
+        ScopedHeifEncodingOptions encodingOptions;
+        ScopedHeifImageHandle encodedImageHandle;
+    };
 
-        return ScopedHeifImageHandle(encodedImageHandle);
+    void EncodeImage(
+        const FormatRecordPtr formatRecord,
+        const std::shared_ptr<ImageEncodeJob>& job,
+        double expectedSeconds)
+    {
+        RunEncodeOnWorkerThread(
+            formatRecord,
+            [job]()
+            {
+                heif_image_handle* encodedImageHandle;
+
+                LibHeifException::ThrowIfError(heif_context_encode_image(
+                    job->context.get(),
+                    job->image.get(),
+                    job->encoder.get(),
+                    job->encodingOptions.get(),
+                    &encodedImageHandle));
+
+                job->encodedImageHandle.reset(encodedImageHandle);
+
+                // The encoder state and the source image are not used after this point.
+                job->encoder.reset();
+                job->image.reset();
+            },
+            { encodeProgressStart, encodeProgressEnd, expectedSeconds });
     }
 
-    ScopedHeifEncoder GetAOMEncoder(heif_context* context)
+    double GetExpectedEncodeSeconds(const EncodeWorkload& workload, heif_encoder* encoder)
     {
-        heif_encoder* tempEncoder;
+        int speed;
+        int threadCount;
 
-        const heif_encoder_descriptor* aomEncoderDescriptor;
-
-        if (heif_context_get_encoder_descriptors(context, heif_compression_AV1, "aom", &aomEncoderDescriptor, 1) != 1)
+        if (heif_encoder_get_parameter_integer(encoder, "speed", &speed).code != heif_error_Ok)
         {
-            throw std::runtime_error("Unable to get the AOM encoder descriptor.");
+            speed = 6;
         }
 
-        LibHeifException::ThrowIfError(heif_context_get_encoder(context, aomEncoderDescriptor, &tempEncoder));
+        if (heif_encoder_get_parameter_integer(encoder, "threads", &threadCount).code != heif_error_Ok)
+        {
+            threadCount = 1;
+        }
 
-        return ScopedHeifEncoder(tempEncoder);
+        // The calibration model uses the AOM speed range, this is only an approximation for the other encoders.
+        return PredictEncodeSeconds(workload, speed, threadCount);
     }
 
     heif_error heif_writer_write(
@@ -81,94 +124,232 @@ namespace
         LibHeifException::ThrowIfError(heif_context_write(context, &writer, reinterpret_cast<void*>(formatRecord->dataFork)));
     }
 
-    void EncodeAndSaveImage(
-        const FormatRecordPtr formatRecord,
-        heif_context* context,
-        heif_image* image,
-        const SaveUIOptions& saveOptions)
+    // The thumbnail is encoded on a worker thread while the host thread encodes the main image,
+    // the result is not valid if the save options do not include a thumbnail.
+    std::future<std::vector<uint8_t>> StartThumbnailEncode(heif_image* image, const SaveUIOptions& saveOptions)
     {
-        formatRecord->progressProc(50, 100);
+        std::future<std::vector<uint8_t>> result;
+
+        if (saveOptions.thumbnailSize > 0)
+        {
+            const int width = heif_image_get_primary_width(image);
+            const int height = heif_image_get_primary_height(image);
+
+            // A thumbnail is only useful if it is smaller than the main image.
+            if (std::max(width, height) > saveOptions.thumbnailSize)
+            {
+                int thumbnailWidth;
+                int thumbnailHeight;
+
+                GetScaledImageSize(width, height, saveOptions.thumbnailSize, thumbnailWidth, thumbnailHeight);
 
-        AddColorProfileToImage(formatRecord, image, saveOptions);
+                ScopedHeifImage thumbnail = ScaleHeifImage(image, thumbnailWidth, thumbnailHeight);
 
-        ScopedHeifEncoder encoder = GetAOMEncoder(context);
+                // The thumbnail always uses AOM, the other encoders have larger minimum image sizes.
+                SaveUIOptions thumbnailOptions = saveOptions;
+                thumbnailOptions.encoderBackend = EncoderBackend::Aom;
+                thumbnailOptions.compressionSpeed = CompressionSpeed::Fastest;
+                thumbnailOptions.encoderSpeed = encoderSpeedUsePreset;
+                thumbnailOptions.lossless = false;
 
-        if (saveOptions.lossless)
+                const bool hasAlpha = HeifImageHasAlphaChannel(image);
+
+                result = StartEncodeOnWorkerThread<std::vector<uint8_t>>(
+                    [thumbnail = std::shared_ptr<heif_image>(std::move(thumbnail)), thumbnailOptions, hasAlpha]()
+                    {
+                        return EncodeImageToMemory(thumbnail.get(), thumbnailOptions, hasAlpha, 1);
+                    });
+            }
+        }
+
+        return result;
+    }
+
+    void WriteFileData(
+        const FormatRecordPtr formatRecord,
+        const std::vector<uint8_t>& file,
+        std::future<std::vector<uint8_t>>& thumbnail)
+    {
+        if (thumbnail.valid())
         {
-            heif_encoder_set_lossy_quality(encoder.get(), 100);
-            heif_encoder_set_lossless(encoder.get(), true);
-            heif_encoder_set_parameter(encoder.get(), "chroma", "444");
+            WaitForWorkerEncode(formatRecord, thumbnail, nullptr, std::chrono::steady_clock::now());
+
+            WriteFileWithThumbnail(formatRecord->dataFork, file, thumbnail.get());
         }
         else
         {
-            heif_encoder_set_lossy_quality(encoder.get(), saveOptions.quality);
-            heif_encoder_set_lossless(encoder.get(), false);
+            OSErrException::ThrowIfError(WriteData(formatRecord->dataFork, file.data(), file.size()));
+        }
+    }
+
+    void SaveImageWithTargetFileSize(
+        const FormatRecordPtr formatRecord,
+        ScopedHeifImage scopedImage,
+        const SaveUIOptions& saveOptions,
+        std::future<std::vector<uint8_t>>& thumbnail,
+        SaveResults& results)
+    {
+        // The image is shared with the encode worker threads, a canceled encode finishes in the background.
+        std::shared_ptr<heif_image> image(std::move(scopedImage));
+
+        const TargetFileSizeResult result = EncodeForTargetFileSize(
+            formatRecord,
+            image,
+            saveOptions,
+            HeifImageHasAlphaChannel(image.get()));
 
-            switch (saveOptions.chromaSubsampling)
+        image.reset();
+        DebugOutMemoryUsage("Released the source image");
+
+        WriteFileData(formatRecord, result.file, thumbnail);
+
+        results.outputFileSize = static_cast<int>(std::min(result.file.size(), static_cast<size_t>(std::numeric_limits<int>::max())));
+        results.outputQuality = result.quality;
+        results.searchIterations = result.iterations;
+    }
+
+    void SaveImageWithTargetQuality(
+        const FormatRecordPtr formatRecord,
+        ScopedHeifImage scopedImage,
+        const SaveUIOptions& saveOptions,
+        std::future<std::vector<uint8_t>>& thumbnail,
+        SaveResults& results)
+    {
+        // The image is shared with the encode worker thread, a canceled encode finishes in the background.
+        std::shared_ptr<heif_image> image(std::move(scopedImage));
+
+        const TargetQualityResult result = EncodeForTargetQuality(
+            formatRecord,
+            image,
+            saveOptions,
+            HeifImageHasAlphaChannel(image.get()));
+
+        image.reset();
+        DebugOutMemoryUsage("Released the source image");
+
+        WriteFileData(formatRecord, result.file, thumbnail);
+
+        results.outputFileSize = static_cast<int>(std::min(result.file.size(), static_cast<size_t>(std::numeric_limits<int>::max())));
+        results.outputQuality = result.quality;
+        results.searchIterations = result.iterations;
+        results.outputSsim = result.ssim;
+        results.outputPsnr = result.psnr;
+    }
+
+    bool UseEncodeTimeBudget(const SaveUIOptions& saveOptions)
+    {
+        // The calibration model only covers the AOM speed range, lossless compression always uses AOM.
+        return saveOptions.encodeTimeBudget > 0
+            && (saveOptions.encoderBackend == EncoderBackend::Aom || saveOptions.lossless);
+    }
+
+    // The workload describes the encoded image, which may have a lower bit depth than the document.
+    EncodeWorkload GetEncodeWorkload(heif_image* image, const SaveUIOptions& saveOptions)
+    {
+        EncodeWorkload workload{};
+
+        workload.width = heif_image_get_primary_width(image);
+        workload.height = heif_image_get_primary_height(image);
+        workload.highBitDepth = GetHeifImageBitsPerChannel(image) > 8;
+        workload.hasAlpha = HeifImageHasAlphaChannel(image);
+        workload.lossless = saveOptions.lossless;
+
+        return workload;
+    }
+
+    // The source image is released as soon as it has been encoded, this avoids keeping
+    // it in memory while libheif serializes the encoded file.
+    void EncodeAndSaveImage(
+        const FormatRecordPtr formatRecord,
+        ScopedHeifImage image,
+        const SaveUIOptions& saveOptions,
+        SaveResults& results)
+    {
+        formatRecord->progressProc(encodeProgressStart, 100);
+
+        AddColorProfileToImage(formatRecord, image.get(), saveOptions);
+
+        std::future<std::vector<uint8_t>> thumbnail = StartThumbnailEncode(image.get(), saveOptions);
+
+        if (!saveOptions.lossless)
+        {
+            // The target file size takes precedence over the target SSIM.
+            if (saveOptions.targetFileSize > 0)
             {
-            case ChromaSubsampling::Yuv420:
-                heif_encoder_set_parameter(encoder.get(), "chroma", "420");
-                break;
-            case ChromaSubsampling::Yuv422:
-                heif_encoder_set_parameter(encoder.get(), "chroma", "422");
-                break;
-            case ChromaSubsampling::Yuv444:
-                heif_encoder_set_parameter(encoder.get(), "chroma", "444");
-                break;
-            default:
-                throw OSErrException(formatBadParameters);
-            }
+                SaveImageWithTargetFileSize(formatRecord, std::move(image), saveOptions, thumbnail, results);
 
-            if (HasAlphaChannel(formatRecord) && saveOptions.losslessAlpha)
+                formatRecord->progressProc(100, 100);
+                return;
+            }
+            else if (saveOptions.targetSsim > 0.0f)
             {
-                heif_encoder_set_parameter_integer(encoder.get(), "alpha-quality", 100);
-                heif_encoder_set_parameter_boolean(encoder.get(), "lossless-alpha", true);
+                SaveImageWithTargetQuality(formatRecord, std::move(image), saveOptions, thumbnail, results);
+
+                formatRecord->progressProc(100, 100);
+                return;
             }
         }
 
-        switch (saveOptions.compressionSpeed)
+        std::shared_ptr<ImageEncodeJob> job = std::make_shared<ImageEncodeJob>();
+        job->context.reset(heif_context_alloc());
+
+        if (job->context == nullptr)
         {
-        case CompressionSpeed::Fastest:
-            heif_encoder_set_parameter_integer(encoder.get(), "speed", 6);
-            heif_encoder_set_parameter_boolean(encoder.get(), "realtime", true);
-            break;
-        case CompressionSpeed::Slowest:
-            heif_encoder_set_parameter_integer(encoder.get(), "speed", 1);
-            break;
-        case CompressionSpeed::Default:
-            heif_encoder_set_parameter_integer(encoder.get(), "speed", 4);
-            break;
-        default:
-            throw OSErrException(formatBadParameters);
+            throw std::bad_alloc();
         }
 
-        const unsigned int threadCount = std::clamp(std::thread::hardware_concurrency(), 1U, 16U);
-        heif_encoder_set_parameter_integer(encoder.get(), "threads", static_cast<int>(threadCount));
+        heif_context* context = job->context.get();
 
-        ScopedHeifEncodingOptions encodingOptions(heif_encoding_options_alloc());
+        const bool useEncodeTimeBudget = UseEncodeTimeBudget(saveOptions);
+        const EncodeWorkload workload = GetEncodeWorkload(image.get(), saveOptions);
+        EncodeSettingsPrediction prediction{};
+        ScopedHeifEncoder encoder;
 
-        if (encodingOptions == nullptr)
+        if (useEncodeTimeBudget)
         {
-            throw std::bad_alloc();
-        }
+            prediction = PredictEncodeSettings(workload, saveOptions.encodeTimeBudget, encoderMaxThreadCount);
 
-        encodingOptions->save_two_colr_boxes_when_ICC_and_nclx_available = true;
-        encodingOptions->macOS_compatibility_workaround_no_nclx_profile = false;
+            SaveUIOptions budgetOptions = saveOptions;
+            budgetOptions.encoderSpeed = prediction.speed;
+
+            encoder = CreateEncoder(context, budgetOptions, workload.hasAlpha, static_cast<unsigned int>(prediction.threadCount));
+            SetEncoderTiling(encoder.get(), prediction.tileColumnsLog2, prediction.tileRowsLog2);
+        }
+        else
+        {
+            encoder = CreateEncoder(context, saveOptions, workload.hasAlpha, encoderMaxThreadCount);
+        }
 
         // Check if cancellation has been requested before staring the encode.
-        // Unfortunately, most encoders do not provide a way to cancel an encode that is in progress.
         if (formatRecord->abortProc())
         {
             throw OSErrException(userCanceledErr);
         }
 
-        ScopedHeifImageHandle encodedImageHandle = EncodeImage(
-            context,
-            image,
-            encoder.get(),
-            encodingOptions.get());
+        const double expectedEncodeSeconds = useEncodeTimeBudget
+            ? prediction.predictedSeconds
+            : GetExpectedEncodeSeconds(workload, encoder.get());
+
+        job->image = std::move(image);
+        job->encoder = std::move(encoder);
+        job->encodingOptions = CreateEncodingOptions();
+
+        const auto encodeStartTime = std::chrono::steady_clock::now();
+
+        EncodeImage(formatRecord, job, expectedEncodeSeconds);
+
+        DebugOutMemoryUsage("Encoded the image and released the source image and encoder");
+
+        ScopedHeifImageHandle encodedImageHandle = std::move(job->encodedImageHandle);
+
+        if (useEncodeTimeBudget)
+        {
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - encodeStartTime;
+
+            RecordEncodeTime(workload, prediction, saveOptions.encodeTimeBudget, elapsed.count());
+        }
 
-        formatRecord->progressProc(75, 100);
+        formatRecord->progressProc(encodeProgressEnd, 100);
         if (formatRecord->abortProc())
         {
             throw OSErrException(userCanceledErr);
@@ -184,7 +365,20 @@ namespace
             AddXmpMetadata(formatRecord, context, encodedImageHandle.get());
         }
 
-        WriteEncodedImage(formatRecord, context);
+        encodedImageHandle.reset();
+
+        if (thumbnail.valid())
+        {
+            // libheif cannot add an image that was encoded in another context, so the thumbnail
+            // is added to the file when it is written.
+            WriteFileData(formatRecord, WriteContextToMemory(context), thumbnail);
+        }
+        else
+        {
+            WriteEncodedImage(formatRecord, context);
+        }
+
+        DebugOutMemoryUsage("Wrote the encoded image");
 
         formatRecord->progressProc(100, 100);
     }
@@ -220,12 +414,14 @@ OSErr DoWritePrepare(FormatRecordPtr formatRecord)
     return noErr;
 }
 
-OSErr DoWriteStart(FormatRecordPtr formatRecord, SaveUIOptions& options)
+OSErr DoWriteStart(FormatRecordPtr formatRecord, SaveUIOptions& options, SaveResults& results)
 {
     PrintFunctionName();
 
     OSErr err = noErr;
 
+    results = SaveResults{};
+
     ReadScriptParamsOnWrite(formatRecord, options, nullptr);
 
     if (formatRecord->depth == 32)
@@ -266,13 +462,6 @@ OSErr DoWriteStart(FormatRecordPtr formatRecord, SaveUIOptions& options)
 
         formatRecord->progressProc(0, 100);
 
-        ScopedHeifContext context(heif_context_alloc());
-
-        if (context == nullptr)
-        {
-            throw std::bad_alloc();
-        }
-
         const VPoint imageSize = GetImageSize(formatRecord);
         const AlphaState alphaState = GetAlphaState(formatRecord, options);
 
@@ -298,49 +487,102 @@ OSErr DoWriteStart(FormatRecordPtr formatRecord, SaveUIOptions& options)
 
         formatRecord->data = buffer.lock();
 
-        ScopedHeifImage image;
+        ChangedGridTiles changedGridTiles;
 
-        if (IsMonochromeImage(formatRecord))
+        if (TryRemuxUnmodifiedImage(formatRecord, options, alphaState, changedGridTiles))
         {
-            switch (formatRecord->depth)
-            {
-            case 8:
-                image = CreateHeifImageGrayEightBit(formatRecord, alphaState, imageSize, options);
-                break;
-            case 16:
-                image = CreateHeifImageGraySixteenBit(formatRecord, alphaState, imageSize, options);
-                break;
-            case 32:
-                image = CreateHeifImageGrayThirtyTwoBit(formatRecord, alphaState, imageSize, options);
-                break;
-            default:
-                throw OSErrException(formatBadParameters);
-            }
+            formatRecord->progressProc(100, 100);
         }
         else
         {
-            switch (formatRecord->depth)
+            // The screen content tools are only supported by AOM.
+            ScreenContentDetector screenContentDetector(
+                options.screenContentTools == ScreenContentTools::Auto
+                && (options.encoderBackend == EncoderBackend::Aom || options.lossless));
+
+            // An opaque alpha channel is excluded before the image is created, this avoids
+            // allocating and encoding a constant alpha plane.
+            const AlphaState imageAlphaState = ExcludeOpaqueAlphaChannel(formatRecord, alphaState, imageSize);
+
+            ScopedHeifImage image;
+
+            if (IsMonochromeImage(formatRecord))
             {
-            case 8:
-                image = CreateHeifImageRGBEightBit(formatRecord, alphaState, imageSize, options);
-                break;
-            case 16:
-                image = CreateHeifImageRGBSixteenBit(formatRecord, alphaState, imageSize, options);
-                break;
-            case 32:
-                image = CreateHeifImageRGBThirtyTwoBit(formatRecord, alphaState, imageSize, options);
-                break;
-            default:
-                throw OSErrException(formatBadParameters);
+                switch (formatRecord->depth)
+                {
+                case 8:
+                    image = CreateHeifImageGrayEightBit(formatRecord, imageAlphaState, imageSize, options, screenContentDetector);
+                    break;
+                case 16:
+                    image = CreateHeifImageGraySixteenBit(formatRecord, imageAlphaState, imageSize, options, screenContentDetector);
+                    break;
+                case 32:
+                    image = CreateHeifImageGrayThirtyTwoBit(formatRecord, imageAlphaState, imageSize, options, screenContentDetector);
+                    break;
+                default:
+                    throw OSErrException(formatBadParameters);
+                }
+            }
+            else
+            {
+                switch (formatRecord->depth)
+                {
+                case 8:
+                    image = CreateHeifImageRGBEightBit(formatRecord, imageAlphaState, imageSize, options, screenContentDetector);
+                    break;
+                case 16:
+                    image = CreateHeifImageRGBSixteenBit(formatRecord, imageAlphaState, imageSize, options, screenContentDetector);
+                    break;
+                case 32:
+                    image = CreateHeifImageRGBThirtyTwoBit(formatRecord, imageAlphaState, imageSize, options, screenContentDetector);
+                    break;
+                default:
+                    throw OSErrException(formatBadParameters);
+                }
             }
-        }
 
-        if (alphaState == AlphaState::Premultiplied)
-        {
-            heif_image_set_premultiplied_alpha(image.get(), true);
-        }
+            if (imageAlphaState == AlphaState::Premultiplied && HeifImageHasAlphaChannel(image.get()))
+            {
+                heif_image_set_premultiplied_alpha(image.get(), true);
+            }
+
+            DebugOutMemoryUsage("Created the source image");
 
-        EncodeAndSaveImage(formatRecord, context.get(), image.get(), options);
+            SaveUIOptions encodeOptions = options;
+
+            if (options.detectEightBitContent
+                && options.imageBitDepth != ImageBitDepth::Eight
+                && GetHeifImageBitsPerChannel(image.get()) == 8)
+            {
+                // The bit depth setting is not changed, the detection result is reported separately
+                // in the scripting parameters.
+                DebugOut("The 16-bit image only contains 8-bit values, saving as 8-bit.");
+                encodeOptions.imageBitDepth = ImageBitDepth::Eight;
+                results.eightBitContentDetected = true;
+            }
+
+            if (options.screenContentTools == ScreenContentTools::Auto)
+            {
+                encodeOptions.screenContentTools = screenContentDetector.IsScreenContent()
+                    ? ScreenContentTools::Enabled
+                    : ScreenContentTools::Disabled;
+            }
+
+            // The variants are encoded on worker threads while the saved image is being encoded.
+            ExportVariantEncoder exportVariants(formatRecord, image.get(), encodeOptions);
+
+            if (changedGridTiles.source != nullptr
+                && TryRemuxChangedGridTiles(formatRecord, changedGridTiles, image.get(), encodeOptions))
+            {
+                formatRecord->progressProc(100, 100);
+            }
+            else
+            {
+                EncodeAndSaveImage(formatRecord, std::move(image), encodeOptions, results);
+            }
+
+            exportVariants.WriteFiles(formatRecord, encodeOptions);
+        }
     }
     catch (const std::bad_alloc&)
     {
@@ -381,10 +623,10 @@ OSErr DoWriteContinue()
     return noErr;
 }
 
-OSErr DoWriteFinish(FormatRecordPtr formatRecord, const SaveUIOptions& options)
+OSErr DoWriteFinish(FormatRecordPtr formatRecord, const SaveUIOptions& options, const SaveResults& results)
 {
     PrintFunctionName();
 
-    WriteScriptParamsOnWrite(formatRecord, options);
+    WriteScriptParamsOnWrite(formatRecord, options, &results);
     return noErr;
 }
@@ -20,11 +20,15 @@
 
 #include "WriteHeifImage.h"
 #include "ColorProfileConversion.h"
+#include "HostMetadata.h"
 #include "LibHeifException.h"
 #include "OSErrException.h"
 #include "PremultipliedAlpha.h"
+#include "ScopedBufferSuite.h"
 #include "Utilities.h"
 #include <algorithm>
+#include <cstring>
+#include <limits>
 #include <vector>
 
 namespace
@@ -84,6 +88,195 @@ namespace
         return chroma;
     }
 
+    template <typename T>
+    void CopyRGBImageDataToMonochrome(
+        const heif_image* image,
+        heif_image* outputImage,
+        int width,
+        int height,
+        bool hasAlpha,
+        bool keepAlpha)
+    {
+        int srcStride;
+        const uint8_t* srcScan0 = heif_image_get_plane_readonly(image, heif_channel_interleaved, &srcStride);
+
+        int yPlaneStride;
+        uint8_t* yPlaneScan0 = heif_image_get_plane(outputImage, heif_channel_Y, &yPlaneStride);
+
+        int alphaPlaneStride = 0;
+        uint8_t* alphaPlaneScan0 = keepAlpha ? heif_image_get_plane(outputImage, heif_channel_Alpha, &alphaPlaneStride) : nullptr;
+
+        const int srcChannelCount = hasAlpha ? 4 : 3;
+
+        for (int y = 0; y < height; y++)
+        {
+            const T* src = reinterpret_cast<const T*>(srcScan0 + (static_cast<int64_t>(y) * srcStride));
+            T* yPlane = reinterpret_cast<T*>(yPlaneScan0 + (static_cast<int64_t>(y) * yPlaneStride));
+
+            if (keepAlpha)
+            {
+                T* alphaPlane = reinterpret_cast<T*>(alphaPlaneScan0 + (static_cast<int64_t>(y) * alphaPlaneStride));
+
+                for (int x = 0; x < width; x++)
+                {
+                    yPlane[x] = src[0];
+                    alphaPlane[x] = src[3];
+
+                    src += srcChannelCount;
+                }
+            }
+            else
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    yPlane[x] = src[0];
+
+                    src += srcChannelCount;
+                }
+            }
+        }
+    }
+
+    // The RGB CreateHeifImage* functions track whether every pixel is neutral gray while they convert
+    // the image data, neutral images are converted to monochrome by copying the gray values to a new
+    // heif_image. An alpha channel that does not contain any information is dropped by the same copy.
+    //
+    // A fully opaque alpha channel is detected by combining the alpha values with a bitwise AND,
+    // the result is only equal to the maximum value for the bit depth when every pixel is opaque.
+    ScopedHeifImage ConvertToMonochromeImage(heif_image* image, bool removeAlpha)
+    {
+        const int width = heif_image_get_primary_width(image);
+        const int height = heif_image_get_primary_height(image);
+        const bool hasAlpha = HeifImageHasAlphaChannel(image);
+        const bool keepAlpha = hasAlpha && !removeAlpha;
+        const int bitDepth = heif_image_get_bits_per_pixel_range(image, heif_channel_interleaved);
+
+        ScopedHeifImage outputImage = CreateHeifImage(width, height, heif_colorspace_monochrome, heif_chroma_monochrome);
+
+        LibHeifException::ThrowIfError(heif_image_add_plane(outputImage.get(), heif_channel_Y, width, height, bitDepth));
+
+        if (keepAlpha)
+        {
+            LibHeifException::ThrowIfError(heif_image_add_plane(outputImage.get(), heif_channel_Alpha, width, height, bitDepth));
+        }
+
+        if (bitDepth > 8)
+        {
+            CopyRGBImageDataToMonochrome<uint16_t>(image, outputImage.get(), width, height, hasAlpha, keepAlpha);
+        }
+        else
+        {
+            CopyRGBImageDataToMonochrome<uint8_t>(image, outputImage.get(), width, height, hasAlpha, keepAlpha);
+        }
+
+        return outputImage;
+    }
+
+    // An RGB ICC profile cannot be used with a monochrome image, so neutral images are only
+    // converted when the color profile is described by the nclx metadata.
+    bool CanSaveNeutralImageAsMonochrome(const FormatRecordPtr formatRecord, const SaveUIOptions& saveOptions)
+    {
+        if (!saveOptions.neutralAsMonochrome)
+        {
+            return false;
+        }
+
+        if (formatRecord->depth == 32 && saveOptions.hdrTransferFunction != ColorTransferFunction::Clip)
+        {
+            return true;
+        }
+
+        return !(saveOptions.keepColorProfile && HasColorProfileMetadata(formatRecord));
+    }
+
+    // Photoshop converts 8-bit values to 16-bit using (value * 32768 + 127) / 255.
+    bool IsEightBitContent(const uint16_t* row, size_t sampleCount)
+    {
+        for (size_t i = 0; i < sampleCount; i++)
+        {
+            const uint32_t value = row[i];
+            const uint32_t eightBitValue = ((value * 255) + 16384) / 32768;
+
+            if (((eightBitValue * 32768) + 127) / 255 != value)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void ConvertPlaneToEightBit(
+        const heif_image* image,
+        heif_image* outputImage,
+        heif_channel channel,
+        int samplesPerRow,
+        int height,
+        int bitDepth)
+    {
+        int srcStride;
+        const uint8_t* srcScan0 = heif_image_get_plane_readonly(image, channel, &srcStride);
+
+        int dstStride;
+        uint8_t* dstScan0 = heif_image_get_plane(outputImage, channel, &dstStride);
+
+        const uint32_t maxValue = (1U << bitDepth) - 1;
+        const uint32_t halfMaxValue = maxValue / 2;
+
+        for (int y = 0; y < height; y++)
+        {
+            const uint16_t* src = reinterpret_cast<const uint16_t*>(srcScan0 + (static_cast<int64_t>(y) * srcStride));
+            uint8_t* dst = dstScan0 + (static_cast<int64_t>(y) * dstStride);
+
+            for (int x = 0; x < samplesPerRow; x++)
+            {
+                dst[x] = static_cast<uint8_t>(((static_cast<uint32_t>(src[x]) * 255) + halfMaxValue) / maxValue);
+            }
+        }
+    }
+
+    // Converts a 10-bit or 12-bit image to 8-bit, this is used when every value in a 16-bit
+    // document was converted from 8-bit.
+    ScopedHeifImage ConvertToEightBitImage(heif_image* image)
+    {
+        const int width = heif_image_get_primary_width(image);
+        const int height = heif_image_get_primary_height(image);
+        const bool hasAlpha = HeifImageHasAlphaChannel(image);
+
+        if (heif_image_get_colorspace(image) == heif_colorspace_monochrome)
+        {
+            const int bitDepth = heif_image_get_bits_per_pixel_range(image, heif_channel_Y);
+
+            ScopedHeifImage outputImage = CreateHeifImage(width, height, heif_colorspace_monochrome, heif_chroma_monochrome);
+
+            LibHeifException::ThrowIfError(heif_image_add_plane(outputImage.get(), heif_channel_Y, width, height, 8));
+            ConvertPlaneToEightBit(image, outputImage.get(), heif_channel_Y, width, height, bitDepth);
+
+            if (hasAlpha)
+            {
+                LibHeifException::ThrowIfError(heif_image_add_plane(outputImage.get(), heif_channel_Alpha, width, height, 8));
+                ConvertPlaneToEightBit(image, outputImage.get(), heif_channel_Alpha, width, height, bitDepth);
+            }
+
+            return outputImage;
+        }
+        else
+        {
+            const int bitDepth = heif_image_get_bits_per_pixel_range(image, heif_channel_interleaved);
+
+            ScopedHeifImage outputImage = CreateHeifImage(
+                width,
+                height,
+                heif_colorspace_RGB,
+                GetRGBImageChroma(ImageBitDepth::Eight, hasAlpha));
+
+            LibHeifException::ThrowIfError(heif_image_add_plane(outputImage.get(), heif_channel_interleaved, width, height, 8));
+            ConvertPlaneToEightBit(image, outputImage.get(), heif_channel_interleaved, width * (hasAlpha ? 4 : 3), height, bitDepth);
+
+            return outputImage;
+        }
+    }
+
     std::vector<uint16_t> BuildEightBitToHeifImageLookup(int bitDepth)
     {
         std::vector<uint16_t> lookupTable;
@@ -164,13 +357,117 @@ namespace
 
         return lookupTable;
     }
+
+    bool IsOpaqueAlphaRow(const void* row, int32 width, int16 depth)
+    {
+        switch (depth)
+        {
+        case 8:
+        {
+            const uint8_t* alpha = static_cast<const uint8_t*>(row);
+
+            for (int32 x = 0; x < width; x++)
+            {
+                if (alpha[x] != 255)
+                {
+                    return false;
+                }
+            }
+            break;
+        }
+        case 16:
+        {
+            // Photoshop uses the range [0, 32768] for 16-bit images.
+            const uint16_t* alpha = static_cast<const uint16_t*>(row);
+
+            for (int32 x = 0; x < width; x++)
+            {
+                if (alpha[x] != 32768)
+                {
+                    return false;
+                }
+            }
+            break;
+        }
+        case 32:
+        {
+            const float* alpha = static_cast<const float*>(row);
+
+            for (int32 x = 0; x < width; x++)
+            {
+                if (!(alpha[x] >= 1.0f))
+                {
+                    return false;
+                }
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+
+        return true;
+    }
+}
+
+AlphaState ExcludeOpaqueAlphaChannel(FormatRecordPtr formatRecord, AlphaState alphaState, const VPoint& imageSize)
+{
+    if (alphaState == AlphaState::None)
+    {
+        return alphaState;
+    }
+
+    const int16 alphaPlane = static_cast<int16>(formatRecord->planes - 1);
+    const int16 colBytes = formatRecord->colBytes;
+    const int32 rowBytes = formatRecord->rowBytes;
+
+    // Only the transparency plane is read, the host row buffer is large enough for all of the planes.
+    formatRecord->loPlane = alphaPlane;
+    formatRecord->hiPlane = alphaPlane;
+    formatRecord->colBytes = formatRecord->planeBytes;
+    formatRecord->rowBytes = imageSize.h * formatRecord->planeBytes;
+
+    bool opaque = true;
+
+    // The search stops at the first row that has a transparent pixel.
+    for (int32 y = 0; y < imageSize.v && opaque; y++)
+    {
+        if (formatRecord->abortProc())
+        {
+            throw OSErrException(userCanceledErr);
+        }
+
+        SetRect(formatRecord, y, 0, y + 1, imageSize.h);
+
+        OSErrException::ThrowIfError(formatRecord->advanceState());
+
+        opaque = IsOpaqueAlphaRow(formatRecord->data, imageSize.h, formatRecord->depth);
+    }
+
+    formatRecord->loPlane = 0;
+
+    if (opaque)
+    {
+        formatRecord->hiPlane = alphaPlane - 1;
+        formatRecord->colBytes = static_cast<int16>(alphaPlane * formatRecord->planeBytes);
+        formatRecord->rowBytes = imageSize.h * formatRecord->colBytes;
+
+        return AlphaState::None;
+    }
+
+    formatRecord->hiPlane = alphaPlane;
+    formatRecord->colBytes = colBytes;
+    formatRecord->rowBytes = rowBytes;
+
+    return alphaState;
 }
 
 ScopedHeifImage CreateHeifImageGrayEightBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions)
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector)
 {
     const bool hasAlpha = alphaState != AlphaState::None;
 
@@ -202,6 +499,7 @@ ScopedHeifImage CreateHeifImageGrayEightBit(
 
         std::vector<uint16_t> lookupTable = BuildEightBitToHeifImageLookup(heifImageBitDepth);
         const uint16_t maxValue = static_cast<uint16_t>((1 << heifImageBitDepth) - 1);
+        const PremultipliedAlphaTable premultipliedAlphaTable(maxValue);
 
         for (int32 y = 0; y < imageSize.v; y++)
         {
@@ -231,17 +529,7 @@ ScopedHeifImage CreateHeifImageGrayEightBit(
 
                     if (alphaState == AlphaState::Premultiplied)
                     {
-                        if (alpha < maxValue)
-                        {
-                            if (alpha == 0)
-                            {
-                                gray = 0;
-                            }
-                            else
-                            {
-                                gray = PremultiplyColor(gray, alpha, maxValue);
-                            }
-                        }
+                        gray = premultipliedAlphaTable.Premultiply(gray, alpha);
                     }
 
                     yPlane[0] = gray;
@@ -262,12 +550,16 @@ ScopedHeifImage CreateHeifImageGrayEightBit(
                     yPlane++;
                 }
             }
+
+            screenContentDetector.AddRow(
+                y,
+                reinterpret_cast<const uint16_t*>(yPlaneScan0 + (static_cast<int64_t>(y) * yPlaneStride)),
+                imageSize.h,
+                1);
         }
     }
     else
     {
-        constexpr uint8_t maxValue = 255;
-
         for (int32 y = 0; y < imageSize.v; y++)
         {
             if (formatRecord->abortProc())
@@ -282,6 +574,11 @@ ScopedHeifImage CreateHeifImageGrayEightBit(
 
             OSErrException::ThrowIfError(formatRecord->advanceState());
 
+            if (alphaState == AlphaState::Premultiplied)
+            {
+                PremultiplyRow(static_cast<uint8_t*>(formatRecord->data), static_cast<size_t>(imageSize.h), 2);
+            }
+
             const uint8_t* src = static_cast<const uint8_t*>(formatRecord->data);
             uint8_t* yPlane = yPlaneScan0 + ((static_cast<int64_t>(y) * yPlaneStride));
 
@@ -291,23 +588,8 @@ ScopedHeifImage CreateHeifImageGrayEightBit(
 
                 for (int32 x = 0; x < imageSize.h; x++)
                 {
-                    uint8_t gray = src[0];
-                    uint8_t alpha = src[1];
-
-                    if (alphaState == AlphaState::Premultiplied)
-                    {
-                        if (alpha < maxValue)
-                        {
-                            if (alpha == 0)
-                            {
-                                gray = 0;
-                            }
-                            else
-                            {
-                                gray = PremultiplyColor(gray, alpha);
-                            }
-                        }
-                    }
+                    const uint8_t gray = src[0];
+                    const uint8_t alpha = src[1];
 
                     yPlane[0] = gray;
                     alphaPlane[0] = alpha;
@@ -327,19 +609,31 @@ ScopedHeifImage CreateHeifImageGrayEightBit(
                     yPlane++;
                 }
             }
+
+            screenContentDetector.AddRow(
+                y,
+                reinterpret_cast<const uint8_t*>(yPlaneScan0 + (static_cast<int64_t>(y) * yPlaneStride)),
+                imageSize.h,
+                1);
         }
     }
 
     return image;
 }
 
-ScopedHeifImage CreateHeifImageGraySixteenBit(FormatRecordPtr formatRecord, AlphaState alphaState, const VPoint& imageSize, const SaveUIOptions& saveOptions)
+ScopedHeifImage CreateHeifImageGraySixteenBit(
+    FormatRecordPtr formatRecord,
+    AlphaState alphaState,
+    const VPoint& imageSize,
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector)
 {
     const bool hasAlpha = alphaState != AlphaState::None;
 
     ScopedHeifImage image = CreateHeifImage(imageSize.h, imageSize.v, heif_colorspace_monochrome, heif_chroma_monochrome);
 
     const int heifImageBitDepth = GetHeifImageBitDepth(saveOptions.imageBitDepth);
+    bool isEightBitContent = saveOptions.detectEightBitContent && heifImageBitDepth > 8;
 
     LibHeifException::ThrowIfError(heif_image_add_plane(image.get(), heif_channel_Y, imageSize.h, imageSize.v, heifImageBitDepth));
 
@@ -364,7 +658,7 @@ ScopedHeifImage CreateHeifImageGraySixteenBit(FormatRecordPtr formatRecord, Alph
         // The 16-bit data must be converted to 8-bit when writing it to the heif_image.
 
         std::vector<uint8> lookupTable = BuildSixteenBitToEightBitLookup();
-        constexpr uint8_t maxValue = 255;
+        const PremultipliedAlphaTable premultipliedAlphaTable(255);
 
         for (int32 y = 0; y < imageSize.v; y++)
         {
@@ -394,17 +688,7 @@ ScopedHeifImage CreateHeifImageGraySixteenBit(FormatRecordPtr formatRecord, Alph
 
                     if (alphaState == AlphaState::Premultiplied)
                     {
-                        if (alpha < maxValue)
-                        {
-                            if (alpha == 0)
-                            {
-                                gray = 0;
-                            }
-                            else
-                            {
-                                gray = PremultiplyColor(gray, alpha);
-                            }
-                        }
+                        gray = static_cast<uint8_t>(premultipliedAlphaTable.Premultiply(gray, alpha));
                     }
 
                     yPlane[0] = gray;
@@ -425,6 +709,12 @@ ScopedHeifImage CreateHeifImageGraySixteenBit(FormatRecordPtr formatRecord, Alph
                     yPlane++;
                 }
             }
+
+            screenContentDetector.AddRow(
+                y,
+                reinterpret_cast<const uint8_t*>(yPlaneScan0 + (static_cast<int64_t>(y) * yPlaneStride)),
+                imageSize.h,
+                1);
         }
     }
     else
@@ -433,6 +723,7 @@ ScopedHeifImage CreateHeifImageGraySixteenBit(FormatRecordPtr formatRecord, Alph
 
         std::vector<uint16_t> lookupTable = BuildSixteenBitToHeifImageLookup(heifImageBitDepth);
         const uint16_t maxValue = static_cast<uint16_t>((1 << heifImageBitDepth) - 1);
+        const PremultipliedAlphaTable premultipliedAlphaTable(maxValue);
 
         for (int32 y = 0; y < imageSize.v; y++)
         {
@@ -448,6 +739,13 @@ ScopedHeifImage CreateHeifImageGraySixteenBit(FormatRecordPtr formatRecord, Alph
 
             OSErrException::ThrowIfError(formatRecord->advanceState());
 
+            if (isEightBitContent)
+            {
+                isEightBitContent = IsEightBitContent(
+                    static_cast<const uint16_t*>(formatRecord->data),
+                    static_cast<size_t>(imageSize.h) * (hasAlpha ? 2 : 1));
+            }
+
             const uint16_t* src = static_cast<const uint16*>(formatRecord->data);
             uint16_t* yPlane = reinterpret_cast<uint16*>(yPlaneScan0 + ((static_cast<int64_t>(y) * yPlaneStride)));
 
@@ -462,17 +760,7 @@ ScopedHeifImage CreateHeifImageGraySixteenBit(FormatRecordPtr formatRecord, Alph
 
                     if (alphaState == AlphaState::Premultiplied)
                     {
-                        if (alpha < maxValue)
-                        {
-                            if (alpha == 0)
-                            {
-                                gray = 0;
-                            }
-                            else
-                            {
-                                gray = PremultiplyColor(gray, alpha, maxValue);
-                            }
-                        }
+                        gray = premultipliedAlphaTable.Premultiply(gray, alpha);
                     }
 
                     yPlane[0] = gray;
@@ -493,9 +781,20 @@ ScopedHeifImage CreateHeifImageGraySixteenBit(FormatRecordPtr formatRecord, Alph
                     yPlane++;
                 }
             }
+
+            screenContentDetector.AddRow(
+                y,
+                reinterpret_cast<const uint16_t*>(yPlaneScan0 + (static_cast<int64_t>(y) * yPlaneStride)),
+                imageSize.h,
+                1);
         }
     }
 
+    if (isEightBitContent)
+    {
+        image = ConvertToEightBitImage(image.get());
+    }
+
     return image;
 }
 
@@ -503,7 +802,8 @@ ScopedHeifImage CreateHeifImageGrayThirtyTwoBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions)
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector)
 {
     const bool hasAlpha = alphaState != AlphaState::None;
 
@@ -532,6 +832,14 @@ ScopedHeifImage CreateHeifImageGrayThirtyTwoBit(
     const float heifImageMaxValue = static_cast<float>((1 << heifImageBitDepth) - 1);
     const ColorTransferFunction transferFunction = saveOptions.hdrTransferFunction;
 
+    if (transferFunction != ColorTransferFunction::PQ && transferFunction != ColorTransferFunction::Clip)
+    {
+        throw std::runtime_error("Unsupported color transfer function.");
+    }
+
+    // The transfer function is applied to a row of gray values at a time.
+    std::vector<float> grayRow(static_cast<size_t>(imageSize.h));
+
     for (int32 y = 0; y < imageSize.v; y++)
     {
         if (formatRecord->abortProc())
@@ -573,25 +881,12 @@ ScopedHeifImage CreateHeifImageGrayThirtyTwoBit(
                     }
                 }
 
-                float transferCurveGray;
-
-                switch (transferFunction)
-                {
-                case ColorTransferFunction::PQ:
-                    transferCurveGray = LinearToPQ(gray, static_cast<float>(saveOptions.pq.nominalPeakBrightness));
-                    break;
-                case ColorTransferFunction::Clip:
-                    transferCurveGray = gray;
-                    break;
-                default:
-                    throw std::runtime_error("Unsupported color transfer function.");
-                }
+                grayRow[x] = gray;
+                const uint16_t alphaValue = static_cast<uint16_t>(std::clamp(alpha * heifImageMaxValue, 0.0f, heifImageMaxValue));
 
-                yPlane[0] = static_cast<uint16_t>(std::clamp(transferCurveGray * heifImageMaxValue, 0.0f, heifImageMaxValue));
-                alphaPlane[0] = static_cast<uint16_t>(std::clamp(alpha * heifImageMaxValue, 0.0f, heifImageMaxValue));
+                alphaPlane[0] = alphaValue;
 
                 src += 2;
-                yPlane++;
                 alphaPlane++;
             }
         }
@@ -599,28 +894,26 @@ ScopedHeifImage CreateHeifImageGrayThirtyTwoBit(
         {
             for (int32 x = 0; x < imageSize.h; x++)
             {
-                const float gray = std::clamp(src[0], 0.0f, 1.0f);
-
-                float transferCurveGray;
-
-                switch (transferFunction)
-                {
-                case ColorTransferFunction::PQ:
-                    transferCurveGray = LinearToPQ(gray, static_cast<float>(saveOptions.pq.nominalPeakBrightness));
-                    break;
-                case ColorTransferFunction::Clip:
-                    transferCurveGray = gray;
-                    break;
-                default:
-                    throw std::runtime_error("Unsupported color transfer function.");
-                }
+                grayRow[x] = std::clamp(src[x], 0.0f, 1.0f);
+            }
+        }
 
-                yPlane[0] = static_cast<uint16_t>(std::clamp(transferCurveGray * heifImageMaxValue, 0.0f, heifImageMaxValue));
+        LinearToTransferFunctionRow(
+            grayRow.data(),
+            grayRow.size(),
+            transferFunction,
+            static_cast<float>(saveOptions.pq.nominalPeakBrightness));
 
-                src++;
-                yPlane++;
-            }
+        for (int32 x = 0; x < imageSize.h; x++)
+        {
+            yPlane[x] = static_cast<uint16_t>(std::clamp(grayRow[x] * heifImageMaxValue, 0.0f, heifImageMaxValue));
         }
+
+        screenContentDetector.AddRow(
+            y,
+            reinterpret_cast<const uint16_t*>(yPlaneScan0 + (static_cast<int64_t>(y) * yPlaneStride)),
+            imageSize.h,
+            1);
     }
 
     return image;
@@ -630,7 +923,8 @@ ScopedHeifImage CreateHeifImageRGBEightBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions)
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector)
 {
     const bool hasAlpha = alphaState != AlphaState::None;
 
@@ -639,6 +933,9 @@ ScopedHeifImage CreateHeifImageRGBEightBit(
     ScopedHeifImage image = CreateHeifImage(imageSize.h, imageSize.v, heif_colorspace_RGB, chroma);
 
     const int heifImageBitDepth = GetHeifImageBitDepth(saveOptions.imageBitDepth);
+    const uint16_t opaqueAlpha = static_cast<uint16_t>((1 << heifImageBitDepth) - 1);
+    uint16_t combinedAlpha = opaqueAlpha;
+    bool allPixelsNeutral = true;
 
     LibHeifException::ThrowIfError(heif_image_add_plane(image.get(), heif_channel_interleaved, imageSize.h, imageSize.v, heifImageBitDepth));
 
@@ -656,6 +953,7 @@ ScopedHeifImage CreateHeifImageRGBEightBit(
 
         std::vector<uint16_t> lookupTable = BuildEightBitToHeifImageLookup(heifImageBitDepth);
         const uint16_t maxValue = static_cast<uint16_t>((1 << heifImageBitDepth) - 1);
+        const PremultipliedAlphaTable premultipliedAlphaTable(maxValue);
 
         for (int32 y = 0; y < imageSize.v; y++)
         {
@@ -690,27 +988,17 @@ ScopedHeifImage CreateHeifImageRGBEightBit(
 
                     if (alphaState == AlphaState::Premultiplied)
                     {
-                        if (a < maxValue)
-                        {
-                            if (a == 0)
-                            {
-                                r = 0;
-                                g = 0;
-                                b = 0;
-                            }
-                            else
-                            {
-                                r = PremultiplyColor(r, a, maxValue);
-                                g = PremultiplyColor(g, a, maxValue);
-                                b = PremultiplyColor(b, a, maxValue);
-                            }
-                        }
+                        r = premultipliedAlphaTable.Premultiply(r, a);
+                        g = premultipliedAlphaTable.Premultiply(g, a);
+                        b = premultipliedAlphaTable.Premultiply(b, a);
                     }
 
                     yPlane[0] = r;
                     yPlane[1] = g;
                     yPlane[2] = b;
                     yPlane[3] = a;
+                    combinedAlpha &= a;
+                    allPixelsNeutral &= yPlane[0] == yPlane[1] && yPlane[1] == yPlane[2];
 
                     src += 4;
                     yPlane += 4;
@@ -720,17 +1008,22 @@ ScopedHeifImage CreateHeifImageRGBEightBit(
                     yPlane[0] = lookupTable[src[0]];
                     yPlane[1] = lookupTable[src[1]];
                     yPlane[2] = lookupTable[src[2]];
+                    allPixelsNeutral &= yPlane[0] == yPlane[1] && yPlane[1] == yPlane[2];
 
                     src += 3;
                     yPlane += 3;
                 }
             }
+
+            screenContentDetector.AddRow(
+                y,
+                reinterpret_cast<const uint16_t*>(heifImageData + (static_cast<int64_t>(y) * heifImageStride)),
+                imageSize.h,
+                hasAlpha ? 4 : 3);
         }
     }
     else
     {
-        constexpr uint8_t maxValue = 255;
-
         for (int32 y = 0; y < imageSize.v; y++)
         {
             if (formatRecord->abortProc())
@@ -750,6 +1043,11 @@ ScopedHeifImage CreateHeifImageRGBEightBit(
                 static_cast<cmsUInt32Number>(imageSize.h),
                 static_cast<cmsUInt32Number>(formatRecord->rowBytes));
 
+            if (alphaState == AlphaState::Premultiplied)
+            {
+                PremultiplyRow(static_cast<uint8_t*>(formatRecord->data), static_cast<size_t>(imageSize.h), 4);
+            }
+
             const uint8_t* src = static_cast<const uint8_t*>(formatRecord->data);
             uint8_t* yPlane = heifImageData + ((static_cast<int64_t>(y) * heifImageStride));
 
@@ -757,34 +1055,17 @@ ScopedHeifImage CreateHeifImageRGBEightBit(
             {
                 if (hasAlpha)
                 {
-                    uint8_t r = src[0];
-                    uint8_t g = src[1];
-                    uint8_t b = src[2];
-                    uint8_t a = src[3];
-
-                    if (alphaState == AlphaState::Premultiplied)
-                    {
-                        if (a < maxValue)
-                        {
-                            if (a == 0)
-                            {
-                                r = 0;
-                                g = 0;
-                                b = 0;
-                            }
-                            else
-                            {
-                                r = PremultiplyColor(r, a);
-                                g = PremultiplyColor(g, a);
-                                b = PremultiplyColor(b, a);
-                            }
-                        }
-                    }
+                    const uint8_t r = src[0];
+                    const uint8_t g = src[1];
+                    const uint8_t b = src[2];
+                    const uint8_t a = src[3];
 
                     yPlane[0] = r;
                     yPlane[1] = g;
                     yPlane[2] = b;
                     yPlane[3] = a;
+                    combinedAlpha &= a;
+                    allPixelsNeutral &= yPlane[0] == yPlane[1] && yPlane[1] == yPlane[2];
 
                     src += 4;
                     yPlane += 4;
@@ -794,14 +1075,26 @@ ScopedHeifImage CreateHeifImageRGBEightBit(
                     yPlane[0] = src[0];
                     yPlane[1] = src[1];
                     yPlane[2] = src[2];
+                    allPixelsNeutral &= yPlane[0] == yPlane[1] && yPlane[1] == yPlane[2];
 
                     src += 3;
                     yPlane += 3;
                 }
             }
+
+            screenContentDetector.AddRow(
+                y,
+                reinterpret_cast<const uint8_t*>(heifImageData + (static_cast<int64_t>(y) * heifImageStride)),
+                imageSize.h,
+                hasAlpha ? 4 : 3);
         }
     }
 
+    if (allPixelsNeutral && CanSaveNeutralImageAsMonochrome(formatRecord, saveOptions))
+    {
+        return ConvertToMonochromeImage(image.get(), hasAlpha && combinedAlpha == opaqueAlpha);
+    }
+
     return image;
 }
 
@@ -809,7 +1102,8 @@ ScopedHeifImage CreateHeifImageRGBSixteenBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions)
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector)
 {
     const bool hasAlpha = alphaState != AlphaState::None;
 
@@ -818,6 +1112,10 @@ ScopedHeifImage CreateHeifImageRGBSixteenBit(
     ScopedHeifImage image = CreateHeifImage(imageSize.h, imageSize.v, heif_colorspace_RGB, chroma);
 
     const int heifImageBitDepth = GetHeifImageBitDepth(saveOptions.imageBitDepth);
+    const uint16_t opaqueAlpha = static_cast<uint16_t>((1 << heifImageBitDepth) - 1);
+    uint16_t combinedAlpha = opaqueAlpha;
+    bool isEightBitContent = saveOptions.detectEightBitContent && heifImageBitDepth > 8;
+    bool allPixelsNeutral = true;
 
     LibHeifException::ThrowIfError(heif_image_add_plane(image.get(), heif_channel_interleaved, imageSize.h, imageSize.v, heifImageBitDepth));
 
@@ -834,7 +1132,7 @@ ScopedHeifImage CreateHeifImageRGBSixteenBit(
         // The 16-bit data must be converted to 8-bit when writing it to the heif_image.
 
         std::vector<uint8_t> lookupTable = BuildSixteenBitToEightBitLookup();
-        constexpr int maxValue = 255;
+        const PremultipliedAlphaTable premultipliedAlphaTable(255);
 
         for (int32 y = 0; y < imageSize.v; y++)
         {
@@ -869,27 +1167,17 @@ ScopedHeifImage CreateHeifImageRGBSixteenBit(
 
                     if (alphaState == AlphaState::Premultiplied)
                     {
-                        if (a < maxValue)
-                        {
-                            if (a == 0)
-                            {
-                                r = 0;
-                                g = 0;
-                                b = 0;
-                            }
-                            else
-                            {
-                                r = PremultiplyColor(r, a);
-                                g = PremultiplyColor(g, a);
-                                b = PremultiplyColor(b, a);
-                            }
-                        }
+                        r = static_cast<uint8_t>(premultipliedAlphaTable.Premultiply(r, a));
+                        g = static_cast<uint8_t>(premultipliedAlphaTable.Premultiply(g, a));
+                        b = static_cast<uint8_t>(premultipliedAlphaTable.Premultiply(b, a));
                     }
 
                     yPlane[0] = r;
                     yPlane[1] = g;
                     yPlane[2] = b;
                     yPlane[3] = a;
+                    combinedAlpha &= a;
+                    allPixelsNeutral &= yPlane[0] == yPlane[1] && yPlane[1] == yPlane[2];
 
                     src += 4;
                     yPlane += 4;
@@ -899,11 +1187,18 @@ ScopedHeifImage CreateHeifImageRGBSixteenBit(
                     yPlane[0] = lookupTable[src[0]];
                     yPlane[1] = lookupTable[src[1]];
                     yPlane[2] = lookupTable[src[2]];
+                    allPixelsNeutral &= yPlane[0] == yPlane[1] && yPlane[1] == yPlane[2];
 
                     src += 3;
                     yPlane += 3;
                 }
             }
+
+            screenContentDetector.AddRow(
+                y,
+                reinterpret_cast<const uint8_t*>(heifImageData + (static_cast<int64_t>(y) * heifImageStride)),
+                imageSize.h,
+                hasAlpha ? 4 : 3);
         }
     }
     else
@@ -912,6 +1207,7 @@ ScopedHeifImage CreateHeifImageRGBSixteenBit(
 
         std::vector<uint16_t> lookupTable = BuildSixteenBitToHeifImageLookup(heifImageBitDepth);
         const uint16_t maxValue = static_cast<uint16_t>((1 << heifImageBitDepth) - 1);
+        const PremultipliedAlphaTable premultipliedAlphaTable(maxValue);
 
         for (int32 y = 0; y < imageSize.v; y++)
         {
@@ -927,6 +1223,14 @@ ScopedHeifImage CreateHeifImageRGBSixteenBit(
 
             OSErrException::ThrowIfError(formatRecord->advanceState());
 
+            // The check must be performed before the color profile conversion.
+            if (isEightBitContent)
+            {
+                isEightBitContent = IsEightBitContent(
+                    static_cast<const uint16_t*>(formatRecord->data),
+                    static_cast<size_t>(imageSize.h) * (hasAlpha ? 4 : 3));
+            }
+
             converter.ConvertRow(
                 formatRecord->data,
                 static_cast<cmsUInt32Number>(imageSize.h),
@@ -946,27 +1250,17 @@ ScopedHeifImage CreateHeifImageRGBSixteenBit(
 
                     if (alphaState == AlphaState::Premultiplied)
                     {
-                        if (a < maxValue)
-                        {
-                            if (a == 0)
-                            {
-                                r = 0;
-                                g = 0;
-                                b = 0;
-                            }
-                            else
-                            {
-                                r = PremultiplyColor(r, a, maxValue);
-                                g = PremultiplyColor(g, a, maxValue);
-                                b = PremultiplyColor(b, a, maxValue);
-                            }
-                        }
+                        r = premultipliedAlphaTable.Premultiply(r, a);
+                        g = premultipliedAlphaTable.Premultiply(g, a);
+                        b = premultipliedAlphaTable.Premultiply(b, a);
                     }
 
                     yPlane[0] = r;
                     yPlane[1] = g;
                     yPlane[2] = b;
                     yPlane[3] = a;
+                    combinedAlpha &= a;
+                    allPixelsNeutral &= yPlane[0] == yPlane[1] && yPlane[1] == yPlane[2];
 
                     src += 4;
                     yPlane += 4;
@@ -976,14 +1270,31 @@ ScopedHeifImage CreateHeifImageRGBSixteenBit(
                     yPlane[0] = lookupTable[src[0]];
                     yPlane[1] = lookupTable[src[1]];
                     yPlane[2] = lookupTable[src[2]];
+                    allPixelsNeutral &= yPlane[0] == yPlane[1] && yPlane[1] == yPlane[2];
 
                     src += 3;
                     yPlane += 3;
                 }
             }
+
+            screenContentDetector.AddRow(
+                y,
+                reinterpret_cast<const uint16_t*>(heifImageData + (static_cast<int64_t>(y) * heifImageStride)),
+                imageSize.h,
+                hasAlpha ? 4 : 3);
         }
     }
 
+    if (isEightBitContent)
+    {
+        image = ConvertToEightBitImage(image.get());
+    }
+
+    if (allPixelsNeutral && CanSaveNeutralImageAsMonochrome(formatRecord, saveOptions))
+    {
+        return ConvertToMonochromeImage(image.get(), hasAlpha && combinedAlpha == opaqueAlpha);
+    }
+
     return image;
 }
 
@@ -991,7 +1302,8 @@ ScopedHeifImage CreateHeifImageRGBThirtyTwoBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions)
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector)
 {
     const bool hasAlpha = alphaState != AlphaState::None;
 
@@ -1000,6 +1312,9 @@ ScopedHeifImage CreateHeifImageRGBThirtyTwoBit(
     ScopedHeifImage image = CreateHeifImage(imageSize.h, imageSize.v, heif_colorspace_RGB, chroma);
 
     const int heifImageBitDepth = GetHeifImageBitDepth(saveOptions.imageBitDepth);
+    const uint16_t opaqueAlpha = static_cast<uint16_t>((1 << heifImageBitDepth) - 1);
+    uint16_t combinedAlpha = opaqueAlpha;
+    bool allPixelsNeutral = true;
 
     LibHeifException::ThrowIfError(heif_image_add_plane(image.get(), heif_channel_interleaved, imageSize.h, imageSize.v, heifImageBitDepth));
 
@@ -1014,40 +1329,59 @@ ScopedHeifImage CreateHeifImageRGBThirtyTwoBit(
 
     ColorProfileConversion converter(formatRecord, hasAlpha, transferFunction, saveOptions.keepColorProfile);
 
-    for (int32 y = 0; y < imageSize.v; y++)
+    // The rows are read in bands when the image requires a color conversion, this allows
+    // the conversion to be split between multiple threads.
+    const int32 bandRowCount = std::min(
+        static_cast<int32>(converter.GetBandRowCount(static_cast<cmsUInt32Number>(formatRecord->rowBytes))),
+        std::max(std::numeric_limits<int32>::max() / formatRecord->rowBytes, 1));
+    void* const hostRowBuffer = formatRecord->data;
+    ScopedBufferSuiteBuffer bandBuffer;
+
+    if (bandRowCount > 1)
+    {
+        bandBuffer = ScopedBufferSuiteBuffer(formatRecord->bufferProcs, bandRowCount * formatRecord->rowBytes);
+        formatRecord->data = bandBuffer.lock();
+    }
+
+    // The transfer function is applied to a row of RGB values at a time.
+    std::vector<float> rgbRow(static_cast<size_t>(imageSize.h) * 3);
+
+    for (int32 bandTop = 0; bandTop < imageSize.v; bandTop += bandRowCount)
     {
         if (formatRecord->abortProc())
         {
             throw OSErrException(userCanceledErr);
         }
 
-        const int32 top = y;
-        const int32 bottom = std::min(top + 1, imageSize.v);
+        const int32 bandBottom = std::min(bandTop + bandRowCount, imageSize.v);
 
-        SetRect(formatRecord, top, left, bottom, right);
+        SetRect(formatRecord, bandTop, left, bandBottom, right);
 
         OSErrException::ThrowIfError(formatRecord->advanceState());
 
-        converter.ConvertRow(
+        converter.ConvertRows(
             formatRecord->data,
+            static_cast<cmsUInt32Number>(bandBottom - bandTop),
             static_cast<cmsUInt32Number>(imageSize.h),
             static_cast<cmsUInt32Number>(formatRecord->rowBytes));
 
-        const float* src = static_cast<const float*>(formatRecord->data);
-        uint16_t* yPlane = reinterpret_cast<uint16_t*>(heifImageData + ((static_cast<int64_t>(y) * heifImageStride)));
-
-        for (int32 x = 0; x < imageSize.h; x++)
+        for (int32 y = bandTop; y < bandBottom; y++)
         {
-            float r = src[0];
-            float g = src[1];
-            float b = src[2];
+            const float* srcRow = reinterpret_cast<const float*>(
+                static_cast<const uint8_t*>(formatRecord->data) + (static_cast<int64_t>(y - bandTop) * formatRecord->rowBytes));
+            const int32 srcChannelCount = hasAlpha ? 4 : 3;
+            const float* src = srcRow;
 
-            if (hasAlpha)
+            for (int32 x = 0; x < imageSize.h; x++)
             {
-                const float a = std::clamp(src[3], 0.0f, 1.0f);
+                float r = src[0];
+                float g = src[1];
+                float b = src[2];
 
-                if (alphaState == AlphaState::Premultiplied)
+                if (hasAlpha && alphaState == AlphaState::Premultiplied)
                 {
+                    const float a = std::clamp(src[3], 0.0f, 1.0f);
+
                     if (a < 1.0f)
                     {
                         if (a == 0)
@@ -1065,75 +1399,81 @@ ScopedHeifImage CreateHeifImageRGBThirtyTwoBit(
                     }
                 }
 
-                float transferCurveR;
-                float transferCurveG;
-                float transferCurveB;
-
-                switch (transferFunction)
-                {
-                case ColorTransferFunction::PQ:
-                    transferCurveR = LinearToPQ(r, static_cast<float>(saveOptions.pq.nominalPeakBrightness));
-                    transferCurveG = LinearToPQ(g, static_cast<float>(saveOptions.pq.nominalPeakBrightness));
-                    transferCurveB = LinearToPQ(b, static_cast<float>(saveOptions.pq.nominalPeakBrightness));
-                    break;
-                case ColorTransferFunction::SMPTE428:
-                    transferCurveR = LinearToSMPTE428(r);
-                    transferCurveG = LinearToSMPTE428(g);
-                    transferCurveB = LinearToSMPTE428(b);
-                    break;
-                case ColorTransferFunction::Clip:
-                    transferCurveR = r;
-                    transferCurveG = g;
-                    transferCurveB = b;
-                    break;
-                default:
-                    throw std::runtime_error("Unsupported color transfer function.");
-                }
+                float* rgb = &rgbRow[static_cast<size_t>(x) * 3];
 
-                yPlane[0] = static_cast<uint16_t>(std::clamp(transferCurveR * heifImageMaxValue, 0.0f, heifImageMaxValue));
-                yPlane[1] = static_cast<uint16_t>(std::clamp(transferCurveG * heifImageMaxValue, 0.0f, heifImageMaxValue));
-                yPlane[2] = static_cast<uint16_t>(std::clamp(transferCurveB * heifImageMaxValue, 0.0f, heifImageMaxValue));
-                yPlane[3] = static_cast<uint16_t>(std::clamp(a * heifImageMaxValue, 0.0f, heifImageMaxValue));
+                rgb[0] = r;
+                rgb[1] = g;
+                rgb[2] = b;
 
-                src += 4;
-                yPlane += 4;
+                src += srcChannelCount;
             }
-            else
+
+            LinearToTransferFunctionRow(
+                rgbRow.data(),
+                rgbRow.size(),
+                transferFunction,
+                static_cast<float>(saveOptions.pq.nominalPeakBrightness));
+
+            src = srcRow;
+            const float* transferCurveRgb = rgbRow.data();
+            uint16_t* yPlane = reinterpret_cast<uint16_t*>(heifImageData + ((static_cast<int64_t>(y) * heifImageStride)));
+
+            for (int32 x = 0; x < imageSize.h; x++)
             {
-                float transferCurveR;
-                float transferCurveG;
-                float transferCurveB;
+                yPlane[0] = static_cast<uint16_t>(std::clamp(transferCurveRgb[0] * heifImageMaxValue, 0.0f, heifImageMaxValue));
+                yPlane[1] = static_cast<uint16_t>(std::clamp(transferCurveRgb[1] * heifImageMaxValue, 0.0f, heifImageMaxValue));
+                yPlane[2] = static_cast<uint16_t>(std::clamp(transferCurveRgb[2] * heifImageMaxValue, 0.0f, heifImageMaxValue));
+                allPixelsNeutral &= yPlane[0] == yPlane[1] && yPlane[1] == yPlane[2];
 
-                switch (transferFunction)
+                if (hasAlpha)
                 {
-                case ColorTransferFunction::PQ:
-                    transferCurveR = LinearToPQ(r, static_cast<float>(saveOptions.pq.nominalPeakBrightness));
-                    transferCurveG = LinearToPQ(g, static_cast<float>(saveOptions.pq.nominalPeakBrightness));
-                    transferCurveB = LinearToPQ(b, static_cast<float>(saveOptions.pq.nominalPeakBrightness));
-                    break;
-                case ColorTransferFunction::SMPTE428:
-                    transferCurveR = LinearToSMPTE428(r);
-                    transferCurveG = LinearToSMPTE428(g);
-                    transferCurveB = LinearToSMPTE428(b);
-                    break;
-                case ColorTransferFunction::Clip:
-                    transferCurveR = r;
-                    transferCurveG = g;
-                    transferCurveB = b;
-                    break;
-                default:
-                    throw std::runtime_error("Unsupported color transfer function.");
-                }
+                    const uint16_t alphaValue = static_cast<uint16_t>(std::clamp(src[3] * heifImageMaxValue, 0.0f, heifImageMaxValue));
 
-                yPlane[0] = static_cast<uint16_t>(std::clamp(transferCurveR * heifImageMaxValue, 0.0f, heifImageMaxValue));
-                yPlane[1] = static_cast<uint16_t>(std::clamp(transferCurveG * heifImageMaxValue, 0.0f, heifImageMaxValue));
-                yPlane[2] = static_cast<uint16_t>(std::clamp(transferCurveB * heifImageMaxValue, 0.0f, heifImageMaxValue));
+                    yPlane[3] = alphaValue;
+                    combinedAlpha &= alphaValue;
+                }
 
-                src += 3;
-                yPlane += 3;
+                src += srcChannelCount;
+                transferCurveRgb += 3;
+                yPlane += srcChannelCount;
             }
+
+            screenContentDetector.AddRow(
+                y,
+                reinterpret_cast<const uint16_t*>(heifImageData + (static_cast<int64_t>(y) * heifImageStride)),
+                imageSize.h,
+                hasAlpha ? 4 : 3);
         }
     }
 
+    formatRecord->data = hostRowBuffer;
+
+    if (allPixelsNeutral && CanSaveNeutralImageAsMonochrome(formatRecord, saveOptions))
+    {
+        return ConvertToMonochromeImage(image.get(), hasAlpha && combinedAlpha == opaqueAlpha);
+    }
+
     return image;
 }
+
+bool HeifImageHasAlphaChannel(const heif_image* image)
+{
+    switch (heif_image_get_chroma_format(image))
+    {
+    case heif_chroma_interleaved_RGBA:
+    case heif_chroma_interleaved_RRGGBBAA_BE:
+    case heif_chroma_interleaved_RRGGBBAA_LE:
+        return true;
+    default:
+        return heif_image_has_channel(image, heif_channel_Alpha) != 0;
+    }
+}
+
+int GetHeifImageBitsPerChannel(const heif_image* image)
+{
+    const heif_channel channel = heif_image_get_colorspace(image) == heif_colorspace_monochrome
+        ? heif_channel_Y
+        : heif_channel_interleaved;
+
+    return heif_image_get_bits_per_pixel_range(image, channel);
+}
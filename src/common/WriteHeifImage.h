@@ -25,42 +25,64 @@
 #include "AlphaState.h"
 #include "ColorTransfer.h"
 #include "ScopedHeif.h"
+#include "ScreenContentDetection.h"
+
+// Reads the document's transparency plane and excludes it from the planes that the host returns
+// when every pixel is fully opaque, AlphaState::None is returned in that case.
+// This is called before the CreateHeifImage* functions, so that an opaque image is created
+// without an alpha channel instead of being copied out of an image that has one.
+AlphaState ExcludeOpaqueAlphaChannel(FormatRecordPtr formatRecord, AlphaState alphaState, const VPoint& imageSize);
+
+// The RGB CreateHeifImage* functions also remove a fully opaque alpha channel when a neutral
+// image is converted to monochrome.
+// The 16-bit functions will create an 8-bit image when every value was converted from 8-bit
+// and SaveUIOptions::detectEightBitContent is set.
 
 ScopedHeifImage CreateHeifImageGrayEightBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions);
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector);
 
 ScopedHeifImage CreateHeifImageGraySixteenBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions);
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector);
 
 ScopedHeifImage CreateHeifImageGrayThirtyTwoBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions);
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector);
 
 ScopedHeifImage CreateHeifImageRGBEightBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions);
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector);
 
 ScopedHeifImage CreateHeifImageRGBSixteenBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions);
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector);
 
 ScopedHeifImage CreateHeifImageRGBThirtyTwoBit(
     FormatRecordPtr formatRecord,
     AlphaState alphaState,
     const VPoint& imageSize,
-    const SaveUIOptions& saveOptions);
+    const SaveUIOptions& saveOptions,
+    ScreenContentDetector& screenContentDetector);
+
+bool HeifImageHasAlphaChannel(const heif_image* image);
+
+int GetHeifImageBitsPerChannel(const heif_image* image);
 
 #endif // !WRITEHEIFIMAGE_H
 
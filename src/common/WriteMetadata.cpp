@@ -140,7 +140,7 @@ void AddColorProfileToImage(const FormatRecordPtr formatRecord, heif_image* imag
         matrixCoefficients = heif_matrix_coefficients_ITU_R_BT_601_6;
     }
 
-    if (saveOptions.lossless && !IsMonochromeImage(formatRecord))
+    if (saveOptions.lossless && heif_image_get_colorspace(image) != heif_colorspace_monochrome)
     {
         matrixCoefficients = heif_matrix_coefficients_RGB_GBR;
     }
@@ -22,6 +22,7 @@
 #define YUVLOOKUPTABLES_H
 
 #include "Common.h"
+#include "PremultipliedAlpha.h"
 #include <memory>
 
 struct YUVLookupTables
@@ -29,6 +30,7 @@ struct YUVLookupTables
     std::unique_ptr<float[]> unormFloatTableY;
     std::unique_ptr<float[]> unormFloatTableUV;
     std::unique_ptr<float[]> unormFloatTableAlpha;
+    std::unique_ptr<PremultipliedAlphaTable> premultipliedAlphaTable;
     const int yuvMaxChannel;
 
     YUVLookupTables(const heif_color_profile_nclx* nclx, int32_t bitDepth, bool monochrome, bool hasAlpha);
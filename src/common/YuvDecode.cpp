@@ -246,17 +246,7 @@ void DecodeY16RowToGrayAlpha32(
 
         if (alphaPremultiplied)
         {
-            if (unormA < tables.yuvMaxChannel)
-            {
-                if (unormA == 0)
-                {
-                    unormY = 0;
-                }
-                else
-                {
-                    unormY = UnpremultiplyColor(unormY, unormA, yuvMaxChannel);
-                }
-            }
+            unormY = tables.premultipliedAlphaTable->Unpremultiply(unormY, unormA);
         }
 
         // Convert unorm to float
@@ -571,15 +561,6 @@ void DecodeYUV16RowToRGB32(
             dstPtr[0] = HLGToLinear(R);
             dstPtr[1] = HLGToLinear(G);
             dstPtr[2] = HLGToLinear(B);
-
-            if (loadOptions.hlg.applyOOTF)
-            {
-                ApplyHLGOOTF(
-                    dstPtr,
-                    hlgLumaCoefficiants,
-                    loadOptions.hlg.displayGamma,
-                    static_cast<float>(loadOptions.hlg.nominalPeakBrightness));
-            }
             break;
         case ColorTransferFunction::SMPTE428:
             dstPtr[0] = SMPTE428ToLinear(R);
@@ -592,6 +573,17 @@ void DecodeYUV16RowToRGB32(
 
         dstPtr += 3;
     }
+
+    if (transferFunction == ColorTransferFunction::HLG && loadOptions.hlg.applyOOTF)
+    {
+        ApplyHLGOOTFRow(
+            rgbRow,
+            static_cast<size_t>(rowWidth),
+            3,
+            hlgLumaCoefficiants,
+            loadOptions.hlg.displayGamma,
+            static_cast<float>(loadOptions.hlg.nominalPeakBrightness));
+    }
 }
 
 void DecodeYUV16RowToRGBA32(
@@ -670,15 +662,6 @@ void DecodeYUV16RowToRGBA32(
             dstPtr[0] = HLGToLinear(R);
             dstPtr[1] = HLGToLinear(G);
             dstPtr[2] = HLGToLinear(B);
-
-            if (loadOptions.hlg.applyOOTF)
-            {
-                ApplyHLGOOTF(
-                    dstPtr,
-                    hlgLumaCoefficiants,
-                    loadOptions.hlg.displayGamma,
-                    static_cast<float>(loadOptions.hlg.nominalPeakBrightness));
-            }
             break;
         case ColorTransferFunction::SMPTE428:
             dstPtr[0] = SMPTE428ToLinear(R);
@@ -690,7 +673,17 @@ void DecodeYUV16RowToRGBA32(
         }
         dstPtr[3] = A;
 
-        
         dstPtr += 4;
     }
+
+    if (transferFunction == ColorTransferFunction::HLG && loadOptions.hlg.applyOOTF)
+    {
+        ApplyHLGOOTFRow(
+            rgbaRow,
+            static_cast<size_t>(rowWidth),
+            4,
+            hlgLumaCoefficiants,
+            loadOptions.hlg.displayGamma,
+            static_cast<float>(loadOptions.hlg.nominalPeakBrightness));
+    }
 }
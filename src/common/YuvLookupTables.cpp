@@ -154,6 +154,7 @@ YUVLookupTables::YUVLookupTables(const heif_color_profile_nclx* nclx, int32_t bi
     if (hasAlpha)
     {
         unormFloatTableAlpha = std::make_unique_for_overwrite<float[]>(count);
+        premultipliedAlphaTable = std::make_unique<PremultipliedAlphaTable>(static_cast<uint16_t>(yuvMaxChannel));
     }
 
     for (int i = 0; i < count; ++i)
@@ -19,7 +19,41 @@
  */
 
 #include "FileIOWin.h"
+#include <ShlObj.h>
 #include <algorithm>
+#include <vector>
+
+OSErr GetFilePathNative(intptr_t refNum, std::filesystem::path& path)
+{
+    HANDLE hFile = reinterpret_cast<HANDLE>(refNum);
+
+    const DWORD requiredLength = GetFinalPathNameByHandleW(hFile, nullptr, 0, FILE_NAME_NORMALIZED);
+
+    if (requiredLength == 0)
+    {
+        return ioErr;
+    }
+
+    try
+    {
+        std::vector<wchar_t> buffer(requiredLength);
+
+        const DWORD length = GetFinalPathNameByHandleW(hFile, buffer.data(), requiredLength, FILE_NAME_NORMALIZED);
+
+        if (length == 0 || length >= requiredLength)
+        {
+            return ioErr;
+        }
+
+        path = std::filesystem::path(buffer.data(), buffer.data() + length);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return memFullErr;
+    }
+
+    return noErr;
+}
 
 OSErr GetFilePositionNative(intptr_t refNum, int64& position)
 {
@@ -122,3 +156,38 @@ OSErr WriteDataNative(intptr_t refNum, const void* buffer, size_t size)
 
     return noErr;
 }
+
+OSErr GetPluginDataDirectoryNative(std::filesystem::path& path)
+{
+    PWSTR localAppDataPath = nullptr;
+
+    if (FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, KF_FLAG_CREATE, nullptr, &localAppDataPath)))
+    {
+        // The path must be freed even when the call fails.
+        CoTaskMemFree(localAppDataPath);
+        return ioErr;
+    }
+
+    OSErr err = noErr;
+
+    try
+    {
+        path = std::filesystem::path(localAppDataPath) / L"avif-format";
+
+        std::error_code errorCode;
+        std::filesystem::create_directories(path, errorCode);
+
+        if (errorCode)
+        {
+            err = ioErr;
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        err = memFullErr;
+    }
+
+    CoTaskMemFree(localAppDataPath);
+
+    return err;
+}
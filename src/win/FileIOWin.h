@@ -22,6 +22,9 @@
 #define FILEIOWIN_H
 
 #include "Common.h"
+#include <filesystem>
+
+OSErr GetFilePathNative(intptr_t refNum, std::filesystem::path& path);
 
 OSErr GetFilePositionNative(intptr_t refNum, int64& position);
 
@@ -33,4 +36,6 @@ OSErr SetFilePositionNative(intptr_t refNum, int64 position);
 
 OSErr WriteDataNative(intptr_t refNum, const void* buffer, size_t size);
 
+OSErr GetPluginDataDirectoryNative(std::filesystem::path& path);
+
 #endif // !FILEIOWIN_H